@@ -0,0 +1,330 @@
+#include "acquisition.h"
+
+#include <stdatomic.h>
+#include <string.h>
+
+#include "adc_block.h"
+#include "adc_pipeline.h"
+#include "nxmic_decimate.h"
+#include "nxmic_frame.h"
+#include "nxmic_gatt.h"
+#include "nxmic_probe.h"
+#include "pico/async_context.h"
+#include "pico/cyw43_arch.h"
+#include "pico/stdlib.h"
+#include "spsc_ring.h"
+#if NXMIC_DUAL_CORE
+#include "pico/multicore.h"
+#endif
+
+#define FRAME_FLUSH_US (ACQUISITION_FRAME_FLUSH_MS * 1000)
+// Longest core1 sleeps without a block or a frame to flush
+#define CORE1_IDLE_WAIT_MS 100
+
+// Results on their way to core0, one per slot behind an output_record_t
+#define OUTPUT_RING_SLOTS 16
+#define OUTPUT_SAMPLE 0
+#define OUTPUT_FRAME 1
+
+// Stream control word, written by core0: max frame length, enabled, and a
+// generation bumped by every change
+#define CONTROL_LENGTH_MASK 0xffffu
+#define CONTROL_ENABLED (1u << 16)
+#define CONTROL_GENERATION_SHIFT 24
+
+// A framed stream: the temperature, one sample per block, and the preview
+typedef struct {
+  uint8_t stream_id;          // gatt_characteristic_id_t
+  atomic_uint control;        // Written by core0
+  uint32_t producer_control;  // The rest is the producer's
+  nxmic_frame_builder_t frame;
+  uint16_t sequence;
+  uint32_t start_us;
+  uint32_t frames;
+} stream_t;
+
+#define STREAM_TEMP 0
+#define STREAM_PREVIEW 1
+#define STREAM_COUNT 2
+
+// The preview filter takes a whole block of the one input
+#if ADC_PIPELINE_BLOCK_SAMPLES > NXMIC_DECIMATE_MAX_BLOCK
+#error "ADC blocks longer than the preview filter takes"
+#endif
+
+typedef struct {
+  uint8_t kind;
+  uint8_t stream;      // Of a frame
+  uint8_t generation;  // Of the stream control it was built under
+} output_record_t;
+
+static const acquisition_output_t *output;
+static spsc_ring_t output_ring;
+static uint8_t output_ring_storage[SPSC_RING_STORAGE_SIZE(
+    OUTPUT_RING_SLOTS, sizeof(output_record_t) + NXMIC_FRAME_MAX_SIZE)];
+static async_when_pending_worker_t output_worker;
+static stream_t streams[STREAM_COUNT] = {
+    [STREAM_TEMP] = {.stream_id = CHAR_TEMPERATURE_STREAMING},
+    [STREAM_PREVIEW] = {.stream_id = CHAR_STETHOSCOPE_PREVIEW_STREAMING},
+};
+static uint32_t stale_frames;  // core0
+
+// Producer side, owned by the core that runs the pipeline
+static uint32_t sample_rate_hz;
+static uint32_t samples_produced;
+static nxmic_decimator_t preview;
+static uint32_t preview_samples;
+#if !NXMIC_DUAL_CORE
+static async_at_time_worker_t flush_worker;
+#endif
+
+static uint8_t control_generation(uint32_t control) {
+  return (uint8_t)(control >> CONTROL_GENERATION_SHIFT);
+}
+
+// Producer: the async context on core0 may be woken from core1, the SDK
+// does it through an alarm when pico_multicore is linked
+static void output_push(uint8_t kind, const stream_t *stream,
+                        const void *data, uint16_t length) {
+  uint8_t *slot = spsc_ring_claim(&output_ring);
+  if (!slot) return;  // counted as an overflow by the ring
+  output_record_t record = {
+      .kind = kind,
+      .stream = stream ? (uint8_t)(stream - streams) : 0,
+      .generation = stream ? control_generation(stream->producer_control) : 0,
+  };
+  memcpy(slot, &record, sizeof(record));
+  memcpy(slot + sizeof(record), data, length);
+  spsc_ring_publish(&output_ring, sizeof(record) + length);
+  async_context_set_work_pending(cyw43_arch_async_context(), &output_worker);
+}
+
+// The oldest frame being built, NULL if none
+static const stream_t *next_flush(void) {
+  const stream_t *next = NULL;
+  for (int i = 0; i < STREAM_COUNT; i++) {
+    const stream_t *stream = &streams[i];
+    if (stream->frame.length &&
+        (!next || (int32_t)(stream->start_us - next->start_us) < 0))
+      next = stream;
+  }
+  return next;
+}
+
+#if !NXMIC_DUAL_CORE
+// One timer for the oldest frame
+static void arm_flush(void) {
+  async_context_t *context = cyw43_arch_async_context();
+  async_context_remove_at_time_worker(context, &flush_worker);
+  const stream_t *next = next_flush();
+  if (!next) return;
+  int32_t wait_us = (int32_t)(next->start_us + FRAME_FLUSH_US - time_us_32());
+  async_context_add_at_time_worker_in_ms(
+      context, &flush_worker, wait_us > 0 ? (uint32_t)wait_us / 1000 : 0);
+}
+#endif
+
+static void frame_discard(stream_t *stream) {
+  stream->frame.length = 0;
+#if !NXMIC_DUAL_CORE
+  arm_flush();
+#endif
+}
+
+static void frame_flush(stream_t *stream) {
+  if (!nxmic_frame_is_empty(&stream->frame)) {
+    output_push(OUTPUT_FRAME, stream, stream->frame.buffer,
+                stream->frame.length);
+    stream->frames++;
+  }
+  frame_discard(stream);
+}
+
+// A change of stream control drops the frame being built; enabling the
+// preview starts its filter afresh
+static void apply_control(void) {
+  for (int i = 0; i < STREAM_COUNT; i++) {
+    stream_t *stream = &streams[i];
+    uint32_t control = atomic_load(&stream->control);
+    if (control == stream->producer_control) continue;
+    stream->producer_control = control;
+    if (i == STREAM_PREVIEW) nxmic_decimator_reset(&preview);
+    frame_discard(stream);
+  }
+}
+
+static void check_flush(uint32_t now_us) {
+  for (int i = 0; i < STREAM_COUNT; i++) {
+    stream_t *stream = &streams[i];
+    if (stream->frame.length && now_us - stream->start_us >= FRAME_FLUSH_US)
+      frame_flush(stream);
+  }
+}
+
+static bool stream_enabled(const stream_t *stream) {
+  return stream->producer_control & CONTROL_ENABLED;
+}
+
+static void frame_add_samples(stream_t *stream, const int16_t *samples,
+                              uint16_t count) {
+  for (uint16_t i = 0; i < count; i++) {
+    if (stream->frame.length == 0) {
+      stream->start_us = time_us_32();
+      nxmic_frame_begin(&stream->frame, stream->stream_id, NXMIC_CODEC_PCM16,
+                        stream->sequence++, stream->start_us,
+                        (uint16_t)(stream->producer_control &
+                                   CONTROL_LENGTH_MASK));
+#if !NXMIC_DUAL_CORE
+      arm_flush();
+#endif
+    }
+    nxmic_frame_append_int16(&stream->frame, samples[i]);
+    if (nxmic_frame_is_full(&stream->frame, sizeof(samples[i])))
+      frame_flush(stream);
+  }
+}
+
+// Producer: oversample, every reading of the sensor in the block averages
+// into one sample. With the preview on, the same pass converts the
+// readings for its filter.
+static void block_handler(const uint16_t *samples, size_t count,
+                          uint8_t input_mask) {
+  NXMIC_PROBE_SCOPE(NXMIC_PROBE_ADC_BLOCK);
+  apply_control();
+  int16_t *preview_in = stream_enabled(&streams[STREAM_PREVIEW])
+                            ? nxmic_decimator_input(&preview)
+                            : NULL;
+  uint32_t raw_sum;
+  uint32_t raw_count = adc_block_sum(samples, count, input_mask,
+                                     ADC_TEMP_SENSOR_INPUT, &raw_sum,
+                                     preview_in);
+  int16_t sample = (int16_t)adc_temp_centi_degrees(raw_sum, raw_count);
+  samples_produced++;
+  output_push(OUTPUT_SAMPLE, NULL, &sample, sizeof(sample));
+  if (stream_enabled(&streams[STREAM_TEMP]))
+    frame_add_samples(&streams[STREAM_TEMP], &sample, 1);
+  if (preview_in) {
+    NXMIC_PROBE_SCOPE(NXMIC_PROBE_PREVIEW_FILTER);
+    int16_t out[NXMIC_DECIMATE_MAX_BLOCK / ACQUISITION_PREVIEW_FACTOR + 1];
+    uint16_t outputs = nxmic_decimator_run(&preview, (uint16_t)raw_count, out);
+    preview_samples += outputs;
+    frame_add_samples(&streams[STREAM_PREVIEW], out, outputs);
+  }
+}
+
+static uint8_t generation_of(uint8_t stream) {
+  return control_generation(atomic_load(&streams[stream].control));
+}
+
+// Consumer, core0 async context. Frames built under an older stream
+// control belong to a stream that was stopped or restarted.
+static void output_worker_handler(async_context_t *context,
+                                  async_when_pending_worker_t *worker) {
+  (void)context;
+  (void)worker;
+  uint32_t count = spsc_ring_available(&output_ring);
+  for (uint32_t i = 0; i < count; i++) {
+    uint16_t length;
+    const uint8_t *slot = spsc_ring_peek(&output_ring, i, &length);
+    output_record_t record;
+    memcpy(&record, slot, sizeof(record));
+    const uint8_t *data = slot + sizeof(record);
+    length -= sizeof(record);
+    if (record.kind == OUTPUT_SAMPLE) {
+      int16_t sample;
+      memcpy(&sample, data, sizeof(sample));
+      output->sample(sample);
+    } else if (record.generation != generation_of(record.stream)) {
+      stale_frames++;
+    } else {
+      output->frame(data, length);
+    }
+  }
+  spsc_ring_release(&output_ring, count);
+}
+
+#if NXMIC_DUAL_CORE
+static void core1_main(void) {
+  NXMIC_PROBE_INIT();
+  bool started = adc_pipeline_start(1u << ADC_TEMP_SENSOR_INPUT,
+                                    sample_rate_hz, block_handler, NULL);
+  // the FIFO's only other use: once core0 has the result its
+  // flash_safe_execute() parks this core through it, so take part first
+  multicore_lockout_victim_init();
+  multicore_fifo_push_blocking(started);
+  // nothing to run without the pipeline, but still parked for flash writes
+  while (!started) __wfe();
+  while (true) {
+    adc_pipeline_service();
+    apply_control();
+    uint32_t now_us = time_us_32();
+    check_flush(now_us);
+    // woken early by the DMA IRQ, taken on this core, or by core0's __sev()
+    const stream_t *next = next_flush();
+    absolute_time_t wake =
+        next ? make_timeout_time_us(next->start_us + FRAME_FLUSH_US - now_us)
+             : make_timeout_time_ms(CORE1_IDLE_WAIT_MS);
+    best_effort_wfe_or_timeout(wake);
+  }
+}
+#else
+static void flush_worker_handler(async_context_t *context,
+                                 async_at_time_worker_t *worker) {
+  (void)context;
+  (void)worker;
+  apply_control();
+  check_flush(time_us_32());
+}
+#endif
+
+bool acquisition_start(uint32_t rate_hz, const acquisition_output_t *out) {
+  if (!out || !spsc_ring_init(&output_ring, output_ring_storage,
+                              OUTPUT_RING_SLOTS,
+                              sizeof(output_record_t) + NXMIC_FRAME_MAX_SIZE))
+    return false;
+  int16_t coefficients[ACQUISITION_PREVIEW_TAPS];
+  nxmic_decimate_design(coefficients, ACQUISITION_PREVIEW_TAPS,
+                        ACQUISITION_PREVIEW_FACTOR);
+  nxmic_decimator_init(&preview, coefficients, ACQUISITION_PREVIEW_TAPS,
+                       ACQUISITION_PREVIEW_FACTOR);
+  output = out;
+  sample_rate_hz = rate_hz;
+  output_worker.do_work = output_worker_handler;
+  async_context_add_when_pending_worker(cyw43_arch_async_context(),
+                                        &output_worker);
+#if NXMIC_DUAL_CORE
+  multicore_launch_core1(core1_main);
+  return multicore_fifo_pop_blocking() != 0;
+#else
+  flush_worker.do_work = flush_worker_handler;
+  return adc_pipeline_start(1u << ADC_TEMP_SENSOR_INPUT, sample_rate_hz,
+                            block_handler, cyw43_arch_async_context());
+#endif
+}
+
+static void set_control(stream_t *stream, bool enabled, uint16_t max_length) {
+  uint32_t generation =
+      (atomic_load(&stream->control) >> CONTROL_GENERATION_SHIFT) + 1;
+  atomic_store(&stream->control,
+               (generation << CONTROL_GENERATION_SHIFT) |
+                   (enabled ? CONTROL_ENABLED : 0) | max_length);
+  __sev();
+}
+
+void acquisition_set_stream(bool enabled, uint16_t max_length) {
+  set_control(&streams[STREAM_TEMP], enabled, max_length);
+}
+
+void acquisition_set_preview(bool enabled, uint16_t max_length) {
+  set_control(&streams[STREAM_PREVIEW], enabled, max_length);
+}
+
+void acquisition_get_stats(acquisition_stats_t *stats) {
+  stats->samples = samples_produced;
+  stats->frames = streams[STREAM_TEMP].frames;
+  stats->preview_samples = preview_samples;
+  stats->preview_frames = streams[STREAM_PREVIEW].frames;
+  stats->ring_high_water = output_ring.high_water;
+  stats->ring_overflows = atomic_load(&output_ring.overflows);
+  stats->stale_frames = stale_frames;
+}
@@ -0,0 +1,66 @@
+#ifndef ACQUISITION_H_
+#define ACQUISITION_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Sensor acquisition and DSP off the radio core. With NXMIC_DUAL_CORE,
+// core1 owns the ADC pipeline: the DMA IRQ, the averaging of each block
+// into a temperature sample and the framing of the temperature stream all
+// run there, so core0 is left with BTstack and the flash store. Without
+// it the same code runs in the async context on core0, as it used to.
+//
+// Results reach core0 through a lock-free SPSC ring rather than the SIO
+// FIFO, which multicore_lockout (flash_safe_execute()) owns, and are
+// handed to the output callbacks from the async context.
+//
+// The same blocks feed the preview of CHAR_STETHOSCOPE_PREVIEW_STREAMING:
+// each reading is converted to Q15 as the block is averaged and the
+// decimating filter (nxmic_decimate.h) brings the lot down to the preview
+// rate. This board has no stethoscope front end, so the preview is of the
+// input that is sampled, the temperature sensor.
+
+#ifndef NXMIC_DUAL_CORE
+#define NXMIC_DUAL_CORE 1
+#endif
+
+// Send a partly filled frame once its first sample is this old
+#define ACQUISITION_FRAME_FLUSH_MS 200
+
+// Preview rate is the ADC rate over the factor
+#define ACQUISITION_PREVIEW_FACTOR 8
+#define ACQUISITION_PREVIEW_TAPS 64
+
+// Called on core0 from the async context
+typedef struct {
+  void (*sample)(int16_t centi_degrees);  // Every sample, streaming or not
+  // A frame of the temperature stream or the preview, by its stream_id,
+  // ready to notify
+  void (*frame)(const uint8_t *frame, uint16_t length);
+} acquisition_output_t;
+
+typedef struct {
+  uint32_t samples;
+  uint32_t frames;
+  uint32_t preview_samples;
+  uint32_t preview_frames;
+  uint32_t ring_high_water;  // Results waiting for core0, most ever
+  uint32_t ring_overflows;   // Results dropped, core0 was too slow
+  uint32_t stale_frames;     // Built before the stream was last changed
+} acquisition_stats_t;
+
+// Start sampling the temperature sensor at sample_rate_hz, on core1 with
+// NXMIC_DUAL_CORE. Call once, from core0.
+bool acquisition_start(uint32_t sample_rate_hz,
+                       const acquisition_output_t *output);
+
+// Core0: start or stop framing the temperature stream into frames of up to
+// max_length bytes. Drops the frame being built and those not handed over.
+void acquisition_set_stream(bool enabled, uint16_t max_length);
+
+// Core0: the same for the preview, which only runs while it is enabled
+void acquisition_set_preview(bool enabled, uint16_t max_length);
+
+void acquisition_get_stats(acquisition_stats_t *stats);
+
+#endif
@@ -0,0 +1,248 @@
+// Host check and benchmark of the ADC block arithmetic (adc_block.h), fed
+// by a synthetic ADC: interleaved blocks laid out as the pipeline's DMA
+// leaves them for every mix of inputs the ADC can round-robin over, with
+// noise and junk above the 12 bits of each reading. Checks that each
+// input's readings are picked out, summed and converted to Q15 exactly,
+// that the temperature of a block matches the sensor's transfer function
+// worked in floating point from the same readings, and that the sensor
+// held at a known temperature reads back within a tenth of a degree.
+//
+//   nxmic_adc_bench [-n blocks]
+//
+// The cost is per block of ADC_PIPELINE_BLOCK_SAMPLES readings of the
+// temperature sensor alone, as the sensor samples it, with and without
+// the Q15 copy the preview takes; then for the whole of what core1 does
+// with a block under NXMIC_DUAL_CORE (acquisition.c), less its SDK calls:
+// the sum with the Q15 copy, the temperature, the preview filter and the
+// framing of both streams into 244-byte frames. Its share of a core is
+// given at the ADC's top rate, a block every 1.02 ms, in the host's
+// cycles. Exits non-zero if a reading is picked out, summed or converted
+// wrong.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "acquisition.h"
+#include "adc_block.h"
+#include "bench_util.h"
+#include "nxmic_decimate.h"
+#include "nxmic_frame.h"
+#include "nxmic_gatt.h"
+
+// adc_pipeline.h needs the SDK; its block size and the sensor's transfer
+// function as adc_block.c has them
+#define BENCH_BLOCK_SAMPLES 512
+#define BENCH_VREF 3.3
+#define BENCH_VBE_27C 0.706
+#define BENCH_SLOPE 0.001721
+// The ADC's top rate, 48 MHz over 96 cycles a conversion
+#define BENCH_ADC_MAX_RATE_HZ 500000
+// Frames on a 247-byte MTU
+#define BENCH_FRAME_CAPACITY 244
+// Integer truncation of the conversion, in degC
+#define BENCH_CONVERSION_ERROR 0.011
+// Averaged over a block the 0.47 degC step of a reading is dithered away
+#define BENCH_TEMPERATURE_ERROR 0.1
+
+static uint16_t block[BENCH_BLOCK_SAMPLES];
+static int16_t q15[BENCH_BLOCK_SAMPLES];
+
+static double reading_of(double temperature) {
+  return (BENCH_VBE_27C - (temperature - 27) * BENCH_SLOPE) / BENCH_VREF *
+         4096;
+}
+
+static double temperature_of(double reading) {
+  return 27 - (reading * BENCH_VREF / 4096 - BENCH_VBE_27C) / BENCH_SLOPE;
+}
+
+// The synthetic ADC: a block as the DMA fills it, round-robin over
+// input_mask; the temperature sensor at temperature with a couple of LSB
+// of noise, every other input a ramp of its own. Junk in the top four
+// bits stands in for whatever the FIFO leaves there. Returns the length,
+// a multiple of the inputs as adc_pipeline_start() rounds it.
+static size_t fill_block(uint8_t input_mask, double temperature,
+                         uint64_t seed) {
+  uint8_t inputs[8];
+  size_t num_inputs = 0;
+  for (uint8_t input = 0; input < 8; input++) {
+    if (input_mask & (1u << input)) inputs[num_inputs++] = input;
+  }
+  size_t count = (BENCH_BLOCK_SAMPLES / num_inputs) * num_inputs;
+  double level = reading_of(temperature);
+  for (size_t i = 0; i < count; i++) {
+    uint8_t input = inputs[i % num_inputs];
+    long raw = input == ADC_TEMP_SENSOR_INPUT
+                   ? lrint(level + bench_noise(seed + i) / 64.0)
+                   : (long)((seed + i * 37 + input * 1000) % 4096);
+    if (raw < 0) raw = 0;
+    if (raw > 4095) raw = 4095;
+    block[i] = (uint16_t)(raw | (bench_noise(seed ^ i) & 0xf) << 12);
+  }
+  return count;
+}
+
+static void check_inputs(void) {
+  for (uint32_t mask = 1; mask < 32; mask++) {
+    size_t count = fill_block((uint8_t)mask, 36.6, mask * 1000);
+    size_t stride = __builtin_popcount(mask);
+    for (uint8_t input = 0; input < 5; input++) {
+      uint32_t sum;
+      memset(q15, 0, sizeof(q15));
+      uint32_t readings =
+          adc_block_sum(block, count, (uint8_t)mask, input, &sum, q15);
+      if (!(mask & (1u << input))) {
+        bench_check(readings == 0 && sum == 0,
+                    "input not sampled has readings");
+        continue;
+      }
+      // where the input's readings sit in the interleaved block
+      size_t first = __builtin_popcount(mask & ((1u << input) - 1));
+      uint32_t expected_sum = 0, expected_readings = 0;
+      int q15_ok = 1;
+      for (size_t i = first; i < count; i += stride) {
+        uint16_t raw = block[i] & 0xfff;
+        expected_sum += raw;
+        if (q15[expected_readings] != (raw - 2048) * 16) q15_ok = 0;
+        expected_readings++;
+      }
+      bench_check(readings == expected_readings, "readings of an input");
+      bench_check(sum == expected_sum, "sum of an input's readings");
+      bench_check(q15_ok, "Q15 of an input's readings");
+    }
+  }
+}
+
+// Against the transfer function in floating point from the same readings,
+// and against the temperature the synthetic sensor was held at
+static void check_temperature(void) {
+  double worst_conversion = 0, worst_temperature = 0;
+  uint8_t mask = 1u << ADC_TEMP_SENSOR_INPUT;
+  for (double t = -40; t <= 100; t += 0.25) {
+    size_t count = fill_block(mask, t, (uint64_t)(t * 1000 + 1e6));
+    uint32_t sum;
+    uint32_t readings =
+        adc_block_sum(block, count, mask, ADC_TEMP_SENSOR_INPUT, &sum, NULL);
+    double measured = adc_temp_centi_degrees(sum, readings) / 100.0;
+    double conversion =
+        fabs(measured - temperature_of((double)sum / readings));
+    double temperature = fabs(measured - t);
+    if (conversion > worst_conversion) worst_conversion = conversion;
+    if (temperature > worst_temperature) worst_temperature = temperature;
+  }
+  printf("temperature -40 to 100 degC: conversion within %.4f degC, "
+         "reading within %.3f degC\n",
+         worst_conversion, worst_temperature);
+  bench_check(worst_conversion <= BENCH_CONVERSION_ERROR,
+              "conversion off the transfer function");
+  bench_check(worst_temperature <= BENCH_TEMPERATURE_ERROR,
+              "reading off the sensor's temperature");
+  bench_check(adc_temp_centi_degrees(0, 0) == 0, "temperature of no readings");
+  // full scale over the largest block the pipeline hands over
+  bench_check(fabs(adc_temp_centi_degrees(4095u * BENCH_BLOCK_SAMPLES,
+                                          BENCH_BLOCK_SAMPLES) / 100.0 -
+                   temperature_of(4095)) <= BENCH_CONVERSION_ERROR,
+              "full-scale block");
+}
+
+static void time_blocks(uint32_t blocks) {
+  uint8_t mask = 1u << ADC_TEMP_SENSOR_INPUT;
+  size_t count = fill_block(mask, 36.6, 1);
+  volatile int32_t sink = 0;
+  for (int with_q15 = 0; with_q15 < 2; with_q15++) {
+    bench_cost_t start = bench_cost_now();
+    for (uint32_t b = 0; b < blocks; b++) {
+      uint32_t sum;
+      uint32_t readings =
+          adc_block_sum(block, count, mask, ADC_TEMP_SENSOR_INPUT, &sum,
+                        with_q15 ? q15 : NULL);
+      sink += adc_temp_centi_degrees(sum, readings);
+    }
+    bench_cost_t cost = bench_cost_since(start);
+    printf("block of %zu%s: %.0f ns, %.0f cycles, %.2f cycles per reading\n",
+           count, with_q15 ? " with Q15" : "", (double)cost.ns / blocks,
+           (double)cost.cycles / blocks, (double)cost.cycles / blocks / count);
+  }
+  (void)sink;
+}
+
+static void frame_add(nxmic_frame_builder_t *frame, uint8_t stream_id,
+                      uint16_t *sequence, const int16_t *samples,
+                      uint16_t count) {
+  for (uint16_t i = 0; i < count; i++) {
+    if (frame->length == 0)
+      nxmic_frame_begin(frame, stream_id, NXMIC_CODEC_PCM16, (*sequence)++, 0,
+                        BENCH_FRAME_CAPACITY);
+    nxmic_frame_append_int16(frame, samples[i]);
+    if (nxmic_frame_is_full(frame, sizeof(samples[i]))) frame->length = 0;
+  }
+}
+
+// acquisition.c's block handler with both streams and the preview on
+static void time_block_path(uint32_t blocks) {
+  static nxmic_decimator_t preview;
+  static nxmic_frame_builder_t temp_frame, preview_frame;
+  int16_t coefficients[ACQUISITION_PREVIEW_TAPS];
+  nxmic_decimate_design(coefficients, ACQUISITION_PREVIEW_TAPS,
+                        ACQUISITION_PREVIEW_FACTOR);
+  nxmic_decimator_init(&preview, coefficients, ACQUISITION_PREVIEW_TAPS,
+                       ACQUISITION_PREVIEW_FACTOR);
+  uint8_t mask = 1u << ADC_TEMP_SENSOR_INPUT;
+  size_t count = fill_block(mask, 36.6, 1);
+  uint16_t temp_sequence = 0, preview_sequence = 0;
+  uint64_t outputs = 0;
+  bench_cost_t start = bench_cost_now();
+  for (uint32_t b = 0; b < blocks; b++) {
+    uint32_t sum;
+    uint32_t readings =
+        adc_block_sum(block, count, mask, ADC_TEMP_SENSOR_INPUT, &sum,
+                      nxmic_decimator_input(&preview));
+    int16_t sample = (int16_t)adc_temp_centi_degrees(sum, readings);
+    frame_add(&temp_frame, CHAR_TEMPERATURE_STREAMING, &temp_sequence,
+              &sample, 1);
+    int16_t out[NXMIC_DECIMATE_MAX_BLOCK / ACQUISITION_PREVIEW_FACTOR + 1];
+    uint16_t produced =
+        nxmic_decimator_run(&preview, (uint16_t)readings, out);
+    outputs += produced;
+    frame_add(&preview_frame, CHAR_STETHOSCOPE_PREVIEW_STREAMING,
+              &preview_sequence, out, produced);
+  }
+  bench_cost_t cost = bench_cost_since(start);
+  double blocks_per_s = (double)BENCH_ADC_MAX_RATE_HZ / count;
+  printf("core1 block path: %.0f ns, %.0f cycles per block of %zu "
+         "(%.1f preview outputs), %.1f%% of a core at %.0f blocks/s\n",
+         (double)cost.ns / blocks, (double)cost.cycles / blocks, count,
+         (double)outputs / blocks,
+         (double)cost.ns / blocks * blocks_per_s / 1e7,
+         blocks_per_s);
+  bench_check(outputs == (uint64_t)blocks * count / ACQUISITION_PREVIEW_FACTOR,
+              "preview outputs per block");
+}
+
+int main(int argc, char **argv) {
+  uint32_t blocks = 200000;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+      case 'n':
+        blocks = (uint32_t)atoi(optarg);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-n blocks]\n", argv[0]);
+        return 2;
+    }
+  }
+  if (blocks == 0) {
+    fprintf(stderr, "invalid block count\n");
+    return 2;
+  }
+
+  check_inputs();
+  check_temperature();
+  time_blocks(blocks);
+  time_block_path(blocks / 10 + 1);
+  return bench_failures != 0;
+}
@@ -0,0 +1,37 @@
+#include "adc_block.h"
+
+// ADC reference and the sensor's transfer function in microvolts:
+// Vbe = 0.706 V at 27 degC, slope -1.721 mV/degC
+#define ADC_VREF_UV 3300000
+#define ADC_MAX_RAW 4096
+#define TEMP_VBE_27C_UV 706000
+#define TEMP_SLOPE_UV_PER_DEGC 1721
+
+uint32_t adc_block_sum(const uint16_t *samples, size_t count,
+                       uint8_t input_mask, uint8_t input, uint32_t *raw_sum,
+                       int16_t *q15) {
+  *raw_sum = 0;
+  if (!(input_mask & (1u << input))) return 0;
+  size_t stride = __builtin_popcount(input_mask);
+  size_t first = __builtin_popcount(input_mask & ((1u << input) - 1));
+  uint32_t sum = 0;
+  uint32_t readings = 0;
+  for (size_t i = first; i < count; i += stride) {
+    uint16_t raw = samples[i] & 0xfff;
+    sum += raw;
+    // 12 bits around mid-scale to Q15
+    if (q15) q15[readings] = (int16_t)((raw - 2048) * 16);
+    readings++;
+  }
+  *raw_sum = sum;
+  return readings;
+}
+
+int32_t adc_temp_centi_degrees(uint32_t raw_sum, uint32_t count) {
+  if (count == 0) return 0;
+  // keep the fractional bits of the average until the final divide
+  int64_t vbe_uv =
+      (int64_t)raw_sum * ADC_VREF_UV / ((int64_t)count * ADC_MAX_RAW);
+  return 2700 - (int32_t)((vbe_uv - TEMP_VBE_27C_UV) * 100 /
+                          TEMP_SLOPE_UV_PER_DEGC);
+}
@@ -0,0 +1,28 @@
+#ifndef ADC_BLOCK_H_
+#define ADC_BLOCK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The arithmetic on a block from the ADC pipeline (adc_pipeline.h), kept
+// apart from the DMA and IRQ glue so the host build can check it: picking
+// one input out of an interleaved block, averaging its readings and
+// converting them, with no SDK dependency.
+
+// The RP2 on-die temperature sensor
+#define ADC_TEMP_SENSOR_INPUT 4
+
+// Sum of the 12-bit readings of input in an interleaved block, where
+// sample i was taken on inputs[i % num_inputs] of input_mask, in increasing
+// order of their ADC number. Bits above the 12 of a reading are ignored.
+// With q15 non-NULL each reading is also written there as Q15 around
+// mid-scale, one per reading. Returns the number of readings, 0 if input
+// is not in input_mask.
+uint32_t adc_block_sum(const uint16_t *samples, size_t count,
+                       uint8_t input_mask, uint8_t input, uint32_t *raw_sum,
+                       int16_t *q15);
+
+// RP2 on-die sensor: averaged 12-bit readings to 0.01 degC, fixed point
+int32_t adc_temp_centi_degrees(uint32_t raw_sum, uint32_t count);
+
+#endif
@@ -0,0 +1,155 @@
+#include "adc_pipeline.h"
+
+#include <string.h>
+
+#include "adc_block.h"
+#include "hardware/adc.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "pico/stdlib.h"
+
+#define NUM_BLOCKS 2
+#define ADC_CLOCK_HZ 48000000
+#define ADC_CYCLES_PER_SAMPLE 96
+
+static uint16_t blocks[NUM_BLOCKS][ADC_PIPELINE_BLOCK_SAMPLES];
+static int dma_channels[NUM_BLOCKS] = {-1, -1};
+static size_t block_samples;
+static uint8_t selected_inputs;
+static adc_pipeline_block_handler_t block_handler;
+static adc_pipeline_stats_t stats;
+
+// Blocks filled by DMA and not handled yet, bit n = blocks[n]
+static volatile uint32_t ready_blocks;
+static uint32_t next_block;  // next block to hand over, in fill order
+
+static async_context_t *block_context;  // NULL: adc_pipeline_service()
+static async_when_pending_worker_t block_worker;
+
+static void dma_irq_handler(void) {
+  uint64_t start = time_us_64();
+  for (int i = 0; i < NUM_BLOCKS; i++) {
+    uint32_t mask = 1u << dma_channels[i];
+    if (!(dma_hw->ints0 & mask)) continue;
+    dma_hw->ints0 = mask;
+    if (ready_blocks & (1u << i)) stats.overruns++;
+    ready_blocks |= 1u << i;
+    // re-arm this channel; it starts when the other one chains to it
+    dma_channel_set_write_addr(dma_channels[i], blocks[i], false);
+    dma_channel_set_trans_count(dma_channels[i], block_samples, false);
+  }
+  if (block_context)
+    async_context_set_work_pending(block_context, &block_worker);
+  stats.busy_us += time_us_64() - start;
+}
+
+uint32_t adc_pipeline_service(void) {
+  uint32_t handled = 0;
+  uint64_t start = time_us_64();
+  while (ready_blocks & (1u << next_block)) {
+    block_handler(blocks[next_block], block_samples, selected_inputs);
+    uint32_t irq_state = save_and_disable_interrupts();
+    ready_blocks &= ~(1u << next_block);
+    restore_interrupts(irq_state);
+    stats.blocks++;
+    stats.samples += block_samples;
+    next_block = (next_block + 1) % NUM_BLOCKS;
+    handled++;
+  }
+  if (handled) stats.busy_us += time_us_64() - start;
+  return handled;
+}
+
+// Runs in the async context, may call into BTstack
+static void block_worker_handler(async_context_t *context,
+                                 async_when_pending_worker_t *worker) {
+  (void)context;
+  (void)worker;
+  adc_pipeline_service();
+}
+
+bool adc_pipeline_start(uint8_t input_mask, uint32_t sample_rate_hz,
+                        adc_pipeline_block_handler_t handler,
+                        async_context_t *context) {
+  int num_inputs = __builtin_popcount(input_mask);
+  if (num_inputs == 0 || sample_rate_hz == 0 || !handler) return false;
+  uint32_t total_rate = sample_rate_hz * num_inputs;
+  if (total_rate > ADC_CLOCK_HZ / ADC_CYCLES_PER_SAMPLE) return false;
+
+  selected_inputs = input_mask;
+  block_handler = handler;
+  block_samples = (ADC_PIPELINE_BLOCK_SAMPLES / num_inputs) * num_inputs;
+  memset(&stats, 0, sizeof(stats));
+  ready_blocks = 0;
+  next_block = 0;
+
+  adc_init();
+  for (int input = 0; input < 4; input++) {
+    if (input_mask & (1u << input)) adc_gpio_init(26 + input);
+  }
+  if (input_mask & (1u << ADC_TEMP_SENSOR_INPUT))
+    adc_set_temp_sensor_enabled(true);
+  adc_select_input(__builtin_ctz(input_mask));
+  adc_set_round_robin(num_inputs > 1 ? input_mask : 0);
+  adc_fifo_setup(true, true, 1, false, false);
+  // conversion starts every (1 + div) ADC clock cycles
+  adc_set_clkdiv((float)ADC_CLOCK_HZ / total_rate - 1);
+
+  for (int i = 0; i < NUM_BLOCKS; i++)
+    dma_channels[i] = dma_claim_unused_channel(true);
+  for (int i = 0; i < NUM_BLOCKS; i++) {
+    dma_channel_config config = dma_channel_get_default_config(dma_channels[i]);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_16);
+    channel_config_set_read_increment(&config, false);
+    channel_config_set_write_increment(&config, true);
+    channel_config_set_dreq(&config, DREQ_ADC);
+    channel_config_set_chain_to(&config, dma_channels[(i + 1) % NUM_BLOCKS]);
+    dma_channel_configure(dma_channels[i], &config, blocks[i], &adc_hw->fifo,
+                          block_samples, false);
+    dma_channel_set_irq0_enabled(dma_channels[i], true);
+  }
+
+  block_context = context;
+  if (context) {
+    block_worker.do_work = block_worker_handler;
+    async_context_add_when_pending_worker(context, &block_worker);
+  }
+  irq_add_shared_handler(DMA_IRQ_0, dma_irq_handler,
+                         PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+  irq_set_enabled(DMA_IRQ_0, true);
+
+  stats.start_us = time_us_64();
+  dma_channel_start(dma_channels[0]);
+  adc_run(true);
+  return true;
+}
+
+void adc_pipeline_stop(void) {
+  adc_run(false);
+  for (int i = 0; i < NUM_BLOCKS; i++) {
+    if (dma_channels[i] < 0) continue;
+    dma_channel_set_irq0_enabled(dma_channels[i], false);
+    dma_channel_abort(dma_channels[i]);
+    dma_channel_unclaim(dma_channels[i]);
+    dma_channels[i] = -1;
+  }
+  irq_remove_handler(DMA_IRQ_0, dma_irq_handler);
+  if (block_context)
+    async_context_remove_when_pending_worker(block_context, &block_worker);
+  block_context = NULL;
+  adc_fifo_drain();
+}
+
+const adc_pipeline_stats_t *adc_pipeline_get_stats(void) { return &stats; }
+
+uint32_t adc_pipeline_sample_rate_hz(void) {
+  uint64_t elapsed = time_us_64() - stats.start_us;
+  if (elapsed == 0) return 0;
+  return (uint32_t)((uint64_t)stats.samples * 1000000 / elapsed);
+}
+
+uint32_t adc_pipeline_cpu_load_permille(void) {
+  uint64_t elapsed = time_us_64() - stats.start_us;
+  if (elapsed == 0) return 0;
+  return (uint32_t)(stats.busy_us * 1000 / elapsed);
+}
@@ -0,0 +1,54 @@
+#ifndef ADC_PIPELINE_H_
+#define ADC_PIPELINE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "pico/async_context.h"
+
+// Continuous ADC acquisition: the ADC free-runs in round-robin over the
+// selected inputs, two DMA channels ping-pong between two blocks in RAM and
+// each completed block is handed to the application, so nothing polls the
+// ADC. Blocks are handed over from an async context worker (the context
+// BTstack runs in), or by adc_pipeline_service() on a core of its own.
+// What is done with a block is in adc_block.h.
+
+// Samples per block, rounded down to a multiple of the number of inputs
+#define ADC_PIPELINE_BLOCK_SAMPLES 512
+
+// Called with an interleaved block: sample i was taken on
+// inputs[i % num_inputs], inputs in increasing order of their ADC number
+typedef void (*adc_pipeline_block_handler_t)(const uint16_t *samples,
+                                             size_t count,
+                                             uint8_t input_mask);
+
+typedef struct {
+  uint32_t blocks;         // Blocks handed to the handler
+  uint32_t samples;        // Samples in those blocks
+  uint32_t overruns;       // Blocks overwritten before they were handled
+  uint64_t start_us;       // When acquisition started
+  uint64_t busy_us;        // Time spent in IRQ and block handler, on the
+                           // core that runs the pipeline
+} adc_pipeline_stats_t;
+
+// Start acquisition on the inputs in input_mask (bit n = ADC input n) at
+// sample_rate_hz per input. The DMA IRQ is taken on the calling core; with
+// context NULL nothing runs the handler but adc_pipeline_service().
+bool adc_pipeline_start(uint8_t input_mask, uint32_t sample_rate_hz,
+                        adc_pipeline_block_handler_t handler,
+                        async_context_t *context);
+void adc_pipeline_stop(void);
+
+// Hand the completed blocks to the handler, for a pipeline started without
+// a context. Call on the core that started it, the DMA IRQ wakes it from
+// __wfe(). Returns the number of blocks handled.
+uint32_t adc_pipeline_service(void);
+
+const adc_pipeline_stats_t *adc_pipeline_get_stats(void);
+
+// Achieved aggregate sample rate and CPU share in 0.1 % since start
+uint32_t adc_pipeline_sample_rate_hz(void);
+uint32_t adc_pipeline_cpu_load_permille(void);
+
+#endif
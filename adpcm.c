@@ -0,0 +1,128 @@
+#include "adpcm.h"
+
+// The Cortex-M33 in the RP2350 has the DSP extension: saturate with a
+// single SSAT instead of compare-and-branch
+#if defined(__ARM_FEATURE_DSP) && __ARM_FEATURE_DSP
+#include <arm_acle.h>
+#define CLAMP_S16(x) __ssat((x), 16)
+#else
+static inline int32_t clamp_s16(int32_t x) {
+  if (x > INT16_MAX) return INT16_MAX;
+  if (x < INT16_MIN) return INT16_MIN;
+  return x;
+}
+#define CLAMP_S16(x) clamp_s16(x)
+#endif
+
+#define STEP_INDEX_MAX 88
+
+static const int16_t step_table[STEP_INDEX_MAX + 1] = {
+    7,     8,     9,     10,    11,    12,    13,    14,    16,    17,
+    19,    21,    23,    25,    28,    31,    34,    37,    41,    45,
+    50,    55,    60,    66,    73,    80,    88,    97,    107,   118,
+    130,   143,   157,   173,   190,   209,   230,   253,   279,   307,
+    337,   371,   408,   449,   494,   544,   598,   658,   724,   796,
+    876,   963,   1060,  1166,  1282,  1411,  1552,  1707,  1878,  2066,
+    2272,  2499,  2749,  3024,  3327,  3660,  4026,  4428,  4871,  5358,
+    5894,  6484,  7132,  7845,  8630,  9493,  10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767};
+
+static const int8_t index_table[8] = {-1, -1, -1, -1, 2, 4, 6, 8};
+
+static inline uint8_t next_step_index(uint8_t step_index, uint8_t code) {
+  int32_t index = step_index + index_table[code & 7];
+  if (index < 0) return 0;
+  if (index > STEP_INDEX_MAX) return STEP_INDEX_MAX;
+  return (uint8_t)index;
+}
+
+// All ones if x is negative, else 0
+static inline int32_t sign_mask(int32_t x) { return x >> 31; }
+
+// Reconstructed difference for a code, the same sum the encoder builds up
+// while choosing it, so both track the same predictor. Each bit adds its
+// part of the step through a mask rather than a branch: on the M33 a taken
+// branch costs a pipeline refill, a masked add one cycle.
+static inline int32_t code_delta(int32_t step, uint8_t code) {
+  int32_t delta = (step >> 3) + (step & -(int32_t)((code >> 2) & 1)) +
+                  ((step >> 1) & -(int32_t)((code >> 1) & 1)) +
+                  ((step >> 2) & -(int32_t)(code & 1));
+  int32_t negative = -(int32_t)((code >> 3) & 1);
+  return (delta ^ negative) - negative;
+}
+
+// The three compare-and-subtract steps of the quantiser, with the
+// reconstructed difference summed as they go instead of decoded again
+static inline uint8_t encode_sample(adpcm_state_t *state, int16_t sample) {
+  int32_t step = step_table[state->step_index];
+  int32_t diff = (int32_t)sample - state->predictor;
+  int32_t negative = sign_mask(diff);
+  diff = (diff ^ negative) - negative;
+  int32_t delta = step >> 3;
+  uint8_t code = (uint8_t)(negative & 8);
+
+  int32_t take = ~sign_mask(diff - step);  // diff >= step
+  code |= (uint8_t)(take & 4);
+  diff -= step & take;
+  delta += step & take;
+  step >>= 1;
+  take = ~sign_mask(diff - step);
+  code |= (uint8_t)(take & 2);
+  diff -= step & take;
+  delta += step & take;
+  step >>= 1;
+  take = ~sign_mask(diff - step);
+  code |= (uint8_t)(take & 1);
+  delta += step & take;
+
+  state->predictor = (int16_t)CLAMP_S16((int32_t)state->predictor +
+                                        ((delta ^ negative) - negative));
+  state->step_index = next_step_index(state->step_index, code);
+  return code;
+}
+
+static inline int16_t decode_sample(adpcm_state_t *state, uint8_t code) {
+  int32_t step = step_table[state->step_index];
+  state->predictor =
+      (int16_t)CLAMP_S16((int32_t)state->predictor + code_delta(step, code));
+  state->step_index = next_step_index(state->step_index, code);
+  return state->predictor;
+}
+
+void adpcm_init(adpcm_state_t *state) {
+  state->predictor = 0;
+  state->step_index = 0;
+}
+
+size_t adpcm_encode_block(adpcm_state_t *state, const int16_t *pcm,
+                          size_t sample_count, uint8_t *out) {
+  out[0] = (uint8_t)state->predictor;
+  out[1] = (uint8_t)((uint16_t)state->predictor >> 8);
+  out[2] = state->step_index;
+  uint8_t *codes = out + ADPCM_BLOCK_HEADER_SIZE;
+
+  size_t i = 0;
+  for (; i + 1 < sample_count; i += 2) {
+    uint8_t low = encode_sample(state, pcm[i]);
+    uint8_t high = encode_sample(state, pcm[i + 1]);
+    *codes++ = (uint8_t)(low | (high << 4));
+  }
+  if (i < sample_count) *codes++ = encode_sample(state, pcm[i]);
+  return (size_t)(codes - out);
+}
+
+size_t adpcm_decode_block(adpcm_state_t *state, const uint8_t *block,
+                          size_t block_size, int16_t *pcm,
+                          size_t max_samples) {
+  if (block_size < ADPCM_BLOCK_HEADER_SIZE) return 0;
+  state->predictor = (int16_t)(block[0] | (block[1] << 8));
+  state->step_index =
+      block[2] > STEP_INDEX_MAX ? STEP_INDEX_MAX : block[2];
+
+  size_t count = 0;
+  for (size_t i = ADPCM_BLOCK_HEADER_SIZE; i < block_size; i++) {
+    if (count < max_samples) pcm[count++] = decode_sample(state, block[i]);
+    if (count < max_samples) pcm[count++] = decode_sample(state, block[i] >> 4);
+  }
+  return count;
+}
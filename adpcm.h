@@ -0,0 +1,44 @@
+#ifndef ADPCM_H_
+#define ADPCM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// IMA-ADPCM, 16-bit PCM to 4-bit codes (4:1), used for
+// CHAR_STETHOSCOPE_STREAMING.
+//
+// Each block starts with the coder state so a lost notification only
+// loses its own samples:
+//
+//   predictor   i16  little-endian
+//   step_index  u8
+//   codes ...        two samples per byte, first sample in the low nibble
+
+#define ADPCM_BLOCK_HEADER_SIZE 3
+
+// Bytes needed for a block of sample_count samples
+#define ADPCM_BLOCK_SIZE(sample_count) \
+  (ADPCM_BLOCK_HEADER_SIZE + ((sample_count) + 1) / 2)
+
+// Samples that fit in a block of block_size bytes
+#define ADPCM_BLOCK_SAMPLES(block_size) \
+  (((block_size) - ADPCM_BLOCK_HEADER_SIZE) * 2)
+
+typedef struct {
+  int16_t predictor;
+  uint8_t step_index;
+} adpcm_state_t;
+
+void adpcm_init(adpcm_state_t *state);
+
+// Encode sample_count samples into out, returns bytes written
+size_t adpcm_encode_block(adpcm_state_t *state, const int16_t *pcm,
+                          size_t sample_count, uint8_t *out);
+
+// Decode a block of block_size bytes, writing at most max_samples samples.
+// The state is taken from the block header. Returns samples written.
+size_t adpcm_decode_block(adpcm_state_t *state, const uint8_t *block,
+                          size_t block_size, int16_t *pcm,
+                          size_t max_samples);
+
+#endif
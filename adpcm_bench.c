@@ -0,0 +1,288 @@
+// Host check and benchmark of the stethoscope codec (adpcm.h): SNR of the
+// decoded signal for the simulator's heart-sound mix and for sines across
+// the band, encoded in blocks the size a 247-byte MTU frame carries, and
+// the encode and decode cost per sample against the compare-and-branch
+// coder it replaced, kept here as the reference. Both must produce the
+// same codes and the same samples, bit for bit.
+//
+//   nxmic_adpcm_bench [-r sample_rate_hz] [-n rounds] [-q min_snr_db]
+//
+// The mix is the one host_sim streams, 100 and 310 Hz over noise, and
+// must decode at min_snr_db or better; each sine is only reported, IMA
+// ADPCM loses SNR as the frequency nears Nyquist. The costs are rounds
+// passes over the signal. Exits non-zero if the mix falls short or the
+// two coders differ.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "adpcm.h"
+#include "bench_util.h"
+#include "nxmic_frame.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define BENCH_MIN_SNR_DB 30.0
+#define BENCH_SIGNAL_SAMPLES 65536
+// Samples of one full frame on a 247-byte MTU, as the sensor sends them
+#define BENCH_BLOCK_SAMPLES \
+  ADPCM_BLOCK_SAMPLES(247 - 3 - NXMIC_FRAME_HEADER_SIZE)
+
+static int16_t signal[BENCH_SIGNAL_SAMPLES];
+static int16_t decoded[BENCH_SIGNAL_SAMPLES];
+static uint8_t encoded[BENCH_SIGNAL_SAMPLES / BENCH_BLOCK_SAMPLES + 1]
+                      [ADPCM_BLOCK_SIZE(BENCH_BLOCK_SAMPLES)];
+static size_t encoded_size[BENCH_SIGNAL_SAMPLES / BENCH_BLOCK_SAMPLES + 1];
+static uint8_t reference[sizeof(encoded)];
+
+// The coder as it was: a branch per quantiser bit, and the difference
+// decoded again from the code
+static const int16_t reference_steps[89] = {
+    7,     8,     9,     10,    11,    12,    13,    14,    16,    17,
+    19,    21,    23,    25,    28,    31,    34,    37,    41,    45,
+    50,    55,    60,    66,    73,    80,    88,    97,    107,   118,
+    130,   143,   157,   173,   190,   209,   230,   253,   279,   307,
+    337,   371,   408,   449,   494,   544,   598,   658,   724,   796,
+    876,   963,   1060,  1166,  1282,  1411,  1552,  1707,  1878,  2066,
+    2272,  2499,  2749,  3024,  3327,  3660,  4026,  4428,  4871,  5358,
+    5894,  6484,  7132,  7845,  8630,  9493,  10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767};
+static const int8_t reference_index[8] = {-1, -1, -1, -1, 2, 4, 6, 8};
+
+static int32_t reference_clamp(int32_t x) {
+  if (x > INT16_MAX) return INT16_MAX;
+  if (x < INT16_MIN) return INT16_MIN;
+  return x;
+}
+
+static uint8_t reference_next_index(uint8_t step_index, uint8_t code) {
+  int32_t index = step_index + reference_index[code & 7];
+  if (index < 0) return 0;
+  if (index > 88) return 88;
+  return (uint8_t)index;
+}
+
+static int32_t reference_delta(int32_t step, uint8_t code) {
+  int32_t delta = step >> 3;
+  if (code & 4) delta += step;
+  if (code & 2) delta += step >> 1;
+  if (code & 1) delta += step >> 2;
+  return (code & 8) ? -delta : delta;
+}
+
+static uint8_t reference_encode_sample(adpcm_state_t *state, int16_t sample) {
+  int32_t step = reference_steps[state->step_index];
+  int32_t diff = (int32_t)sample - state->predictor;
+  uint8_t code = 0;
+  if (diff < 0) {
+    code = 8;
+    diff = -diff;
+  }
+  if (diff >= step) {
+    code |= 4;
+    diff -= step;
+  }
+  if (diff >= step >> 1) {
+    code |= 2;
+    diff -= step >> 1;
+  }
+  if (diff >= step >> 2) code |= 1;
+  state->predictor = (int16_t)reference_clamp((int32_t)state->predictor +
+                                              reference_delta(step, code));
+  state->step_index = reference_next_index(state->step_index, code);
+  return code;
+}
+
+static int16_t reference_decode_sample(adpcm_state_t *state, uint8_t code) {
+  int32_t step = reference_steps[state->step_index];
+  state->predictor = (int16_t)reference_clamp((int32_t)state->predictor +
+                                              reference_delta(step, code));
+  state->step_index = reference_next_index(state->step_index, code);
+  return state->predictor;
+}
+
+__attribute__((noinline)) static size_t reference_encode_block(
+    adpcm_state_t *state, const int16_t *pcm, size_t count, uint8_t *out) {
+  out[0] = (uint8_t)state->predictor;
+  out[1] = (uint8_t)((uint16_t)state->predictor >> 8);
+  out[2] = state->step_index;
+  uint8_t *codes = out + ADPCM_BLOCK_HEADER_SIZE;
+  size_t i = 0;
+  for (; i + 1 < count; i += 2) {
+    uint8_t low = reference_encode_sample(state, pcm[i]);
+    uint8_t high = reference_encode_sample(state, pcm[i + 1]);
+    *codes++ = (uint8_t)(low | (high << 4));
+  }
+  if (i < count) *codes++ = reference_encode_sample(state, pcm[i]);
+  return (size_t)(codes - out);
+}
+
+__attribute__((noinline)) static size_t reference_decode_block(
+    adpcm_state_t *state, const uint8_t *block, size_t size, int16_t *pcm,
+    size_t max_samples) {
+  state->predictor = (int16_t)(block[0] | (block[1] << 8));
+  state->step_index = block[2] > 88 ? 88 : block[2];
+  size_t count = 0;
+  for (size_t i = ADPCM_BLOCK_HEADER_SIZE; i < size; i++) {
+    if (count < max_samples)
+      pcm[count++] = reference_decode_sample(state, block[i]);
+    if (count < max_samples)
+      pcm[count++] = reference_decode_sample(state, block[i] >> 4);
+  }
+  return count;
+}
+
+static void make_mix(uint32_t rate) {
+  for (uint32_t n = 0; n < BENCH_SIGNAL_SAMPLES; n++) {
+    double t = (double)n / rate;
+    signal[n] = (int16_t)(6000 * sin(2 * M_PI * 100 * t) +
+                          3000 * sin(2 * M_PI * 310 * t) + bench_noise(n));
+  }
+}
+
+static void make_sine(double frequency, uint32_t rate) {
+  for (uint32_t n = 0; n < BENCH_SIGNAL_SAMPLES; n++)
+    signal[n] = (int16_t)lrint(16000 * sin(2 * M_PI * frequency * n / rate));
+}
+
+typedef size_t (*encode_block_t)(adpcm_state_t *, const int16_t *, size_t,
+                                 uint8_t *);
+typedef size_t (*decode_block_t)(adpcm_state_t *, const uint8_t *, size_t,
+                                 int16_t *, size_t);
+
+// signal into encoded[] in frame-sized blocks, the state carried across
+// them as the sensor's encoder does; returns the block count
+static uint32_t encode_all(encode_block_t encode) {
+  adpcm_state_t state;
+  adpcm_init(&state);
+  uint32_t blocks = 0;
+  for (uint32_t i = 0; i < BENCH_SIGNAL_SAMPLES; i += BENCH_BLOCK_SAMPLES) {
+    uint32_t count = BENCH_SIGNAL_SAMPLES - i < BENCH_BLOCK_SAMPLES
+                         ? BENCH_SIGNAL_SAMPLES - i
+                         : BENCH_BLOCK_SAMPLES;
+    encoded_size[blocks] = encode(&state, &signal[i], count, encoded[blocks]);
+    blocks++;
+  }
+  return blocks;
+}
+
+static void decode_all(decode_block_t decode, uint32_t blocks) {
+  adpcm_state_t state;
+  for (uint32_t b = 0; b < blocks; b++) {
+    uint32_t first = b * BENCH_BLOCK_SAMPLES;
+    decode(&state, encoded[b], encoded_size[b], &decoded[first],
+           BENCH_SIGNAL_SAMPLES - first);
+  }
+}
+
+static double snr_db(void) {
+  double signal_energy = 0, error_energy = 0;
+  for (uint32_t n = 0; n < BENCH_SIGNAL_SAMPLES; n++) {
+    double error = (double)decoded[n] - signal[n];
+    signal_energy += (double)signal[n] * signal[n];
+    error_energy += error * error;
+  }
+  return error_energy > 0 ? 10 * log10(signal_energy / error_energy)
+                          : INFINITY;
+}
+
+// Both coders on the current signal: same codes, same samples
+static int same_as_reference(void) {
+  static int16_t reference_decoded[BENCH_SIGNAL_SAMPLES];
+  uint32_t blocks = encode_all(reference_encode_block);
+  memcpy(reference, encoded, sizeof(encoded));
+  decode_all(reference_decode_block, blocks);
+  memcpy(reference_decoded, decoded, sizeof(decoded));
+  encode_all(adpcm_encode_block);
+  decode_all(adpcm_decode_block, blocks);
+  return memcmp(reference, encoded, sizeof(encoded)) == 0 &&
+         memcmp(reference_decoded, decoded, sizeof(decoded)) == 0;
+}
+
+static bench_cost_t time_encode(encode_block_t encode, uint32_t rounds) {
+  bench_cost_t start = bench_cost_now();
+  for (uint32_t r = 0; r < rounds; r++) encode_all(encode);
+  return bench_cost_since(start);
+}
+
+static bench_cost_t time_decode(decode_block_t decode, uint32_t blocks,
+                                uint32_t rounds) {
+  bench_cost_t start = bench_cost_now();
+  for (uint32_t r = 0; r < rounds; r++) decode_all(decode, blocks);
+  return bench_cost_since(start);
+}
+
+static void print_cost(const char *name, bench_cost_t reference_cost,
+                       bench_cost_t cost, uint64_t samples) {
+  printf("%s: %5.2f ns, %5.1f cycles per sample (reference %5.2f ns, "
+         "%5.1f cycles), %.2fx\n",
+         name, (double)cost.ns / samples, (double)cost.cycles / samples,
+         (double)reference_cost.ns / samples,
+         (double)reference_cost.cycles / samples,
+         (double)reference_cost.ns / cost.ns);
+}
+
+int main(int argc, char **argv) {
+  uint32_t rate = 4000;  // The simulator's stethoscope stream
+  uint32_t rounds = 200;
+  double min_snr_db = BENCH_MIN_SNR_DB;
+  int opt;
+  while ((opt = getopt(argc, argv, "r:n:q:")) != -1) {
+    switch (opt) {
+      case 'r':
+        rate = (uint32_t)atoi(optarg);
+        break;
+      case 'n':
+        rounds = (uint32_t)atoi(optarg);
+        break;
+      case 'q':
+        min_snr_db = atof(optarg);
+        break;
+      default:
+        fprintf(stderr,
+                "usage: %s [-r sample_rate_hz] [-n rounds] [-q min_snr_db]\n",
+                argv[0]);
+        return 2;
+    }
+  }
+  if (rate < 1000 || rounds == 0) {
+    fprintf(stderr, "invalid sample rate or round count\n");
+    return 2;
+  }
+
+  int failed = 0;
+  printf("%u Hz, blocks of %d samples in %d bytes\n", rate,
+         BENCH_BLOCK_SAMPLES, ADPCM_BLOCK_SIZE(BENCH_BLOCK_SAMPLES));
+  const double sines[] = {50, 100, 200, 400, 800, 1600};
+  for (size_t i = 0; i < sizeof(sines) / sizeof(sines[0]); i++) {
+    if (sines[i] >= rate / 2.0) continue;
+    make_sine(sines[i], rate);
+    int same = same_as_reference();
+    printf("  sine %4.0f Hz: SNR %5.1f dB%s\n", sines[i], snr_db(),
+           same ? "" : ", DIFFERS from the reference coder");
+    if (!same) failed = 1;
+  }
+  make_mix(rate);
+  int same = same_as_reference();
+  double snr = snr_db();
+  printf("heart-sound mix: SNR %.1f dB, at least %.1f%s\n", snr, min_snr_db,
+         same ? "" : ", DIFFERS from the reference coder");
+  if (!same || snr < min_snr_db) failed = 1;
+
+  uint32_t blocks = encode_all(adpcm_encode_block);
+  uint64_t samples = (uint64_t)rounds * BENCH_SIGNAL_SAMPLES;
+  time_encode(reference_encode_block, rounds / 10 + 1);  // warm up
+  bench_cost_t reference_encode = time_encode(reference_encode_block, rounds);
+  bench_cost_t encode = time_encode(adpcm_encode_block, rounds);
+  bench_cost_t reference_decode =
+      time_decode(reference_decode_block, blocks, rounds);
+  bench_cost_t decode = time_decode(adpcm_decode_block, blocks, rounds);
+  print_cost("encode", reference_encode, encode, samples);
+  print_cost("decode", reference_decode, decode, samples);
+  return failed;
+}
@@ -0,0 +1,200 @@
+// Host benchmark of the sensor's ATT read dispatch (nxmic_att.h) as the
+// characteristic count grows: the handle-indexed table serving values in
+// place, against the if-chain it replaced, which compared the handle with
+// each characteristic in turn and staged the value in a local copy before
+// the blob read. Every characteristic has a 20-byte value and a CCCD, laid
+// out as compile_gatt.py does, and reads hit them uniformly at random.
+// First checks that a Write Long staged in chunks reaches the write
+// function whole, or not at all when cancelled, and that chunks off the
+// end of the value or for a second handle are refused.
+//
+//   nxmic_att_bench [-n reads]
+//
+// Times are this host's, per read including the copy into the response.
+// Exits non-zero if a check fails or the two return different values.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench_util.h"
+#include "nxmic_att.h"
+
+#define BENCH_VALUE_SIZE 20
+#define BENCH_MAX_CHARACTERISTICS 20
+// Characteristic declaration, value, CCCD; handle 1 is the service
+#define BENCH_HANDLES_PER_CHARACTERISTIC 3
+
+static const int bench_counts[] = {2, 4, 8, 12, 16, 20};
+#define BENCH_COUNTS (int)(sizeof(bench_counts) / sizeof(bench_counts[0]))
+
+static uint8_t values[BENCH_MAX_CHARACTERISTICS][BENCH_VALUE_SIZE];
+static nxmic_att_handler_t handlers[BENCH_MAX_CHARACTERISTICS];
+static uint16_t chain_handles[BENCH_MAX_CHARACTERISTICS];
+static int chain_count;
+static nxmic_att_table_t table;
+
+// What the Write Long checks' write function last saw
+static uint8_t written[NXMIC_ATT_PREPARE_MAX];
+static uint16_t written_length;
+static int writes;
+
+static uint16_t value_handle_of(int i) {
+  return (uint16_t)(2 + i * BENCH_HANDLES_PER_CHARACTERISTIC + 1);
+}
+
+// As att_read_callback_handle_blob() does it
+static uint16_t read_blob(const uint8_t *value, uint16_t length,
+                          uint16_t offset, uint8_t *buffer,
+                          uint16_t buffer_size) {
+  if (offset > length) return 0;
+  uint16_t n = length - offset < buffer_size ? length - offset : buffer_size;
+  memcpy(buffer, value + offset, n);
+  return n;
+}
+
+__attribute__((noinline)) static uint16_t chain_read(uint16_t handle,
+                                                     uint8_t *buffer,
+                                                     uint16_t buffer_size) {
+  for (int i = 0; i < chain_count; i++) {
+    if (handle != chain_handles[i]) continue;
+    uint8_t staged[BENCH_VALUE_SIZE];
+    memcpy(staged, values[i], sizeof(staged));
+    return read_blob(staged, sizeof(staged), 0, buffer, buffer_size);
+  }
+  return 0;
+}
+
+__attribute__((noinline)) static uint16_t table_read(uint16_t handle,
+                                                     uint8_t *buffer,
+                                                     uint16_t buffer_size) {
+  uint8_t scratch[NXMIC_ATT_BUILD_MAX];
+  uint16_t length;
+  const uint8_t *value = nxmic_att_value(&table, handle, scratch, &length);
+  if (!value) return 0;
+  return read_blob(value, length, 0, buffer, buffer_size);
+}
+
+static void setup(int count) {
+  nxmic_att_init(&table);
+  chain_count = count;
+  for (int i = 0; i < count; i++) {
+    for (int j = 0; j < BENCH_VALUE_SIZE; j++)
+      values[i][j] = (uint8_t)(i * 31 + j);
+    handlers[i] = (nxmic_att_handler_t){.value = values[i],
+                                        .size = BENCH_VALUE_SIZE};
+    chain_handles[i] = value_handle_of(i);
+    nxmic_att_register(&table, chain_handles[i], &handlers[i]);
+  }
+}
+
+static int record_write(uint16_t con_handle, const uint8_t *value,
+                        uint16_t length) {
+  (void)con_handle;
+  memcpy(written, value, length);
+  written_length = length;
+  writes++;
+  return 0;
+}
+
+// As att_write_callback() drives it: 18-byte chunks, the most a 23-byte
+// MTU carries, then an execute or a cancel
+static void check_write_long(void) {
+  static uint8_t label[NXMIC_ATT_PREPARE_MAX], other[4];
+  static const nxmic_att_handler_t label_handler = {
+      .value = label, .size = sizeof(label), .write = record_write};
+  static const nxmic_att_handler_t other_handler = {
+      .value = other, .size = sizeof(other), .write = record_write};
+  uint8_t value[sizeof(label)];
+  for (size_t i = 0; i < sizeof(value); i++) value[i] = (uint8_t)(i * 7 + 1);
+  nxmic_att_init(&table);
+  nxmic_att_register(&table, 3, &label_handler);
+  nxmic_att_register(&table, 6, &other_handler);
+
+  int error = 0;
+  for (uint16_t offset = 0; offset < sizeof(value); offset += 18) {
+    uint16_t n = sizeof(value) - offset < 18 ? sizeof(value) - offset : 18;
+    error |= nxmic_att_prepare(&table, 3, offset, value + offset, n);
+  }
+  bench_check(error == 0, "chunk of a Write Long refused");
+  bench_check(writes == 0, "write before the execute");
+  bench_check(nxmic_att_prepare(&table, 6, 0, value, 1) ==
+                  NXMIC_ATT_ERROR_PREPARE_QUEUE_FULL,
+              "second handle staged alongside the first");
+  bench_check(nxmic_att_execute(&table, 1) == 0, "execute");
+  bench_check(writes == 1 && written_length == sizeof(value) &&
+                  memcmp(written, value, sizeof(value)) == 0,
+              "Write Long not written whole");
+
+  nxmic_att_prepare(&table, 3, 0, value, 18);
+  nxmic_att_cancel(&table);
+  bench_check(nxmic_att_execute(&table, 1) == 0 && writes == 1,
+              "cancelled Write Long written");
+
+  bench_check(nxmic_att_prepare(&table, 3, sizeof(value) + 1, value, 1) ==
+                  NXMIC_ATT_ERROR_INVALID_OFFSET,
+              "offset past the value");
+  bench_check(nxmic_att_prepare(&table, 3, sizeof(value) - 10, value, 18) ==
+                  NXMIC_ATT_ERROR_INVALID_ATTRIBUTE_VALUE_LENGTH,
+              "chunk running past the value");
+  bench_check(nxmic_att_execute(&table, 1) == 0 && writes == 1,
+              "refused chunks written");
+}
+
+// Reads of uniformly random characteristics, the same sequence both ways.
+// Returns the time, and a checksum of the responses in *sum.
+static uint64_t run(uint16_t (*read)(uint16_t, uint8_t *, uint16_t),
+                    uint32_t reads, uint32_t *sum) {
+  uint8_t response[BENCH_VALUE_SIZE + 2];
+  uint32_t random_state = 0x2545f491;
+  *sum = 0;
+  uint64_t start = bench_now_ns();
+  for (uint32_t i = 0; i < reads; i++) {
+    random_state = random_state * 1664525 + 1013904223;
+    int characteristic = (int)((random_state >> 16) % chain_count);
+    uint16_t handle = value_handle_of(characteristic);
+    uint16_t n = read(handle, response, sizeof(response));
+    *sum = *sum * 31 + n + response[n - 1];
+  }
+  return bench_now_ns() - start;
+}
+
+int main(int argc, char **argv) {
+  uint32_t reads = 2000000;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+      case 'n':
+        reads = (uint32_t)atoi(optarg);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-n reads]\n", argv[0]);
+        return 2;
+    }
+  }
+  if (reads == 0) {
+    fprintf(stderr, "invalid read count\n");
+    return 2;
+  }
+  if (value_handle_of(BENCH_MAX_CHARACTERISTICS - 1) >= NXMIC_ATT_MAX_HANDLES) {
+    fprintf(stderr, "profile larger than NXMIC_ATT_MAX_HANDLES\n");
+    return 2;
+  }
+
+  check_write_long();
+  printf("chars  handles  if-chain ns/read  table ns/read  speedup\n");
+  for (int c = 0; c < BENCH_COUNTS; c++) {
+    setup(bench_counts[c]);
+    uint32_t chain_sum, table_sum;
+    run(chain_read, reads / 10, &chain_sum);  // warm up
+    uint64_t chain_ns = run(chain_read, reads, &chain_sum);
+    uint64_t table_ns = run(table_read, reads, &table_sum);
+    bench_check(chain_sum == table_sum, "table and if-chain differ");
+    printf("%5d  %7d  %16.1f  %13.1f  %6.2fx%s\n", bench_counts[c],
+           value_handle_of(bench_counts[c] - 1) + 1, (double)chain_ns / reads,
+           (double)table_ns / reads, (double)chain_ns / table_ns,
+           chain_sum != table_sum ? "  MISMATCH" : "");
+  }
+  return bench_failures != 0;
+}
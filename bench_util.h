@@ -0,0 +1,64 @@
+#ifndef BENCH_UTIL_H_
+#define BENCH_UTIL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// What the host benchmarks (*_bench.c) and host_sim share, host build
+// only: the clocks they time with, the noise their signals are made of and
+// the check that makes a bench exit non-zero.
+//
+// Cycles are the host's time stamp counter where it has one and 0
+// elsewhere; on the sensor the probes count them (nxmic_probe.h).
+
+typedef struct {
+  uint64_t ns;
+  uint64_t cycles;
+} bench_cost_t;
+
+// Checks that failed, for the exit code
+static int bench_failures __attribute__((unused));
+
+static inline uint64_t bench_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline uint64_t bench_now_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+static inline bench_cost_t bench_cost_now(void) {
+  return (bench_cost_t){bench_now_ns(), bench_now_cycles()};
+}
+
+// Time and cycles since start, from bench_cost_now()
+static inline bench_cost_t bench_cost_since(bench_cost_t start) {
+  bench_cost_t now = bench_cost_now();
+  return (bench_cost_t){now.ns - start.ns, now.cycles - start.cycles};
+}
+
+// Deterministic noise in [-128, 127], the same for every n on every run
+static inline int bench_noise(uint64_t n) {
+  uint64_t x = (n + 1) * 0x9e3779b97f4a7c15ull;
+  x ^= x >> 29;
+  return (int)(x & 0xff) - 128;
+}
+
+static inline void bench_check(bool ok, const char *what) {
+  if (ok) return;
+  printf("FAILED: %s\n", what);
+  bench_failures++;
+}
+
+#endif
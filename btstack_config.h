@@ -7,6 +7,7 @@
 
 // BTstack features that can be enabled
 #define ENABLE_LE_PERIPHERAL
+#define ENABLE_LE_DATA_LENGTH_EXTENSION
 #define ENABLE_LOG_INFO
 #define ENABLE_LOG_ERROR
 #define ENABLE_PRINTF_HEXDUMP
@@ -14,16 +15,26 @@
 // for the client
 #if RUNNING_AS_CLIENT
 #define ENABLE_LE_CENTRAL
-#define MAX_NR_GATT_CLIENTS 1
+// Number of NxMic peripherals a client serves at once
+#ifndef NXMIC_MAX_LINKS
+#define NXMIC_MAX_LINKS 4
+#endif
+#define MAX_NR_GATT_CLIENTS NXMIC_MAX_LINKS
+#define MAX_NR_HCI_CONNECTIONS NXMIC_MAX_LINKS
 #else
 #define MAX_NR_GATT_CLIENTS 0
+#define MAX_NR_HCI_CONNECTIONS 1
 #endif
 
+// L2CAP LE credit-based channel for the bulk export, see nxmic_export.h
+#define ENABLE_L2CAP_LE_CREDIT_BASED_FLOW_CONTROL_MODE
+#define MAX_NR_L2CAP_SERVICES 1
+#define MAX_NR_L2CAP_CHANNELS MAX_NR_HCI_CONNECTIONS
+
 // BTstack configuration. buffers, sizes, ...
 #define HCI_OUTGOING_PRE_BUFFER_SIZE 4
 #define HCI_ACL_PAYLOAD_SIZE (255 + 4)
 #define HCI_ACL_CHUNK_SIZE_ALIGNMENT 4
-#define MAX_NR_HCI_CONNECTIONS 1
 #define MAX_NR_SM_LOOKUP_ENTRIES 3
 #define MAX_NR_WHITELIST_ENTRIES 16
 #define MAX_NR_LE_DEVICE_DB_ENTRIES 16
@@ -5,10 +5,31 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gatt_cache.h"
+#include "link_profile.h"
+#include "nxmic_adv.h"
+#include "nxmic_bench.h"
+#include "nxmic_codec.h"
+#include "nxmic_export.h"
+#include "nxmic_frame.h"
+#include "nxmic_gateway.h"
 #include "nxmic_gatt.h"
+#include "nxmic_log.h"
+#include "nxmic_probe.h"
+#include "nxmic_reader.h"
+#include "nxmic_retransmit.h"
+#include "nxmic_stream.h"
+#include "nxmic_timesync.h"
+#include "spsc_ring.h"
 #include "btstack.h"
 #include "pico/cyw43_arch.h"
 #include "pico/stdlib.h"
+#if NXMIC_GATEWAY
+#include "gateway_lwip.h"
+#endif
 
 #if 0
 #define DEBUG_LOG(...) printf(__VA_ARGS__)
@@ -19,181 +40,1237 @@
 #define LED_QUICK_FLASH_DELAY_MS 100
 #define LED_SLOW_FLASH_DELAY_MS 1000
 
+#ifndef STATS_REPORT_PERIOD_MS
+#define STATS_REPORT_PERIOD_MS 10000
+#endif
+// Received rate the link profile follows, measured over this window
+#define LINK_PROFILE_WINDOW_MS 2000
+#define CONNECT_TIMEOUT_MS 3000
+
+// With known sensors away, the controller connects to whichever of them it
+// hears first for ACCEPT_LIST_WINDOW_MS, then a discovery scan looks for
+// new ones for DISCOVERY_WINDOW_MS, and so on. The scan also steps down
+// its duty cycle once per window, see scan_profiles.
+#define ACCEPT_LIST_WINDOW_MS 5000
+#define DISCOVERY_WINDOW_MS 2000
+
+// The sensor averages each 512-sample ADC block at 1 kHz into one
+// temperature sample
+#define TEMP_SAMPLE_PERIOD_NS 512000000u
+
+// Notifications handed from the BTstack callback to the main loop. Each slot
+// holds a nxmic_reader_record_t header followed by the ATT value.
+#define NOTIFICATION_RING_SLOTS 64
+#define NOTIFICATION_MAX_VALUE (HCI_ACL_PAYLOAD_SIZE - 4 - 3)
+#define NOTIFICATION_BATCH_WAIT_MS 1
+// Deferred log records printed per pass of the main loop
+#define LOG_DRAIN_BATCH 8
+
+// Number of peripherals served at once, see btstack_config.h
+#ifndef NXMIC_MAX_LINKS
+#define NXMIC_MAX_LINKS 1
+#endif
+
+// Gateway build: notifications are also forwarded over Wi-Fi to a UDP sink,
+// see nxmic_gateway.h
+#ifndef NXMIC_GATEWAY
+#define NXMIC_GATEWAY 0
+#endif
+#ifndef NXMIC_GATEWAY_HOST
+#define NXMIC_GATEWAY_HOST "192.168.1.2"
+#endif
+#ifndef NXMIC_GATEWAY_PORT
+#define NXMIC_GATEWAY_PORT 5401
+#endif
+// A datagram leaves once its oldest notification is this old
+#ifndef NXMIC_GATEWAY_FLUSH_MS
+#define NXMIC_GATEWAY_FLUSH_MS 5
+#endif
+
+// Observer build: never connects, only collects the readings the sensors
+// broadcast in their advertisements, see nxmic_adv.h
+#ifndef NXMIC_OBSERVER
+#define NXMIC_OBSERVER 0
+#endif
+#define OBSERVER_MAX_SENSORS 16
+
 // Gatt Client States
-// Defines various states, e.g. scanning, connecting, discovering services, etc.
+// Defines various states, e.g. scanning, connecting, etc. Discovery and
+// what follows it are the reader's, see nxmic_reader.h.
 // TC stands for Temperature Client
 typedef enum {
   TC_OFF,
   TC_IDLE,
   TC_W4_SCAN_RESULT,
   TC_W4_CONNECT,
-  TC_W4_SERVICE_RESULT,
-  TC_W4_CHARACTERISTIC_RESULT,
-  TC_W4_ENABLE_NOTIFICATIONS_COMPLETE,
-  TC_W4_READY
+  TC_CONNECTED
 } gc_state_t;
 
+// Scan duty cycle, interval and window in units of 0.625 ms. Each takes
+// over after_ms since the last boot or disconnect: a sensor that just went
+// away is likely to be back soon.
+typedef struct {
+  const char *name;
+  uint16_t interval;
+  uint16_t window;
+  uint32_t after_ms;
+} scan_profile_t;
+
+static const scan_profile_t scan_profiles[] = {
+    {"fast", 0x0030, 0x0030, 0},             // 30 of 30 ms, 100 %
+    {"balanced", 0x0100, 0x0030, 30000},     // 30 of 160 ms, 19 %
+    {"low duty", 0x0800, 0x0012, 300000},    // 11.25 of 1280 ms, 0.9 %
+};
+#define SCAN_PROFILE_COUNT (sizeof(scan_profiles) / sizeof(scan_profiles[0]))
+
+// Connection-up to all streams enabled, split by cold and cached discovery;
+// also disconnect to all streams enabled, split by how the sensor was found
+typedef struct {
+  uint32_t count;
+  uint32_t total_ms;
+  uint32_t max_ms;
+} reconnect_latency_t;
+
+// Offload of one sensor's recording. Kept outside nxmic_link_t so a transfer
+// cut by a disconnect resumes from the last acknowledged offset.
+typedef struct {
+  bool used;
+  bool reported;  // Result printed
+  bd_addr_t addr;
+  uint32_t started_ms;
+  nxmic_export_receiver_t receiver;
+} export_session_t;
+
+// Everything the client knows about one peripheral. Links in TC_IDLE are
+// free; the link in TC_W4_CONNECT is the one gap_connect() is working on.
+typedef struct {
+  gc_state_t state;                // Current state of this link
+  bd_addr_t addr;                  // Address of the server device
+  bd_addr_type_t addr_type;        // Type of the server device address
+  hci_con_handle_t con_handle;     // Handle for the connection
+  nxmic_reader_t reader;  // Discovery, streams and clock fit, BTstack context
+  bool listener_registered;  // Flag to check if the listener is registered
+  gatt_client_notification_t
+      notification_listener;     // Listener for notifications
+  uint32_t connect_time_ms;      // When the connection came up
+  bool via_accept_list;          // Connected by the controller's accept list
+  bool reconnect;                // Came back after a disconnect
+  uint32_t lost_ms;              // When it went away, if reconnect
+  uint32_t dispatch_us;          // Time spent routing notifications
+  uint32_t report_notifications;  // Totals at the previous stats report
+  uint32_t profile_window_ms;     // Start of the link profile's window
+  uint32_t profile_window_bytes;  // Stream bytes received before it
+  uint32_t report_bytes;
+  uint32_t connection;                   // Tags ring records, see reset_link()
+  export_session_t *export_session;      // Set once notifications are on
+  export_session_t *export_pending;      // Waiting for the export channel
+  uint16_t export_cid;                   // L2CAP channel, 0 if none
+  uint8_t export_sdu[NXMIC_EXPORT_SDU_SIZE];  // Its receive buffer
+  btstack_timer_source_t timesync_timer;  // Starts the next clock sync round
+} nxmic_link_t;
+
+// Main loop side of a link, kept out of nxmic_link_t so reset_link() in
+// BTstack context never clears it under the main loop. It counts for one
+// connection of the link and starts afresh with the first record of the
+// next.
+typedef struct {
+  uint32_t connection;
+  nxmic_gap_tracker_t gaps[CHAR_COUNT];  // Lost frames per stream
+#if NXMIC_BENCHMARK
+  nxmic_bench_t bench;  // Latency and loss of the sensor's benchmark stream
+#endif
+} link_accounting_t;
+
 // Global variables
 static btstack_packet_callback_registration_t
-    hci_event_callback_registration;     // Callback registration for HCI events
-static gc_state_t state = TC_OFF;        // Current state of the Gatt Client
-static bd_addr_t server_addr;            // Address of the server device
-static bd_addr_type_t server_addr_type;  // Type of the server device address
-static hci_con_handle_t connection_handle;    // Handle for the connection
-static gatt_client_service_t server_service;  // Service of the server device
-static gatt_client_characteristic_t
-    server_characteristic;        // Characteristic of the server device
-static bool listener_registered;  // Flag to check if the listener is registered
-static gatt_client_notification_t
-    notification_listener;                // Listener for notifications
-static btstack_timer_source_t heartbeat;  // Timer source for the heartbeat
+    hci_event_callback_registration;  // Callback registration for HCI events
+static bool client_running;           // HCI is up
+static bool scanning;                 // Scan is enabled
+static nxmic_link_t links[NXMIC_MAX_LINKS];  // Connection table
+static nxmic_link_t *connecting_link;  // Link waiting for connection complete
+static btstack_timer_source_t connect_timer;  // Gives up on a silent peer
+static btstack_timer_source_t heartbeat;      // Timer source for the heartbeat
+static reconnect_latency_t cold_latency, cached_latency;
+static reconnect_latency_t accept_list_latency, discovery_latency;
+static btstack_timer_source_t scan_timer;  // Ends a discovery window
+static gatt_cache_known_t known_sensors;   // Persisted, most recent first
+static uint32_t accept_list_synced;   // Known sensors in the accept list
+static bool accept_list_stale;        // known_sensors changed since
+static bool discovery_turn;           // Scan next, even with sensors away
+static uint32_t scan_trigger_ms;      // Last boot or disconnect
+static const scan_profile_t *scan_profile;  // Of the running scan
+// When each recently lost sensor went away, to time its reconnect
+typedef struct {
+  bool used;
+  bd_addr_t addr;
+  uint32_t lost_ms;
+} outage_t;
+static outage_t outages[NXMIC_MAX_LINKS];
+
+// A sensor heard by the observer
+typedef struct {
+  bd_addr_t addr;
+  nxmic_adv_reading_t reading;  // Last one heard
+  int8_t rssi;
+  uint32_t reports;  // Advertisements with a broadcast
+  uint32_t updates;  // New sequences
+  uint32_t missed;   // Sequences skipped between two updates
+  uint32_t heard_ms;
+} observed_sensor_t;
+
+static observed_sensor_t observed[OBSERVER_MAX_SENSORS];
+static int observed_count;
+static uint32_t observer_unlisted;  // Broadcasts from sensors past the table
+static uint32_t last_report_ms;
+static export_session_t export_sessions[NXMIC_MAX_LINKS];
+// Main loop copies of links[].reader.timesync, taken under the async
+// context lock
+static nxmic_timesync_t clock_snapshots[NXMIC_MAX_LINKS];
+// Main loop copies of links[].connection, taken with the clocks
+static uint32_t connection_snapshots[NXMIC_MAX_LINKS];
+static link_accounting_t accounting[NXMIC_MAX_LINKS];
+static uint32_t stale_notifications;  // Queued before their link was reset
+#if NXMIC_GATEWAY
+// Main loop, with the lwIP lock held; acks come in from the async context
+static nxmic_gateway_t gateway;
+#endif
+
+static spsc_ring_t notification_ring;
+static uint8_t notification_ring_storage[SPSC_RING_STORAGE_SIZE(
+    NOTIFICATION_RING_SLOTS,
+    sizeof(nxmic_reader_record_t) + NOTIFICATION_MAX_VALUE)];
+
+static const uint8_t cccd_enable_notifications[] = {
+    GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_NOTIFICATION, 0x00};
+
+static const char *const stream_names[CHAR_COUNT] = {
+    [CHAR_IMU_STREAMING] = "imu",
+    [CHAR_TEMPERATURE_STREAMING] = "temp",
+    [CHAR_STETHOSCOPE_STREAMING] = "steth",
+    [CHAR_STETHOSCOPE_PREVIEW_STREAMING] = "steth-preview",
+    [CHAR_ECG_STREAMING] = "ecg",
+    [CHAR_DATA_EXPORT] = "export",
+};
+
+static void handle_gatt_client_event(uint8_t packet_type, uint16_t channel,
+                                     uint8_t *packet, uint16_t size);
+static void export_channel_handler(uint8_t packet_type, uint16_t channel,
+                                   uint8_t *packet, uint16_t size);
+
+static nxmic_link_t *link_for_con_handle(hci_con_handle_t con_handle) {
+  for (int i = 0; i < NXMIC_MAX_LINKS; i++) {
+    if (links[i].state > TC_W4_CONNECT && links[i].con_handle == con_handle)
+      return &links[i];
+  }
+  return NULL;
+}
+
+static nxmic_link_t *link_for_addr(const bd_addr_t addr) {
+  for (int i = 0; i < NXMIC_MAX_LINKS; i++) {
+    if (links[i].state >= TC_W4_CONNECT &&
+        bd_addr_cmp(links[i].addr, addr) == 0)
+      return &links[i];
+  }
+  return NULL;
+}
+
+static nxmic_link_t *free_link(void) {
+  for (int i = 0; i < NXMIC_MAX_LINKS; i++) {
+    if (links[i].state == TC_IDLE) return &links[i];
+  }
+  return NULL;
+}
+
+static int link_index(const nxmic_link_t *link) { return (int)(link - links); }
+
+static const scan_profile_t *current_scan_profile(void) {
+  uint32_t elapsed = btstack_run_loop_get_time_ms() - scan_trigger_ms;
+  const scan_profile_t *profile = &scan_profiles[0];
+  for (unsigned i = 1; i < SCAN_PROFILE_COUNT; i++) {
+    if (elapsed >= scan_profiles[i].after_ms) profile = &scan_profiles[i];
+  }
+  return profile;
+}
+
+// Known sensors not connected, as a mask of known_sensors indices
+static uint32_t absent_known_sensors(void) {
+  uint32_t absent = 0;
+  for (int i = 0; i < known_sensors.count; i++) {
+    if (!link_for_addr(known_sensors.addrs[i])) absent |= 1u << i;
+  }
+  return absent;
+}
+
+// Put the absent known sensors in the controller's accept list, only
+// touching it when that set changed. Returns how many there are.
+static int sync_accept_list(void) {
+  uint32_t absent = absent_known_sensors();
+  if (absent != accept_list_synced || accept_list_stale) {
+    gap_whitelist_clear();
+    for (int i = 0; i < known_sensors.count; i++) {
+      if (absent & (1u << i))
+        gap_whitelist_add((bd_addr_type_t)known_sensors.addr_types[i],
+                          known_sensors.addrs[i]);
+    }
+    accept_list_synced = absent;
+    accept_list_stale = false;
+  }
+  return __builtin_popcount(absent);
+}
+
+// Sensors bonded through the Security Manager count as known too
+static void load_known_sensors(void) {
+  gatt_cache_known_load(&known_sensors);
+  for (int i = 0; i < le_device_db_max_count(); i++) {
+    int addr_type = BD_ADDR_TYPE_UNKNOWN;
+    bd_addr_t addr;
+    le_device_db_info(i, &addr_type, addr, NULL);
+    if (addr_type == BD_ADDR_TYPE_UNKNOWN) continue;
+    bool listed = false;
+    for (int k = 0; k < known_sensors.count; k++) {
+      if (bd_addr_cmp(known_sensors.addrs[k], addr) == 0) listed = true;
+    }
+    if (!listed && known_sensors.count < GATT_CACHE_KNOWN_MAX) {
+      bd_addr_copy(known_sensors.addrs[known_sensors.count], addr);
+      known_sensors.addr_types[known_sensors.count++] = (uint8_t)addr_type;
+    }
+  }
+  accept_list_stale = true;
+  printf("%d known sensors\n", known_sensors.count);
+}
 
 static void client_start(void) {
-  DEBUG_LOG("Start scanning!\n");
-  state = TC_W4_SCAN_RESULT;
-  gap_set_scan_parameters(0, 0x0030, 0x0030);
+  // keep looking as long as there is a free slot and no pending connect
+  if (!client_running || scanning || connecting_link) return;
+  nxmic_link_t *link = free_link();
+  if (!link) return;
+  if (NXMIC_OBSERVER) {
+    // listen all the time, and to every repeat: the data changes, the
+    // address does not
+    scanning = true;
+    gap_set_scan_duplicate_filter(false);
+    gap_set_scan_parameters(0, scan_profiles[0].interval,
+                            scan_profiles[0].window);
+    gap_start_scan();
+    return;
+  }
+  const scan_profile_t *profile = current_scan_profile();
+  if (!discovery_turn && sync_accept_list() > 0) {
+    // the controller connects to the first of them it hears, no reports
+    DEBUG_LOG("Connect to known sensors, %s scan\n", profile->name);
+    link->state = TC_W4_CONNECT;
+    link->via_accept_list = true;
+    connecting_link = link;
+    link_profile_set_initiator_scan(profile->interval, profile->window);
+    gap_connect_with_whitelist();
+    btstack_run_loop_set_timer(&connect_timer, ACCEPT_LIST_WINDOW_MS);
+    btstack_run_loop_add_timer(&connect_timer);
+    return;
+  }
+  DEBUG_LOG("Start scanning, %s!\n", profile->name);
+  scanning = true;
+  scan_profile = profile;
+  gap_set_scan_parameters(0, profile->interval, profile->window);
   gap_start_scan();
+  btstack_run_loop_set_timer(&scan_timer, DISCOVERY_WINDOW_MS);
+  btstack_run_loop_add_timer(&scan_timer);
 }
 
-static bool advertisement_report_contains_service(
-    uint16_t service, uint8_t *advertisement_report) {
-  // get advertisement from report event
-  const uint8_t *adv_data =
-      gap_event_advertising_report_get_data(advertisement_report);
-  uint8_t adv_len =
-      gap_event_advertising_report_get_data_length(advertisement_report);
-
-  // iterate over advertisement data
-  ad_context_t context;
-  for (ad_iterator_init(&context, adv_len, adv_data);
-       ad_iterator_has_more(&context); ad_iterator_next(&context)) {
-    uint8_t data_type = ad_iterator_get_data_type(&context);
-    uint8_t data_size = ad_iterator_get_data_len(&context);
-    const uint8_t *data = ad_iterator_get_data(&context);
-    switch (data_type) {
-      case BLUETOOTH_DATA_TYPE_COMPLETE_LIST_OF_16_BIT_SERVICE_CLASS_UUIDS:
-        for (int i = 0; i < data_size; i += 2) {
-          uint16_t type = little_endian_read_16(data, i);
-          if (type == service) return true;
-        }
+static void stop_scan(void) {
+  scanning = false;
+  btstack_run_loop_remove_timer(&scan_timer);
+  gap_stop_scan();
+}
+
+// End of a discovery window: back to the accept list if a known sensor is
+// away, or a step down in duty cycle
+static void scan_timeout_handler(struct btstack_timer_source *ts) {
+  if (!scanning) return;
+  if (absent_known_sensors() == 0 && current_scan_profile() == scan_profile) {
+    btstack_run_loop_set_timer(ts, DISCOVERY_WINDOW_MS);
+    btstack_run_loop_add_timer(ts);
+    return;
+  }
+  stop_scan();
+  discovery_turn = false;
+  client_start();
+}
+
+// Runs in BTstack context: only copy the value into the ring, all decoding
+// and printing happens in process_notifications()
+static void queue_notification(void *context, gatt_characteristic_id_t char_id,
+                               const uint8_t *value, uint16_t value_length) {
+  NXMIC_PROBE_SCOPE(NXMIC_PROBE_NOTIFICATION);
+  nxmic_link_t *link = (nxmic_link_t *)context;
+  nxmic_reader_record_t record = {
+      .link = (uint8_t)link_index(link),
+      .char_id = (uint8_t)char_id,
+      .arrival_us = time_us_32(),
+      .connection = link->connection,
+  };
+  // a full ring is counted as an overflow by the ring
+  nxmic_reader_queue(&notification_ring, &record, value, value_length);
+}
+
+// Only the frame base carries a sensor timestamp; once the sensor clock is
+// fitted every sample gets its own time on the reader's clock
+static void handle_temperature_stream(int link,
+                                      const nxmic_frame_header_t *frame,
+                                      const int16_t *samples, int count) {
+  const nxmic_timesync_t *clock = &clock_snapshots[link];
+  for (int i = 0; i < count; i++) {
+    int centi = samples[i];
+    char sign = centi < 0 ? '-' : '+';
+    if (!clock->valid) {
+      NXMIC_LOG_INFO(
+          "[%d] read temp %c%d.%02d degc (frame %u @ %lu us sensor time)\n",
+          link, sign, abs(centi) / 100, abs(centi) % 100, frame->sequence,
+          frame->base_timestamp_us);
+      continue;
+    }
+    NXMIC_LOG_INFO("[%d] read temp %c%d.%02d degc (frame %u @ %lu us +/-%lu)\n",
+                   link, sign, abs(centi) / 100, abs(centi) % 100,
+                   frame->sequence,
+                   nxmic_timesync_sample_time(clock, frame->base_timestamp_us,
+                                              (uint32_t)i,
+                                              TEMP_SAMPLE_PERIOD_NS),
+                   clock->error_us);
+  }
+}
+
+// Done with the first count slots. The gateway holds on to them until
+// their datagram is sent; returns how many are still in the ring.
+static uint32_t release_notifications(uint32_t count) {
+#if NXMIC_GATEWAY
+  cyw43_arch_lwip_begin();
+  uint32_t released = nxmic_gateway_service(&gateway, &notification_ring,
+                                            count, time_us_32());
+  cyw43_arch_lwip_end();
+  return count - released;
+#else
+  spsc_ring_release(&notification_ring, count);
+  return 0;
+#endif
+}
+
+// Main loop: the first record of a new connection of link l
+static void reset_accounting(int l, uint32_t connection) {
+  link_accounting_t *account = &accounting[l];
+  account->connection = connection;
+  for (int i = 0; i < CHAR_COUNT; i++) nxmic_gap_init(&account->gaps[i]);
+#if NXMIC_BENCHMARK
+  nxmic_bench_init(&account->bench, false);
+  nxmic_bench_set_clock(&account->bench, &clock_snapshots[l]);
+#endif
+}
+
+// Main loop consumer: decode everything the callback queued in one batch,
+// first_new skips slots decoded on an earlier pass but not released yet
+static uint32_t process_notifications(void) {
+  NXMIC_PROBE_SCOPE(NXMIC_PROBE_DECODE_BATCH);
+  static int16_t decoded[NXMIC_CODEC_MAX_SAMPLES];
+  static uint32_t first_new;
+  uint32_t count = spsc_ring_available(&notification_ring);
+  uint32_t new_count = count - first_new;
+  if (new_count == 0) {
+    first_new = release_notifications(count);  // flush deadlines
+    return 0;
+  }
+  // sync rounds refit the clocks and disconnects reset the links in
+  // BTstack context; every record counted was queued before the snapshot
+  async_context_t *context = cyw43_arch_async_context();
+  async_context_acquire_lock_blocking(context);
+  for (int l = 0; l < NXMIC_MAX_LINKS; l++) {
+    clock_snapshots[l] = links[l].reader.timesync;
+    connection_snapshots[l] = links[l].connection;
+  }
+  async_context_release_lock(context);
+  for (uint32_t i = first_new; i < count; i++) {
+    nxmic_reader_record_t record;
+    nxmic_frame_header_t frame;
+    const uint8_t *payload;
+    uint16_t payload_length;
+    bool parsed = nxmic_reader_peek(&notification_ring, i, &record, &frame,
+                                    &payload, &payload_length);
+    if (record.connection != connection_snapshots[record.link]) {
+      stale_notifications++;
+      continue;
+    }
+    link_accounting_t *account = &accounting[record.link];
+    if (account->connection != record.connection)
+      reset_accounting(record.link, record.connection);
+    if (!parsed) {
+      NXMIC_LOG_WARN("[%d] Unexpected length %d\n", record.link,
+                     record.length);
+      continue;
+    }
+#if NXMIC_BENCHMARK
+    // the benchmark stream carries filler, only its timing matters
+    nxmic_bench_record(&account->bench, &frame, record.length,
+                       payload_length, record.arrival_us);
+    continue;
+#endif
+    nxmic_gap_tracker_t *gaps = &account->gaps[record.char_id];
+    if (!nxmic_gap_on_frame(gaps, frame.sequence)) continue;  // duplicate
+    int sample_count = nxmic_codec_decode(&frame, payload, payload_length,
+                                          decoded, NXMIC_CODEC_MAX_SAMPLES);
+    if (sample_count < 0) {
+      NXMIC_LOG_WARN("[%d] Corrupt frame %u of stream %u (codec %u)\n",
+                     record.link, frame.sequence, record.char_id,
+                     frame.codec);
+      continue;
+    }
+    switch (record.char_id) {
+      case CHAR_TEMPERATURE_STREAMING:
+        handle_temperature_stream(record.link, &frame, decoded,
+                                  sample_count);
+        break;
       default:
+        DEBUG_LOG("[%d] %s: frame %u, %d samples in %u bytes\n", record.link,
+                  stream_names[record.char_id], frame.sequence, sample_count,
+                  payload_length);
         break;
     }
   }
-  return false;
+  first_new = release_notifications(count);
+  return new_count;
+}
+
+// Ask the sensors for frames that went missing. Runs in the main loop, so
+// BTstack is only called with the async context lock held.
+static void request_missing_frames(void) {
+  uint32_t now = time_us_32();
+  for (int l = 0; l < NXMIC_MAX_LINKS; l++) {
+    nxmic_link_t *link = &links[l];
+    link_accounting_t *account = &accounting[l];
+    for (int i = 0; i < CHAR_COUNT; i++) {
+      if (account->gaps[i].missing_count == 0) continue;
+      async_context_t *context = cyw43_arch_async_context();
+      async_context_acquire_lock_blocking(context);
+      // the frames of an earlier connection are not asked of this one
+      if (link->connection == account->connection)
+        nxmic_reader_request_frames(&link->reader,
+                                    (gatt_characteristic_id_t)i,
+                                    &account->gaps[i], now);
+      async_context_release_lock(context);
+    }
+  }
+}
+
+static void report_export(int l, const export_session_t *session) {
+  const nxmic_export_receiver_t *rx = &session->receiver;
+  uint32_t elapsed_ms = btstack_run_loop_get_time_ms() - session->started_ms;
+  printf("[%d] export %s over %s: %lu bytes in %lu ms (%lu kB/min), "
+         "%lu restarts, %lu chunk CRC errors\n",
+         l, rx->state == NXMIC_EXPORT_DONE ? "done, CRC ok" : "CRC MISMATCH",
+         rx->transport == NXMIC_EXPORT_TRANSPORT_L2CAP ? "L2CAP"
+                                                       : "notifications",
+         (unsigned long)rx->bytes, (unsigned long)elapsed_ms,
+         (unsigned long)(elapsed_ms ? (uint64_t)rx->bytes * 60 / elapsed_ms
+                                    : 0),
+         (unsigned long)rx->restarts, (unsigned long)rx->crc_errors);
+}
+
+// Drive the recording offloads: START and credit grants go out from the main
+// loop with the async context lock held, chunks arrive in BTstack context.
+// A request that does not go out is caught by the receiver's stall timeout.
+static void run_exports(void) {
+  uint32_t now = time_us_32();
+  for (int l = 0; l < NXMIC_MAX_LINKS; l++) {
+    nxmic_link_t *link = &links[l];
+    if (!link->export_session) continue;
+    async_context_t *context = cyw43_arch_async_context();
+    async_context_acquire_lock_blocking(context);
+    export_session_t *session = link->export_session;
+    if (nxmic_reader_ready(&link->reader) && session) {
+      nxmic_reader_request_export(&link->reader, now);
+      if (session->receiver.state != NXMIC_EXPORT_RUNNING &&
+          !session->reported) {
+        session->reported = true;
+        report_export(l, session);
+      }
+    }
+    async_context_release_lock(context);
+  }
+}
+
+#if !NXMIC_BENCHMARK
+// Main loop side of the stream stats: the gap trackers are only touched
+// here, report_stream_stats() has the rest in BTstack context
+static void report_losses(void) {
+  static uint32_t last_report_us;
+  uint32_t now = time_us_32();
+  if (now - last_report_us < STATS_REPORT_PERIOD_MS * 1000) return;
+  last_report_us = now;
+  for (int l = 0; l < NXMIC_MAX_LINKS; l++) {
+    if (!links[l].listener_registered) continue;
+    for (int i = 0; i < CHAR_COUNT; i++) {
+      if (!nxmic_stream_is_streaming((gatt_characteristic_id_t)i)) continue;
+      const nxmic_gap_tracker_t *gaps = &accounting[l].gaps[i];
+      printf("[%d] %-14s %lu lost frames (%lu recovered, "
+             "%lu unrecoverable)\n",
+             l, stream_names[i], (unsigned long)gaps->gaps,
+             (unsigned long)gaps->recovered,
+             (unsigned long)gaps->unrecoverable);
+    }
+  }
+}
+#endif
+
+#if NXMIC_BENCHMARK
+// Main loop side of the benchmark: the histograms are only touched here
+static void report_benchmark(void) {
+  static uint32_t last_report_us;
+  uint32_t now = time_us_32();
+  if (now - last_report_us < STATS_REPORT_PERIOD_MS * 1000) return;
+  last_report_us = now;
+  for (int i = 0; i < NXMIC_MAX_LINKS; i++) {
+    if (!links[i].listener_registered) continue;
+    char label[8];
+    snprintf(label, sizeof(label), "[%d]", i);
+    nxmic_bench_report(&accounting[i].bench, label, now);
+  }
+}
+#endif
+
+// The sensor can send its recording
+static bool exports_recording(const nxmic_link_t *link) {
+  return nxmic_reader_characteristic(&link->reader, CHAR_DATA_EXPORT)
+             ->properties &
+         ATT_PROPERTY_NOTIFY;
+}
+
+// Offload the sensor's recording once per boot of the reader, picking up an
+// interrupted transfer where it stopped
+static void start_export(nxmic_link_t *link) {
+  if (!exports_recording(link)) return;
+  export_session_t *session = NULL;
+  for (int i = 0; i < NXMIC_MAX_LINKS && !session; i++) {
+    if (export_sessions[i].used &&
+        bd_addr_cmp(export_sessions[i].addr, link->addr) == 0)
+      session = &export_sessions[i];
+  }
+  if (session) {
+    nxmic_export_receiver_resume(&session->receiver);
+  } else {
+    // a free slot, or one whose transfer is over
+    for (int i = 0; i < NXMIC_MAX_LINKS && !session; i++) {
+      if (!export_sessions[i].used ||
+          export_sessions[i].receiver.state != NXMIC_EXPORT_RUNNING)
+        session = &export_sessions[i];
+    }
+    if (!session) return;
+    memset(session, 0, sizeof(*session));
+    session->used = true;
+    bd_addr_copy(session->addr, link->addr);
+    session->started_ms = btstack_run_loop_get_time_ms();
+    nxmic_export_receiver_init(&session->receiver, NULL, NULL);
+    nxmic_export_receiver_begin(&session->receiver, 0, NXMIC_EXPORT_TO_END);
+  }
+  // the first START waits for the channel, so chunks do not switch path
+  // mid-transfer; a sensor without it refuses and notifications are used
+  uint8_t status = l2cap_cbm_create_channel(
+      &export_channel_handler, link->con_handle, NXMIC_EXPORT_PSM,
+      link->export_sdu, sizeof(link->export_sdu), L2CAP_LE_AUTOMATIC_CREDITS,
+      LEVEL_0, &link->export_cid);
+  if (status == ERROR_CODE_SUCCESS) {
+    link->export_pending = session;
+    return;
+  }
+  link->export_cid = 0;
+  session->receiver.transport = NXMIC_EXPORT_TRANSPORT_GATT;
+  link->export_session = session;
+  link->reader.export = &session->receiver;
+}
+
+static nxmic_link_t *link_for_export_cid(uint16_t cid) {
+  for (int i = 0; i < NXMIC_MAX_LINKS; i++) {
+    if (cid && links[i].export_cid == cid) return &links[i];
+  }
+  return NULL;
+}
+
+// Export chunks as SDUs, and the channel's own events. Runs in BTstack
+// context like the notification path.
+static void export_channel_handler(uint8_t packet_type, uint16_t channel,
+                                   uint8_t *packet, uint16_t size) {
+  nxmic_link_t *link;
+  if (packet_type == L2CAP_DATA_PACKET) {
+    link = link_for_export_cid(channel);
+    if (link && link->export_session)
+      nxmic_export_receiver_on_notification(&link->export_session->receiver,
+                                            packet, size, time_us_32());
+    return;
+  }
+  if (packet_type != HCI_EVENT_PACKET) return;
+  switch (hci_event_packet_get_type(packet)) {
+    case L2CAP_EVENT_CBM_CHANNEL_OPENED: {
+      link = link_for_export_cid(
+          l2cap_event_cbm_channel_opened_get_local_cid(packet));
+      if (!link || !link->export_pending) break;
+      export_session_t *session = link->export_pending;
+      link->export_pending = NULL;
+      if (l2cap_event_cbm_channel_opened_get_status(packet) ==
+          ERROR_CODE_SUCCESS) {
+        session->receiver.transport = NXMIC_EXPORT_TRANSPORT_L2CAP;
+      } else {
+        link->export_cid = 0;
+        session->receiver.transport = NXMIC_EXPORT_TRANSPORT_GATT;
+      }
+      DEBUG_LOG("[%d] Export over %s.\n", link_index(link),
+                link->export_cid ? "L2CAP" : "notifications");
+      link->export_session = session;
+      link->reader.export = &session->receiver;
+      break;
+    }
+    case L2CAP_EVENT_CHANNEL_CLOSED:
+      link = link_for_export_cid(
+          l2cap_event_channel_closed_get_local_cid(packet));
+      if (!link) break;
+      link->export_cid = 0;
+      // closed under a live connection: carry on with notifications
+      if (link->export_session &&
+          link->export_session->receiver.transport ==
+              NXMIC_EXPORT_TRANSPORT_L2CAP) {
+        link->export_session->receiver.transport = NXMIC_EXPORT_TRANSPORT_GATT;
+        nxmic_export_receiver_resume(&link->export_session->receiver);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+// All GATT client events carry the connection handle right after the
+// event header
+static hci_con_handle_t gatt_event_get_con_handle(const uint8_t *packet) {
+  return little_endian_read_16(packet, 2);
 }
 
+static void add_latency(reconnect_latency_t *latency, uint32_t elapsed) {
+  latency->count++;
+  latency->total_ms += elapsed;
+  if (elapsed > latency->max_ms) latency->max_ms = elapsed;
+}
+
+static void print_latency(const char *name, const reconnect_latency_t *latency,
+                          const char *separator) {
+  printf("%s: n=%lu avg=%lu max=%lu ms%s", name,
+         (unsigned long)latency->count,
+         (unsigned long)(latency->count ? latency->total_ms / latency->count
+                                        : 0),
+         (unsigned long)latency->max_ms, separator);
+}
+
+static void record_reconnect_latency(nxmic_link_t *link) {
+  uint32_t now = btstack_run_loop_get_time_ms();
+  uint32_t elapsed = now - link->connect_time_ms;
+  add_latency(link->reader.cached ? &cached_latency : &cold_latency,
+              elapsed);
+  printf("[%d] Streams enabled %lu ms after connect (%s discovery)\n",
+         link_index(link), (unsigned long)elapsed,
+         link->reader.cached ? "cached" : "cold");
+  printf("reconnect ");
+  print_latency("cold", &cold_latency, ", ");
+  print_latency("cached", &cached_latency, "\n");
+  if (!link->reconnect) return;
+  // the whole outage, as the sensor's user sees it
+  add_latency(link->via_accept_list ? &accept_list_latency
+                                    : &discovery_latency,
+              now - link->lost_ms);
+  printf("disconnect to streams ");
+  print_latency("accept list", &accept_list_latency, ", ");
+  print_latency("scan", &discovery_latency, "\n");
+}
+
+// Links start on the fast profile and follow the rate their streams deliver
+// once notifications are on: one that only receives slow streams does not
+// need it, whatever the sensor's table lists. The host simulator checks the
+// same choice.
+static void start_profile_window(nxmic_link_t *link) {
+  link->profile_window_ms = btstack_run_loop_get_time_ms();
+  link->profile_window_bytes = nxmic_stream_total_bytes(&link->reader.streams);
+}
+
+static void select_link_profile(nxmic_link_t *link, uint32_t now) {
+  uint32_t period_ms = now - link->profile_window_ms;
+  if (period_ms < LINK_PROFILE_WINDOW_MS) return;
+  const link_params_t *params = link_profile_get_params(link->con_handle);
+  if (!params) return;
+  uint32_t bytes = nxmic_stream_total_bytes(&link->reader.streams);
+  bool low_power = params->profile == LINK_PROFILE_LOW_POWER;
+  bool fits = nxmic_stream_fits_low_power(
+      bytes - link->profile_window_bytes, period_ms, low_power);
+  if (fits != low_power) {
+    link_profile_set(link->con_handle, fits ? LINK_PROFILE_LOW_POWER
+                                            : LINK_PROFILE_HIGH_THROUGHPUT);
+  }
+  link->profile_window_ms = now;
+  link->profile_window_bytes = bytes;
+}
+
+static void register_listener(nxmic_link_t *link) {
+  // register one handler for all notifications on this connection
+  link->listener_registered = true;
+  gatt_client_listen_for_characteristic_value_updates(
+      &link->notification_listener, handle_gatt_client_event,
+      link->con_handle, NULL);
+}
+
+// The reader's procedures on BTstack's GATT client, all in BTstack context.
+// Their results come back through handle_gatt_client_event().
+static bool reader_read_database_hash(void *context) {
+  nxmic_link_t *link = (nxmic_link_t *)context;
+  return gatt_client_read_value_of_characteristics_by_uuid16(
+             handle_gatt_client_event, link->con_handle, 0x0001, 0xffff,
+             ORG_BLUETOOTH_CHARACTERISTIC_DATABASE_HASH) ==
+         ERROR_CODE_SUCCESS;
+}
+
+static bool reader_discover_service(void *context, const uint8_t *uuid128) {
+  nxmic_link_t *link = (nxmic_link_t *)context;
+  DEBUG_LOG("[%d] Search for NxMic service.\n", link_index(link));
+  return gatt_client_discover_primary_services_by_uuid128(
+             handle_gatt_client_event, link->con_handle, uuid128) ==
+         ERROR_CODE_SUCCESS;
+}
+
+static bool reader_discover_characteristics(void *context,
+                                            uint16_t start_handle,
+                                            uint16_t end_handle) {
+  nxmic_link_t *link = (nxmic_link_t *)context;
+  // the GATT client only takes the range of the service
+  gatt_client_service_t service = {.start_group_handle = start_handle,
+                                   .end_group_handle = end_handle};
+  return gatt_client_discover_characteristics_for_service(
+             handle_gatt_client_event, link->con_handle, &service) ==
+         ERROR_CODE_SUCCESS;
+}
+
+static bool reader_read_cccds(void *context, uint16_t start_handle,
+                              uint16_t end_handle) {
+  nxmic_link_t *link = (nxmic_link_t *)context;
+  return gatt_client_read_value_of_characteristics_by_uuid16(
+             handle_gatt_client_event, link->con_handle, start_handle,
+             end_handle, GATT_CLIENT_CHARACTERISTICS_CONFIGURATION) ==
+         ERROR_CODE_SUCCESS;
+}
+
+static bool reader_write_cccd(void *context,
+                              const nxmic_reader_characteristic_t *c) {
+  nxmic_link_t *link = (nxmic_link_t *)context;
+  if (c->cccd_handle != 0) {
+    return gatt_client_write_value_of_characteristic(
+               handle_gatt_client_event, link->con_handle, c->cccd_handle,
+               sizeof(cccd_enable_notifications),
+               (uint8_t *)cccd_enable_notifications) == ERROR_CODE_SUCCESS;
+  }
+  // the GATT client looks the CCCD up in the characteristic's range
+  gatt_client_characteristic_t characteristic = {
+      .start_handle = c->start_handle,
+      .value_handle = c->value_handle,
+      .end_handle = c->end_handle,
+      .properties = c->properties,
+  };
+  return gatt_client_write_client_characteristic_configuration(
+             handle_gatt_client_event, link->con_handle, &characteristic,
+             GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_NOTIFICATION) ==
+         ERROR_CODE_SUCCESS;
+}
+
+static bool reader_write(void *context, uint16_t value_handle,
+                         const uint8_t *value, uint16_t length) {
+  nxmic_link_t *link = (nxmic_link_t *)context;
+  return gatt_client_write_value_of_characteristic(
+             handle_gatt_client_event, link->con_handle, value_handle, length,
+             (uint8_t *)value) == ERROR_CODE_SUCCESS;
+}
+
+static bool reader_read(void *context, uint16_t value_handle) {
+  nxmic_link_t *link = (nxmic_link_t *)context;
+  return gatt_client_read_value_of_characteristic_using_value_handle(
+             handle_gatt_client_event, link->con_handle, value_handle) ==
+         ERROR_CODE_SUCCESS;
+}
+
+static bool reader_write_without_response(void *context,
+                                          uint16_t value_handle,
+                                          const uint8_t *value,
+                                          uint16_t length) {
+  nxmic_link_t *link = (nxmic_link_t *)context;
+  return gatt_client_write_value_of_characteristic_without_response(
+             link->con_handle, value_handle, length, (uint8_t *)value) ==
+         ERROR_CODE_SUCCESS;
+}
+
+// The reader has the peer's Database Hash by now; an entry stored under
+// another one is of no use again
+static bool reader_cache_load(void *context, nxmic_reader_handles_t *handles) {
+  nxmic_link_t *link = (nxmic_link_t *)context;
+  gatt_cache_entry_t entry;
+  if (!gatt_cache_load(link->addr, &entry)) return false;
+  if (memcmp(entry.handles.database_hash,
+             link->reader.handles.database_hash,
+             sizeof(entry.handles.database_hash)) != 0) {
+    DEBUG_LOG("Database hash changed, dropping cache\n");
+    gatt_cache_delete(link->addr);
+    return false;
+  }
+  *handles = entry.handles;
+  return true;
+}
+
+static void reader_cache_store(void *context,
+                               const nxmic_reader_handles_t *handles) {
+  nxmic_link_t *link = (nxmic_link_t *)context;
+  gatt_cache_entry_t entry;
+  memset(&entry, 0, sizeof(entry));
+  bd_addr_copy(entry.addr, link->addr);
+  entry.handles = *handles;
+  if (!gatt_cache_store(&entry)) printf("Failed to store GATT cache\n");
+}
+
+static void timesync_handler(struct btstack_timer_source *ts) {
+  nxmic_link_t *link = (nxmic_link_t *)btstack_run_loop_get_timer_context(ts);
+  nxmic_reader_sync_clock(&link->reader, time_us_32());
+}
+
+static void reader_schedule_timesync(void *context, uint32_t delay_ms) {
+  nxmic_link_t *link = (nxmic_link_t *)context;
+  btstack_run_loop_set_timer(&link->timesync_timer, delay_ms);
+  btstack_run_loop_add_timer(&link->timesync_timer);
+}
+
+static void reader_bound(void *context) {
+  nxmic_link_t *link = (nxmic_link_t *)context;
+  DEBUG_LOG("[%d] Handles bound (%s).\n", link_index(link),
+            link->reader.cached ? "cached" : "discovered");
+  register_listener(link);
+  start_profile_window(link);
+}
+
+static void reader_ready(void *context) {
+  nxmic_link_t *link = (nxmic_link_t *)context;
+  record_reconnect_latency(link);
+  start_export(link);
+}
+
+static void reader_failed(void *context) {
+  nxmic_link_t *link = (nxmic_link_t *)context;
+  printf("[%d] NxMic discovery failed.\n", link_index(link));
+  gap_disconnect(link->con_handle);
+}
+
+static const nxmic_reader_ops_t reader_ops = {
+    .read_database_hash = reader_read_database_hash,
+    .discover_service = reader_discover_service,
+    .discover_characteristics = reader_discover_characteristics,
+    .read_cccds = reader_read_cccds,
+    .write_cccd = reader_write_cccd,
+    .write = reader_write,
+    .read = reader_read,
+    .write_without_response = reader_write_without_response,
+    .cache_load = reader_cache_load,
+    .cache_store = reader_cache_store,
+    .schedule_timesync = reader_schedule_timesync,
+    .bound = reader_bound,
+    .ready = reader_ready,
+    .failed = reader_failed,
+};
+
 static void handle_gatt_client_event(uint8_t packet_type, uint16_t channel,
                                      uint8_t *packet, uint16_t size) {
+  NXMIC_PROBE_SCOPE(NXMIC_PROBE_GATT_CLIENT_EVENT);
   UNUSED(packet_type);
   UNUSED(channel);
   UNUSED(size);
 
-  uint8_t att_status;
-  switch (state) {
-    case TC_W4_SERVICE_RESULT:
-      switch (hci_event_packet_get_type(packet)) {
-        case GATT_EVENT_SERVICE_QUERY_RESULT:
-          // store service (we expect only one)
-          DEBUG_LOG("Storing service\n");
-          gatt_event_service_query_result_get_service(packet, &server_service);
-          break;
-        case GATT_EVENT_QUERY_COMPLETE:
-          att_status = gatt_event_query_complete_get_att_status(packet);
-          if (att_status != ATT_ERROR_SUCCESS) {
-            printf("SERVICE_QUERY_RESULT, ATT Error 0x%02x.\n", att_status);
-            gap_disconnect(connection_handle);
-            break;
-          }
-          // service query complete, look for characteristic
-          state = TC_W4_CHARACTERISTIC_RESULT;
-          DEBUG_LOG("Search for env sensing characteristic.\n");
-          gatt_client_discover_characteristics_for_service_by_uuid16(
-              handle_gatt_client_event, connection_handle, &server_service,
-              nxmic_gatt_service.uuid128);
-          break;
-        default:
-          break;
-      }
+  uint8_t event_type = hci_event_packet_get_type(packet);
+  nxmic_link_t *link = link_for_con_handle(gatt_event_get_con_handle(packet));
+  if (!link) return;
+
+  // Notifications are routed by value handle, whatever the discovery state
+  if (event_type == GATT_EVENT_NOTIFICATION) {
+    uint32_t start = time_us_32();
+    nxmic_reader_on_notification(
+        &link->reader, gatt_event_notification_get_value_handle(packet),
+        gatt_event_notification_get_value(packet),
+        gatt_event_notification_get_value_length(packet), start);
+    link->dispatch_us += time_us_32() - start;
+    return;
+  }
+
+  switch (event_type) {
+    case GATT_EVENT_SERVICE_QUERY_RESULT: {
+      gatt_client_service_t service;
+      gatt_event_service_query_result_get_service(packet, &service);
+      nxmic_reader_on_service(&link->reader, service.start_group_handle,
+                              service.end_group_handle);
       break;
-    case TC_W4_CHARACTERISTIC_RESULT:
-      switch (hci_event_packet_get_type(packet)) {
-        case GATT_EVENT_CHARACTERISTIC_QUERY_RESULT:
-          DEBUG_LOG("Storing characteristic\n");
-          gatt_event_characteristic_query_result_get_characteristic(
-              packet, &server_characteristic);
-          break;
-        case GATT_EVENT_QUERY_COMPLETE:
-          att_status = gatt_event_query_complete_get_att_status(packet);
-          if (att_status != ATT_ERROR_SUCCESS) {
-            printf("CHARACTERISTIC_QUERY_RESULT, ATT Error 0x%02x.\n",
-                   att_status);
-            gap_disconnect(connection_handle);
-            break;
-          }
-          // register handler for notifications
-          listener_registered = true;
-          gatt_client_listen_for_characteristic_value_updates(
-              &notification_listener, handle_gatt_client_event,
-              connection_handle, &server_characteristic);
-          // enable notifications
-          DEBUG_LOG("Enable notify on characteristic.\n");
-          state = TC_W4_ENABLE_NOTIFICATIONS_COMPLETE;
-          gatt_client_write_client_characteristic_configuration(
-              handle_gatt_client_event, connection_handle,
-              &server_characteristic,
-              GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_NOTIFICATION);
-          break;
-        default:
-          break;
-      }
+    }
+    case GATT_EVENT_CHARACTERISTIC_QUERY_RESULT: {
+      gatt_client_characteristic_t c;
+      gatt_event_characteristic_query_result_get_characteristic(packet, &c);
+      nxmic_reader_characteristic_t characteristic = {
+          .start_handle = c.start_handle,
+          .value_handle = c.value_handle,
+          .end_handle = c.end_handle,
+          .properties = c.properties,
+      };
+      nxmic_reader_on_characteristic(&link->reader, c.uuid128,
+                                     &characteristic);
       break;
-    case TC_W4_ENABLE_NOTIFICATIONS_COMPLETE:
-      switch (hci_event_packet_get_type(packet)) {
-        case GATT_EVENT_QUERY_COMPLETE:
-          DEBUG_LOG("Notifications enabled, ATT status 0x%02x\n",
-                    gatt_event_query_complete_get_att_status(packet));
-          if (gatt_event_query_complete_get_att_status(packet) !=
-              ATT_ERROR_SUCCESS)
-            break;
-          state = TC_W4_READY;
-          break;
-        default:
-          break;
-      }
+    }
+    case GATT_EVENT_CHARACTERISTIC_VALUE_QUERY_RESULT:
+      nxmic_reader_on_value(
+          &link->reader,
+          gatt_event_characteristic_value_query_result_get_value_handle(
+              packet),
+          gatt_event_characteristic_value_query_result_get_value(packet),
+          gatt_event_characteristic_value_query_result_get_value_length(
+              packet));
       break;
-    case TC_W4_READY:
-      switch (hci_event_packet_get_type(packet)) {
-        case GATT_EVENT_NOTIFICATION: {
-          uint16_t value_length =
-              gatt_event_notification_get_value_length(packet);
-          const uint8_t *value = gatt_event_notification_get_value(packet);
-          DEBUG_LOG("Indication value len %d\n", value_length);
-          if (value_length == 2) {
-            float temp = little_endian_read_16(value, 0);
-            printf("read temp %.2f degc\n", temp / 100);
-          } else {
-            printf("Unexpected length %d\n", value_length);
-          }
-          break;
-        }
-        default:
-          printf("Unknown packet type 0x%02x\n",
-                 hci_event_packet_get_type(packet));
-          break;
-      }
+    case GATT_EVENT_QUERY_COMPLETE:
+      nxmic_reader_on_complete(
+          &link->reader, gatt_event_query_complete_get_att_status(packet),
+          time_us_32());
       break;
     default:
-      printf("error\n");
       break;
   }
 }
 
+// Records the link queued from here on are told apart from those of the
+// connection before by link->connection
+static void reset_link(nxmic_link_t *link) {
+  btstack_run_loop_remove_timer(&link->timesync_timer);
+  uint32_t connection = link->connection;
+  memset(link, 0, sizeof(*link));
+  link->connection = connection + 1;
+  link->state = TC_IDLE;
+  link->con_handle = HCI_CON_HANDLE_INVALID;
+  link->timesync_timer.process = &timesync_handler;
+  btstack_run_loop_set_timer_context(&link->timesync_timer, link);
+  nxmic_reader_init(&link->reader, &reader_ops, link);
+}
+
+// Runs in BTstack context, for every advertisement heard
+static void observe(const uint8_t *report) {
+  const uint8_t *data = gap_event_advertising_report_get_data(report);
+  uint8_t length = gap_event_advertising_report_get_data_length(report);
+  nxmic_adv_reading_t reading;
+  if (!nxmic_adv_broadcast_decode(data, length, &reading)) return;
+  if (!nxmic_adv_has_service128(data, length, nxmic_gatt_service.uuid128))
+    return;
+
+  bd_addr_t addr;
+  gap_event_advertising_report_get_address(report, addr);
+  observed_sensor_t *sensor = NULL;
+  for (int i = 0; i < observed_count; i++) {
+    if (bd_addr_cmp(observed[i].addr, addr) == 0) sensor = &observed[i];
+  }
+  bool first = sensor == NULL;
+  if (first) {
+    if (observed_count == OBSERVER_MAX_SENSORS) {
+      observer_unlisted++;
+      return;
+    }
+    sensor = &observed[observed_count++];
+    bd_addr_copy(sensor->addr, addr);
+  }
+  sensor->reports++;
+  sensor->rssi = (int8_t)gap_event_advertising_report_get_rssi(report);
+  sensor->heard_ms = btstack_run_loop_get_time_ms();
+  if (!first && reading.sequence == sensor->reading.sequence) return;
+  if (!first)
+    sensor->missed += (uint8_t)(reading.sequence - sensor->reading.sequence - 1);
+  sensor->updates++;
+  sensor->reading = reading;
+  int16_t centi = reading.temperature;
+  NXMIC_LOG_INFO("[obs %d] temp %c%d.%02d degc, sequence %u\n",
+                 (int)(sensor - observed), centi < 0 ? '-' : '+',
+                 abs(centi) / 100, abs(centi) % 100, reading.sequence);
+}
+
+static void report_observer_stats(void) {
+  uint32_t now = btstack_run_loop_get_time_ms();
+  for (int i = 0; i < observed_count; i++) {
+    const observed_sensor_t *sensor = &observed[i];
+    int16_t centi = sensor->reading.temperature;
+    char battery[8] = "unknown";
+    if (sensor->reading.battery != NXMIC_ADV_BATTERY_UNKNOWN)
+      snprintf(battery, sizeof(battery), "%u%%", sensor->reading.battery);
+    printf("[obs %d] %s: %c%d.%02d degc, battery %s, sequence %u, %lu "
+           "advertisements, %lu updates, %lu missed, rssi %d, %lu ms ago\n",
+           i, bd_addr_to_str(sensor->addr), centi < 0 ? '-' : '+',
+           abs(centi) / 100, abs(centi) % 100, battery,
+           sensor->reading.sequence, (unsigned long)sensor->reports,
+           (unsigned long)sensor->updates, (unsigned long)sensor->missed,
+           sensor->rssi, (unsigned long)(now - sensor->heard_ms));
+  }
+  if (observer_unlisted)
+    printf("observer: %lu broadcasts from sensors past the first %d\n",
+           (unsigned long)observer_unlisted, OBSERVER_MAX_SENSORS);
+}
+
+static void report_stream_stats(void) {
+  uint32_t now = btstack_run_loop_get_time_ms();
+  uint32_t period_ms = now - last_report_ms;
+  last_report_ms = now;
+  if (period_ms == 0) return;
+
+  printf("notification ring: high water %lu/%d, overflows %lu, stale %lu\n",
+         (unsigned long)notification_ring.high_water, NOTIFICATION_RING_SLOTS,
+         (unsigned long)atomic_load(&notification_ring.overflows),
+         (unsigned long)stale_notifications);
+  nxmic_log_stats_t log_stats;
+  nxmic_log_get_stats(&log_stats);
+  printf("log: %lu records, %lu dropped\n", (unsigned long)log_stats.written,
+         (unsigned long)log_stats.dropped);
+  NXMIC_PROBE_REPORT();
+  NXMIC_PROBE_RESET();
+  report_observer_stats();
+#if NXMIC_GATEWAY
+  nxmic_gateway_report(&gateway, "udp", time_us_32());
+#endif
+
+  for (int l = 0; l < NXMIC_MAX_LINKS; l++) {
+    nxmic_link_t *link = &links[l];
+    if (!link->listener_registered) continue;
+    uint32_t notifications = 0;
+    uint32_t bytes = 0;
+    for (int i = 0; i < CHAR_COUNT; i++) {
+      if (!nxmic_stream_is_streaming((gatt_characteristic_id_t)i)) continue;
+      const nxmic_stream_stats_t *stats =
+          nxmic_stream_get_stats(&link->reader.streams,
+                                 (gatt_characteristic_id_t)i);
+      notifications += stats->notifications;
+      bytes += stats->bytes;
+      printf("[%d] %-14s handle 0x%04x: %lu notifications, %lu bytes\n", l,
+             stream_names[i],
+             nxmic_stream_value_handle(&link->reader.streams,
+                                       (gatt_characteristic_id_t)i),
+             (unsigned long)stats->notifications,
+             (unsigned long)stats->bytes);
+    }
+    // throughput over the last report period
+    uint32_t period_notifications = notifications - link->report_notifications;
+    uint32_t period_bytes = bytes - link->report_bytes;
+    link->report_notifications = notifications;
+    link->report_bytes = bytes;
+    printf("[%d] %s: %lu notif/s, %lu B/s, unrouted %lu, "
+           "dispatch %lu ns/notif\n",
+           l, bd_addr_to_str(link->addr),
+           (unsigned long)((uint64_t)period_notifications * 1000 / period_ms),
+           (unsigned long)((uint64_t)period_bytes * 1000 / period_ms),
+           (unsigned long)link->reader.streams.unrouted,
+           (unsigned long)(notifications ? (uint64_t)link->dispatch_us * 1000 /
+                                               notifications
+                                         : 0));
+    const nxmic_timesync_t *clock = &link->reader.timesync;
+    if (clock->valid) {
+      printf("[%d] clock sync: +/-%lu us, drift %ld ppb, %u of %lu rounds "
+             "fitted\n",
+             l, (unsigned long)clock->error_us, (long)clock->drift_ppb,
+             clock->used, (unsigned long)clock->total_rounds);
+    }
+    link_profile_print(link->con_handle);
+  }
+}
+
+static void connect_timeout_handler(struct btstack_timer_source *ts) {
+  UNUSED(ts);
+  if (!connecting_link) return;
+  // the controller reports the cancel as a failed connection complete
+  if (connecting_link->via_accept_list) {
+    DEBUG_LOG("No known sensor in range\n");
+    discovery_turn = true;
+  } else {
+    printf("Connect to %s timed out.\n",
+           bd_addr_to_str(connecting_link->addr));
+  }
+  gap_connect_cancel();
+}
+
+// Time the reconnect of a sensor seen going away
+static void match_outage(nxmic_link_t *link) {
+  for (int i = 0; i < NXMIC_MAX_LINKS; i++) {
+    outage_t *outage = &outages[i];
+    if (!outage->used || bd_addr_cmp(outage->addr, link->addr) != 0) continue;
+    outage->used = false;
+    link->reconnect = true;
+    link->lost_ms = outage->lost_ms;
+    printf("[%d] Reconnected %lu ms after the disconnect (%s)\n",
+           link_index(link),
+           (unsigned long)(link->connect_time_ms - outage->lost_ms),
+           link->via_accept_list ? "accept list" : "scan");
+    return;
+  }
+}
+
+static void record_outage(const nxmic_link_t *link, uint32_t now) {
+  outage_t *slot = &outages[0];
+  for (int i = 0; i < NXMIC_MAX_LINKS; i++) {
+    outage_t *outage = &outages[i];
+    if (!outage->used || bd_addr_cmp(outage->addr, link->addr) == 0) {
+      slot = outage;
+      break;
+    }
+    if (now - outage->lost_ms > now - slot->lost_ms) slot = outage;
+  }
+  slot->used = true;
+  bd_addr_copy(slot->addr, link->addr);
+  slot->lost_ms = now;
+}
+
+static void handle_connection_complete(uint8_t *packet) {
+  nxmic_link_t *link = connecting_link;
+  if (!link) return;
+  connecting_link = NULL;
+  btstack_run_loop_remove_timer(&connect_timer);
+
+  uint8_t status = hci_subevent_le_connection_complete_get_status(packet);
+  if (status != ERROR_CODE_SUCCESS) {
+    if (!link->via_accept_list)
+      printf("Connection to %s failed, status 0x%02x\n",
+             bd_addr_to_str(link->addr), status);
+    reset_link(link);
+    client_start();
+    return;
+  }
+
+  link->con_handle =
+      hci_subevent_le_connection_complete_get_connection_handle(packet);
+  link->connect_time_ms = btstack_run_loop_get_time_ms();
+  if (link->via_accept_list) {
+    hci_subevent_le_connection_complete_get_peer_address(packet, link->addr);
+    link->addr_type =
+        hci_subevent_le_connection_complete_get_peer_address_type(packet);
+    printf("[%d] Known sensor %s connected.\n", link_index(link),
+           bd_addr_to_str(link->addr));
+  }
+  match_outage(link);
+  if (gatt_cache_known_add(&known_sensors, link->addr, link->addr_type)) {
+    accept_list_stale = true;
+    if (!gatt_cache_known_store(&known_sensors))
+      printf("Failed to store known sensors\n");
+  }
+  // the Database Hash decides between cached handles and discovery
+  link->state = TC_CONNECTED;
+  nxmic_reader_connect(&link->reader);
+
+  // look for the next peripheral while this one is discovered
+  client_start();
+}
+
 static void hci_event_handler(uint8_t packet_type, uint16_t channel,
                               uint8_t *packet, uint16_t size) {
+  NXMIC_PROBE_SCOPE(NXMIC_PROBE_HCI_EVENT);
   UNUSED(size);
   UNUSED(channel);
   bd_addr_t local_addr;
+  bd_addr_t addr;
+  nxmic_link_t *link;
   if (packet_type != HCI_EVENT_PACKET) return;
 
   uint8_t event_type = hci_event_packet_get_type(packet);
@@ -202,56 +1279,85 @@ static void hci_event_handler(uint8_t packet_type, uint16_t channel,
       if (btstack_event_state_get_state(packet) == HCI_STATE_WORKING) {
         gap_local_bd_addr(local_addr);
         printf("BTstack up and running on %s.\n", bd_addr_to_str(local_addr));
+        client_running = true;
+        load_known_sensors();
+        scan_trigger_ms = btstack_run_loop_get_time_ms();
         client_start();
       } else {
-        state = TC_OFF;
+        client_running = false;
+        scanning = false;
+        connecting_link = NULL;
+        btstack_run_loop_remove_timer(&scan_timer);
+        btstack_run_loop_remove_timer(&connect_timer);
+        for (int i = 0; i < NXMIC_MAX_LINKS; i++) {
+          if (links[i].listener_registered)
+            gatt_client_stop_listening_for_characteristic_value_updates(
+                &links[i].notification_listener);
+          reset_link(&links[i]);
+        }
       }
       break;
     case GAP_EVENT_ADVERTISING_REPORT:
-      if (state != TC_W4_SCAN_RESULT) return;
-      // check name in advertisement
-      if (!advertisement_report_contains_service(
-              ORG_BLUETOOTH_SERVICE_ENVIRONMENTAL_SENSING, packet))
+      if (NXMIC_OBSERVER) {
+        observe(packet);
+        return;
+      }
+      if (!scanning || connecting_link) return;
+      // look for the NxMic service
+      if (!nxmic_adv_has_service128(
+              gap_event_advertising_report_get_data(packet),
+              gap_event_advertising_report_get_data_length(packet),
+              nxmic_gatt_service.uuid128))
         return;
+      gap_event_advertising_report_get_address(packet, addr);
+      if (link_for_addr(addr)) return;  // already connected
+      link = free_link();
+      if (!link) return;
       // store address and type
-      gap_event_advertising_report_get_address(packet, server_addr);
-      server_addr_type = gap_event_advertising_report_get_address_type(packet);
-      // stop scanning, and connect to the device
-      state = TC_W4_CONNECT;
-      gap_stop_scan();
-      printf("Connecting to device with addr %s.\n",
-             bd_addr_to_str(server_addr));
-      gap_connect(server_addr, server_addr_type);
+      bd_addr_copy(link->addr, addr);
+      link->addr_type = gap_event_advertising_report_get_address_type(packet);
+      // stop scanning, and connect to the device, it was just heard
+      link->state = TC_W4_CONNECT;
+      connecting_link = link;
+      stop_scan();
+      printf("[%d] Connecting to device with addr %s.\n", link_index(link),
+             bd_addr_to_str(link->addr));
+      link_profile_set_initiator_scan(scan_profiles[0].interval,
+                                      scan_profiles[0].window);
+      gap_connect(link->addr, link->addr_type);
+      btstack_run_loop_set_timer(&connect_timer, CONNECT_TIMEOUT_MS);
+      btstack_run_loop_add_timer(&connect_timer);
       break;
     case HCI_EVENT_LE_META:
       // wait for connection complete
       switch (hci_event_le_meta_get_subevent_code(packet)) {
         case HCI_SUBEVENT_LE_CONNECTION_COMPLETE:
-          if (state != TC_W4_CONNECT) return;
-          connection_handle =
-              hci_subevent_le_connection_complete_get_connection_handle(packet);
-          // initialize gatt client context with handle, and add it to the list
-          // of active clients query primary services
-          DEBUG_LOG("Search for env sensing service.\n");
-          state = TC_W4_SERVICE_RESULT;
-          gatt_client_discover_primary_services_by_uuid16(
-              handle_gatt_client_event, connection_handle,
-              ORG_BLUETOOTH_SERVICE_ENVIRONMENTAL_SENSING);
+          handle_connection_complete(packet);
           break;
         default:
           break;
       }
       break;
     case HCI_EVENT_DISCONNECTION_COMPLETE:
+      link = link_for_con_handle(
+          hci_event_disconnection_complete_get_connection_handle(packet));
+      if (!link) break;
       // unregister listener
-      connection_handle = HCI_CON_HANDLE_INVALID;
-      if (listener_registered) {
-        listener_registered = false;
+      if (link->listener_registered) {
+        link->listener_registered = false;
         gatt_client_stop_listening_for_characteristic_value_updates(
-            &notification_listener);
+            &link->notification_listener);
+      }
+      printf("[%d] Disconnected %s\n", link_index(link),
+             bd_addr_to_str(link->addr));
+      scan_trigger_ms = btstack_run_loop_get_time_ms();
+      record_outage(link, scan_trigger_ms);
+      reset_link(link);
+      // a scan in progress would keep its slower profile
+      if (scanning) {
+        stop_scan();
+        discovery_turn = false;
       }
-      printf("Disconnected %s\n", bd_addr_to_str(server_addr));
-      if (state == TC_OFF) break;
       client_start();
       break;
     default:
@@ -264,11 +1370,24 @@ static void heartbeat_handler(struct btstack_timer_source *ts) {
   static bool quick_flash;
   static bool led_on = true;
 
+  uint32_t now = btstack_run_loop_get_time_ms();
+  bool any_connected = false;
+  for (int i = 0; i < NXMIC_MAX_LINKS; i++) {
+    if (links[i].listener_registered) any_connected = true;
+    if (nxmic_reader_ready(&links[i].reader))
+      select_link_profile(&links[i], now);
+  }
+
+  if ((any_connected || NXMIC_OBSERVER) &&
+      now - last_report_ms >= STATS_REPORT_PERIOD_MS) {
+    report_stream_stats();
+  }
+
   led_on = !led_on;
   cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, led_on);
-  if (listener_registered && led_on) {
+  if (any_connected && led_on) {
     quick_flash = !quick_flash;
-  } else if (!listener_registered) {
+  } else if (!any_connected) {
     quick_flash = false;
   }
 
@@ -281,6 +1400,7 @@ static void heartbeat_handler(struct btstack_timer_source *ts) {
 
 int main() {
   stdio_init_all();
+  NXMIC_PROBE_INIT();
 
   for (int i = 0; i < 10; i++) {
     printf("CLIENT STARTING..\n");
@@ -294,6 +1414,27 @@ int main() {
     return -1;
   }
 
+#if NXMIC_GATEWAY
+  cyw43_arch_enable_sta_mode();
+  printf("Connecting to Wi-Fi...\n");
+  if (cyw43_arch_wifi_connect_timeout_ms(WIFI_SSID, WIFI_PASSWORD,
+                                         CYW43_AUTH_WPA2_AES_PSK, 30000)) {
+    printf("failed to connect.\n");
+    return 1;
+  }
+  cyw43_arch_lwip_begin();
+  bool gateway_ready =
+      gateway_lwip_init(&gateway, NXMIC_GATEWAY_HOST, NXMIC_GATEWAY_PORT,
+                        NXMIC_GATEWAY_FLUSH_MS * 1000);
+  cyw43_arch_lwip_end();
+  if (!gateway_ready) {
+    printf("failed to open the gateway to %s:%d\n", NXMIC_GATEWAY_HOST,
+           NXMIC_GATEWAY_PORT);
+    return 1;
+  }
+  printf("Forwarding to %s:%d\n", NXMIC_GATEWAY_HOST, NXMIC_GATEWAY_PORT);
+#endif
+
   l2cap_init();
   sm_init();
   sm_set_io_capabilities(IO_CAPABILITY_NO_INPUT_NO_OUTPUT);
@@ -303,10 +1444,28 @@ int main() {
   att_server_init(NULL, NULL, NULL);
 
   gatt_client_init();
+  link_profile_init(LINK_PROFILE_HIGH_THROUGHPUT);
+
+  // route each streaming characteristic to its decoder
+  for (int i = 0; i < NXMIC_MAX_LINKS; i++) {
+    reset_link(&links[i]);
+    reset_accounting(i, links[i].connection);
+  }
+  spsc_ring_init(&notification_ring, notification_ring_storage,
+                 NOTIFICATION_RING_SLOTS,
+                 sizeof(nxmic_reader_record_t) + NOTIFICATION_MAX_VALUE);
+  for (int i = 0; i < CHAR_COUNT; i++) {
+    if (nxmic_stream_is_streaming((gatt_characteristic_id_t)i))
+      nxmic_stream_set_handler((gatt_characteristic_id_t)i,
+                               queue_notification);
+  }
 
   hci_event_callback_registration.callback = &hci_event_handler;
   hci_add_event_handler(&hci_event_callback_registration);
 
+  connect_timer.process = &connect_timeout_handler;
+  scan_timer.process = &scan_timeout_handler;
+
   // set one-shot btstack timer
   heartbeat.process = &heartbeat_handler;
   btstack_run_loop_set_timer(&heartbeat, LED_SLOW_FLASH_DELAY_MS);
@@ -321,7 +1480,7 @@ int main() {
   // IRQ, so it is fine to call bt_stack_run_loop_execute() but equally you can
   // continue executing user code.
 
-#if 1  // this is only necessary when using polling (which we aren't, but we're
+#if 0  // this is only necessary when using polling (which we aren't, but we're
        // showing it is still safe to call in this case)
   btstack_run_loop_execute();
 #else
@@ -329,9 +1488,23 @@ int main() {
   // (in which case you should use btstacK_run_loop_ methods to add work to the
   // run loop.
 
-  // this is a forever loop in place of where user code would go.
+  // drain notifications queued by the BTstack callback, sleeping briefly
+  // whenever the ring is empty
   while (true) {
-    sleep_ms(1000);
+#if NXMIC_BENCHMARK
+    report_benchmark();
+#else
+    report_losses();
+#endif
+    NXMIC_PROBE_POLL();
+    request_missing_frames();
+    run_exports();
+    uint32_t processed = process_notifications();
+    // a few deferred log lines per pass, formatted after the decoding
+    if (nxmic_log_drain(LOG_DRAIN_BATCH) == 0 && processed == 0) {
+      best_effort_wfe_or_timeout(
+          make_timeout_time_ms(NOTIFICATION_BATCH_WAIT_MS));
+    }
   }
 #endif
   return 0;
@@ -0,0 +1,163 @@
+// Host check and benchmark of the preview filter (nxmic_decimate.h):
+// frequency response of the designed low-pass measured through the Q15
+// decimator with sines across the input band, identical output whatever
+// the block sizes, and the cost per output sample against filtering every
+// input and then dropping factor - 1 of each factor outputs.
+//
+//   nxmic_decimate_bench [-m factor] [-t taps] [-n blocks]
+//
+// Frequencies are in cycles per input sample, 0.5 is the input Nyquist
+// frequency. The passband runs to half the output Nyquist frequency and
+// must stay within NXMIC_BENCH_PASSBAND_DB; everything from 1.5 times the
+// output Nyquist frequency, which would alias into the passband, must be
+// NXMIC_BENCH_STOPBAND_DB down. Exits non-zero if the response is off or
+// the output depends on the block size.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "acquisition.h"
+#include "bench_util.h"
+#include "nxmic_decimate.h"
+
+#define NXMIC_BENCH_PASSBAND_DB 0.1
+#define NXMIC_BENCH_STOPBAND_DB 40.0
+#define BENCH_AMPLITUDE 16384.0
+#define BENCH_RESPONSE_INPUTS 8192
+#define BENCH_RESPONSE_POINTS 128
+
+static int16_t coefficients[NXMIC_DECIMATE_MAX_TAPS];
+static nxmic_decimator_t decimator;
+static nxmic_decimator_t every_input;  // The same filter, factor 1
+static int16_t input[BENCH_RESPONSE_INPUTS];
+static int16_t output[BENCH_RESPONSE_INPUTS];
+
+static void make_sine(double frequency, int16_t *samples, uint32_t count) {
+  for (uint32_t i = 0; i < count; i++)
+    samples[i] = (int16_t)lrint(BENCH_AMPLITUDE *
+                                sin(2 * M_PI * frequency * i + 0.3));
+}
+
+// All of input through the decimator in blocks of block samples
+static uint32_t decimate_all(uint16_t block, int16_t *out) {
+  nxmic_decimator_reset(&decimator);
+  uint32_t outputs = 0;
+  for (uint32_t i = 0; i < BENCH_RESPONSE_INPUTS; i += block) {
+    uint16_t n = BENCH_RESPONSE_INPUTS - i < block
+                     ? (uint16_t)(BENCH_RESPONSE_INPUTS - i)
+                     : block;
+    outputs += nxmic_decimate(&decimator, &input[i], n, &out[outputs]);
+  }
+  return outputs;
+}
+
+static double power_of(const int16_t *samples, uint32_t count) {
+  double power = 0;
+  for (uint32_t i = 0; i < count; i++)
+    power += (double)samples[i] * samples[i];
+  return power / count;
+}
+
+// Gain in dB at frequency, output power over input power once the filter
+// has filled
+static double gain_db(double frequency, uint16_t taps, uint8_t factor) {
+  make_sine(frequency, input, BENCH_RESPONSE_INPUTS);
+  uint32_t outputs = decimate_all(NXMIC_DECIMATE_MAX_BLOCK, output);
+  uint32_t first = taps / factor + 1;
+  double power = power_of(&output[first], outputs - first);
+  double reference = power_of(&input[first * factor],
+                              BENCH_RESPONSE_INPUTS - first * factor);
+  return power > 0 ? 10 * log10(power / reference) : -200;
+}
+
+int main(int argc, char **argv) {
+  int factor = ACQUISITION_PREVIEW_FACTOR;
+  int taps = ACQUISITION_PREVIEW_TAPS;
+  uint32_t blocks = 20000;
+  int opt;
+  while ((opt = getopt(argc, argv, "m:t:n:")) != -1) {
+    switch (opt) {
+      case 'm':
+        factor = atoi(optarg);
+        break;
+      case 't':
+        taps = atoi(optarg);
+        break;
+      case 'n':
+        blocks = (uint32_t)atoi(optarg);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-m factor] [-t taps] [-n blocks]\n",
+                argv[0]);
+        return 2;
+    }
+  }
+  if (factor < 2 || factor > 255 || taps < 1 ||
+      taps > NXMIC_DECIMATE_MAX_TAPS || blocks == 0) {
+    fprintf(stderr, "invalid factor, taps or block count\n");
+    return 2;
+  }
+  nxmic_decimate_design(coefficients, (uint16_t)taps, (uint8_t)factor);
+  nxmic_decimator_init(&decimator, coefficients, (uint16_t)taps,
+                       (uint8_t)factor);
+  nxmic_decimator_init(&every_input, coefficients, (uint16_t)taps, 1);
+
+  int failed = 0;
+  double nyquist = 0.5 / factor;
+  double passband_db = 0, stopband_db = -200;
+  printf("decimation by %d, %d taps\n", factor, taps);
+  // between the frequencies that alias onto the output's DC and Nyquist,
+  // where the power sampled depends on the phase
+  for (int p = 0; p < BENCH_RESPONSE_POINTS; p++) {
+    double frequency = 0.5 * (p + 0.5) / BENCH_RESPONSE_POINTS;
+    double db = gain_db(frequency, (uint16_t)taps, (uint8_t)factor);
+    if (frequency <= nyquist / 2 && fabs(db) > fabs(passband_db))
+      passband_db = db;
+    if (frequency >= nyquist * 1.5 && db > stopband_db) stopband_db = db;
+    if (p % 8 == 0) printf("  %.4f: %7.2f dB\n", frequency, db);
+  }
+  printf("passband to %.4f: worst %+.3f dB\n", nyquist / 2, passband_db);
+  printf("stopband from %.4f: worst %.1f dB\n", nyquist * 1.5, stopband_db);
+  if (fabs(passband_db) > NXMIC_BENCH_PASSBAND_DB ||
+      stopband_db > -NXMIC_BENCH_STOPBAND_DB)
+    failed = 1;
+
+  // the history and phase carry across blocks of any size
+  make_sine(nyquist / 3, input, BENCH_RESPONSE_INPUTS);
+  static int16_t reference[BENCH_RESPONSE_INPUTS];
+  uint32_t outputs = decimate_all(NXMIC_DECIMATE_MAX_BLOCK, reference);
+  const uint16_t block_sizes[] = {1, 7, 37, 100, 511};
+  for (size_t b = 0; b < sizeof(block_sizes) / sizeof(block_sizes[0]); b++) {
+    if (decimate_all(block_sizes[b], output) != outputs ||
+        memcmp(output, reference, outputs * sizeof(output[0])) != 0) {
+      printf("blocks of %u: output differs\n", block_sizes[b]);
+      failed = 1;
+    }
+  }
+
+  // cost per output: blocks as the ADC hands them over
+  make_sine(nyquist / 3, input, NXMIC_DECIMATE_MAX_BLOCK);
+  bench_cost_t start = bench_cost_now();
+  uint64_t produced = 0;
+  for (uint32_t i = 0; i < blocks; i++)
+    produced += nxmic_decimate(&decimator, input, NXMIC_DECIMATE_MAX_BLOCK,
+                               output);
+  bench_cost_t decimate_cost = bench_cost_since(start);
+  start = bench_cost_now();
+  uint64_t kept = 0;
+  for (uint32_t i = 0; i < blocks; i++)
+    kept += nxmic_decimate(&every_input, input, NXMIC_DECIMATE_MAX_BLOCK,
+                           output) / factor;
+  bench_cost_t full_cost = bench_cost_since(start);
+  printf("decimator: %.1f ns, %.0f cycles per output sample\n",
+         (double)decimate_cost.ns / produced,
+         (double)decimate_cost.cycles / produced);
+  printf("filter every input: %.1f ns, %.0f cycles per output sample, "
+         "%.1fx\n",
+         (double)full_cost.ns / kept, (double)full_cost.cycles / kept,
+         (double)full_cost.ns / decimate_cost.ns);
+  return failed;
+}
@@ -0,0 +1,256 @@
+// Host check and benchmark of the ECG codec (ecg_codec.h): every signal is
+// encoded into frame payloads the way the sensor fills them on a 247-byte
+// MTU (nxmic_encoder_encode), decoded back and compared sample for sample,
+// with the compression ratio against packed 16-bit samples and the encode
+// and decode cost per sample.
+//
+//   nxmic_ecg_bench [-r sample_rate_hz] [-n rounds] [-f recording]
+//
+// The signals are a synthetic ECG (P, QRS and T waves with beat-to-beat
+// variation, baseline wander, mains hum and noise), host_sim's simpler
+// one, and fixtures for what an electrode lead does that a model does
+// not: a lead-off step to the rail, clipping, pacemaker spikes and a flat
+// line, and full-scale noise, which takes the escape codes. -f adds a
+// recording as 16-bit little-endian samples, the format of the sensor's
+// recordings and of host_sim -x. The costs are rounds passes over each
+// signal; encoding includes the retries with fewer samples when a block
+// does not fit. Exits non-zero if a sample does not come back exactly.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench_util.h"
+#include "ecg_codec.h"
+#include "nxmic_codec.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define BENCH_MAX_SAMPLES 65536
+#define BENCH_SIGNAL_SAMPLES 30000  // A minute at 500 Hz
+// Payload of one full frame on a 247-byte MTU, as the sensor sends them
+#define BENCH_PAYLOAD_SIZE (247 - 3 - NXMIC_FRAME_HEADER_SIZE)
+// Full-scale noise takes 44 bits a sample, so at least 42 fit a frame
+#define BENCH_MAX_FRAMES (BENCH_MAX_SAMPLES / 42 + 1)
+
+static int16_t signal[BENCH_MAX_SAMPLES];
+static int16_t decoded[BENCH_MAX_SAMPLES];
+static uint8_t payload[BENCH_MAX_FRAMES][BENCH_PAYLOAD_SIZE];
+static uint16_t payload_size[BENCH_MAX_FRAMES];
+static uint16_t payload_samples[BENCH_MAX_FRAMES];
+
+static double wave(double t, double centre, double width, double height) {
+  double x = (t - centre) / width;
+  return height * exp(-0.5 * x * x);
+}
+
+// One lead at about 2.5 uV per count: each beat a sum of Gaussians for the
+// P, Q, R, S and T waves, the R-R interval varying around 72 bpm
+static uint32_t make_ecg(uint32_t rate) {
+  static const double beat[5][3] = {
+      // centre s, width s, height
+      {-0.20, 0.025, 50},
+      {-0.03, 0.010, -60},
+      {0.00, 0.012, 420},
+      {0.03, 0.010, -110},
+      {0.28, 0.060, 120},
+  };
+  double next_beat = 0.3, last_beat = -1;
+  uint32_t beats = 0;
+  for (uint32_t n = 0; n < BENCH_SIGNAL_SAMPLES; n++) {
+    double t = (double)n / rate;
+    if (t >= next_beat - 0.25) {
+      last_beat = next_beat;
+      next_beat += 60.0 / 72 * (1 + 0.05 * sin(2 * M_PI * 0.25 * last_beat) +
+                                0.02 * bench_noise(beats) / 128.0);
+      beats++;
+    }
+    double value = 80 * sin(2 * M_PI * 0.3 * t) + 12 * sin(2 * M_PI * 50 * t) +
+                   bench_noise(n) / 32.0;
+    for (int w = 0; w < 5; w++) {
+      value += wave(t, last_beat + beat[w][0], beat[w][1], beat[w][2]);
+      value += wave(t, next_beat + beat[w][0], beat[w][1], beat[w][2]);
+    }
+    signal[n] = (int16_t)lrint(value);
+  }
+  return BENCH_SIGNAL_SAMPLES;
+}
+
+// The signal host_sim.c streams
+static uint32_t make_host_sim(void) {
+  for (uint32_t n = 0; n < BENCH_SIGNAL_SAMPLES; n++) {
+    uint32_t phase = n % 400;
+    double value = 50 * sin(2 * M_PI * n / 2000.0) + bench_noise(n) / 16;
+    if (phase < 10) {
+      value += 150 * (phase < 5 ? phase : 10 - phase) * 2;
+    } else if (phase >= 100 && phase < 160) {
+      value += 200 * sin(M_PI * (phase - 100) / 60.0);
+    }
+    signal[n] = (int16_t)value;
+  }
+  return BENCH_SIGNAL_SAMPLES;
+}
+
+// The ECG, then the lead coming off (a step to the positive rail, held),
+// back on with the amplifier clipping at both rails, a paced stretch with
+// a one-sample spike before each beat, and a flat line
+static uint32_t make_lead_events(uint32_t rate) {
+  uint32_t count = make_ecg(rate);
+  uint32_t fifth = count / 5;
+  for (uint32_t n = fifth; n < 2 * fifth; n++) signal[n] = INT16_MAX;
+  for (uint32_t n = 2 * fifth; n < 3 * fifth; n++) {
+    int32_t clipped = signal[n] * 120;
+    signal[n] = (int16_t)(clipped > INT16_MAX   ? INT16_MAX
+                          : clipped < INT16_MIN ? INT16_MIN
+                                                : clipped);
+  }
+  for (uint32_t n = 3 * fifth; n < 4 * fifth; n += rate * 5 / 6)
+    signal[n] = n & 1 ? INT16_MIN : INT16_MAX;
+  for (uint32_t n = 4 * fifth; n < count; n++) signal[n] = -1200;
+  return count;
+}
+
+static uint32_t make_full_scale_noise(void) {
+  for (uint32_t n = 0; n < BENCH_SIGNAL_SAMPLES; n++)
+    signal[n] =
+        (int16_t)(bench_noise(n) << 8 | (bench_noise(n + 77777) & 0xff));
+  return BENCH_SIGNAL_SAMPLES;
+}
+
+static uint32_t load_recording(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (!file) return 0;
+  uint8_t bytes[2];
+  uint32_t count = 0;
+  while (count < BENCH_MAX_SAMPLES && fread(bytes, 1, 2, file) == 2)
+    signal[count++] = (int16_t)(bytes[0] | bytes[1] << 8);
+  fclose(file);
+  return count;
+}
+
+// signal into payload[] frame by frame, each offered the samples the
+// encoder expects a payload to hold, as host_sim's sensor does; returns
+// the frame count, 0 if a frame took no samples
+static uint32_t encode_all(uint32_t count) {
+  nxmic_encoder_t encoder;
+  nxmic_encoder_init(&encoder, NXMIC_CODEC_RICE);
+  size_t offered = nxmic_encoder_frame_samples(&encoder, BENCH_PAYLOAD_SIZE);
+  uint32_t frames = 0;
+  for (uint32_t i = 0; i < count && frames < BENCH_MAX_FRAMES; frames++) {
+    size_t used;
+    payload_size[frames] = (uint16_t)nxmic_encoder_encode(
+        &encoder, &signal[i], count - i < offered ? count - i : offered,
+        payload[frames], BENCH_PAYLOAD_SIZE, &used);
+    if (used == 0) return 0;
+    payload_samples[frames] = (uint16_t)used;
+    i += used;
+  }
+  return frames;
+}
+
+// payload[] back into decoded[]; returns the samples decoded
+static uint32_t decode_all(uint32_t frames) {
+  uint32_t count = 0;
+  for (uint32_t f = 0; f < frames; f++) {
+    if (!ecg_decode_block(payload[f], payload_size[f], &decoded[count],
+                          payload_samples[f]))
+      return count;
+    count += payload_samples[f];
+  }
+  return count;
+}
+
+static bench_cost_t time_encode(uint32_t count, uint32_t rounds) {
+  bench_cost_t start = bench_cost_now();
+  for (uint32_t r = 0; r < rounds; r++) encode_all(count);
+  return bench_cost_since(start);
+}
+
+static bench_cost_t time_decode(uint32_t frames, uint32_t rounds) {
+  bench_cost_t start = bench_cost_now();
+  for (uint32_t r = 0; r < rounds; r++) decode_all(frames);
+  return bench_cost_since(start);
+}
+
+// Round trip and cost of the current signal, 0 if it came back exactly
+static int run(const char *name, uint32_t count, uint32_t rate,
+               uint32_t rounds) {
+  memset(decoded, 0, sizeof(decoded));
+  uint32_t frames = encode_all(count);
+  uint32_t decoded_count = frames ? decode_all(frames) : 0;
+  uint32_t mismatch = count;
+  if (decoded_count == count) {
+    for (mismatch = 0; mismatch < count; mismatch++) {
+      if (decoded[mismatch] != signal[mismatch]) break;
+    }
+  }
+  if (mismatch < count) {
+    printf("%-12s FAILED: sample %u of %u does not round trip\n", name,
+           mismatch, count);
+    return 1;
+  }
+
+  uint64_t bytes = 0;
+  for (uint32_t f = 0; f < frames; f++) bytes += payload_size[f];
+  uint64_t samples = (uint64_t)rounds * count;
+  bench_cost_t encode = time_encode(count, rounds);
+  bench_cost_t decode = time_decode(frames, rounds);
+  printf("%-12s %5u frames %5.2f bits/sample  ratio %5.2f  %6.0f B/s at "
+         "%u Hz  encode %6.1f ns %6.1f cycles  decode %6.1f ns %6.1f cycles "
+         "per sample\n",
+         name, frames, 8.0 * bytes / count, 2.0 * count / bytes,
+         (double)bytes * rate / count, rate, (double)encode.ns / samples,
+         (double)encode.cycles / samples, (double)decode.ns / samples,
+         (double)decode.cycles / samples);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  uint32_t rate = 500;  // The simulator's ECG stream
+  uint32_t rounds = 20;
+  const char *recording = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "r:n:f:")) != -1) {
+    switch (opt) {
+      case 'r':
+        rate = (uint32_t)atoi(optarg);
+        break;
+      case 'n':
+        rounds = (uint32_t)atoi(optarg);
+        break;
+      case 'f':
+        recording = optarg;
+        break;
+      default:
+        fprintf(stderr,
+                "usage: %s [-r sample_rate_hz] [-n rounds] [-f recording]\n",
+                argv[0]);
+        return 2;
+    }
+  }
+  if (rate < 100 || rounds == 0) {
+    fprintf(stderr, "invalid sample rate or round count\n");
+    return 2;
+  }
+
+  int failed = 0;
+  printf("%u Hz, frames of up to %d payload bytes\n", rate,
+         BENCH_PAYLOAD_SIZE);
+  if (recording) {
+    uint32_t count = load_recording(recording);
+    if (count == 0) {
+      fprintf(stderr, "cannot read %s\n", recording);
+      return 2;
+    }
+    failed |= run("recording", count, rate, rounds);
+  }
+  failed |= run("ecg", make_ecg(rate), rate, rounds);
+  failed |= run("host_sim", make_host_sim(), rate, rounds);
+  failed |= run("lead events", make_lead_events(rate), rate, rounds);
+  failed |= run("noise", make_full_scale_noise(), rate, rounds);
+  return failed;
+}
@@ -0,0 +1,189 @@
+#include "ecg_codec.h"
+
+#include <stdbool.h>
+
+#define MAX_ORDER 2
+#define MAX_RICE_K 16
+
+typedef struct {
+  uint8_t *data;
+  size_t size;
+  size_t position;  // bytes completed
+  uint32_t bits;    // pending bits, MSB aligned at bit_count
+  int bit_count;
+  bool overflow;
+} bit_writer_t;
+
+typedef struct {
+  const uint8_t *data;
+  size_t size;
+  size_t position;
+  uint32_t bits;
+  int bit_count;
+} bit_reader_t;
+
+static void write_bits(bit_writer_t *w, uint32_t value, int count) {
+  while (count > 0) {
+    int take = count > 16 ? 16 : count;
+    count -= take;
+    w->bits = (w->bits << take) | ((value >> count) & ((1u << take) - 1));
+    w->bit_count += take;
+    while (w->bit_count >= 8) {
+      w->bit_count -= 8;
+      if (w->position >= w->size) {
+        w->overflow = true;
+        return;
+      }
+      w->data[w->position++] = (uint8_t)(w->bits >> w->bit_count);
+    }
+  }
+}
+
+static void flush_bits(bit_writer_t *w) {
+  if (w->bit_count > 0) write_bits(w, 0, 8 - w->bit_count);
+}
+
+static bool read_bit(bit_reader_t *r, uint32_t *bit) {
+  if (r->bit_count == 0) {
+    if (r->position >= r->size) return false;
+    r->bits = r->data[r->position++];
+    r->bit_count = 8;
+  }
+  r->bit_count--;
+  *bit = (r->bits >> r->bit_count) & 1;
+  return true;
+}
+
+static bool read_bits(bit_reader_t *r, int count, uint32_t *value) {
+  uint32_t v = 0;
+  for (int i = 0; i < count; i++) {
+    uint32_t bit;
+    if (!read_bit(r, &bit)) return false;
+    v = (v << 1) | bit;
+  }
+  *value = v;
+  return true;
+}
+
+static inline uint32_t zigzag(int32_t v) {
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t v) {
+  return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static inline int32_t predict(const int16_t *samples, size_t i, int order) {
+  if (order == 1) return samples[i - 1];
+  return 2 * (int32_t)samples[i - 1] - samples[i - 2];
+}
+
+static size_t rice_bits(uint32_t value, int k) {
+  uint32_t q = value >> k;
+  if (q >= ECG_RICE_ESCAPE) return ECG_RICE_ESCAPE + ECG_RICE_ESCAPE_BITS;
+  return q + 1 + k;
+}
+
+// Pick the cheaper predictor and the Rice parameter for it. k starts at the
+// usual log2(mean) estimate and is refined by exact cost on its neighbours.
+static void choose_parameters(const int16_t *samples, size_t count,
+                              int *best_order, int *best_k) {
+  uint64_t best_sum = UINT64_MAX;
+  *best_order = 1;
+  for (int order = 1; order <= MAX_ORDER; order++) {
+    uint64_t sum = 0;
+    for (size_t i = order; i < count; i++)
+      sum += zigzag((int32_t)samples[i] - predict(samples, i, order));
+    if (sum < best_sum) {
+      best_sum = sum;
+      *best_order = order;
+    }
+  }
+
+  size_t n = count > (size_t)*best_order ? count - *best_order : 1;
+  uint64_t mean = best_sum / n;
+  int estimate = 0;
+  while (estimate < MAX_RICE_K && (mean >> (estimate + 1)) > 0) estimate++;
+
+  size_t best_bits = SIZE_MAX;
+  *best_k = estimate;
+  for (int k = estimate - 1; k <= estimate + 1; k++) {
+    if (k < 0 || k > MAX_RICE_K) continue;
+    size_t bits = 0;
+    for (size_t i = *best_order; i < count; i++)
+      bits += rice_bits(
+          zigzag((int32_t)samples[i] - predict(samples, i, *best_order)), k);
+    if (bits < best_bits) {
+      best_bits = bits;
+      *best_k = k;
+    }
+  }
+}
+
+size_t ecg_encode_block(const int16_t *samples, size_t sample_count,
+                        uint8_t *out, size_t out_size) {
+  if (sample_count == 0 || out_size == 0) return 0;
+  int order, k;
+  choose_parameters(samples, sample_count, &order, &k);
+  if ((size_t)order > sample_count) order = (int)sample_count;
+
+  bit_writer_t w = {.data = out, .size = out_size};
+  write_bits(&w, (uint32_t)(order << 5) | (uint32_t)k, 8);
+  for (int i = 0; i < order; i++) write_bits(&w, (uint16_t)samples[i], 16);
+
+  for (size_t i = order; i < sample_count && !w.overflow; i++) {
+    uint32_t value =
+        zigzag((int32_t)samples[i] - predict(samples, i, order));
+    uint32_t q = value >> k;
+    if (q >= ECG_RICE_ESCAPE) {
+      write_bits(&w, (1u << ECG_RICE_ESCAPE) - 1, ECG_RICE_ESCAPE);
+      write_bits(&w, value, ECG_RICE_ESCAPE_BITS);
+      continue;
+    }
+    // unary quotient, terminated by a zero, then k low bits
+    while (q >= 16) {
+      write_bits(&w, 0xffff, 16);
+      q -= 16;
+    }
+    write_bits(&w, ((1u << q) - 1) << 1, (int)q + 1);
+    if (k) write_bits(&w, value, k);
+  }
+  flush_bits(&w);
+  return w.overflow ? 0 : w.position;
+}
+
+size_t ecg_decode_block(const uint8_t *block, size_t block_size,
+                        int16_t *samples, size_t sample_count) {
+  if (block_size < 1 || sample_count == 0) return 0;
+  int order = (block[0] >> 5) & 3;
+  int k = block[0] & 0x1f;
+  if (order < 1 || order > MAX_ORDER || k > MAX_RICE_K) return 0;
+  if ((size_t)order > sample_count) return 0;
+  if (block_size < 1 + 2 * (size_t)order) return 0;
+
+  // warm-up samples are stored big-endian by the bit writer
+  for (int i = 0; i < order; i++)
+    samples[i] = (int16_t)((block[1 + 2 * i] << 8) | block[2 + 2 * i]);
+
+  bit_reader_t r = {.data = block + 1 + 2 * order,
+                    .size = block_size - 1 - 2 * order};
+  for (size_t i = order; i < sample_count; i++) {
+    uint32_t q = 0;
+    uint32_t bit;
+    while (q < ECG_RICE_ESCAPE) {
+      if (!read_bit(&r, &bit)) return 0;
+      if (!bit) break;
+      q++;
+    }
+    uint32_t value;
+    if (q == ECG_RICE_ESCAPE) {
+      if (!read_bits(&r, ECG_RICE_ESCAPE_BITS, &value)) return 0;
+    } else {
+      uint32_t low = 0;
+      if (k && !read_bits(&r, k, &low)) return 0;
+      value = (q << k) | low;
+    }
+    samples[i] = (int16_t)(predict(samples, i, order) + unzigzag(value));
+  }
+  return sample_count;
+}
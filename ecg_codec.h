@@ -0,0 +1,36 @@
+#ifndef ECG_CODEC_H_
+#define ECG_CODEC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Lossless ECG codec for CHAR_ECG_STREAMING: fixed first or second order
+// prediction followed by Rice coding of the residuals, with the predictor
+// order and Rice parameter chosen per block.
+//
+//   params      u8   predictor order (bits 5-6) | Rice parameter k (bits 0-4)
+//   warm-up     i16  x order, raw big-endian samples
+//   residuals ...    Rice codes, MSB first, zero padded to a byte
+//
+// A residual whose quotient reaches ECG_RICE_ESCAPE is sent as
+// ECG_RICE_ESCAPE one bits followed by its raw ECG_RICE_ESCAPE_BITS-bit
+// zigzag value, which bounds the size of a block with outliers.
+
+#define ECG_RICE_ESCAPE 24
+#define ECG_RICE_ESCAPE_BITS 20
+
+// Worst case block size for sample_count samples
+#define ECG_BLOCK_MAX_SIZE(sample_count) \
+  (1 + 4 + ((sample_count) * (ECG_RICE_ESCAPE + ECG_RICE_ESCAPE_BITS) + 7) / 8)
+
+// Encode sample_count samples into out. Returns the bytes written, or 0 if
+// the block does not fit in out_size bytes.
+size_t ecg_encode_block(const int16_t *samples, size_t sample_count,
+                        uint8_t *out, size_t out_size);
+
+// Decode exactly sample_count samples from a block of block_size bytes.
+// Returns sample_count, or 0 if the block is malformed.
+size_t ecg_decode_block(const uint8_t *block, size_t block_size,
+                        int16_t *samples, size_t sample_count);
+
+#endif
@@ -0,0 +1,125 @@
+#include "flash_file.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Power is cut by this operation: apply only its first half
+static bool power_cut(flash_file_t *file) {
+  if (file->powered_off) return true;
+  if (file->cut_after < 0) return false;
+  if (--file->cut_after > 0) return false;
+  file->powered_off = true;
+  return true;
+}
+
+static bool flash_file_read(void *context, uint32_t address, void *buffer,
+                            uint32_t length) {
+  flash_file_t *file = context;
+  if (address + length > file->flash.size) return false;
+  file->reads++;
+  file->read_bytes += length;
+  file->busy_ns += FLASH_FILE_READ_SETUP_NS +
+                   (uint64_t)length * FLASH_FILE_READ_NS_PER_BYTE;
+  return pread(file->fd, buffer, length, address) == (ssize_t)length;
+}
+
+static bool flash_file_program(void *context, uint32_t address,
+                               const void *data, uint32_t length) {
+  flash_file_t *file = context;
+  uint8_t page[NXMIC_STORE_MAX_PAGE_SIZE];
+  if (file->powered_off) return false;
+  if (address % file->flash.page_size != 0 ||
+      length != file->flash.page_size ||
+      address + length > file->flash.size)
+    return false;
+  bool cut = power_cut(file);
+  if (pread(file->fd, page, length, address) != (ssize_t)length) return false;
+  const uint8_t *bytes = data;
+  uint32_t programmed = cut ? length / 2 : length;
+  for (uint32_t i = 0; i < programmed; i++) page[i] &= bytes[i];
+  if (pwrite(file->fd, page, length, address) != (ssize_t)length)
+    return false;
+  file->programs++;
+  file->busy_ns += (uint64_t)FLASH_FILE_PAGE_PROGRAM_US * 1000;
+  return !cut;
+}
+
+static bool flash_file_erase(void *context, uint32_t address) {
+  flash_file_t *file = context;
+  uint32_t sector_size = file->flash.sector_size;
+  if (file->powered_off) return false;
+  if (address % sector_size != 0 || address >= file->flash.size) return false;
+  bool cut = power_cut(file);
+  uint8_t *erased = malloc(sector_size);
+  if (!erased) return false;
+  memset(erased, 0xff, sector_size);
+  uint32_t length = cut ? sector_size / 2 : sector_size;
+  bool ok = pwrite(file->fd, erased, length, address) == (ssize_t)length;
+  free(erased);
+  if (!ok) return false;
+  file->erases++;
+  file->erase_counts[address / sector_size]++;
+  // a 64 kB block erase is much cheaper per byte than sixteen 4 kB ones
+  file->busy_ns += (uint64_t)(sector_size >= 65536
+                                  ? FLASH_FILE_BLOCK_ERASE_US *
+                                        (sector_size / 65536)
+                                  : FLASH_FILE_SECTOR_ERASE_US *
+                                        ((sector_size + 4095) / 4096)) *
+                   1000;
+  return !cut;
+}
+
+bool flash_file_open(flash_file_t *file, const char *path, uint32_t size,
+                     uint32_t sector_size, uint16_t page_size) {
+  memset(file, 0, sizeof(*file));
+  file->fd = -1;
+  file->cut_after = -1;
+  if (sector_size == 0 || size % sector_size != 0) return false;
+  file->erase_counts = calloc(size / sector_size, sizeof(uint32_t));
+  if (!file->erase_counts) return false;
+  file->flash.size = size;
+  file->flash.sector_size = sector_size;
+  file->flash.page_size = page_size;
+  file->flash.context = file;
+  file->flash.read = flash_file_read;
+  file->flash.program = flash_file_program;
+  file->flash.erase = flash_file_erase;
+
+  file->fd = open(path, O_RDWR | O_CREAT, 0644);
+  struct stat st;
+  if (file->fd < 0 || fstat(file->fd, &st) != 0) {
+    flash_file_close(file);
+    return false;
+  }
+  if (st.st_size == (off_t)size) return true;
+  if (ftruncate(file->fd, size) != 0 || !flash_file_wipe(file)) {
+    flash_file_close(file);
+    return false;
+  }
+  return true;
+}
+
+void flash_file_close(flash_file_t *file) {
+  if (file->fd >= 0) close(file->fd);
+  file->fd = -1;
+  free(file->erase_counts);
+  file->erase_counts = NULL;
+}
+
+bool flash_file_wipe(flash_file_t *file) {
+  uint32_t sector_size = file->flash.sector_size;
+  uint8_t *erased = malloc(sector_size);
+  if (!erased) return false;
+  memset(erased, 0xff, sector_size);
+  bool ok = true;
+  for (uint32_t address = 0; ok && address < file->flash.size;
+       address += sector_size) {
+    ok = pwrite(file->fd, erased, sector_size, address) ==
+         (ssize_t)sector_size;
+  }
+  free(erased);
+  return ok;
+}
@@ -0,0 +1,45 @@
+#ifndef FLASH_FILE_H_
+#define FLASH_FILE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "nxmic_store.h"
+
+// NOR flash emulated in a file, for the host build. Programming can only
+// clear bits and erase sets a whole sector to 0xff, like the real part, so
+// the image survives between runs the way the on-board flash survives a
+// reboot. Operations are charged to a virtual busy time with typical QSPI
+// NOR timings (W25Q-class parts as on the Pico boards).
+
+#define FLASH_FILE_PAGE_PROGRAM_US 400
+#define FLASH_FILE_SECTOR_ERASE_US 45000   // 4 kB
+#define FLASH_FILE_BLOCK_ERASE_US 150000   // 64 kB
+#define FLASH_FILE_READ_SETUP_NS 1000      // Command and address
+#define FLASH_FILE_READ_NS_PER_BYTE 30     // Quad I/O, about 33 MB/s
+
+typedef struct {
+  nxmic_flash_t flash;  // Handed to nxmic_store_init()
+  int fd;
+  uint32_t *erase_counts;  // Per sector
+  uint64_t busy_ns;        // Virtual flash time
+  uint32_t reads;
+  uint64_t read_bytes;
+  uint32_t programs;
+  uint32_t erases;
+  // Power cut: the operation that brings this to 0 is torn halfway and
+  // everything after it fails, until cleared. Negative to never cut.
+  int32_t cut_after;
+  bool powered_off;
+} flash_file_t;
+
+// Open path as a flash of size bytes, creating it erased if it is missing
+// or has another size
+bool flash_file_open(flash_file_t *file, const char *path, uint32_t size,
+                     uint32_t sector_size, uint16_t page_size);
+void flash_file_close(flash_file_t *file);
+
+// Erase the whole image, outside of the statistics
+bool flash_file_wipe(flash_file_t *file);
+
+#endif
@@ -0,0 +1,66 @@
+#include "flash_pico.h"
+
+#include <string.h>
+
+#include "hardware/regs/addressmap.h"
+#include "pico/btstack_flash_bank.h"
+#include "pico/flash.h"
+
+#define FLASH_PICO_STORE_OFFSET \
+  (PICO_FLASH_BANK_STORAGE_OFFSET - FLASH_PICO_STORE_SIZE)
+
+// Longest the other core may take to get out of the way
+#define FLASH_PICO_SAFE_TIMEOUT_MS 100
+
+typedef struct {
+  uint32_t offset;
+  const void *data;
+} flash_operation_t;
+
+static void program_page(void *param) {
+  const flash_operation_t *operation = param;
+  flash_range_program(operation->offset, operation->data, FLASH_PAGE_SIZE);
+}
+
+static void erase_sector(void *param) {
+  const flash_operation_t *operation = param;
+  flash_range_erase(operation->offset, FLASH_SECTOR_SIZE);
+}
+
+// Recordings are read through the uncached XIP window, so an export does
+// not evict code from the cache
+static bool flash_pico_read(void *context, uint32_t address, void *buffer,
+                            uint32_t length) {
+  (void)context;
+  memcpy(buffer,
+         (const uint8_t *)(XIP_NOCACHE_NOALLOC_BASE + FLASH_PICO_STORE_OFFSET +
+                           address),
+         length);
+  return true;
+}
+
+static bool flash_pico_program(void *context, uint32_t address,
+                               const void *data, uint32_t length) {
+  (void)context;
+  if (length != FLASH_PAGE_SIZE) return false;
+  flash_operation_t operation = {FLASH_PICO_STORE_OFFSET + address, data};
+  return flash_safe_execute(program_page, &operation,
+                            FLASH_PICO_SAFE_TIMEOUT_MS) == PICO_OK;
+}
+
+static bool flash_pico_erase(void *context, uint32_t address) {
+  (void)context;
+  flash_operation_t operation = {FLASH_PICO_STORE_OFFSET + address, NULL};
+  return flash_safe_execute(erase_sector, &operation,
+                            FLASH_PICO_SAFE_TIMEOUT_MS) == PICO_OK;
+}
+
+void flash_pico_init(nxmic_flash_t *flash) {
+  memset(flash, 0, sizeof(*flash));
+  flash->size = FLASH_PICO_STORE_SIZE;
+  flash->sector_size = FLASH_SECTOR_SIZE;
+  flash->page_size = FLASH_PAGE_SIZE;
+  flash->read = flash_pico_read;
+  flash->program = flash_pico_program;
+  flash->erase = flash_pico_erase;
+}
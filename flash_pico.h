@@ -0,0 +1,18 @@
+#ifndef FLASH_PICO_H_
+#define FLASH_PICO_H_
+
+#include "hardware/flash.h"
+#include "nxmic_store.h"
+
+// The recording store's flash on the board: the megabyte right below the
+// BTstack TLV bank at the end of flash, in 4 kB sectors. A 4 kB erase
+// stalls for about 45 ms; 64 kB blocks would triple the write bandwidth
+// but stall for 150 ms and give up 64 kB of old data at a time.
+#define FLASH_PICO_STORE_SIZE (1024 * 1024)
+#define FLASH_PICO_SECTORS (FLASH_PICO_STORE_SIZE / FLASH_SECTOR_SIZE)
+
+// Program and erase go through flash_safe_execute(): interrupts are off on
+// this core and the other one is parked while XIP is unavailable
+void flash_pico_init(nxmic_flash_t *flash);
+
+#endif
@@ -0,0 +1,70 @@
+#include "gateway_lwip.h"
+
+#include <string.h>
+
+#include "lwip/ip_addr.h"
+#include "lwip/pbuf.h"
+#include "lwip/udp.h"
+#include "pico/time.h"
+
+typedef struct {
+  struct udp_pcb *pcb;
+  ip_addr_t host;
+  uint16_t port;
+} gateway_lwip_t;
+
+static gateway_lwip_t sink;
+
+// A PBUF_REF pbuf only borrows the slot: if lwIP has to queue the datagram
+// (ARP still resolving) it copies the chain first, so the slot can go back
+// to the ring as soon as this returns
+static bool gateway_lwip_send(void *context, const uint8_t *header,
+                              const nxmic_gateway_chunk_t *entries,
+                              uint8_t count, uint16_t length) {
+  gateway_lwip_t *gateway = context;
+  (void)length;
+  struct pbuf *datagram =
+      pbuf_alloc(PBUF_TRANSPORT, NXMIC_GATEWAY_HEADER_SIZE, PBUF_RAM);
+  if (!datagram) return false;
+  memcpy(datagram->payload, header, NXMIC_GATEWAY_HEADER_SIZE);
+  for (uint8_t i = 0; i < count; i++) {
+    struct pbuf *entry = pbuf_alloc(PBUF_RAW, entries[i].length, PBUF_REF);
+    if (!entry) {
+      pbuf_free(datagram);
+      return false;
+    }
+    entry->payload = (void *)entries[i].data;
+    pbuf_cat(datagram, entry);
+  }
+  err_t err = udp_sendto(gateway->pcb, datagram, &gateway->host,
+                         gateway->port);
+  pbuf_free(datagram);
+  return err == ERR_OK;
+}
+
+static void gateway_lwip_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p,
+                              const ip_addr_t *addr, u16_t port) {
+  (void)pcb;
+  (void)addr;
+  (void)port;
+  uint8_t ack[NXMIC_GATEWAY_ACK_SIZE];
+  uint16_t length = pbuf_copy_partial(p, ack, sizeof(ack), 0);
+  nxmic_gateway_on_ack(arg, ack, length, time_us_32());
+  pbuf_free(p);
+}
+
+bool gateway_lwip_init(nxmic_gateway_t *gateway, const char *host,
+                       uint16_t port, uint32_t flush_us) {
+  if (!ipaddr_aton(host, &sink.host)) return false;
+  sink.port = port;
+  sink.pcb = udp_new_ip_type(IPADDR_TYPE_V4);
+  if (!sink.pcb) return false;
+  if (udp_bind(sink.pcb, IP_ANY_TYPE, 0) != ERR_OK) {
+    udp_remove(sink.pcb);
+    sink.pcb = NULL;
+    return false;
+  }
+  nxmic_gateway_init(gateway, flush_us, gateway_lwip_send, &sink);
+  udp_recv(sink.pcb, gateway_lwip_recv, gateway);
+  return true;
+}
@@ -0,0 +1,23 @@
+#ifndef GATEWAY_LWIP_H_
+#define GATEWAY_LWIP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "nxmic_gateway.h"
+
+// The gateway's datagrams on lwIP UDP. Each one is a PBUF_RAM header
+// chained to one PBUF_REF pbuf per entry, pointing at the ring slot, so
+// lwIP takes the notifications where they are; the cyw43 driver still
+// copies the chain into its bus buffer on the way out. Acks arrive on the
+// same PCB and go to nxmic_gateway_on_ack().
+//
+// Everything here runs with the lwIP lock held, cyw43_arch_lwip_begin() on
+// the main loop; the ack callback already runs in the async context.
+
+// Open the PCB to host:port and wire gateway to it. false if host is not
+// an IPv4 address or lwIP is out of PCBs.
+bool gateway_lwip_init(nxmic_gateway_t *gateway, const char *host,
+                       uint16_t port, uint32_t flush_us);
+
+#endif
@@ -0,0 +1,92 @@
+#include "gatt_cache.h"
+
+#include <string.h>
+
+#include "btstack_tlv.h"
+
+// Tags are 'N' 'X' followed by a 16-bit fold of the peer address. Entries
+// carry the full address so a fold collision is a miss, not a wrong hit.
+#define GATT_CACHE_TAG_PREFIX (((uint32_t)'N' << 24) | ((uint32_t)'X' << 16))
+// Outside the 'N' 'X' range
+#define GATT_CACHE_KNOWN_TAG \
+  (((uint32_t)'N' << 24) | ((uint32_t)'K' << 16) | ((uint32_t)'N' << 8) | 'S')
+
+static uint32_t gatt_cache_tag(const bd_addr_t addr) {
+  uint16_t fold = 0;
+  for (int i = 0; i < BD_ADDR_LEN; i++) {
+    fold = (uint16_t)((fold << 5) | (fold >> 11)) ^ addr[i];
+  }
+  return GATT_CACHE_TAG_PREFIX | fold;
+}
+
+static bool gatt_cache_tlv(const btstack_tlv_t **tlv_impl,
+                           void **tlv_context) {
+  btstack_tlv_get_instance(tlv_impl, tlv_context);
+  return *tlv_impl != NULL;
+}
+
+bool gatt_cache_load(const bd_addr_t addr, gatt_cache_entry_t *entry) {
+  const btstack_tlv_t *tlv_impl;
+  void *tlv_context;
+  if (!gatt_cache_tlv(&tlv_impl, &tlv_context)) return false;
+
+  int len = tlv_impl->get_tag(tlv_context, gatt_cache_tag(addr),
+                              (uint8_t *)entry, sizeof(*entry));
+  if (len != (int)sizeof(*entry)) return false;
+  return bd_addr_cmp(entry->addr, addr) == 0;
+}
+
+bool gatt_cache_store(const gatt_cache_entry_t *entry) {
+  const btstack_tlv_t *tlv_impl;
+  void *tlv_context;
+  if (!gatt_cache_tlv(&tlv_impl, &tlv_context)) return false;
+
+  return tlv_impl->store_tag(tlv_context, gatt_cache_tag(entry->addr),
+                             (const uint8_t *)entry, sizeof(*entry)) == 0;
+}
+
+void gatt_cache_delete(const bd_addr_t addr) {
+  const btstack_tlv_t *tlv_impl;
+  void *tlv_context;
+  if (!gatt_cache_tlv(&tlv_impl, &tlv_context)) return;
+
+  tlv_impl->delete_tag(tlv_context, gatt_cache_tag(addr));
+}
+
+void gatt_cache_known_load(gatt_cache_known_t *known) {
+  memset(known, 0, sizeof(*known));
+  const btstack_tlv_t *tlv_impl;
+  void *tlv_context;
+  if (!gatt_cache_tlv(&tlv_impl, &tlv_context)) return;
+
+  int len = tlv_impl->get_tag(tlv_context, GATT_CACHE_KNOWN_TAG,
+                              (uint8_t *)known, sizeof(*known));
+  if (len != (int)sizeof(*known) || known->count > GATT_CACHE_KNOWN_MAX)
+    memset(known, 0, sizeof(*known));
+}
+
+bool gatt_cache_known_add(gatt_cache_known_t *known, const bd_addr_t addr,
+                          bd_addr_type_t addr_type) {
+  int i = 0;
+  while (i < known->count && bd_addr_cmp(known->addrs[i], addr) != 0) i++;
+  if (i == 0 && known->count > 0 && known->addr_types[0] == addr_type)
+    return false;
+  if (i == known->count) {
+    if (known->count < GATT_CACHE_KNOWN_MAX) known->count++;
+    i = known->count - 1;  // the new entry or the oldest, overwritten
+  }
+  memmove(&known->addrs[1], &known->addrs[0], i * sizeof(bd_addr_t));
+  memmove(&known->addr_types[1], &known->addr_types[0], i);
+  bd_addr_copy(known->addrs[0], addr);
+  known->addr_types[0] = (uint8_t)addr_type;
+  return true;
+}
+
+bool gatt_cache_known_store(const gatt_cache_known_t *known) {
+  const btstack_tlv_t *tlv_impl;
+  void *tlv_context;
+  if (!gatt_cache_tlv(&tlv_impl, &tlv_context)) return false;
+
+  return tlv_impl->store_tag(tlv_context, GATT_CACHE_KNOWN_TAG,
+                             (const uint8_t *)known, sizeof(*known)) == 0;
+}
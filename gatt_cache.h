@@ -0,0 +1,46 @@
+#ifndef GATT_CACHE_H_
+#define GATT_CACHE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "btstack.h"
+#include "nxmic_reader.h"
+
+// Everything needed to skip discovery on reconnect. Only valid while the
+// peer's Database Hash matches the one stored with it.
+typedef struct {
+  bd_addr_t addr;
+  nxmic_reader_handles_t handles;
+} gatt_cache_entry_t;
+
+// Load the entry for addr from the TLV store, returns false if none
+bool gatt_cache_load(const bd_addr_t addr, gatt_cache_entry_t *entry);
+
+// Persist entry under its address, replacing any previous one
+bool gatt_cache_store(const gatt_cache_entry_t *entry);
+
+// Drop the entry for addr, e.g. when the peer's database hash changed
+void gatt_cache_delete(const bd_addr_t addr);
+
+// Sensors the reader has connected to, most recent first, for the
+// controller's accept list (MAX_NR_WHITELIST_ENTRIES in btstack_config.h)
+#define GATT_CACHE_KNOWN_MAX 16
+
+typedef struct {
+  uint8_t count;
+  uint8_t addr_types[GATT_CACHE_KNOWN_MAX];  // bd_addr_type_t
+  bd_addr_t addrs[GATT_CACHE_KNOWN_MAX];
+} gatt_cache_known_t;
+
+// Load the list from the TLV store, empty if none was stored
+void gatt_cache_known_load(gatt_cache_known_t *known);
+
+// Move addr to the front, dropping the oldest entry if the list is full.
+// Returns false if addr was already first, i.e. nothing to store.
+bool gatt_cache_known_add(gatt_cache_known_t *known, const bd_addr_t addr,
+                          bd_addr_type_t addr_type);
+
+bool gatt_cache_known_store(const gatt_cache_known_t *known);
+
+#endif
@@ -0,0 +1,106 @@
+// Writes the sensor's GATT profile, for BTstack's compile_gatt.py, from
+// nxmic_gatt_service: the GAP, GATT and Environmental Sensing services the
+// sensor has always had, then the NxMic service with every characteristic
+// of the table, in its order. A stream the sensor has no source for stays
+// silent; the reader picks its link profile from what it receives.
+//
+//   nxmic_gatt_gen [file.gatt]
+//
+// Every NxMic value is DYNAMIC, served by the sensor's ATT handlers (see
+// nxmic_att.h), so a characteristic with notifications or indications gets
+// its Client Characteristic Configuration from the properties alone. The
+// build runs this before compile_gatt.py; writes to stdout without a file.
+
+#include <stdio.h>
+
+#include "nxmic_gatt.h"
+
+static const char *const char_names[CHAR_COUNT] = {
+    [CHAR_DEVICE_SERIAL] = "CHAR_DEVICE_SERIAL",
+    [CHAR_TIMESTAMP] = "CHAR_TIMESTAMP",
+    [CHAR_FIRMWARE_VERSION] = "CHAR_FIRMWARE_VERSION",
+    [CHAR_IMU_STREAMING] = "CHAR_IMU_STREAMING",
+    [CHAR_TEMPERATURE_STREAMING] = "CHAR_TEMPERATURE_STREAMING",
+    [CHAR_STETHOSCOPE_STREAMING] = "CHAR_STETHOSCOPE_STREAMING",
+    [CHAR_STETHOSCOPE_PREVIEW_STREAMING] = "CHAR_STETHOSCOPE_PREVIEW_STREAMING",
+    [CHAR_ECG_STREAMING] = "CHAR_ECG_STREAMING",
+    [CHAR_LED_INDICATE] = "CHAR_LED_INDICATE",
+    [CHAR_BATTERY_LEVEL] = "CHAR_BATTERY_LEVEL",
+    [CHAR_DEVICE_CONTROL] = "CHAR_DEVICE_CONTROL",
+    [CHAR_ACTIVE_RECORDING] = "CHAR_ACTIVE_RECORDING",
+    [CHAR_DATA_EXPORT] = "CHAR_DATA_EXPORT",
+    [CHAR_LABEL_DATA] = "CHAR_LABEL_DATA",
+    [CHAR_RECORDING_INTERVAL_SETTINGS] = "CHAR_RECORDING_INTERVAL_SETTINGS",
+    [CHAR_FILESYSTEM_MANAGEMENT] = "CHAR_FILESYSTEM_MANAGEMENT",
+};
+
+static const struct {
+  uint8_t property;
+  const char *flag;
+} flags[] = {
+    {GATT_CHAR_READ, "READ"},
+    {GATT_CHAR_WRITE, "WRITE"},
+    {GATT_CHAR_WRITE_WITHOUT_RESPONSE, "WRITE_WITHOUT_RESPONSE"},
+    {GATT_CHAR_NOTIFY, "NOTIFY"},
+    {GATT_CHAR_INDICATE, "INDICATE"},
+    {GATT_CHAR_AUTH_READ, "READ_AUTHENTICATED"},
+    {GATT_CHAR_AUTH_WRITE, "WRITE_AUTHENTICATED"},
+};
+
+// As the .gatt format writes it: big-endian, 8-4-4-4-12 hex digits
+static void print_uuid128(FILE *out, const uint8_t uuid128[16]) {
+  for (int i = 15; i >= 0; i--) {
+    fprintf(out, "%02X", uuid128[i]);
+    if (i == 12 || i == 10 || i == 8 || i == 6) fputc('-', out);
+  }
+}
+
+static void print_profile(FILE *out) {
+  fprintf(out,
+          "// Generated by gatt_gen.c from nxmic_gatt_service, do not edit\n"
+          "\n"
+          "PRIMARY_SERVICE, GAP_SERVICE\n"
+          "CHARACTERISTIC, GAP_DEVICE_NAME, READ, \"picow_temp\"\n"
+          "\n"
+          "PRIMARY_SERVICE, GATT_SERVICE\n"
+          "CHARACTERISTIC, GATT_DATABASE_HASH, READ,\n"
+          "\n"
+          "PRIMARY_SERVICE, ORG_BLUETOOTH_SERVICE_ENVIRONMENTAL_SENSING\n"
+          "CHARACTERISTIC, ORG_BLUETOOTH_CHARACTERISTIC_TEMPERATURE, READ | "
+          "NOTIFY | INDICATE | DYNAMIC,\n"
+          "\n"
+          "// NxMic service, see nxmic_gatt.h\n"
+          "PRIMARY_SERVICE, ");
+  print_uuid128(out, nxmic_gatt_service.uuid128);
+  fputc('\n', out);
+  for (int i = 0; i < nxmic_gatt_service.num_characteristics; i++) {
+    const gatt_characteristic_t *c = &nxmic_gatt_service.characteristics[i];
+    fprintf(out, "// %s\nCHARACTERISTIC, ",
+            c->char_id < CHAR_COUNT ? char_names[c->char_id] : "unknown");
+    print_uuid128(out, c->uuid128);
+    fputs(", ", out);
+    for (size_t f = 0; f < sizeof(flags) / sizeof(flags[0]); f++) {
+      if (c->properties & flags[f].property)
+        fprintf(out, "%s | ", flags[f].flag);
+    }
+    fputs("DYNAMIC,\n", out);
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc > 2) {
+    fprintf(stderr, "usage: %s [file.gatt]\n", argv[0]);
+    return 2;
+  }
+  FILE *out = argc == 2 ? fopen(argv[1], "w") : stdout;
+  if (!out) {
+    perror(argv[1]);
+    return 1;
+  }
+  print_profile(out);
+  if (out != stdout && fclose(out) != 0) {
+    perror(argv[1]);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,1497 @@
+// Host build: runs a simulated NxMic sensor and reader end-to-end over a
+// virtual_link_t, with the same framing, codecs, routing table and
+// notification ring as the firmware. Time is virtual, so every run with the
+// same options produces the same numbers.
+//
+// The reader connects with nxmic_reader.h, as client.c does: Database Hash,
+// cache or discovery, the CCCD chain, clock sync, NACKs and export requests.
+// The sensor sends with nxmic_notify.h and dispatches ATT with nxmic_att.h,
+// as server_common.c does. Only the GATT procedures themselves run on the
+// virtual link instead of BTstack.
+//
+//   nxmic_host_sim [-b] [-t seconds] [-s report_period_s]
+//                  [-r reconnect_period_s] [-m mtu] [-i conn_interval_us]
+//                  [-d max_tx_octets] [-p phy_mbps] [-e packets_per_event]
+//                  [-l loss_per_mille] [-x export_kb] [-c drift_ppm]
+//                  [-g udp_port] [-w capture]
+//   nxmic_host_sim -y capture [-n rounds]
+//
+// -b runs the benchmark stream of NXMIC_BENCHMARK firmware instead of the
+// sensor streams: full frames of filler, as fast as the link takes them.
+// -x offloads a recording of export_kb kB with nxmic_export.h instead: once
+// as notifications on CHAR_DATA_EXPORT, once over the L2CAP credit-based
+// channel, each on a fresh link with the same parameters, then times the
+// same offload with Read Blob.
+//
+// The sensor runs on its own clock, drift_ppm off the reader's, and stamps
+// frames with it; the reader syncs to it over CHAR_TIMESTAMP
+// (nxmic_timesync.h) and checks the sample times it reconstructs against
+// the true ones.
+//
+// At the end the sensor stops sampling and the link runs until what is
+// queued and asked for again is through, then every frame the sensor sent
+// must be accounted for: received, given up on by the reader, or lost
+// where the reader cannot see a gap, ahead of the first or after the last
+// frame of a connection. Exits non-zero if one is not.
+//
+// It also checks the link profile the reader picks from what it receives,
+// as client.c does: high throughput for the simulated sensor's stethoscope
+// and ECG, low power for its temperature stream alone; exits non-zero if
+// not.
+//
+// -g also forwards the reader's notification ring to 127.0.0.1:udp_port
+// with the gateway (nxmic_gateway.h), for nxmic_udp_sink to check. The
+// network is real, so the simulation is slowed down to real time and its
+// gateway numbers vary from run to run.
+//
+// -w captures every notification the reader receives on a stream, as the
+// link hands it over, with the value handles it was routed by. -y replays
+// a capture rounds times through the reader's path, the one the
+// firmware's handle_gatt_client_event() and process_notifications() take:
+// routing by value handle into the notification ring, then frame parsing,
+// gap tracking and decoding. It prints the cost per notification on this
+// host, and exits non-zero if a notification is not routed or does not
+// decode.
+
+#include <arpa/inet.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "bench_util.h"
+#include "nxmic_att.h"
+#include "nxmic_bench.h"
+#include "nxmic_codec.h"
+#include "nxmic_export.h"
+#include "nxmic_frame.h"
+#include "nxmic_gateway.h"
+#include "nxmic_gatt.h"
+#include "nxmic_notify.h"
+#include "nxmic_reader.h"
+#include "nxmic_stream.h"
+#include "nxmic_timesync.h"
+#include "nxmic_txq.h"
+#include "spsc_ring.h"
+#include "virtual_link.h"
+
+#define SIM_TICK_US 1000
+#define SIM_RECONNECT_GAP_US 100000
+// Sensor side backlog per stream while the link is busy
+#define SIM_PENDING_SAMPLES 4096
+// The sensor booted this long before the reader
+#define SIM_SENSOR_BOOT_US 1500000
+// What a failed GATT procedure completes with (Attribute Not Found)
+#define SIM_ATT_ERROR 0x0a
+// Largest value a GATT read hands back: the Database Hash
+#define SIM_GATT_VALUE_MAX 16
+// Longest the link runs at the end to deliver what is in flight, enough for
+// every attempt of a retransmission
+#define SIM_DRAIN_US 1000000
+// Received rate the reader's link profile follows, as LINK_PROFILE_WINDOW_MS
+// in client.c
+#define SIM_PROFILE_WINDOW_US 2000000
+// Same default as the firmware's NXMIC_GATEWAY_FLUSH_MS
+#define SIM_GATEWAY_FLUSH_US 5000
+
+#define NOTIFICATION_RING_SLOTS 64
+
+// -w and -y: the value handle of each characteristic, u16 x CHAR_COUNT,
+// then for each notification its u16 value handle, u16 length and value,
+// all little-endian
+#define CAPTURE_HEADER_SIZE (2 * CHAR_COUNT)
+#define CAPTURE_RECORD_HEADER_SIZE 4
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+typedef int16_t (*sample_generator_t)(uint64_t n);
+
+typedef struct {
+  gatt_characteristic_id_t char_id;
+  const char *name;
+  nxmic_codec_t codec;
+  uint32_t sample_rate_hz;
+  uint32_t flush_ms;  // send partial frames this old, 0 for full frames only
+  sample_generator_t generate;
+} sim_stream_config_t;
+
+// Sensor side state of one stream
+typedef struct {
+  nxmic_encoder_t encoder;
+  uint64_t next_sample;    // Index of the next sample to generate
+  uint64_t first_pending;  // Index of pending[0]
+  int16_t pending[SIM_PENDING_SAMPLES];
+  size_t pending_count;
+  uint16_t sequence;
+  uint16_t connection_sequence;  // First frame since the reader subscribed
+  uint16_t value_handle;
+  nxmic_retx_window_t *retx;  // The notifier's window of the stream
+  uint64_t frames_sent;
+  uint64_t samples_sent;
+  uint64_t samples_dropped;  // Backlog overflow
+  uint64_t blocked;          // Frame held back by a full notification queue
+} sim_source_t;
+
+// Reader side state of one stream
+typedef struct {
+  uint64_t frames;
+  uint64_t samples;
+  uint64_t payload_bytes;
+  uint64_t corrupt;
+  uint64_t mismatched;  // Samples differing from the source, lossless codecs
+  nxmic_gap_tracker_t gaps;
+  uint64_t unseen;  // Lost ahead of the first or after the last frame
+                    // received on a connection, no gap to find
+  double signal_energy;
+  double error_energy;
+  uint64_t timed;            // Samples given a reader time, once synced
+  uint64_t outside_bound;    // Off by more than the fit's error bound
+  double max_time_error_us;  // Against the true time of the sample
+} sim_sink_t;
+
+typedef struct {
+  uint32_t count;
+  uint64_t total_us;
+  uint64_t max_us;
+} sim_latency_t;
+
+typedef struct {
+  nxmic_reader_t gatt;  // Connection flow, streams and clock fit
+  bool cache_valid;
+  nxmic_reader_handles_t cache;  // Of the one simulated sensor
+  uint64_t next_sync_us;  // Clock sync round due, UINT64_MAX if none
+  uint64_t connect_us;    // Start of the connect in progress
+  bool failed;            // The connect in progress is of no use
+  uint32_t connection;  // Bumped by every connect, tags the ring records
+  bool low_power;       // Link profile the reader would have the link on
+  uint32_t profile_windows;
+  uint32_t low_power_windows;  // Ended on the low-power profile
+  uint64_t profile_window_us;  // Start of the profile's window
+  uint32_t profile_window_bytes;
+  sim_latency_t cold_latency;
+  sim_latency_t cached_latency;
+} sim_reader_t;
+
+typedef enum {
+  SIM_GATT_IDLE,
+  SIM_GATT_SERVICE,
+  SIM_GATT_CHARACTERISTICS,
+  SIM_GATT_CCCDS,
+  SIM_GATT_READ,
+  SIM_GATT_WRITE,
+} sim_gatt_procedure_t;
+
+// The GATT procedure in flight. The virtual link runs it at once; its
+// results go to the reader from pump_gatt(), once the op that started it
+// has returned, as they would from BTstack's run loop.
+typedef struct {
+  sim_gatt_procedure_t procedure;  // SIM_GATT_IDLE if none
+  bool ok;
+  uint16_t start_handle;  // Service found
+  uint16_t end_handle;
+  virtual_link_characteristic_t characteristics[CHAR_COUNT];
+  uint16_t cccds[CHAR_COUNT];
+  int count;  // Of characteristics or cccds
+  uint16_t value_handle;  // Value read
+  uint8_t value[SIM_GATT_VALUE_MAX];
+  uint16_t length;
+} sim_gatt_t;
+
+static int16_t temperature_sample(uint64_t n);
+static int16_t stethoscope_sample(uint64_t n);
+static int16_t ecg_sample(uint64_t n);
+
+static const sim_stream_config_t stream_configs[] = {
+    {CHAR_TEMPERATURE_STREAMING, "temp", NXMIC_CODEC_PCM16, 10, 200,
+     temperature_sample},
+    {CHAR_STETHOSCOPE_STREAMING, "steth", NXMIC_CODEC_ADPCM, 4000, 0,
+     stethoscope_sample},
+    {CHAR_ECG_STREAMING, "ecg", NXMIC_CODEC_RICE, 500, 250, ecg_sample},
+};
+#define SIM_STREAM_COUNT \
+  (int)(sizeof(stream_configs) / sizeof(stream_configs[0]))
+
+static virtual_link_t sim_link;
+static sim_source_t sources[SIM_STREAM_COUNT];
+static sim_sink_t sinks[SIM_STREAM_COUNT];
+static sim_reader_t reader;
+static sim_gatt_t gatt;
+static nxmic_notifier_t notifier;  // Sensor's notifications
+static nxmic_att_table_t sensor_att;
+static bool benchmark_mode;
+static FILE *capture_file;  // -w, NULL if off
+static bool replaying;      // -y, no source to check the samples against
+static uint16_t bench_sequence;
+static nxmic_bench_t bench;
+static uint32_t export_size;  // Recording offloaded by -x, 0 if off
+static int32_t sensor_drift_ppm = 40;
+static uint8_t sensor_timesync_value[NXMIC_TIMESYNC_VALUE_SIZE];
+static nxmic_export_sender_t export_sender;
+static nxmic_export_receiver_t export_receiver;
+static uint64_t export_mismatched;  // Bytes differing from the recording
+
+static spsc_ring_t notification_ring;
+static uint8_t notification_ring_storage[SPSC_RING_STORAGE_SIZE(
+    NOTIFICATION_RING_SLOTS,
+    sizeof(nxmic_reader_record_t) + NXMIC_FRAME_MAX_SIZE)];
+static uint32_t ring_decoded;  // Slots decoded but still held by the gateway
+
+static uint16_t gateway_port;  // -g, 0 if off
+static int gateway_socket = -1;
+static nxmic_gateway_t gateway;
+static uint64_t gateway_start_us;  // Wall clock of virtual time 0
+
+
+static int16_t temperature_sample(uint64_t n) {
+  return (int16_t)(2500 + 50 * sin(2 * M_PI * n / 600.0));
+}
+
+static int16_t stethoscope_sample(uint64_t n) {
+  double t = n / 4000.0;
+  return (int16_t)(6000 * sin(2 * M_PI * 100 * t) +
+                   3000 * sin(2 * M_PI * 310 * t) + bench_noise(n));
+}
+
+static int16_t ecg_sample(uint64_t n) {
+  // 75 bpm at 500 Hz: QRS spike, then a T wave, over baseline wander
+  uint32_t phase = n % 400;
+  double value = 50 * sin(2 * M_PI * n / 2000.0) + bench_noise(n) / 16;
+  if (phase < 10) {
+    value += 150 * (phase < 5 ? phase : 10 - phase) * 2;
+  } else if (phase >= 100 && phase < 160) {
+    value += 200 * sin(M_PI * (phase - 100) / 60.0);
+  }
+  return (int16_t)value;
+}
+
+// The sensor's recording for -x: the ECG signal as 16-bit little-endian
+static uint8_t recording_byte(uint32_t offset) {
+  uint16_t sample = (uint16_t)ecg_sample(offset / 2);
+  return (uint8_t)(offset & 1 ? sample >> 8 : sample);
+}
+
+static uint16_t recording_read(void *context, uint32_t offset,
+                               uint8_t *buffer, uint16_t length) {
+  (void)context;
+  if (offset >= export_size) return 0;
+  if (length > export_size - offset) length = (uint16_t)(export_size - offset);
+  for (uint16_t i = 0; i < length; i++) buffer[i] = recording_byte(offset + i);
+  return length;
+}
+
+static void export_write(void *context, uint32_t offset, const uint8_t *data,
+                         uint16_t length) {
+  (void)context;
+  for (uint16_t i = 0; i < length; i++) {
+    if (data[i] != recording_byte(offset + i)) export_mismatched++;
+  }
+}
+
+// Sensor clock at reader time now_us. The sensor samples and stamps frames
+// with it, so everything on the sensor side runs in its time.
+static uint64_t sensor_time_us(uint64_t now_us) {
+  return SIM_SENSOR_BOOT_US + now_us +
+         (int64_t)now_us * sensor_drift_ppm / 1000000;
+}
+
+// Reader time of sensor time t_us, the inverse of sensor_time_us()
+static double reader_time_us(double t_us) {
+  return (t_us - SIM_SENSOR_BOOT_US) / (1 + sensor_drift_ppm / 1e6);
+}
+
+static int stream_index(gatt_characteristic_id_t char_id) {
+  for (int i = 0; i < SIM_STREAM_COUNT; i++) {
+    if (stream_configs[i].char_id == char_id) return i;
+  }
+  return -1;
+}
+
+static uint64_t sample_time_us(const sim_stream_config_t *config,
+                               uint64_t n) {
+  return n * 1000000 / config->sample_rate_hz;
+}
+
+// Inverse of sample_time_us() for the 32-bit frame timestamp
+static uint64_t sample_index(const sim_stream_config_t *config,
+                             uint32_t timestamp_us) {
+  return ((uint64_t)timestamp_us * config->sample_rate_hz + 999999) / 1000000;
+}
+
+static void source_reset(sim_source_t *source) {
+  source->first_pending = source->next_sample;
+  source->pending_count = 0;
+  source->connection_sequence = source->sequence;
+  nxmic_notify_reset(&notifier, source->value_handle);
+}
+
+// Sensor: generate samples up to now (sensor time) and queue every frame
+// that is due
+static void source_tick(int index, uint64_t now_us) {
+  const sim_stream_config_t *config = &stream_configs[index];
+  sim_source_t *source = &sources[index];
+  uint64_t end = now_us * config->sample_rate_hz / 1000000;
+  if (!virtual_link_notifications_enabled(&sim_link, config->char_id)) {
+    // nobody subscribed, like temp_stream_reset() on the sensor
+    source->next_sample = end;
+    source_reset(source);
+    return;
+  }
+  for (; source->next_sample < end; source->next_sample++) {
+    if (source->pending_count == SIM_PENDING_SAMPLES) {
+      size_t drop = SIM_PENDING_SAMPLES / 2;
+      memmove(source->pending, source->pending + drop,
+              (SIM_PENDING_SAMPLES - drop) * sizeof(int16_t));
+      source->pending_count -= drop;
+      source->first_pending += drop;
+      source->samples_dropped += drop;
+    }
+    source->pending[source->pending_count++] =
+        config->generate(source->next_sample);
+  }
+
+  uint16_t capacity = sim_link.config.mtu - 3;
+  size_t frame_samples = nxmic_encoder_frame_samples(
+      &source->encoder, capacity - NXMIC_FRAME_HEADER_SIZE);
+  while (source->pending_count) {
+    bool full = source->pending_count >= frame_samples;
+    bool due = config->flush_ms &&
+               now_us >= sample_time_us(config, source->first_pending) +
+                             config->flush_ms * 1000;
+    if (!full && !due) break;
+    // no frame is evicted to make room, every one queued goes out
+    if (notifier.queue.count == NXMIC_TXQ_SLOTS) {
+      source->blocked++;
+      break;  // retried next tick
+    }
+
+    nxmic_frame_builder_t builder;
+    nxmic_frame_begin(&builder, (uint8_t)config->char_id, config->codec,
+                      source->sequence,
+                      (uint32_t)sample_time_us(config, source->first_pending),
+                      capacity);
+    nxmic_encoder_t encoder = source->encoder;
+    size_t used;
+    size_t length = nxmic_encoder_encode(
+        &encoder, source->pending, source->pending_count,
+        nxmic_frame_payload(&builder), nxmic_frame_remaining(&builder), &used);
+    if (!length) break;
+    nxmic_frame_commit(&builder, (uint16_t)length, (uint16_t)used);
+    nxmic_txq_push(&notifier.queue, source->value_handle,
+                   NXMIC_TXQ_PRIORITY_NORMAL, false, 0, builder.buffer,
+                   builder.length, (uint32_t)now_us);
+    source->encoder = encoder;
+    memmove(source->pending, source->pending + used,
+            (source->pending_count - used) * sizeof(int16_t));
+    source->pending_count -= used;
+    source->first_pending += used;
+    source->sequence++;
+    source->frames_sent++;
+    source->samples_sent += used;
+  }
+}
+
+static bool export_uses_channel(void) {
+  return export_sender.transport == NXMIC_EXPORT_TRANSPORT_L2CAP &&
+         sim_link.coc_open;
+}
+
+// Benchmark stream: a full frame stamped with its send time
+static bool bench_send_frame(void) {
+  nxmic_frame_builder_t frame;
+  nxmic_frame_begin(&frame, CHAR_TEMPERATURE_STREAMING, NXMIC_CODEC_PCM16,
+                    bench_sequence,
+                    (uint32_t)sensor_time_us(sim_link.now_us),
+                    sim_link.config.mtu - 3);
+  while (!nxmic_frame_is_full(&frame, sizeof(int16_t))) {
+    nxmic_frame_append_int16(&frame, (int16_t)bench_sequence);
+  }
+  if (!virtual_link_notify(
+          &sim_link,
+          virtual_link_value_handle(&sim_link, CHAR_TEMPERATURE_STREAMING),
+          frame.buffer, frame.length))
+    return false;
+  bench_sequence++;
+  return true;
+}
+
+// Export chunk on CHAR_DATA_EXPORT, when the export is not on the channel
+static bool export_send_chunk(void) {
+  static uint8_t chunk[NXMIC_FRAME_MAX_SIZE];
+  uint16_t max_length = sim_link.config.mtu - 3;
+  if (max_length > sizeof(chunk)) max_length = sizeof(chunk);
+  uint16_t length =
+      nxmic_export_sender_build(&export_sender, chunk, max_length);
+  if (!length ||
+      !virtual_link_notify(
+          &sim_link, virtual_link_value_handle(&sim_link, CHAR_DATA_EXPORT),
+          chunk, length))
+    return false;
+  nxmic_export_sender_sent(&export_sender);
+  return true;
+}
+
+// Export SDUs as fast as the channel takes them; over notifications the
+// chunks go out from the notifier's fill
+static void export_tick(void) {
+  static uint8_t sdu[NXMIC_EXPORT_SDU_SIZE];
+  if (!export_uses_channel()) return;
+  uint16_t max_length =
+      sim_link.coc_mtu < sizeof(sdu) ? sim_link.coc_mtu : sizeof(sdu);
+  uint16_t length;
+  while ((length = nxmic_export_sender_build(&export_sender, sdu,
+                                             max_length))) {
+    if (!virtual_link_coc_send(&sim_link, sdu, length)) break;
+    nxmic_export_sender_sent(&export_sender);
+  }
+}
+
+// The sensor's notifier on the virtual link, as server_common.c's is on
+// BTstack's ATT server
+static bool sensor_notify(void *context, uint16_t handle,
+                          const uint8_t *value, uint16_t length) {
+  (void)context;
+  return virtual_link_notify(&sim_link, handle, value, length);
+}
+
+static bool sensor_can_notify(void *context) {
+  (void)context;
+  return virtual_link_can_notify(&sim_link);
+}
+
+// After the queue and the retransmissions: benchmark filler, or the export
+static bool sensor_fill(void *context) {
+  (void)context;
+  if (benchmark_mode) return bench_send_frame();
+  return export_size && !export_uses_channel() && export_send_chunk();
+}
+
+static bool sensor_fill_pending(void *context) {
+  (void)context;
+  if (benchmark_mode)
+    return virtual_link_notifications_enabled(&sim_link,
+                                              CHAR_TEMPERATURE_STREAMING);
+  return export_size && !export_uses_channel() &&
+         nxmic_export_sender_pending(&export_sender);
+}
+
+// Sensor side of CHAR_TIMESTAMP and CHAR_DATA_EXPORT, as the firmware's
+// ATT handlers
+static int sensor_timestamp_write(uint16_t con_handle, const uint8_t *value,
+                                  uint16_t length) {
+  (void)con_handle;
+  if (!nxmic_timesync_encode_value(value, length,
+                                   (uint32_t)sensor_time_us(sim_link.now_us),
+                                   sensor_timesync_value))
+    return NXMIC_ATT_ERROR_INVALID_ATTRIBUTE_VALUE_LENGTH;
+  return 0;
+}
+
+static int sensor_export_write(uint16_t con_handle, const uint8_t *value,
+                               uint16_t length) {
+  (void)con_handle;
+  if (!nxmic_export_sender_handle_write(&export_sender, value, length))
+    nxmic_notify_handle_nack(&notifier, value, length);
+  return 0;
+}
+
+static const nxmic_att_handler_t sensor_timestamp_handler = {
+    .value = sensor_timesync_value,
+    .size = sizeof(sensor_timesync_value),
+    .write = sensor_timestamp_write,
+};
+static const nxmic_att_handler_t sensor_export_handler = {
+    .write = sensor_export_write,
+};
+
+static void sensor_write_handler(void *context, uint16_t value_handle,
+                                 const uint8_t *value, uint16_t value_length) {
+  (void)context;
+  nxmic_att_write(&sensor_att, value_handle, 0, value, value_length);
+}
+
+static uint16_t sensor_read_handler(void *context, uint16_t value_handle,
+                                    uint8_t *buffer, uint16_t buffer_size) {
+  (void)context;
+  uint8_t scratch[NXMIC_ATT_BUILD_MAX];
+  uint16_t length;
+  const uint8_t *value =
+      nxmic_att_value(&sensor_att, value_handle, scratch, &length);
+  if (!value || length > buffer_size) return 0;
+  memcpy(buffer, value, length);
+  return length;
+}
+
+// Sensor: ATT dispatch and notifier for a fresh link
+static void sensor_init(void) {
+  nxmic_att_init(&sensor_att);
+  nxmic_att_register(&sensor_att,
+                     virtual_link_value_handle(&sim_link, CHAR_TIMESTAMP),
+                     &sensor_timestamp_handler);
+  nxmic_att_register(&sensor_att,
+                     virtual_link_value_handle(&sim_link, CHAR_DATA_EXPORT),
+                     &sensor_export_handler);
+  virtual_link_set_write_handler(&sim_link, sensor_write_handler, NULL);
+  virtual_link_set_read_handler(&sim_link, sensor_read_handler, NULL);
+  nxmic_notify_init(&notifier, sensor_notify, sensor_can_notify, 0, NULL);
+  nxmic_notify_set_fill(&notifier, sensor_fill, sensor_fill_pending);
+  for (int i = 0; i < SIM_STREAM_COUNT; i++) {
+    gatt_characteristic_id_t char_id = stream_configs[i].char_id;
+    sources[i].value_handle = virtual_link_value_handle(&sim_link, char_id);
+    sources[i].retx = nxmic_notify_add_stream(
+        &notifier, sources[i].value_handle, (uint8_t)char_id);
+  }
+}
+
+// Link callback, same split as the firmware reader: copy into the ring here,
+// decode in the main loop
+static void queue_notification(void *context, gatt_characteristic_id_t char_id,
+                               const uint8_t *value, uint16_t value_length) {
+  (void)context;
+  nxmic_reader_record_t record = {
+      .char_id = (uint8_t)char_id,
+      .arrival_us = (uint32_t)sim_link.now_us,
+      .connection = reader.connection,
+  };
+  nxmic_reader_queue(&notification_ring, &record, value, value_length);
+}
+
+static void link_notification_handler(void *context, uint16_t value_handle,
+                                      const uint8_t *value,
+                                      uint16_t value_length) {
+  sim_reader_t *r = (sim_reader_t *)context;
+  if (capture_file && !export_size) {
+    uint8_t header[CAPTURE_RECORD_HEADER_SIZE] = {
+        (uint8_t)value_handle, (uint8_t)(value_handle >> 8),
+        (uint8_t)value_length, (uint8_t)(value_length >> 8)};
+    fwrite(header, 1, sizeof(header), capture_file);
+    fwrite(value, 1, value_length, capture_file);
+  }
+  nxmic_reader_on_notification(&r->gatt, value_handle, value, value_length,
+                               (uint32_t)sim_link.now_us);
+}
+
+static void link_sdu_handler(void *context, const uint8_t *sdu,
+                             uint16_t length) {
+  (void)context;
+  nxmic_export_receiver_on_notification(&export_receiver, sdu, length,
+                                        (uint32_t)sim_link.now_us);
+}
+
+static void sink_frame(int index, const nxmic_frame_header_t *frame,
+                       const int16_t *samples, int count,
+                       uint16_t payload_length) {
+  const sim_stream_config_t *config = &stream_configs[index];
+  sim_sink_t *sink = &sinks[index];
+  sink->frames++;
+  sink->samples += count;
+  sink->payload_bytes += payload_length;
+  if (replaying) return;
+
+  uint64_t first = sample_index(config, frame->base_timestamp_us);
+  for (int i = 0; i < count; i++) {
+    int16_t expected = config->generate(first + i);
+    double error = samples[i] - expected;
+    sink->signal_energy += (double)expected * expected;
+    sink->error_energy += error * error;
+    if (config->codec != NXMIC_CODEC_ADPCM && samples[i] != expected)
+      sink->mismatched++;
+  }
+
+  // per-sample reader times from the frame base and the fitted clock
+  const nxmic_timesync_t *ts = &reader.gatt.timesync;
+  if (!ts->valid) return;
+  uint32_t period_ns = 1000000000u / config->sample_rate_hz;
+  for (int i = 0; i < count; i++) {
+    uint32_t t = nxmic_timesync_sample_time(ts, frame->base_timestamp_us,
+                                            (uint32_t)i, period_ns);
+    // the first samples can predate the reader, t then wraps
+    double truth = reader_time_us((double)sample_time_us(config, first + i));
+    double error = fabs((int32_t)(t - (uint32_t)(int64_t)floor(truth)) -
+                        (truth - floor(truth)));
+    sink->timed++;
+    if (error > ts->error_us) sink->outside_bound++;
+    if (error > sink->max_time_error_us) sink->max_time_error_us = error;
+  }
+}
+
+// The gateway's clock is the wall clock, lined up with virtual time by
+// pace_to_real_time()
+static uint32_t gateway_time_us(void) {
+  return (uint32_t)(bench_now_ns() / 1000 - gateway_start_us);
+}
+
+static void gateway_poll_acks(void) {
+  uint8_t ack[NXMIC_GATEWAY_ACK_SIZE + 1];
+  ssize_t length;
+  while ((length = recv(gateway_socket, ack, sizeof(ack), MSG_DONTWAIT)) > 0)
+    nxmic_gateway_on_ack(&gateway, ack, (uint16_t)length, gateway_time_us());
+}
+
+// Wait for the wall clock to catch up with virtual time, taking acks as
+// they come so their round trips are not rounded up to a tick
+static void pace_to_real_time(uint64_t now_us) {
+  uint64_t wall_us;
+  while ((wall_us = bench_now_ns() / 1000 - gateway_start_us) < now_us) {
+    struct pollfd fd = {.fd = gateway_socket, .events = POLLIN};
+    int timeout_ms = (int)((now_us - wall_us + 999) / 1000);
+    if (poll(&fd, 1, timeout_ms) > 0) gateway_poll_acks();
+  }
+}
+
+// One datagram with sendmsg(), the entries straight from the ring slots
+static bool gateway_send(void *context, const uint8_t *header,
+                         const nxmic_gateway_chunk_t *entries, uint8_t count,
+                         uint16_t length) {
+  struct sockaddr_in *sink = context;
+  struct iovec iov[1 + NXMIC_GATEWAY_MAX_ENTRIES];
+  iov[0].iov_base = (void *)header;
+  iov[0].iov_len = NXMIC_GATEWAY_HEADER_SIZE;
+  for (uint8_t i = 0; i < count; i++) {
+    iov[1 + i].iov_base = (void *)entries[i].data;
+    iov[1 + i].iov_len = entries[i].length;
+  }
+  struct msghdr message = {
+      .msg_name = sink,
+      .msg_namelen = sizeof(*sink),
+      .msg_iov = iov,
+      .msg_iovlen = 1 + count,
+  };
+  return sendmsg(gateway_socket, &message, 0) == length;
+}
+
+static bool gateway_open(void) {
+  static struct sockaddr_in sink;
+  sink.sin_family = AF_INET;
+  sink.sin_port = htons(gateway_port);
+  sink.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  gateway_socket = socket(AF_INET, SOCK_DGRAM, 0);
+  if (gateway_socket < 0) return false;
+  nxmic_gateway_init(&gateway, SIM_GATEWAY_FLUSH_US, gateway_send, &sink);
+  return true;
+}
+
+// Done with the first count slots; the gateway holds on to them until
+// their datagram is sent
+static void release_notifications(uint32_t count) {
+  if (gateway_socket < 0) {
+    spsc_ring_release(&notification_ring, count);
+    ring_decoded = 0;
+    return;
+  }
+  ring_decoded = count - nxmic_gateway_service(&gateway, &notification_ring,
+                                               count, gateway_time_us());
+  gateway_poll_acks();
+}
+
+static void process_notifications(void) {
+  static int16_t decoded[NXMIC_CODEC_MAX_SAMPLES];
+  uint32_t count = spsc_ring_available(&notification_ring);
+  for (uint32_t i = ring_decoded; i < count; i++) {
+    nxmic_reader_record_t record;
+    nxmic_frame_header_t frame;
+    const uint8_t *payload;
+    uint16_t payload_length;
+    bool parsed = nxmic_reader_peek(&notification_ring, i, &record, &frame,
+                                    &payload, &payload_length);
+    int index = stream_index((gatt_characteristic_id_t)record.char_id);
+    if (index < 0) continue;
+    int sample_count = -1;
+    if (parsed) {
+      nxmic_bench_record(&bench, &frame, record.length, payload_length,
+                         record.arrival_us);
+      if (benchmark_mode) continue;
+      if (!sinks[index].gaps.synced && !replaying) {
+        sinks[index].unseen +=
+            (uint16_t)(frame.sequence - sources[index].connection_sequence);
+      }
+      if (!nxmic_gap_on_frame(&sinks[index].gaps, frame.sequence)) continue;
+      sample_count = nxmic_codec_decode(&frame, payload, payload_length,
+                                        decoded, NXMIC_CODEC_MAX_SAMPLES);
+    }
+    if (sample_count < 0) {
+      sinks[index].corrupt++;
+      continue;
+    }
+    sink_frame(index, &frame, decoded, sample_count, payload_length);
+  }
+  release_notifications(count);
+}
+
+static void request_missing_frames(sim_reader_t *r) {
+  for (int i = 0; i < SIM_STREAM_COUNT; i++) {
+    nxmic_reader_request_frames(&r->gatt, stream_configs[i].char_id,
+                                &sinks[i].gaps, (uint32_t)sim_link.now_us);
+  }
+}
+
+// The profile select_link_profile() in client.c would put the link on, from
+// what the streams delivered over the last window. The virtual link keeps
+// its parameters, only the choice is checked.
+static void select_link_profile(sim_reader_t *r) {
+  uint64_t period_us = sim_link.now_us - r->profile_window_us;
+  if (period_us < SIM_PROFILE_WINDOW_US) return;
+  uint32_t bytes = nxmic_stream_total_bytes(&r->gatt.streams);
+  bool fits = nxmic_stream_fits_low_power(bytes - r->profile_window_bytes,
+                                          (uint32_t)(period_us / 1000),
+                                          r->low_power);
+  r->low_power = fits;
+  r->profile_windows++;
+  if (fits) r->low_power_windows++;
+  r->profile_window_us = sim_link.now_us;
+  r->profile_window_bytes = bytes;
+}
+
+static const char *profile_name(bool low_power) {
+  return low_power ? "low power" : "high throughput";
+}
+
+// The temperature stream alone, as a sensor with nothing else to send would
+// deliver it, must fit the low-power profile; the simulated sensor must not
+// be put on it in any window
+static bool check_link_profiles(double seconds) {
+  bool temperature_only = false;
+  for (int i = 0; i < SIM_STREAM_COUNT; i++) {
+    if (stream_configs[i].char_id != CHAR_TEMPERATURE_STREAMING) continue;
+    uint64_t bytes =
+        sinks[i].payload_bytes + sinks[i].frames * NXMIC_FRAME_HEADER_SIZE;
+    temperature_only = nxmic_stream_fits_low_power(
+        (uint32_t)bytes, (uint32_t)(seconds * 1000), false);
+  }
+  printf("reader link profile: low power in %lu of %lu windows, "
+         "temperature alone %s\n",
+         (unsigned long)reader.low_power_windows,
+         (unsigned long)reader.profile_windows, profile_name(temperature_only));
+  return temperature_only && reader.low_power_windows == 0;
+}
+
+// The reader's GATT client procedures on the virtual link. Each runs at
+// once and leaves its results in gatt for pump_gatt().
+static bool gatt_start(sim_gatt_procedure_t procedure) {
+  if (gatt.procedure != SIM_GATT_IDLE) return false;
+  memset(&gatt, 0, sizeof(gatt));
+  gatt.procedure = procedure;
+  return true;
+}
+
+static bool sim_read_database_hash(void *context) {
+  (void)context;
+  if (!gatt_start(SIM_GATT_READ)) return false;
+  gatt.ok = virtual_link_read_database_hash(&sim_link, gatt.value);
+  gatt.length = gatt.ok ? 16 : 0;
+  return true;
+}
+
+static bool sim_discover_service(void *context, const uint8_t *uuid128) {
+  (void)context;
+  if (!gatt_start(SIM_GATT_SERVICE)) return false;
+  gatt.ok = virtual_link_discover_service(&sim_link, uuid128,
+                                          &gatt.start_handle,
+                                          &gatt.end_handle);
+  return true;
+}
+
+static bool sim_discover_characteristics(void *context, uint16_t start_handle,
+                                         uint16_t end_handle) {
+  (void)context;
+  (void)start_handle;
+  (void)end_handle;
+  if (!gatt_start(SIM_GATT_CHARACTERISTICS)) return false;
+  gatt.count = virtual_link_discover_characteristics(
+      &sim_link, gatt.characteristics, CHAR_COUNT);
+  gatt.ok = gatt.count > 0;
+  return true;
+}
+
+static bool sim_read_cccds(void *context, uint16_t start_handle,
+                           uint16_t end_handle) {
+  (void)context;
+  (void)start_handle;
+  (void)end_handle;
+  if (!gatt_start(SIM_GATT_CCCDS)) return false;
+  gatt.count = virtual_link_read_cccds(&sim_link, gatt.cccds, CHAR_COUNT);
+  gatt.ok = gatt.count > 0;
+  return true;
+}
+
+// Without a CCCD from the sweep, the one in the characteristic's range
+static bool sim_write_cccd(void *context,
+                           const nxmic_reader_characteristic_t *c) {
+  (void)context;
+  uint16_t cccd = c->cccd_handle;
+  if (!cccd) {
+    uint16_t cccds[CHAR_COUNT];
+    int count = virtual_link_read_cccds(&sim_link, cccds, CHAR_COUNT);
+    for (int i = 0; i < count; i++) {
+      if (cccds[i] > c->value_handle && cccds[i] <= c->end_handle)
+        cccd = cccds[i];
+    }
+    if (!cccd) return false;
+  }
+  if (!gatt_start(SIM_GATT_WRITE)) return false;
+  gatt.ok = virtual_link_write_cccd(&sim_link, cccd, true);
+  return true;
+}
+
+static bool sim_write(void *context, uint16_t value_handle,
+                      const uint8_t *value, uint16_t length) {
+  (void)context;
+  if (!gatt_start(SIM_GATT_WRITE)) return false;
+  gatt.ok = virtual_link_write(&sim_link, value_handle, value, length);
+  return true;
+}
+
+static bool sim_read(void *context, uint16_t value_handle) {
+  (void)context;
+  if (!gatt_start(SIM_GATT_READ)) return false;
+  gatt.value_handle = value_handle;
+  gatt.length = virtual_link_read(&sim_link, value_handle, gatt.value,
+                                  sizeof(gatt.value));
+  gatt.ok = gatt.length != 0;
+  return true;
+}
+
+static bool sim_write_without_response(void *context, uint16_t value_handle,
+                                       const uint8_t *value,
+                                       uint16_t length) {
+  (void)context;
+  return virtual_link_write_without_response(&sim_link, value_handle, value,
+                                             length);
+}
+
+// The reader's cache holds the one simulated sensor
+static bool sim_cache_load(void *context, nxmic_reader_handles_t *handles) {
+  sim_reader_t *r = (sim_reader_t *)context;
+  if (!r->cache_valid) return false;
+  *handles = r->cache;
+  return true;
+}
+
+static void sim_cache_store(void *context,
+                            const nxmic_reader_handles_t *handles) {
+  sim_reader_t *r = (sim_reader_t *)context;
+  r->cache = *handles;
+  r->cache_valid = true;
+}
+
+static void sim_schedule_timesync(void *context, uint32_t delay_ms) {
+  sim_reader_t *r = (sim_reader_t *)context;
+  r->next_sync_us = sim_link.now_us + (uint64_t)delay_ms * 1000;
+}
+
+static void sim_bound(void *context) {
+  sim_reader_t *r = (sim_reader_t *)context;
+  // every connection starts on the fast profile
+  r->low_power = false;
+  r->profile_window_us = sim_link.now_us;
+  r->profile_window_bytes = 0;
+}
+
+static void record_latency(sim_latency_t *latency, uint64_t us) {
+  latency->count++;
+  latency->total_us += us;
+  if (us > latency->max_us) latency->max_us = us;
+}
+
+static void sim_ready(void *context) {
+  sim_reader_t *r = (sim_reader_t *)context;
+  if (export_size) {
+    if (export_receiver.transport == NXMIC_EXPORT_TRANSPORT_L2CAP &&
+        !virtual_link_coc_open(&sim_link, NXMIC_EXPORT_PSM,
+                               NXMIC_EXPORT_SDU_SIZE, link_sdu_handler, r)) {
+      r->failed = true;
+      return;
+    }
+    nxmic_export_receiver_resume(&export_receiver);
+  }
+  record_latency(r->gatt.cached ? &r->cached_latency : &r->cold_latency,
+                 sim_link.now_us - r->connect_us);
+  for (int i = 0; i < SIM_STREAM_COUNT; i++) nxmic_gap_reset(&sinks[i].gaps);
+}
+
+static void sim_failed(void *context) {
+  sim_reader_t *r = (sim_reader_t *)context;
+  r->failed = true;
+}
+
+static const nxmic_reader_ops_t sim_reader_ops = {
+    .read_database_hash = sim_read_database_hash,
+    .discover_service = sim_discover_service,
+    .discover_characteristics = sim_discover_characteristics,
+    .read_cccds = sim_read_cccds,
+    .write_cccd = sim_write_cccd,
+    .write = sim_write,
+    .read = sim_read,
+    .write_without_response = sim_write_without_response,
+    .cache_load = sim_cache_load,
+    .cache_store = sim_cache_store,
+    .schedule_timesync = sim_schedule_timesync,
+    .bound = sim_bound,
+    .ready = sim_ready,
+    .failed = sim_failed,
+};
+
+// Hand the reader the results of the procedure in flight, and of the ones
+// it starts from them, until none is left
+static void pump_gatt(sim_reader_t *r) {
+  while (gatt.procedure != SIM_GATT_IDLE) {
+    sim_gatt_t result = gatt;
+    gatt.procedure = SIM_GATT_IDLE;
+    switch (result.procedure) {
+      case SIM_GATT_SERVICE:
+        if (result.ok)
+          nxmic_reader_on_service(&r->gatt, result.start_handle,
+                                  result.end_handle);
+        break;
+      case SIM_GATT_CHARACTERISTICS:
+        for (int i = 0; i < result.count; i++) {
+          const virtual_link_characteristic_t *c = &result.characteristics[i];
+          nxmic_reader_characteristic_t characteristic = {
+              .start_handle = c->start_handle,
+              .value_handle = c->value_handle,
+              .end_handle = c->end_handle,
+              .properties = c->properties,
+          };
+          nxmic_reader_on_characteristic(&r->gatt, c->uuid128,
+                                         &characteristic);
+        }
+        break;
+      case SIM_GATT_CCCDS: {
+        static const uint8_t off[2] = {0, 0};
+        for (int i = 0; i < result.count; i++)
+          nxmic_reader_on_value(&r->gatt, result.cccds[i], off, sizeof(off));
+        break;
+      }
+      case SIM_GATT_READ:
+        if (result.ok)
+          nxmic_reader_on_value(&r->gatt, result.value_handle, result.value,
+                                result.length);
+        break;
+      default:
+        break;
+    }
+    nxmic_reader_on_complete(&r->gatt, result.ok ? 0 : SIM_ATT_ERROR,
+                             (uint32_t)sim_link.now_us);
+  }
+}
+
+// Reader: connection up to every stream enabled
+static bool reader_connect(sim_reader_t *r) {
+  r->connect_us = sim_link.now_us;
+  r->failed = false;
+  r->next_sync_us = UINT64_MAX;
+  virtual_link_connect(&sim_link);
+  r->connection++;
+  nxmic_reader_connect(&r->gatt);
+  pump_gatt(r);
+  return nxmic_reader_ready(&r->gatt) && !r->failed;
+}
+
+static void print_latency(const char *name, const sim_latency_t *latency) {
+  if (!latency->count) return;
+  printf("%s connects: %u, avg %.1f ms, max %.1f ms\n", name,
+         (unsigned)latency->count,
+         latency->total_us / 1000.0 / latency->count,
+         latency->max_us / 1000.0);
+}
+
+static void print_report(double seconds) {
+  const virtual_link_stats_t *stats = &sim_link.stats;
+  printf("link: mtu %u, interval %.2f ms, %u octets/PDU, %u Mbps PHY, "
+         "%u PDUs/event\n",
+         sim_link.config.mtu, sim_link.config.conn_interval_us / 1000.0,
+         sim_link.config.max_tx_octets, sim_link.config.phy_mbps,
+         sim_link.config.max_packets_per_event);
+  printf("link: %u notifications (%.0f/s), %.0f B/s ATT payload, %u PDUs, "
+         "%u events, %u queue full, %u lost on disconnect, %u dropped, "
+         "%u writes\n",
+         (unsigned)stats->notifications, stats->notifications / seconds,
+         stats->bytes / seconds, (unsigned)stats->pdus, (unsigned)stats->events,
+         (unsigned)stats->queue_full, (unsigned)stats->lost,
+         (unsigned)stats->dropped, (unsigned)stats->writes);
+  printf("notification ring: high water %u/%d, overflows %u\n",
+         (unsigned)notification_ring.high_water, NOTIFICATION_RING_SLOTS,
+         (unsigned)atomic_load(&notification_ring.overflows));
+  print_latency("cold", &reader.cold_latency);
+  print_latency("cached", &reader.cached_latency);
+  const nxmic_timesync_t *ts = &reader.gatt.timesync;
+  if (ts->valid) {
+    printf("clock sync: %lu rounds, drift %.3f ppm fitted (%d ppm true), "
+           "error bound +/-%lu us\n",
+           (unsigned long)ts->total_rounds, ts->drift_ppb / 1000.0,
+           (int)sensor_drift_ppm, (unsigned long)ts->error_us);
+  }
+
+  for (int i = 0; i < SIM_STREAM_COUNT && !export_size; i++) {
+    const sim_source_t *source = &sources[i];
+    const sim_sink_t *sink = &sinks[i];
+    double snr = sink->error_energy > 0
+                     ? 10 * log10(sink->signal_energy / sink->error_energy)
+                     : INFINITY;
+    printf("%-6s sent %lu frames/%lu samples, dropped %lu, blocked %lu | "
+           "received %lu frames/%lu samples, %.0f B/s payload, "
+           "%.2f bits/sample, lost %lu (recovered %lu, unrecoverable %lu), "
+           "lost at reconnects %lu, retransmitted %lu, duplicates %lu, "
+           "corrupt %lu, mismatched %lu, "
+           "SNR %.1f dB, sample time error max %.0f us (%lu/%lu outside "
+           "the bound)\n",
+           stream_configs[i].name, (unsigned long)source->frames_sent,
+           (unsigned long)source->samples_sent,
+           (unsigned long)source->samples_dropped,
+           (unsigned long)source->blocked, (unsigned long)sink->frames,
+           (unsigned long)sink->samples, sink->payload_bytes / seconds,
+           sink->samples ? 8.0 * sink->payload_bytes / sink->samples : 0.0,
+           (unsigned long)sink->gaps.gaps, (unsigned long)sink->gaps.recovered,
+           (unsigned long)sink->gaps.unrecoverable,
+           (unsigned long)sink->unseen,
+           (unsigned long)source->retx->retransmitted,
+           (unsigned long)sink->gaps.duplicates, (unsigned long)sink->corrupt,
+           (unsigned long)sink->mismatched, snr, sink->max_time_error_us,
+           (unsigned long)sink->outside_bound, (unsigned long)sink->timed);
+  }
+}
+
+static double megabytes_per_minute(uint32_t bytes, uint64_t us) {
+  return us ? bytes / 1e6 * 60e6 / us : 0.0;
+}
+
+static const char *const transport_names[] = {
+    [NXMIC_EXPORT_TRANSPORT_GATT] = "notifications",
+    [NXMIC_EXPORT_TRANSPORT_L2CAP] = "L2CAP channel",
+};
+
+// Offload result over one transport, returns its MB/min
+static double print_export_report(uint64_t export_us) {
+  const nxmic_export_receiver_t *rx = &export_receiver;
+  static const char *const states[] = {"idle", "running", "done, CRC ok",
+                                        "CRC-32 MISMATCH"};
+  const virtual_link_stats_t *stats = &sim_link.stats;
+  double rate = megabytes_per_minute(rx->bytes, export_us);
+  printf("export over %s: %lu/%lu bytes in %.2f s, %.2f MB/min, "
+         "%lu chunks, %lu LL PDUs, %lu restarts, %lu crc errors, "
+         "%lu out of order, %lu mismatched, %s\n",
+         transport_names[rx->transport], (unsigned long)rx->bytes,
+         (unsigned long)export_size, export_us / 1e6, rate,
+         (unsigned long)rx->chunks, (unsigned long)stats->pdus,
+         (unsigned long)rx->restarts, (unsigned long)rx->crc_errors,
+         (unsigned long)rx->out_of_order, (unsigned long)export_mismatched,
+         states[rx->state]);
+  return rate;
+}
+
+// The same recording read with Read Blob on a fresh connection
+static void print_read_blob_report(const virtual_link_config_t *config,
+                                   const double *export_rates) {
+  virtual_link_t blob_link;
+  virtual_link_init(&blob_link, config);
+  virtual_link_connect(&blob_link);
+  virtual_link_read_long(&blob_link, export_size);
+  uint64_t blob_us = blob_link.now_us;
+  double rate = megabytes_per_minute(export_size, blob_us);
+  printf("read blob: %lu bytes in %.2f s, %.2f MB/min, %lu requests "
+         "(notifications %.1fx, L2CAP channel %.1fx the rate)\n",
+         (unsigned long)export_size, blob_us / 1e6, rate,
+         (unsigned long)blob_link.stats.att_requests,
+         export_rates[NXMIC_EXPORT_TRANSPORT_GATT] / rate,
+         export_rates[NXMIC_EXPORT_TRANSPORT_L2CAP] / rate);
+}
+
+static uint16_t get_le16(const uint8_t *p) {
+  return (uint16_t)(p[0] | p[1] << 8);
+}
+
+// Before the first notification of a capture: the handles it is routed by
+static void write_capture_handles(const sim_reader_t *r) {
+  uint8_t header[CAPTURE_HEADER_SIZE];
+  for (int i = 0; i < CHAR_COUNT; i++) {
+    uint16_t handle =
+        nxmic_stream_value_handle(&r->gatt.streams,
+                                  (gatt_characteristic_id_t)i);
+    header[2 * i] = (uint8_t)handle;
+    header[2 * i + 1] = (uint8_t)(handle >> 8);
+  }
+  fwrite(header, 1, sizeof(header), capture_file);
+}
+
+// -y: the capture rounds times through the reader's path. Each round
+// starts with fresh gap trackers, so frames are not taken for duplicates
+// of the round before. The ring is drained once half full, as the
+// reader's main loop would between connection events.
+static bool replay(const char *path, uint32_t rounds) {
+  FILE *file = fopen(path, "rb");
+  if (!file) return false;
+  static uint8_t capture[64 * 1024 * 1024];
+  size_t size = fread(capture, 1, sizeof(capture), file);
+  bool complete = feof(file);
+  fclose(file);
+  if (!complete || size < CAPTURE_HEADER_SIZE) return false;
+
+  replaying = true;
+  nxmic_reader_init(&reader.gatt, &sim_reader_ops, &reader);
+  for (int i = 0; i < CHAR_COUNT; i++) {
+    uint16_t handle = get_le16(&capture[2 * i]);
+    if (handle && nxmic_stream_is_streaming((gatt_characteristic_id_t)i))
+      nxmic_stream_bind(&reader.gatt.streams, (gatt_characteristic_id_t)i,
+                        handle);
+  }
+  uint32_t notifications = 0;
+  for (size_t at = CAPTURE_HEADER_SIZE; at < size; notifications++) {
+    if (size - at < CAPTURE_RECORD_HEADER_SIZE) return false;
+    uint16_t length = get_le16(&capture[at + 2]);
+    if (length > NXMIC_FRAME_MAX_SIZE ||
+        size - at - CAPTURE_RECORD_HEADER_SIZE < length)
+      return false;
+    at += CAPTURE_RECORD_HEADER_SIZE + length;
+  }
+  for (int i = 0; i < SIM_STREAM_COUNT; i++)
+    nxmic_stream_set_handler(stream_configs[i].char_id, queue_notification);
+  spsc_ring_init(&notification_ring, notification_ring_storage,
+                 NOTIFICATION_RING_SLOTS,
+                 sizeof(nxmic_reader_record_t) + NXMIC_FRAME_MAX_SIZE);
+  nxmic_bench_init(&bench, false);
+
+  uint64_t total_ns = 0, process_ns = 0;
+  for (uint32_t round = 0; round < rounds; round++) {
+    memset(sinks, 0, sizeof(sinks));
+    for (int i = 0; i < SIM_STREAM_COUNT; i++) nxmic_gap_init(&sinks[i].gaps);
+    reader.gatt.streams.unrouted = 0;
+    uint64_t start_ns = bench_now_ns();
+    for (size_t at = CAPTURE_HEADER_SIZE; at < size;) {
+      uint16_t value_handle = get_le16(&capture[at]);
+      uint16_t length = get_le16(&capture[at + 2]);
+      nxmic_reader_on_notification(&reader.gatt, value_handle,
+                                   &capture[at + CAPTURE_RECORD_HEADER_SIZE],
+                                   length, 0);
+      at += CAPTURE_RECORD_HEADER_SIZE + length;
+      if (spsc_ring_available(&notification_ring) >=
+          NOTIFICATION_RING_SLOTS / 2) {
+        uint64_t process_start_ns = bench_now_ns();
+        process_notifications();
+        process_ns += bench_now_ns() - process_start_ns;
+      }
+    }
+    uint64_t process_start_ns = bench_now_ns();
+    process_notifications();
+    uint64_t end_ns = bench_now_ns();
+    process_ns += end_ns - process_start_ns;
+    total_ns += end_ns - start_ns;
+  }
+
+  uint64_t replayed = (uint64_t)rounds * notifications;
+  uint64_t corrupt = 0;
+  printf("replay of %s: %u notifications x %u rounds, %.1f ns per "
+         "notification (routing and ring %.1f ns, decoding %.1f ns), "
+         "%u unrouted, ring overflows %u\n",
+         path, (unsigned)notifications, (unsigned)rounds,
+         replayed ? (double)total_ns / replayed : 0.0,
+         replayed ? (double)(total_ns - process_ns) / replayed : 0.0,
+         replayed ? (double)process_ns / replayed : 0.0,
+         (unsigned)reader.gatt.streams.unrouted,
+         (unsigned)atomic_load(&notification_ring.overflows));
+  for (int i = 0; i < SIM_STREAM_COUNT; i++) {
+    const sim_sink_t *sink = &sinks[i];
+    corrupt += sink->corrupt;
+    if (!sink->frames && !sink->corrupt) continue;
+    printf("%-6s %lu frames/%lu samples a round, lost %lu, duplicates %lu, "
+           "corrupt %lu\n",
+           stream_configs[i].name, (unsigned long)sink->frames,
+           (unsigned long)sink->samples, (unsigned long)sink->gaps.gaps,
+           (unsigned long)sink->gaps.duplicates, (unsigned long)sink->corrupt);
+  }
+  return reader.gatt.streams.unrouted == 0 && corrupt == 0 &&
+         atomic_load(&notification_ring.overflows) == 0;
+}
+// Frames sent on the connection after the last one the reader received,
+// lost with the controller queue or never delivered
+static uint16_t unseen_tail(int index) {
+  const sim_source_t *source = &sources[index];
+  const nxmic_gap_tracker_t *gaps = &sinks[index].gaps;
+  return (uint16_t)(source->sequence - (gaps->synced
+                                            ? gaps->next_sequence
+                                            : source->connection_sequence));
+}
+
+// The sensor stops sampling; the link runs until the frames queued, the
+// retransmissions and the reader's requests for missing frames are through
+static void drain_link(void) {
+  uint64_t sensor_end_us = sensor_time_us(sim_link.now_us);
+  uint64_t deadline_us = sim_link.now_us + SIM_DRAIN_US;
+  while (sim_link.now_us < deadline_us) {
+    bool pending =
+        sim_link.queue_count != 0 || nxmic_notify_pending(&notifier);
+    for (int i = 0; i < SIM_STREAM_COUNT; i++)
+      pending = pending || sinks[i].gaps.missing_count;
+    if (!pending) break;
+    for (int i = 0; i < SIM_STREAM_COUNT; i++) source_tick(i, sensor_end_us);
+    nxmic_notify_run(&notifier, (uint32_t)sensor_end_us);
+    virtual_link_run_until(&sim_link, sim_link.now_us + SIM_TICK_US);
+    process_notifications();
+    request_missing_frames(&reader);
+  }
+  for (int i = 0; i < SIM_STREAM_COUNT; i++) sinks[i].unseen += unseen_tail(i);
+}
+
+// Every frame sent was received, given up on, or lost out of sight
+static bool check_frames(void) {
+  bool ok = true;
+  for (int i = 0; i < SIM_STREAM_COUNT; i++) {
+    const sim_source_t *source = &sources[i];
+    const sim_sink_t *sink = &sinks[i];
+    uint64_t accounted = sink->frames + sink->corrupt +
+                         sink->gaps.unrecoverable + sink->gaps.missing_count +
+                         sink->unseen;
+    if (accounted != source->frames_sent) {
+      printf("FAILED: %s sent %lu frames, %lu accounted for\n",
+             stream_configs[i].name, (unsigned long)source->frames_sent,
+             (unsigned long)accounted);
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+// Connect and run until end_us, or until the export is over. Returns false
+// if a (re)connect failed.
+static bool simulate(const virtual_link_config_t *config, uint64_t end_us,
+                     uint32_t reconnect_period_s, uint32_t report_period_s,
+                     uint8_t export_transport) {
+  virtual_link_init(&sim_link, config);
+  memset(&reader, 0, sizeof(reader));
+  nxmic_reader_init(&reader.gatt, &sim_reader_ops, &reader);
+  reader.gatt.export = &export_receiver;
+  nxmic_bench_init(&bench, false);
+  nxmic_bench_set_clock(&bench, &reader.gatt.timesync);
+  virtual_link_set_handler(&sim_link, link_notification_handler, &reader);
+  sensor_init();
+  nxmic_export_sender_init(&export_sender, recording_read, NULL);
+  nxmic_export_sender_set_size(&export_sender, export_size);
+  nxmic_export_receiver_init(&export_receiver, export_write, NULL);
+  export_receiver.transport = export_transport;
+  export_mismatched = 0;
+  spsc_ring_init(&notification_ring, notification_ring_storage,
+                 NOTIFICATION_RING_SLOTS,
+                 sizeof(nxmic_reader_record_t) + NXMIC_FRAME_MAX_SIZE);
+  ring_decoded = 0;
+  gateway_start_us = bench_now_ns() / 1000;
+  for (int i = 0; i < SIM_STREAM_COUNT; i++) {
+    nxmic_encoder_init(&sources[i].encoder, stream_configs[i].codec);
+    sources[i].next_sample =
+        sensor_time_us(0) * stream_configs[i].sample_rate_hz / 1000000;
+    source_reset(&sources[i]);
+    nxmic_gap_init(&sinks[i].gaps);
+    nxmic_stream_set_handler(stream_configs[i].char_id, queue_notification);
+  }
+
+  uint64_t next_reconnect_us = (uint64_t)reconnect_period_s * 1000000;
+  uint64_t next_report_us = (uint64_t)report_period_s * 1000000;
+  if (!reader_connect(&reader)) {
+    fprintf(stderr, "discovery failed\n");
+    return false;
+  }
+  if (capture_file) write_capture_handles(&reader);
+  if (export_size) nxmic_export_receiver_begin(&export_receiver, 0,
+                                               NXMIC_EXPORT_TO_END);
+  while (sim_link.now_us < end_us) {
+    uint64_t now_us = sim_link.now_us + SIM_TICK_US;
+    if (reconnect_period_s && now_us >= next_reconnect_us) {
+      virtual_link_disconnect(&sim_link);
+      nxmic_export_sender_stop(&export_sender);
+      nxmic_notify_clear(&notifier);
+      process_notifications();
+      for (int i = 0; i < SIM_STREAM_COUNT; i++) {
+        sinks[i].unseen += unseen_tail(i);
+        source_reset(&sources[i]);
+      }
+      virtual_link_run_until(&sim_link, sim_link.now_us + SIM_RECONNECT_GAP_US);
+      if (!reader_connect(&reader)) {
+        fprintf(stderr, "reconnect failed\n");
+        return false;
+      }
+      next_reconnect_us += (uint64_t)reconnect_period_s * 1000000;
+      continue;
+    }
+    if (!export_size && now_us >= reader.next_sync_us) {
+      reader.next_sync_us = UINT64_MAX;
+      nxmic_reader_sync_clock(&reader.gatt, (uint32_t)sim_link.now_us);
+      pump_gatt(&reader);
+      continue;
+    }
+    if (export_size) {
+      export_tick();
+    } else if (!benchmark_mode) {
+      for (int i = 0; i < SIM_STREAM_COUNT; i++)
+        source_tick(i, sensor_time_us(now_us));
+    }
+    nxmic_notify_run(&notifier, (uint32_t)sensor_time_us(now_us));
+    virtual_link_run_until(&sim_link, now_us);
+    if (gateway_socket >= 0) pace_to_real_time(now_us);
+    process_notifications();
+    select_link_profile(&reader);
+    request_missing_frames(&reader);
+    if (export_size) {
+      nxmic_reader_request_export(&reader.gatt, (uint32_t)sim_link.now_us);
+      if (export_receiver.state != NXMIC_EXPORT_RUNNING) break;
+    }
+    if (now_us >= next_report_us && !export_size) {
+      nxmic_bench_report(&bench, "sim", (uint32_t)now_us);
+      if (gateway_socket >= 0)
+        nxmic_gateway_report(&gateway, "sim", gateway_time_us());
+      next_report_us += (uint64_t)report_period_s * 1000000;
+    }
+  }
+  if (!export_size && !benchmark_mode) drain_link();
+  if (gateway_socket >= 0) {
+    // last partial datagram, then the acks still on their way
+    pace_to_real_time(sim_link.now_us + SIM_GATEWAY_FLUSH_US);
+    process_notifications();
+    pace_to_real_time(sim_link.now_us + 2 * SIM_GATEWAY_FLUSH_US);
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  uint32_t seconds = 60;
+  uint32_t report_period_s = 10;
+  uint32_t reconnect_period_s = 20;
+  virtual_link_config_t config = {
+      .mtu = 247,
+      .conn_interval_us = 7500,
+      .max_tx_octets = 251,
+      .phy_mbps = 2,
+      .max_packets_per_event = 8,
+  };
+  const char *capture_path = NULL;
+  const char *replay_path = NULL;
+  uint32_t replay_rounds = 100;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "bt:s:r:m:i:d:p:e:l:x:c:g:w:y:n:")) !=
+         -1) {
+    switch (opt) {
+      case 'b':
+        benchmark_mode = true;
+        break;
+      case 't':
+        seconds = (uint32_t)atoi(optarg);
+        break;
+      case 's':
+        report_period_s = (uint32_t)atoi(optarg);
+        break;
+      case 'r':
+        reconnect_period_s = (uint32_t)atoi(optarg);
+        break;
+      case 'm':
+        config.mtu = (uint16_t)atoi(optarg);
+        break;
+      case 'i':
+        config.conn_interval_us = (uint32_t)atoi(optarg);
+        break;
+      case 'd':
+        config.max_tx_octets = (uint16_t)atoi(optarg);
+        break;
+      case 'p':
+        config.phy_mbps = (uint8_t)atoi(optarg);
+        break;
+      case 'e':
+        config.max_packets_per_event = (uint8_t)atoi(optarg);
+        break;
+      case 'l':
+        config.loss_per_mille = (uint16_t)atoi(optarg);
+        break;
+      case 'x':
+        export_size = (uint32_t)atoi(optarg) * 1024;
+        break;
+      case 'c':
+        sensor_drift_ppm = atoi(optarg);
+        break;
+      case 'g':
+        gateway_port = (uint16_t)atoi(optarg);
+        break;
+      case 'w':
+        capture_path = optarg;
+        break;
+      case 'y':
+        replay_path = optarg;
+        break;
+      case 'n':
+        replay_rounds = (uint32_t)atoi(optarg);
+        break;
+      default:
+        fprintf(stderr,
+                "usage: %s [-b] [-t seconds] [-s report_period_s] "
+                "[-r reconnect_period_s] [-m mtu] [-i conn_interval_us] "
+                "[-d max_tx_octets] [-p phy_mbps] [-e packets_per_event] "
+                "[-l loss_per_mille] [-x export_kb] [-c drift_ppm] "
+                "[-g udp_port] [-w capture]\n"
+                "       %s -y capture [-n rounds]\n",
+                argv[0], argv[0]);
+        return 2;
+    }
+  }
+  // frame timestamps are 32-bit us
+  if (seconds == 0 || seconds > 3600 || report_period_s == 0 ||
+      config.mtu < 23 ||
+      config.conn_interval_us < 7500 || config.max_tx_octets < 27 ||
+      (config.phy_mbps != 1 && config.phy_mbps != 2) ||
+      config.max_packets_per_event == 0 || config.loss_per_mille > 1000 ||
+      export_size > 64 * 1024 * 1024 || sensor_drift_ppm < -500 ||
+      sensor_drift_ppm > 500) {
+    fprintf(stderr, "invalid link parameters\n");
+    return 2;
+  }
+  // the gateway forwards the streams, not an offload
+  if (gateway_port && (export_size || !gateway_open())) {
+    fprintf(stderr, "cannot forward to UDP port %u\n", gateway_port);
+    return 2;
+  }
+
+  if (replay_path) {
+    if (replay_rounds == 0) {
+      fprintf(stderr, "invalid round count\n");
+      return 2;
+    }
+    if (!replay(replay_path, replay_rounds)) {
+      fprintf(stderr, "replay of %s failed\n", replay_path);
+      return 1;
+    }
+    return 0;
+  }
+  // a capture is of the streams, not of an offload
+  if (capture_path &&
+      (export_size || !(capture_file = fopen(capture_path, "wb")))) {
+    fprintf(stderr, "cannot capture to %s\n", capture_path);
+    return 2;
+  }
+
+  uint64_t end_us = (uint64_t)seconds * 1000000;
+  if (export_size) {
+    double rates[2];
+    bool done = true;
+    for (uint8_t transport = NXMIC_EXPORT_TRANSPORT_GATT;
+         transport <= NXMIC_EXPORT_TRANSPORT_L2CAP; transport++) {
+      if (!simulate(&config, end_us, reconnect_period_s, report_period_s,
+                    transport))
+        return 1;
+      // the export starts once the first connect is through
+      uint64_t export_us = sim_link.now_us - reader.cold_latency.total_us;
+      print_report(sim_link.now_us / 1e6);
+      rates[transport] = print_export_report(export_us);
+      done = done && export_receiver.state == NXMIC_EXPORT_DONE;
+    }
+    print_read_blob_report(&config, rates);
+    return done ? 0 : 1;
+  }
+  if (!simulate(&config, end_us, reconnect_period_s, report_period_s,
+                NXMIC_EXPORT_TRANSPORT_GATT))
+    return 1;
+  print_report(seconds);
+  if (capture_file) fclose(capture_file);
+  if (benchmark_mode) return 0;
+  bool profiles_ok = check_link_profiles(seconds);
+  return check_frames() && profiles_ok ? 0 : 1;
+}
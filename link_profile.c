@@ -0,0 +1,287 @@
+#include "link_profile.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Retry or step down the interval ladder if the peer has not moved to the
+// requested interval within this time
+#define LADDER_TIMEOUT_MS 2000
+
+// LE_Set_PHY masks
+#define PHY_1M_MASK 0x01
+#define PHY_2M_MASK 0x02
+
+typedef struct {
+  uint16_t interval_min;  // units of 1.25 ms
+  uint16_t interval_max;
+  uint16_t latency;
+  uint16_t supervision_timeout;  // units of 10 ms
+} interval_rung_t;
+
+// Tried in order until the peer accepts one
+static const interval_rung_t high_throughput_ladder[] = {
+    {6, 12, 0, 400},   // 7.5 - 15 ms
+    {12, 24, 0, 400},  // 15 - 30 ms
+    {24, 40, 0, 400},  // 30 - 50 ms
+};
+
+static const interval_rung_t low_power_ladder[] = {
+    {80, 160, 4, 600},  // 100 - 200 ms, skip up to 4 events
+};
+
+typedef struct {
+  link_params_t params;
+  bool in_use;
+  bool phy_pending;  // LE Set PHY could not be sent yet
+  btstack_timer_source_t ladder_timer;
+} link_state_t;
+
+static link_state_t links[MAX_NR_HCI_CONNECTIONS];
+static link_profile_t default_link_profile;
+static uint16_t initiator_scan_interval = 0x0030;
+static uint16_t initiator_scan_window = 0x0030;
+static btstack_packet_callback_registration_t hci_event_callback_registration;
+
+static link_state_t *link_for_handle(hci_con_handle_t con_handle) {
+  for (int i = 0; i < MAX_NR_HCI_CONNECTIONS; i++) {
+    if (links[i].in_use && links[i].params.con_handle == con_handle)
+      return &links[i];
+  }
+  return NULL;
+}
+
+static const interval_rung_t *ladder_for(link_profile_t profile,
+                                         int *num_rungs) {
+  if (profile == LINK_PROFILE_LOW_POWER) {
+    *num_rungs = sizeof(low_power_ladder) / sizeof(low_power_ladder[0]);
+    return low_power_ladder;
+  }
+  *num_rungs =
+      sizeof(high_throughput_ladder) / sizeof(high_throughput_ladder[0]);
+  return high_throughput_ladder;
+}
+
+static void request_phy(link_state_t *link) {
+  uint8_t phys = link->params.profile == LINK_PROFILE_HIGH_THROUGHPUT
+                     ? PHY_2M_MASK | PHY_1M_MASK
+                     : PHY_1M_MASK;
+  // the controller picks 2M if both sides support it
+  link->phy_pending = gap_le_set_phy(link->params.con_handle, 0, phys, phys,
+                                     0) != ERROR_CODE_SUCCESS;
+}
+
+static void request_interval(link_state_t *link) {
+  int num_rungs;
+  const interval_rung_t *ladder = ladder_for(link->params.profile, &num_rungs);
+  const interval_rung_t *rung = &ladder[link->params.ladder_step];
+  if (link->params.is_central) {
+    gap_update_connection_parameters(link->params.con_handle,
+                                     rung->interval_min, rung->interval_max,
+                                     rung->latency, rung->supervision_timeout);
+  } else {
+    gap_request_connection_parameter_update(
+        link->params.con_handle, rung->interval_min, rung->interval_max,
+        rung->latency, rung->supervision_timeout);
+  }
+  btstack_run_loop_set_timer(&link->ladder_timer, LADDER_TIMEOUT_MS);
+  btstack_run_loop_add_timer(&link->ladder_timer);
+}
+
+static bool interval_accepted(const link_state_t *link) {
+  int num_rungs;
+  const interval_rung_t *ladder = ladder_for(link->params.profile, &num_rungs);
+  const interval_rung_t *rung = &ladder[link->params.ladder_step];
+  return link->params.conn_interval >= rung->interval_min &&
+         link->params.conn_interval <= rung->interval_max;
+}
+
+// Peer did not move to the requested interval in time: try the next rung
+static void ladder_timeout_handler(btstack_timer_source_t *ts) {
+  link_state_t *link =
+      (link_state_t *)btstack_run_loop_get_timer_context(ts);
+  if (!link->in_use) return;
+  if (link->phy_pending) request_phy(link);
+  if (interval_accepted(link)) return;
+  int num_rungs;
+  ladder_for(link->params.profile, &num_rungs);
+  if (link->params.ladder_step + 1 >= num_rungs) return;  // keep what we got
+  link->params.ladder_step++;
+  request_interval(link);
+}
+
+static void start_profile(link_state_t *link, link_profile_t profile) {
+  link->params.profile = profile;
+  link->params.ladder_step = 0;
+  request_phy(link);
+  request_interval(link);
+}
+
+static void handle_connection_complete(const uint8_t *packet) {
+  if (hci_subevent_le_connection_complete_get_status(packet) !=
+      ERROR_CODE_SUCCESS)
+    return;
+  link_state_t *link = NULL;
+  for (int i = 0; i < MAX_NR_HCI_CONNECTIONS; i++) {
+    if (!links[i].in_use) {
+      link = &links[i];
+      break;
+    }
+  }
+  if (!link) return;
+
+  memset(link, 0, sizeof(*link));
+  link->in_use = true;
+  link->params.con_handle =
+      hci_subevent_le_connection_complete_get_connection_handle(packet);
+  link->params.is_central =
+      hci_subevent_le_connection_complete_get_role(packet) == 0;
+  link->params.mtu = ATT_DEFAULT_MTU;
+  link->params.max_tx_octets = 27;
+  link->params.max_rx_octets = 27;
+  link->params.tx_phy = 1;
+  link->params.rx_phy = 1;
+  link->params.conn_interval =
+      hci_subevent_le_connection_complete_get_conn_interval(packet);
+  link->params.conn_latency =
+      hci_subevent_le_connection_complete_get_conn_latency(packet);
+  link->params.supervision_timeout =
+      hci_subevent_le_connection_complete_get_supervision_timeout(packet);
+  link->ladder_timer.process = &ladder_timeout_handler;
+  btstack_run_loop_set_timer_context(&link->ladder_timer, link);
+  start_profile(link, default_link_profile);
+}
+
+static void hci_event_handler(uint8_t packet_type, uint16_t channel,
+                              uint8_t *packet, uint16_t size) {
+  UNUSED(channel);
+  UNUSED(size);
+  if (packet_type != HCI_EVENT_PACKET) return;
+
+  link_state_t *link;
+  switch (hci_event_packet_get_type(packet)) {
+    case HCI_EVENT_LE_META:
+      switch (hci_event_le_meta_get_subevent_code(packet)) {
+        case HCI_SUBEVENT_LE_CONNECTION_COMPLETE:
+          handle_connection_complete(packet);
+          break;
+        case HCI_SUBEVENT_LE_CONNECTION_UPDATE_COMPLETE:
+          link = link_for_handle(
+              hci_subevent_le_connection_update_complete_get_connection_handle(
+                  packet));
+          if (!link) break;
+          link->params.conn_interval =
+              hci_subevent_le_connection_update_complete_get_conn_interval(
+                  packet);
+          link->params.conn_latency =
+              hci_subevent_le_connection_update_complete_get_conn_latency(
+                  packet);
+          link->params.supervision_timeout =
+              hci_subevent_le_connection_update_complete_get_supervision_timeout(
+                  packet);
+          if (interval_accepted(link))
+            btstack_run_loop_remove_timer(&link->ladder_timer);
+          break;
+        case HCI_SUBEVENT_LE_DATA_LENGTH_CHANGE:
+          link = link_for_handle(
+              hci_subevent_le_data_length_change_get_connection_handle(packet));
+          if (!link) break;
+          link->params.max_tx_octets =
+              hci_subevent_le_data_length_change_get_max_tx_octets(packet);
+          link->params.max_rx_octets =
+              hci_subevent_le_data_length_change_get_max_rx_octets(packet);
+          break;
+        case HCI_SUBEVENT_LE_PHY_UPDATE_COMPLETE:
+          link = link_for_handle(
+              hci_subevent_le_phy_update_complete_get_connection_handle(
+                  packet));
+          if (!link) break;
+          if (hci_subevent_le_phy_update_complete_get_status(packet) !=
+              ERROR_CODE_SUCCESS)
+            break;
+          link->params.tx_phy =
+              hci_subevent_le_phy_update_complete_get_tx_phy(packet);
+          link->params.rx_phy =
+              hci_subevent_le_phy_update_complete_get_rx_phy(packet);
+          break;
+        default:
+          break;
+      }
+      break;
+    case HCI_EVENT_DISCONNECTION_COMPLETE:
+      link = link_for_handle(
+          hci_event_disconnection_complete_get_connection_handle(packet));
+      if (!link) break;
+      btstack_run_loop_remove_timer(&link->ladder_timer);
+      link->in_use = false;
+      break;
+    default:
+      break;
+  }
+}
+
+static void set_connection_parameters(void) {
+#ifdef ENABLE_LE_CENTRAL
+  // connect straight at the first rung so most links need no update
+  int num_rungs;
+  const interval_rung_t *rung = ladder_for(default_link_profile, &num_rungs);
+  gap_set_connection_parameters(initiator_scan_interval, initiator_scan_window,
+                                rung->interval_min, rung->interval_max,
+                                rung->latency, rung->supervision_timeout, 0,
+                                0);
+#endif
+}
+
+void link_profile_init(link_profile_t default_profile) {
+  default_link_profile = default_profile;
+  set_connection_parameters();
+  hci_event_callback_registration.callback = &hci_event_handler;
+  hci_add_event_handler(&hci_event_callback_registration);
+}
+
+void link_profile_set_initiator_scan(uint16_t scan_interval,
+                                     uint16_t scan_window) {
+  if (scan_interval == initiator_scan_interval &&
+      scan_window == initiator_scan_window)
+    return;
+  initiator_scan_interval = scan_interval;
+  initiator_scan_window = scan_window;
+  set_connection_parameters();
+}
+
+void link_profile_set(hci_con_handle_t con_handle, link_profile_t profile) {
+  link_state_t *link = link_for_handle(con_handle);
+  if (!link || link->params.profile == profile) return;
+  btstack_run_loop_remove_timer(&link->ladder_timer);
+  start_profile(link, profile);
+}
+
+const link_params_t *link_profile_get_params(hci_con_handle_t con_handle) {
+  link_state_t *link = link_for_handle(con_handle);
+  if (!link) return NULL;
+  // MTU is negotiated by the ATT layer, read it on demand
+#if MAX_NR_GATT_CLIENTS > 0
+  if (link->params.is_central) {
+    uint16_t mtu;
+    if (gatt_client_get_mtu(con_handle, &mtu) == ERROR_CODE_SUCCESS)
+      link->params.mtu = mtu;
+  } else
+#endif
+  {
+    link->params.mtu = att_server_get_mtu(con_handle);
+  }
+  return &link->params;
+}
+
+void link_profile_print(hci_con_handle_t con_handle) {
+  const link_params_t *params = link_profile_get_params(con_handle);
+  if (!params) return;
+  printf("link 0x%04x %s: mtu %u, pdu %u/%u, phy %u/%u, interval %u.%02u ms, "
+         "latency %u, timeout %u ms\n",
+         params->con_handle,
+         params->profile == LINK_PROFILE_LOW_POWER ? "low-power"
+                                                   : "high-throughput",
+         params->mtu, params->max_tx_octets, params->max_rx_octets,
+         params->tx_phy, params->rx_phy, params->conn_interval * 125 / 100,
+         params->conn_interval * 125 % 100, params->conn_latency,
+         params->supervision_timeout * 10);
+}
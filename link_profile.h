@@ -0,0 +1,50 @@
+#ifndef LINK_PROFILE_H_
+#define LINK_PROFILE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "btstack.h"
+
+// What a connection is tuned for once it comes up
+typedef enum {
+  // Largest MTU and PDUs, 2M PHY and the shortest connection interval the
+  // peer accepts, stepping down a ladder of intervals on rejection
+  LINK_PROFILE_HIGH_THROUGHPUT,
+  // 1M PHY, long interval and slave latency, for temperature-only sessions
+  LINK_PROFILE_LOW_POWER,
+} link_profile_t;
+
+// Negotiated values of one connection
+typedef struct {
+  hci_con_handle_t con_handle;
+  link_profile_t profile;
+  bool is_central;
+  uint16_t mtu;                  // ATT MTU
+  uint16_t max_tx_octets;        // LL PDU payload, 27 without DLE
+  uint16_t max_rx_octets;
+  uint8_t tx_phy;                // 1 = 1M, 2 = 2M, 3 = Coded
+  uint8_t rx_phy;
+  uint16_t conn_interval;        // units of 1.25 ms
+  uint16_t conn_latency;         // connection events
+  uint16_t supervision_timeout;  // units of 10 ms
+  uint8_t ladder_step;           // interval rung currently requested
+} link_params_t;
+
+// Register for HCI events. Connections start on default_profile.
+void link_profile_init(link_profile_t default_profile);
+
+// Scan interval and window the controller initiates connections with,
+// units of 0.625 ms. 0x0030 for both until set.
+void link_profile_set_initiator_scan(uint16_t scan_interval,
+                                     uint16_t scan_window);
+
+// Switch an open connection to another profile
+void link_profile_set(hci_con_handle_t con_handle, link_profile_t profile);
+
+// Negotiated values, NULL if the connection is unknown
+const link_params_t *link_profile_get_params(hci_con_handle_t con_handle);
+
+void link_profile_print(hci_con_handle_t con_handle);
+
+#endif
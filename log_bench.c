@@ -0,0 +1,107 @@
+// Host benchmark of the deferred log (nxmic_log.h) against printf: cost per
+// call of the reader's per-sample temperature line both ways, cost of
+// draining a record later, what a burst with no drain keeps and drops, and
+// the overhead of a cycle probe (nxmic_probe.h).
+//
+//   nxmic_log_bench [-n calls]
+//
+// Formatted output goes to /dev/null, so the printf numbers are the
+// formatting alone; on the Pico USB stdio comes on top. Times are this
+// host's, per call.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "nxmic_log.h"
+#include "nxmic_probe.h"
+
+// Writes timed between two drains, well inside the ring
+#define BENCH_BATCH (NXMIC_LOG_RING_SLOTS / 2)
+
+static int saved_stdout = -1;
+
+static void quiet(bool on) {
+  fflush(stdout);
+  if (on) {
+    saved_stdout = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    close(null);
+  } else {
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+  }
+}
+
+static int16_t sample_of(uint32_t i) { return (int16_t)(2500 + i % 300); }
+
+int main(int argc, char **argv) {
+  uint32_t calls = 100000;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+      case 'n':
+        calls = (uint32_t)atoi(optarg);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-n calls]\n", argv[0]);
+        return 2;
+    }
+  }
+  calls -= calls % BENCH_BATCH;
+  if (calls == 0) {
+    fprintf(stderr, "invalid call count\n");
+    return 2;
+  }
+
+  quiet(true);
+  uint64_t log_ns = 0, drain_ns = 0;
+  for (uint32_t i = 0; i < calls; i += BENCH_BATCH) {
+    uint32_t start = nxmic_probe_now();
+    for (uint32_t j = i; j < i + BENCH_BATCH; j++) {
+      int16_t centi = sample_of(j);
+      NXMIC_LOG_INFO("[%d] read temp %c%d.%02d degc (frame %u @ %u us)\n", 0,
+                     centi < 0 ? '-' : '+', abs(centi) / 100,
+                     abs(centi) % 100, j / 10, j * 10000);
+    }
+    uint32_t middle = nxmic_probe_now();
+    nxmic_log_drain(BENCH_BATCH);
+    drain_ns += nxmic_probe_now() - middle;
+    log_ns += middle - start;
+  }
+
+  uint32_t start = nxmic_probe_now();
+  for (uint32_t j = 0; j < calls; j++) {
+    printf("[%d] read temp %.2f degc (frame %u @ %u us)\n", 0,
+           sample_of(j) / 100.0f, j / 10, j * 10000);
+  }
+  uint64_t printf_ns = nxmic_probe_now() - start;
+
+  // a burst nobody drains
+  nxmic_log_stats_t before, after;
+  nxmic_log_get_stats(&before);
+  for (uint32_t j = 0; j < 1000; j++) NXMIC_LOG_INFO("burst %u\n", j);
+  nxmic_log_get_stats(&after);
+  nxmic_log_drain(NXMIC_LOG_RING_SLOTS);
+
+  start = nxmic_probe_now();
+  for (uint32_t j = 0; j < calls; j++) {
+    NXMIC_PROBE_SCOPE(NXMIC_PROBE_DECODE_BATCH);
+    __asm__ volatile("" ::: "memory");
+  }
+  uint64_t probe_ns = nxmic_probe_now() - start;
+  quiet(false);
+
+  printf("deferred log: %.1f ns/call, drained later at %.1f ns/record\n",
+         (double)log_ns / calls, (double)drain_ns / calls);
+  printf("printf with %%.2f: %.1f ns/call, %.1fx the deferred call\n",
+         (double)printf_ns / calls, (double)printf_ns / log_ns);
+  printf("burst of 1000 with no drain: %u kept, %u dropped (%d slots)\n",
+         after.written - before.written, after.dropped - before.dropped,
+         NXMIC_LOG_RING_SLOTS);
+  printf("probe scope: %.1f ns per timed block\n", (double)probe_ns / calls);
+  NXMIC_PROBE_REPORT();
+  return after.written - before.written == NXMIC_LOG_RING_SLOTS ? 0 : 1;
+}
@@ -22,6 +22,8 @@
 #define MEM_SIZE                    4000
 #define MEMP_NUM_TCP_SEG            32
 #define MEMP_NUM_ARP_QUEUE          10
+// PBUF_REF pbufs of a gateway datagram, one per batched notification
+#define MEMP_NUM_PBUF               24
 #define PBUF_POOL_SIZE              24
 #define LWIP_ARP                    1
 #define LWIP_ETHERNET               1
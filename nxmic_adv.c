@@ -0,0 +1,92 @@
+#include "nxmic_adv.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// The AD structure at *data, its size without the length byte in *size.
+// False at the end of the data or at a structure running past it.
+static bool next_structure(const uint8_t **data, const uint8_t *end,
+                           uint8_t *size) {
+  if (end - *data < 2) return false;
+  *size = (*data)[0];  // type and value
+  if (*size == 0) return false;  // early end of the data
+  return end - *data - 1 >= *size;
+}
+
+bool nxmic_adv_has_service128(const uint8_t *data, uint16_t length,
+                              const uint8_t uuid128[16]) {
+  // most reports are not sensors: compare one word before the whole UUID
+  uint32_t head;
+  memcpy(&head, uuid128, sizeof(head));
+  const uint8_t *end = data + length;
+  uint8_t size;
+  for (; next_structure(&data, end, &size); data += 1 + size) {
+    uint8_t type = data[1];
+    if (type != NXMIC_ADV_TYPE_COMPLETE_LIST_128 &&
+        type != NXMIC_ADV_TYPE_INCOMPLETE_LIST_128)
+      continue;
+    for (const uint8_t *uuid = data + 2; uuid + 16 <= data + 1 + size;
+         uuid += 16) {
+      uint32_t word;
+      memcpy(&word, uuid, sizeof(word));
+      if (word == head && memcmp(uuid, uuid128, 16) == 0) return true;
+    }
+  }
+  return false;
+}
+
+bool nxmic_adv_broadcast_update(nxmic_adv_broadcast_t *broadcast,
+                                int16_t temperature, uint8_t battery,
+                                uint32_t now_ms) {
+  nxmic_adv_reading_t *reading = &broadcast->reading;
+  if (broadcast->valid && battery == reading->battery &&
+      abs(temperature - reading->temperature) < NXMIC_ADV_TEMPERATURE_STEP)
+    return false;
+  if (broadcast->valid) reading->sequence++;
+  reading->temperature = temperature;
+  reading->battery = battery;
+  broadcast->valid = true;
+  broadcast->changed_ms = now_ms;
+  return true;
+}
+
+uint16_t nxmic_adv_broadcast_interval(const nxmic_adv_broadcast_t *broadcast,
+                                      uint32_t now_ms) {
+  if (!broadcast->valid) return NXMIC_ADV_INTERVAL_STEADY;
+  uint32_t steady_ms = now_ms - broadcast->changed_ms;
+  if (steady_ms >= NXMIC_ADV_SLOW_AFTER_MS) return NXMIC_ADV_INTERVAL_SLOW;
+  if (steady_ms < NXMIC_ADV_BURST_MS) return NXMIC_ADV_INTERVAL_BURST;
+  return NXMIC_ADV_INTERVAL_STEADY;
+}
+
+void nxmic_adv_broadcast_encode(const nxmic_adv_broadcast_t *broadcast,
+                                uint8_t *out) {
+  const nxmic_adv_reading_t *reading = &broadcast->reading;
+  out[0] = NXMIC_ADV_BROADCAST_SIZE - 1;
+  out[1] = NXMIC_ADV_TYPE_MANUFACTURER_DATA;
+  out[2] = NXMIC_ADV_COMPANY_ID & 0xff;
+  out[3] = NXMIC_ADV_COMPANY_ID >> 8;
+  out[4] = NXMIC_ADV_BROADCAST_VERSION;
+  out[5] = reading->sequence;
+  out[6] = (uint8_t)reading->temperature;
+  out[7] = (uint8_t)((uint16_t)reading->temperature >> 8);
+  out[8] = reading->battery;
+}
+
+bool nxmic_adv_broadcast_decode(const uint8_t *data, uint16_t length,
+                                nxmic_adv_reading_t *reading) {
+  const uint8_t *end = data + length;
+  uint8_t size;
+  for (; next_structure(&data, end, &size); data += 1 + size) {
+    if (size != NXMIC_ADV_BROADCAST_SIZE - 1 ||
+        data[1] != NXMIC_ADV_TYPE_MANUFACTURER_DATA ||
+        (data[2] | data[3] << 8) != NXMIC_ADV_COMPANY_ID ||
+        data[4] != NXMIC_ADV_BROADCAST_VERSION)
+      continue;
+    reading->sequence = data[5];
+    reading->temperature = (int16_t)(data[6] | data[7] << 8);
+    reading->battery = data[8];
+    return true;
+  }
+  return false;
+}
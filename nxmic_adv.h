@@ -0,0 +1,92 @@
+#ifndef NXMIC_ADV_H_
+#define NXMIC_ADV_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Advertising data of an NxMic sensor, and the reader's side of it. The
+// sensor advertises:
+//
+//   Flags, the NxMic service UUID (128-bit), telemetry broadcast
+//
+// and puts its name in the scan response, so a passive scan sees the
+// service and the latest readings without asking for a scan response.
+//
+// The broadcast is Manufacturer Specific Data, NXMIC_ADV_BROADCAST_SIZE
+// bytes with its length and type:
+//
+//   company u16 0xffff, version u8, sequence u8, temperature i16
+//   (hundredths of a degree C), battery u8 (percent, 0xff if unknown)
+//
+// little-endian. The sequence moves on whenever a value does, so an
+// observer hearing the same advertisement many times counts it once and
+// sees from a jump in the sequence that it missed an update. While a value
+// is changing the sensor advertises fast, NXMIC_ADV_INTERVAL_BURST for
+// NXMIC_ADV_BURST_MS, then at NXMIC_ADV_INTERVAL_STEADY, and at
+// NXMIC_ADV_INTERVAL_SLOW once nothing changed for NXMIC_ADV_SLOW_AFTER_MS.
+// Before the first reading it stays at NXMIC_ADV_INTERVAL_STEADY.
+//
+// Legacy advertising: all of it fits in 31 bytes, and observers do not
+// need Bluetooth 5 controllers.
+
+// AD types, Core Supplement Part A 1.1
+#define NXMIC_ADV_TYPE_INCOMPLETE_LIST_128 0x06
+#define NXMIC_ADV_TYPE_COMPLETE_LIST_128 0x07
+#define NXMIC_ADV_TYPE_MANUFACTURER_DATA 0xff
+
+// Reserved by the Bluetooth SIG for tests, until NxMic has its own
+#define NXMIC_ADV_COMPANY_ID 0xffff
+#define NXMIC_ADV_BROADCAST_VERSION 1
+#define NXMIC_ADV_BROADCAST_SIZE 9
+#define NXMIC_ADV_BATTERY_UNKNOWN 0xff
+
+// A temperature change below this is noise, not a new value
+#define NXMIC_ADV_TEMPERATURE_STEP 20
+
+// Advertising intervals, units of 0.625 ms
+#define NXMIC_ADV_INTERVAL_BURST 160   // 100 ms
+#define NXMIC_ADV_INTERVAL_STEADY 800  // 500 ms
+#define NXMIC_ADV_INTERVAL_SLOW 1600   // 1 s
+#define NXMIC_ADV_BURST_MS 2000
+#define NXMIC_ADV_SLOW_AFTER_MS 60000
+
+typedef struct {
+  uint8_t sequence;
+  int16_t temperature;  // Hundredths of a degree C
+  uint8_t battery;      // Percent
+} nxmic_adv_reading_t;
+
+// Sensor side: the readings on air and when they last changed
+typedef struct {
+  nxmic_adv_reading_t reading;
+  bool valid;
+  uint32_t changed_ms;
+} nxmic_adv_broadcast_t;
+
+// Whether the advertising data lists uuid128 (little-endian, as in
+// nxmic_gatt_service) among its 128-bit service UUIDs. One pass over the
+// AD structures that stops at the first match; a structure running past
+// the end ends the search.
+bool nxmic_adv_has_service128(const uint8_t *data, uint16_t length,
+                              const uint8_t uuid128[16]);
+
+// Take the latest values. Returns true if the broadcast changed, with a new
+// sequence, and needs encoding again.
+bool nxmic_adv_broadcast_update(nxmic_adv_broadcast_t *broadcast,
+                                int16_t temperature, uint8_t battery,
+                                uint32_t now_ms);
+
+// Advertising interval for now, NXMIC_ADV_INTERVAL_*
+uint16_t nxmic_adv_broadcast_interval(const nxmic_adv_broadcast_t *broadcast,
+                                      uint32_t now_ms);
+
+// The AD structure, NXMIC_ADV_BROADCAST_SIZE bytes
+void nxmic_adv_broadcast_encode(const nxmic_adv_broadcast_t *broadcast,
+                                uint8_t *out);
+
+// Find a broadcast in advertising data, in one pass as
+// nxmic_adv_has_service128(). False if there is none of this version.
+bool nxmic_adv_broadcast_decode(const uint8_t *data, uint16_t length,
+                                nxmic_adv_reading_t *reading);
+
+#endif
@@ -0,0 +1,80 @@
+#include "nxmic_att.h"
+
+#include <string.h>
+
+static const nxmic_att_handler_t *handler_of(const nxmic_att_table_t *table,
+                                            uint16_t handle) {
+  return handle < NXMIC_ATT_MAX_HANDLES ? table->handlers[handle] : NULL;
+}
+
+void nxmic_att_init(nxmic_att_table_t *table) {
+  memset(table, 0, sizeof(*table));
+}
+
+bool nxmic_att_register(nxmic_att_table_t *table, uint16_t handle,
+                        const nxmic_att_handler_t *handler) {
+  if (handle == 0 || handle >= NXMIC_ATT_MAX_HANDLES) return false;
+  if (!table->handlers[handle]) table->registered++;
+  table->handlers[handle] = handler;
+  return true;
+}
+
+const uint8_t *nxmic_att_value(const nxmic_att_table_t *table,
+                               uint16_t handle,
+                               uint8_t scratch[NXMIC_ATT_BUILD_MAX],
+                               uint16_t *length) {
+  const nxmic_att_handler_t *handler = handler_of(table, handle);
+  *length = 0;
+  if (!handler) return NULL;
+  if (handler->value) {
+    *length = handler->length ? *handler->length : handler->size;
+    return handler->value;
+  }
+  if (!handler->build) return NULL;
+  *length = handler->build(scratch);
+  return scratch;
+}
+
+int nxmic_att_write(const nxmic_att_table_t *table, uint16_t handle,
+                    uint16_t con_handle, const uint8_t *value,
+                    uint16_t length) {
+  const nxmic_att_handler_t *handler = handler_of(table, handle);
+  if (!handler || !handler->write) return 0;
+  return handler->write(con_handle, value, length);
+}
+
+int nxmic_att_prepare(nxmic_att_table_t *table, uint16_t handle,
+                      uint16_t offset, const uint8_t *value,
+                      uint16_t length) {
+  const nxmic_att_handler_t *handler = handler_of(table, handle);
+  if (!handler || !handler->write) return 0;
+  if (table->prepared_handle && table->prepared_handle != handle)
+    return NXMIC_ATT_ERROR_PREPARE_QUEUE_FULL;
+  uint16_t size = handler->value && handler->size < NXMIC_ATT_PREPARE_MAX
+                      ? handler->size
+                      : NXMIC_ATT_PREPARE_MAX;
+  if (offset > size) return NXMIC_ATT_ERROR_INVALID_OFFSET;
+  if (length > size - offset)
+    return NXMIC_ATT_ERROR_INVALID_ATTRIBUTE_VALUE_LENGTH;
+  if (!table->prepared_handle) {
+    table->prepared_handle = handle;
+    table->prepared_length = 0;
+  }
+  memcpy(table->prepared + offset, value, length);
+  if (offset + length > table->prepared_length)
+    table->prepared_length = offset + length;
+  return 0;
+}
+
+int nxmic_att_execute(nxmic_att_table_t *table, uint16_t con_handle) {
+  if (!table->prepared_handle) return 0;
+  int error = nxmic_att_write(table, table->prepared_handle, con_handle,
+                              table->prepared, table->prepared_length);
+  nxmic_att_cancel(table);
+  return error;
+}
+
+void nxmic_att_cancel(nxmic_att_table_t *table) {
+  table->prepared_handle = 0;
+  table->prepared_length = 0;
+}
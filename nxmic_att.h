@@ -0,0 +1,92 @@
+#ifndef NXMIC_ATT_H_
+#define NXMIC_ATT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Dispatch of the sensor's ATT reads and writes: one handler per attribute
+// handle, found by indexing an array with the handle instead of comparing
+// it against each characteristic in turn, so a request costs the same
+// however many characteristics the profile has.
+//
+// A handler serves reads from a live buffer, the variable the value is kept
+// in, which the read callback hands to BTstack as it is (no staging copy,
+// long reads take their offset straight from it); values that only exist
+// encoded are built into a scratch buffer on each read instead. Writes go
+// to the write function. A handle without a handler reads as empty and
+// ignores writes.
+//
+// A Write Long comes in chunks, each with its offset (BTstack's
+// ATT_TRANSACTION_MODE_ACTIVE); they are staged here and the write
+// function sees the whole value once, on execute, or nothing if the client
+// cancels. One value is staged at a time.
+//
+// Handles come from the generated profile, see gatt_gen.c; handle 0 is not
+// an attribute.
+
+#define NXMIC_ATT_MAX_HANDLES 64
+// Largest value a build function writes
+#define NXMIC_ATT_BUILD_MAX 32
+// Largest value a Write Long stages
+#define NXMIC_ATT_PREPARE_MAX 64
+
+// The ATT error codes returned by the table itself
+#define NXMIC_ATT_ERROR_INVALID_OFFSET 0x07
+#define NXMIC_ATT_ERROR_PREPARE_QUEUE_FULL 0x09
+#define NXMIC_ATT_ERROR_INVALID_ATTRIBUTE_VALUE_LENGTH 0x0d
+
+typedef struct {
+  // Live value: size bytes at value, or *length of them if it varies, in
+  // which case size is the most it holds. A Write Long past size is
+  // refused; without a live value, past NXMIC_ATT_PREPARE_MAX.
+  const void *value;
+  uint16_t size;
+  const uint16_t *length;
+  // Or built on each read, returns the length
+  uint16_t (*build)(uint8_t out[NXMIC_ATT_BUILD_MAX]);
+  // 0 or an ATT error code; NULL if writes are ignored
+  int (*write)(uint16_t con_handle, const uint8_t *value, uint16_t length);
+} nxmic_att_handler_t;
+
+typedef struct {
+  const nxmic_att_handler_t *handlers[NXMIC_ATT_MAX_HANDLES];
+  uint16_t registered;
+  // Write Long in progress, prepared_handle 0 if none
+  uint16_t prepared_handle;
+  uint16_t prepared_length;
+  uint8_t prepared[NXMIC_ATT_PREPARE_MAX];
+} nxmic_att_table_t;
+
+void nxmic_att_init(nxmic_att_table_t *table);
+
+// false if the handle is 0 or past NXMIC_ATT_MAX_HANDLES
+bool nxmic_att_register(nxmic_att_table_t *table, uint16_t handle,
+                        const nxmic_att_handler_t *handler);
+
+// The value of handle, in place or built into scratch; NULL with *length 0
+// if there is none
+const uint8_t *nxmic_att_value(const nxmic_att_table_t *table,
+                               uint16_t handle,
+                               uint8_t scratch[NXMIC_ATT_BUILD_MAX],
+                               uint16_t *length);
+
+// 0 or an ATT error code from the handler of handle
+int nxmic_att_write(const nxmic_att_table_t *table, uint16_t handle,
+                    uint16_t con_handle, const uint8_t *value,
+                    uint16_t length);
+
+// Stage a chunk of a Write Long at offset. 0 or an ATT error code: an
+// offset past the value, a chunk running past it, or a chunk for another
+// handle while one is staged.
+int nxmic_att_prepare(nxmic_att_table_t *table, uint16_t handle,
+                      uint16_t offset, const uint8_t *value,
+                      uint16_t length);
+
+// Write what is staged through its handler, as nxmic_att_write(), and
+// drop it
+int nxmic_att_execute(nxmic_att_table_t *table, uint16_t con_handle);
+
+// Drop what is staged, e.g. when the client cancels or disconnects
+void nxmic_att_cancel(nxmic_att_table_t *table);
+
+#endif
@@ -0,0 +1,158 @@
+#include "nxmic_bench.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static uint32_t bucket_index(uint32_t value) {
+  if (value < NXMIC_HISTOGRAM_LINEAR_BUCKETS) return value;
+  uint32_t exponent = 31 - __builtin_clz(value);  // >= 4
+  uint32_t sub = (value >> (exponent - 3)) & (NXMIC_HISTOGRAM_SUB_BUCKETS - 1);
+  return NXMIC_HISTOGRAM_LINEAR_BUCKETS +
+         (exponent - 4) * NXMIC_HISTOGRAM_SUB_BUCKETS + sub;
+}
+
+static uint32_t bucket_upper_bound(uint32_t index) {
+  if (index < NXMIC_HISTOGRAM_LINEAR_BUCKETS) return index;
+  index -= NXMIC_HISTOGRAM_LINEAR_BUCKETS;
+  uint32_t exponent = index / NXMIC_HISTOGRAM_SUB_BUCKETS + 4;
+  uint32_t sub = index % NXMIC_HISTOGRAM_SUB_BUCKETS;
+  uint64_t lower = (uint64_t)(NXMIC_HISTOGRAM_SUB_BUCKETS + sub)
+                   << (exponent - 3);
+  uint64_t upper = lower + (1ull << (exponent - 3)) - 1;
+  return upper > UINT32_MAX ? UINT32_MAX : (uint32_t)upper;
+}
+
+void nxmic_histogram_reset(nxmic_histogram_t *histogram) {
+  memset(histogram, 0, sizeof(*histogram));
+}
+
+void nxmic_histogram_add(nxmic_histogram_t *histogram, uint32_t value) {
+  histogram->counts[bucket_index(value)]++;
+  histogram->total++;
+  if (value > histogram->max) histogram->max = value;
+}
+
+uint32_t nxmic_histogram_quantile(const nxmic_histogram_t *histogram,
+                                  uint32_t per_10000) {
+  if (histogram->total == 0) return 0;
+  // rank of the sample at the quantile, 1-based and rounded up
+  uint64_t rank = ((uint64_t)histogram->total * per_10000 + 9999) / 10000;
+  if (rank == 0) rank = 1;
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < NXMIC_HISTOGRAM_BUCKETS; i++) {
+    seen += histogram->counts[i];
+    if (seen >= rank) {
+      uint32_t upper = bucket_upper_bound(i);
+      return upper < histogram->max ? upper : histogram->max;
+    }
+  }
+  return histogram->max;
+}
+
+static void start_period(nxmic_bench_t *bench) {
+  nxmic_histogram_reset(&bench->latency);
+  nxmic_histogram_reset(&bench->inter_arrival);
+  bench->notifications = 0;
+  bench->bytes = 0;
+  bench->payload_bytes = 0;
+  bench->lost = 0;
+}
+
+void nxmic_bench_init(nxmic_bench_t *bench, bool shared_clock) {
+  memset(bench, 0, sizeof(*bench));
+  bench->shared_clock = shared_clock;
+}
+
+void nxmic_bench_set_clock(nxmic_bench_t *bench,
+                           const nxmic_timesync_t *clock) {
+  bench->clock = clock;
+}
+
+static bool absolute_latency(const nxmic_bench_t *bench) {
+  return bench->shared_clock || (bench->clock && bench->clock->valid);
+}
+
+static uint32_t frame_latency_us(nxmic_bench_t *bench, uint32_t timestamp_us,
+                                 uint32_t arrival_us) {
+  if (bench->clock && bench->clock->valid)
+    timestamp_us = nxmic_timesync_to_client(bench->clock, timestamp_us);
+  uint32_t offset = arrival_us - timestamp_us;
+  if (absolute_latency(bench)) return (int32_t)offset < 0 ? 0 : offset;
+  // offsets mod 2^32, compared relative to the first one
+  if (!bench->offset_valid) {
+    bench->offset_valid = true;
+    bench->first_offset = offset;
+    bench->min_delta = 0;
+  }
+  int32_t delta = (int32_t)(offset - bench->first_offset);
+  if (delta < bench->min_delta) bench->min_delta = delta;
+  return (uint32_t)(delta - bench->min_delta);
+}
+
+void nxmic_bench_record(nxmic_bench_t *bench,
+                        const nxmic_frame_header_t *frame,
+                        uint16_t value_length, uint16_t payload_length,
+                        uint32_t arrival_us) {
+  if (bench->notifications == 0) {
+    bench->period_start_us = arrival_us;
+  } else {
+    nxmic_histogram_add(&bench->inter_arrival,
+                        arrival_us - bench->last_arrival_us);
+  }
+  bench->last_arrival_us = arrival_us;
+  bench->notifications++;
+  bench->bytes += value_length;
+  bench->payload_bytes += payload_length;
+  nxmic_histogram_add(&bench->latency,
+                      frame_latency_us(bench, frame->base_timestamp_us,
+                                       arrival_us));
+
+  if (frame->stream_id >= CHAR_COUNT) return;
+  uint32_t stream_bit = 1u << frame->stream_id;
+  if (bench->synced & stream_bit) {
+    uint16_t gap = frame->sequence - bench->next_sequence[frame->stream_id];
+    if (gap < 0x8000) bench->lost += gap;  // else late or duplicate
+  }
+  bench->synced |= stream_bit;
+  bench->next_sequence[frame->stream_id] = frame->sequence + 1;
+}
+
+void nxmic_bench_report(nxmic_bench_t *bench, const char *label,
+                        uint32_t now_us) {
+  uint32_t period_us = now_us - bench->period_start_us;
+  if (bench->notifications == 0 || period_us == 0) {
+    printf("%s bench: no notifications\n", label);
+    return;
+  }
+  uint32_t expected = bench->notifications + bench->lost;
+  printf("%s bench: %lu notif/s, goodput %lu B/s (%lu B/s ATT), "
+         "loss %lu/%lu (%lu.%02lu%%)\n",
+         label,
+         (unsigned long)((uint64_t)bench->notifications * 1000000 / period_us),
+         (unsigned long)((uint64_t)bench->payload_bytes * 1000000 / period_us),
+         (unsigned long)((uint64_t)bench->bytes * 1000000 / period_us),
+         (unsigned long)bench->lost, (unsigned long)expected,
+         (unsigned long)(10000ull * bench->lost / expected / 100),
+         (unsigned long)(10000ull * bench->lost / expected % 100));
+  const nxmic_histogram_t *histograms[] = {&bench->latency,
+                                           &bench->inter_arrival};
+  const char *names[] = {absolute_latency(bench) ? "latency"
+                                                 : "latency above min",
+                         "inter-arrival"};
+  for (int i = 0; i < 2; i++) {
+    printf("%s bench: %s p50 %lu us, p99 %lu us, p999 %lu us, max %lu us\n",
+           label, names[i],
+           (unsigned long)nxmic_histogram_quantile(histograms[i], 5000),
+           (unsigned long)nxmic_histogram_quantile(histograms[i], 9900),
+           (unsigned long)nxmic_histogram_quantile(histograms[i], 9990),
+           (unsigned long)histograms[i]->max);
+  }
+  if (bench->clock && bench->clock->valid) {
+    printf("%s bench: clock sync error bound +/-%lu us, drift %ld ppb, "
+           "%u of %lu rounds fitted\n",
+           label, (unsigned long)bench->clock->error_us,
+           (long)bench->clock->drift_ppb, bench->clock->used,
+           (unsigned long)bench->clock->total_rounds);
+  }
+  start_period(bench);
+}
@@ -0,0 +1,73 @@
+#ifndef NXMIC_BENCH_H_
+#define NXMIC_BENCH_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "nxmic_frame.h"
+#include "nxmic_gatt.h"
+#include "nxmic_timesync.h"
+
+// Streaming benchmark on the receiving side: goodput, notification rate,
+// loss from frame sequence numbers and latency/inter-arrival percentiles.
+// Shared by the reader firmware and the host simulator.
+
+// Fixed-bucket histogram of microsecond values: exact below 16 us, then
+// eight buckets per power of two (12.5 % resolution) up to 2^32 us
+#define NXMIC_HISTOGRAM_LINEAR_BUCKETS 16
+#define NXMIC_HISTOGRAM_SUB_BUCKETS 8
+#define NXMIC_HISTOGRAM_BUCKETS \
+  (NXMIC_HISTOGRAM_LINEAR_BUCKETS + (32 - 4) * NXMIC_HISTOGRAM_SUB_BUCKETS)
+
+typedef struct {
+  uint32_t counts[NXMIC_HISTOGRAM_BUCKETS];
+  uint32_t total;
+  uint32_t max;
+} nxmic_histogram_t;
+
+void nxmic_histogram_reset(nxmic_histogram_t *histogram);
+void nxmic_histogram_add(nxmic_histogram_t *histogram, uint32_t value);
+// Upper bound of the bucket holding the given quantile, in 1/10000
+// (5000 = p50, 9990 = p999). 0 for an empty histogram.
+uint32_t nxmic_histogram_quantile(const nxmic_histogram_t *histogram,
+                                  uint32_t per_10000);
+
+typedef struct {
+  nxmic_histogram_t latency;        // frame timestamp to arrival
+  nxmic_histogram_t inter_arrival;  // between consecutive notifications
+  uint32_t notifications;
+  uint32_t bytes;          // ATT values, frame headers included
+  uint32_t payload_bytes;  // frame payloads, the goodput
+  uint32_t lost;           // frames missing from the sequence
+  uint32_t period_start_us;
+  uint32_t last_arrival_us;
+  uint16_t next_sequence[CHAR_COUNT];
+  uint32_t synced;  // bit per stream, next_sequence valid
+  // Without a shared clock latency is measured above the fastest frame
+  // seen, which removes the unknown offset between the two clocks
+  bool shared_clock;
+  bool offset_valid;
+  uint32_t first_offset;
+  int32_t min_delta;
+  const nxmic_timesync_t *clock;  // Sensor clock fit, NULL if none
+} nxmic_bench_t;
+
+// shared_clock: frame timestamps and arrival times come from the same clock
+// (host simulator), so latency is absolute
+void nxmic_bench_init(nxmic_bench_t *bench, bool shared_clock);
+// Once clock is valid, frame timestamps are mapped to the receiver's time
+// with it and latency is absolute, within the sync error the report prints
+void nxmic_bench_set_clock(nxmic_bench_t *bench,
+                           const nxmic_timesync_t *clock);
+
+// One received notification, arrival_us taken as early as possible
+void nxmic_bench_record(nxmic_bench_t *bench,
+                        const nxmic_frame_header_t *frame,
+                        uint16_t value_length, uint16_t payload_length,
+                        uint32_t arrival_us);
+
+// Print the summary since the previous report and start a new period
+void nxmic_bench_report(nxmic_bench_t *bench, const char *label,
+                        uint32_t now_us);
+
+#endif
@@ -0,0 +1,103 @@
+#include "nxmic_codec.h"
+
+#include "ecg_codec.h"
+
+void nxmic_encoder_init(nxmic_encoder_t *encoder, nxmic_codec_t codec) {
+  encoder->codec = codec;
+  adpcm_init(&encoder->adpcm);
+}
+
+size_t nxmic_encoder_frame_samples(const nxmic_encoder_t *encoder,
+                                   size_t payload_size) {
+  switch (encoder->codec) {
+    case NXMIC_CODEC_PCM16:
+      return payload_size / sizeof(int16_t);
+    case NXMIC_CODEC_ADPCM:
+      if (payload_size <= ADPCM_BLOCK_HEADER_SIZE) return 0;
+      return ADPCM_BLOCK_SAMPLES(payload_size);
+    case NXMIC_CODEC_RICE:
+      return payload_size;
+    default:
+      return 0;
+  }
+}
+
+static size_t encode_pcm16(const int16_t *samples, size_t sample_count,
+                           uint8_t *out, size_t out_size,
+                           size_t *samples_used) {
+  size_t count = out_size / sizeof(int16_t);
+  if (count > sample_count) count = sample_count;
+  for (size_t i = 0; i < count; i++) {
+    out[2 * i] = (uint8_t)samples[i];
+    out[2 * i + 1] = (uint8_t)((uint16_t)samples[i] >> 8);
+  }
+  *samples_used = count;
+  return count * sizeof(int16_t);
+}
+
+static size_t encode_rice(const int16_t *samples, size_t sample_count,
+                          uint8_t *out, size_t out_size,
+                          size_t *samples_used) {
+  // the block size depends on the data: shrink until it fits
+  size_t count = sample_count;
+  if (count > NXMIC_CODEC_MAX_SAMPLES) count = NXMIC_CODEC_MAX_SAMPLES;
+  while (count > 0) {
+    size_t size = ecg_encode_block(samples, count, out, out_size);
+    if (size) {
+      *samples_used = count;
+      return size;
+    }
+    size_t shrink = count / 8;
+    count -= shrink ? shrink : 1;
+  }
+  *samples_used = 0;
+  return 0;
+}
+
+size_t nxmic_encoder_encode(nxmic_encoder_t *encoder, const int16_t *samples,
+                            size_t sample_count, uint8_t *out,
+                            size_t out_size, size_t *samples_used) {
+  *samples_used = 0;
+  switch (encoder->codec) {
+    case NXMIC_CODEC_PCM16:
+      return encode_pcm16(samples, sample_count, out, out_size, samples_used);
+    case NXMIC_CODEC_ADPCM: {
+      size_t count = nxmic_encoder_frame_samples(encoder, out_size);
+      if (count > sample_count) count = sample_count;
+      if (count == 0) return 0;
+      *samples_used = count;
+      return adpcm_encode_block(&encoder->adpcm, samples, count, out);
+    }
+    case NXMIC_CODEC_RICE:
+      return encode_rice(samples, sample_count, out, out_size, samples_used);
+    default:
+      return 0;
+  }
+}
+
+int nxmic_codec_decode(const nxmic_frame_header_t *frame,
+                       const uint8_t *payload, uint16_t payload_length,
+                       int16_t *samples, size_t max_samples) {
+  if (frame->sample_count > max_samples) return -1;
+  switch (frame->codec) {
+    case NXMIC_CODEC_PCM16:
+      if (payload_length < frame->sample_count * sizeof(int16_t)) return -1;
+      for (int i = 0; i < frame->sample_count; i++) {
+        samples[i] = (int16_t)(payload[2 * i] | (payload[2 * i + 1] << 8));
+      }
+      return frame->sample_count;
+    case NXMIC_CODEC_ADPCM: {
+      adpcm_state_t state;
+      if (payload_length < ADPCM_BLOCK_SIZE(frame->sample_count)) return -1;
+      return (int)adpcm_decode_block(&state, payload, payload_length, samples,
+                                     frame->sample_count);
+    }
+    case NXMIC_CODEC_RICE:
+      if (!ecg_decode_block(payload, payload_length, samples,
+                            frame->sample_count))
+        return -1;
+      return frame->sample_count;
+    default:
+      return -1;
+  }
+}
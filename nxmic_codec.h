@@ -0,0 +1,42 @@
+#ifndef NXMIC_CODEC_H_
+#define NXMIC_CODEC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "adpcm.h"
+#include "nxmic_frame.h"
+
+// Frame payload <-> int16 samples for every nxmic_codec_t, shared by the
+// reader, the sensors and the host simulator.
+
+// Most samples one frame payload can decode to (Rice: >= 1 bit per sample)
+#define NXMIC_CODEC_MAX_SAMPLES \
+  ((NXMIC_FRAME_MAX_SIZE - NXMIC_FRAME_HEADER_SIZE) * 8)
+
+typedef struct {
+  nxmic_codec_t codec;
+  adpcm_state_t adpcm;  // carried across blocks for a smoother predictor
+} nxmic_encoder_t;
+
+void nxmic_encoder_init(nxmic_encoder_t *encoder, nxmic_codec_t codec);
+
+// Samples a payload of payload_size bytes is expected to hold. Exact for
+// the fixed-rate codecs, an estimate of 8 bits per sample for Rice.
+size_t nxmic_encoder_frame_samples(const nxmic_encoder_t *encoder,
+                                   size_t payload_size);
+
+// Encode as many of the sample_count samples as fit in out_size bytes.
+// Returns the payload bytes written and sets *samples_used, 0 if none fit.
+size_t nxmic_encoder_encode(nxmic_encoder_t *encoder, const int16_t *samples,
+                            size_t sample_count, uint8_t *out,
+                            size_t out_size, size_t *samples_used);
+
+// Decode a received frame payload into at most max_samples samples.
+// Returns the number of samples, or -1 for an unknown codec, a sample count
+// that does not fit or a malformed payload.
+int nxmic_codec_decode(const nxmic_frame_header_t *frame,
+                       const uint8_t *payload, uint16_t payload_length,
+                       int16_t *samples, size_t max_samples);
+
+#endif
@@ -0,0 +1,106 @@
+#include "nxmic_decimate.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__ARM_FEATURE_DSP)
+#include <arm_acle.h>
+#endif
+
+// acc + x[0] * h[0] + x[1] * h[1]
+static inline int32_t dual_mac(const int16_t *x, const int16_t *h,
+                               int32_t acc) {
+#if defined(__ARM_FEATURE_DSP)
+  int32_t x2, h2;
+  memcpy(&x2, x, sizeof(x2));  // unaligned LDR, x moves one sample a step
+  memcpy(&h2, h, sizeof(h2));
+  return __smlad(x2, h2, acc);
+#else
+  return acc + x[0] * h[0] + x[1] * h[1];
+#endif
+}
+
+// Q30 sum to Q15, rounded
+static inline int16_t to_q15(int32_t acc) {
+  acc = (acc + (1 << 14)) >> 15;
+#if defined(__ARM_FEATURE_SAT)
+  return (int16_t)__ssat(acc, 16);
+#else
+  if (acc > INT16_MAX) return INT16_MAX;
+  if (acc < INT16_MIN) return INT16_MIN;
+  return (int16_t)acc;
+#endif
+}
+
+// One output from the taps samples at x, oldest first
+static int16_t filter(const nxmic_decimator_t *decimator, const int16_t *x) {
+  const int16_t *h = decimator->coefficients;
+  int32_t acc = 0;
+  for (uint16_t i = 0; i < decimator->taps; i += 2)
+    acc = dual_mac(&x[i], &h[i], acc);
+  return to_q15(acc);
+}
+
+bool nxmic_decimator_init(nxmic_decimator_t *decimator,
+                          const int16_t *coefficients, uint16_t taps,
+                          uint8_t factor) {
+  if (taps == 0 || taps > NXMIC_DECIMATE_MAX_TAPS || factor == 0)
+    return false;
+  memset(decimator, 0, sizeof(*decimator));
+  decimator->factor = factor;
+  decimator->taps = (uint16_t)((taps + 1) & ~1u);
+  int16_t *reversed = &decimator->coefficients[decimator->taps - taps];
+  for (uint16_t i = 0; i < taps; i++) reversed[i] = coefficients[taps - 1 - i];
+  return true;
+}
+
+void nxmic_decimator_reset(nxmic_decimator_t *decimator) {
+  memset(decimator->history, 0, sizeof(decimator->history));
+  decimator->phase = 0;
+}
+
+uint16_t nxmic_decimator_run(nxmic_decimator_t *decimator, uint16_t count,
+                             int16_t *out) {
+  if (count > NXMIC_DECIMATE_MAX_BLOCK) count = NXMIC_DECIMATE_MAX_BLOCK;
+  uint16_t outputs = 0;
+  // the window of the output after input i starts at history[i]
+  for (uint32_t i = decimator->factor - 1u - decimator->phase; i < count;
+       i += decimator->factor)
+    out[outputs++] = filter(decimator, &decimator->history[i]);
+  decimator->phase = (uint8_t)((decimator->phase + count) % decimator->factor);
+  memmove(decimator->history, &decimator->history[count],
+          (decimator->taps - 1u) * sizeof(decimator->history[0]));
+  return outputs;
+}
+
+uint16_t nxmic_decimate(nxmic_decimator_t *decimator, const int16_t *in,
+                        uint16_t count, int16_t *out) {
+  if (count > NXMIC_DECIMATE_MAX_BLOCK) count = NXMIC_DECIMATE_MAX_BLOCK;
+  memcpy(nxmic_decimator_input(decimator), in, count * sizeof(in[0]));
+  return nxmic_decimator_run(decimator, count, out);
+}
+
+void nxmic_decimate_design(int16_t *coefficients, uint16_t taps,
+                           uint8_t factor) {
+  const float pi = 3.14159265f;
+  float cutoff = 0.5f / factor;  // cycles per input sample
+  float center = (taps - 1) / 2.0f;
+  float h[NXMIC_DECIMATE_MAX_TAPS];
+  float sum = 0;
+  if (taps > NXMIC_DECIMATE_MAX_TAPS) taps = NXMIC_DECIMATE_MAX_TAPS;
+  for (uint16_t i = 0; i < taps; i++) {
+    float t = i - center;
+    float sinc = t == 0 ? 2 * cutoff : sinf(2 * pi * cutoff * t) / (pi * t);
+    float window =
+        taps > 1 ? 0.54f - 0.46f * cosf(2 * pi * i / (taps - 1)) : 1;
+    h[i] = sinc * window;
+    sum += h[i];
+  }
+  // rounding leaves the DC gain off by a few LSB, the middle tap takes it
+  int32_t total = 0;
+  for (uint16_t i = 0; i < taps; i++) {
+    coefficients[i] = (int16_t)lrintf(h[i] / sum * 32768.0f);
+    total += coefficients[i];
+  }
+  coefficients[taps / 2] += (int16_t)(32768 - total);
+}
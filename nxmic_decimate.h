@@ -0,0 +1,66 @@
+#ifndef NXMIC_DECIMATE_H_
+#define NXMIC_DECIMATE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Decimating FIR filter in Q15, for previews of a stream at a fraction of
+// its rate: low-pass filter, then keep one sample in factor. Only the kept
+// outputs are computed, each from the taps and the input window it needs,
+// which is what a polyphase decimator does without splitting the input
+// into factor delay lines: the cost is taps multiply-accumulates per
+// output, not per input.
+//
+// Samples pass through the filter a block at a time. A producer that
+// converts its own buffer (e.g. raw ADC readings) writes the converted
+// samples straight after the filter's history, at nxmic_decimator_input(),
+// and runs the filter over them, so the block is read once.
+//
+// On cores with the DSP extension (Cortex-M33) two taps go through each
+// SMLAD; elsewhere the same arithmetic runs as scalar C, bit for bit.
+// The absolute coefficients must sum to less than 2.0 so the 32-bit
+// accumulator cannot overflow; outputs are rounded and saturated.
+
+#define NXMIC_DECIMATE_MAX_TAPS 64
+#define NXMIC_DECIMATE_MAX_BLOCK 512
+
+typedef struct {
+  uint8_t factor;
+  uint8_t phase;  // Inputs since the last output
+  uint16_t taps;  // Rounded up to even
+  // Time-reversed, a zero tap first if the filter had an odd length
+  int16_t coefficients[NXMIC_DECIMATE_MAX_TAPS];
+  // taps - 1 samples of the previous blocks, then the current block
+  int16_t history[NXMIC_DECIMATE_MAX_TAPS - 1 + NXMIC_DECIMATE_MAX_BLOCK];
+} nxmic_decimator_t;
+
+// coefficients are the impulse response h[0..taps-1] in Q15. false if
+// taps or factor is out of range.
+bool nxmic_decimator_init(nxmic_decimator_t *decimator,
+                          const int16_t *coefficients, uint16_t taps,
+                          uint8_t factor);
+
+// Forget the history, as if every earlier input was 0
+void nxmic_decimator_reset(nxmic_decimator_t *decimator);
+
+// Where the next block goes, NXMIC_DECIMATE_MAX_BLOCK samples at most
+static inline int16_t *nxmic_decimator_input(nxmic_decimator_t *decimator) {
+  return &decimator->history[decimator->taps - 1];
+}
+
+// Filter the count samples written at nxmic_decimator_input() into out,
+// room for count / factor + 1 outputs. Returns the number of outputs.
+uint16_t nxmic_decimator_run(nxmic_decimator_t *decimator, uint16_t count,
+                             int16_t *out);
+
+// Same, with the block copied in from in
+uint16_t nxmic_decimate(nxmic_decimator_t *decimator, const int16_t *in,
+                        uint16_t count, int16_t *out);
+
+// Low-pass for decimation by factor (2 or more) into coefficients: a
+// Hamming windowed sinc with its cutoff at the output Nyquist frequency,
+// unity gain at DC.
+void nxmic_decimate_design(int16_t *coefficients, uint16_t taps,
+                           uint8_t factor);
+
+#endif
@@ -0,0 +1,314 @@
+#include "nxmic_export.h"
+
+#include <string.h>
+
+// Data read per step while the sensor computes the final CRC
+#define CRC_READ_SIZE 64
+
+// Nibble tables: 128 bytes of flash instead of 1.5 kB for byte tables
+static const uint32_t crc32_table[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4,
+    0x4db26158, 0x5005713c, 0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+    0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+};
+
+static const uint16_t crc16_table[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+};
+
+uint32_t nxmic_crc32_update(uint32_t crc, const uint8_t *data, size_t length) {
+  crc = ~crc;
+  for (size_t i = 0; i < length; i++) {
+    crc = (crc >> 4) ^ crc32_table[(crc ^ data[i]) & 0x0f];
+    crc = (crc >> 4) ^ crc32_table[(crc ^ (data[i] >> 4)) & 0x0f];
+  }
+  return ~crc;
+}
+
+uint16_t nxmic_crc16(const uint8_t *data, size_t length) {
+  uint16_t crc = 0xffff;
+  for (size_t i = 0; i < length; i++) {
+    crc = (uint16_t)(crc << 4) ^ crc16_table[(crc >> 12) ^ (data[i] >> 4)];
+    crc = (uint16_t)(crc << 4) ^ crc16_table[(crc >> 12) ^ (data[i] & 0x0f)];
+  }
+  return crc;
+}
+
+static uint16_t read_16(const uint8_t *buffer, int offset) {
+  return (uint16_t)(buffer[offset] | (buffer[offset + 1] << 8));
+}
+
+static uint32_t read_32(const uint8_t *buffer, int offset) {
+  return (uint32_t)buffer[offset] | ((uint32_t)buffer[offset + 1] << 8) |
+         ((uint32_t)buffer[offset + 2] << 16) |
+         ((uint32_t)buffer[offset + 3] << 24);
+}
+
+static void write_16(uint8_t *buffer, int offset, uint16_t value) {
+  buffer[offset] = (uint8_t)value;
+  buffer[offset + 1] = (uint8_t)(value >> 8);
+}
+
+static void write_32(uint8_t *buffer, int offset, uint32_t value) {
+  write_16(buffer, offset, (uint16_t)value);
+  write_16(buffer, offset + 2, (uint16_t)(value >> 16));
+}
+
+void nxmic_export_sender_init(nxmic_export_sender_t *sender,
+                              nxmic_export_read_t read, void *context) {
+  memset(sender, 0, sizeof(*sender));
+  sender->read = read;
+  sender->context = context;
+}
+
+void nxmic_export_sender_set_size(nxmic_export_sender_t *sender,
+                                  uint32_t size) {
+  sender->size = size;
+}
+
+static void handle_start(nxmic_export_sender_t *sender,
+                         const uint8_t *value) {
+  uint32_t start = read_32(value, 2);
+  uint32_t resume = read_32(value, 6);
+  uint32_t end = read_32(value, 10);
+  if (end > sender->size) end = sender->size;
+  if (start > end) start = end;
+  if (resume < start) resume = start;
+  if (resume > end) resume = end;
+  sender->start = start;
+  sender->end = end;
+  sender->next = resume;
+  sender->acked = resume;
+  sender->credits = read_16(value, 14);
+  sender->tag = value[1];
+  sender->transport = value[16];
+  sender->active = true;
+  sender->starts++;
+}
+
+bool nxmic_export_sender_handle_write(nxmic_export_sender_t *sender,
+                                      const uint8_t *value, uint16_t length) {
+  if (length < 1) return false;
+  switch (value[0]) {
+    case NXMIC_EXPORT_OP_START:
+      if (length < NXMIC_EXPORT_START_SIZE) return false;
+      handle_start(sender, value);
+      return true;
+    case NXMIC_EXPORT_OP_CREDIT: {
+      if (length < NXMIC_EXPORT_CREDIT_SIZE) return false;
+      if (!sender->active) return true;  // stale, the transfer ended
+      sender->acked = read_32(value, 1);
+      uint32_t credits = (uint32_t)sender->credits + read_16(value, 5);
+      sender->credits = credits > 0xffff ? 0xffff : (uint16_t)credits;
+      return true;
+    }
+    case NXMIC_EXPORT_OP_ABORT:
+      sender->active = false;
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool nxmic_export_sender_pending(const nxmic_export_sender_t *sender) {
+  if (!sender->active) return false;
+  return sender->next == sender->end || sender->credits > 0;
+}
+
+static uint32_t range_crc(const nxmic_export_sender_t *sender) {
+  uint8_t buffer[CRC_READ_SIZE];
+  uint32_t crc = 0;
+  for (uint32_t offset = sender->start; offset < sender->end;) {
+    uint32_t left = sender->end - offset;
+    uint16_t length = sender->read(sender->context, offset, buffer,
+                                   left < sizeof(buffer) ? (uint16_t)left
+                                                         : sizeof(buffer));
+    if (length == 0) break;
+    crc = nxmic_crc32_update(crc, buffer, length);
+    offset += length;
+  }
+  return crc;
+}
+
+uint16_t nxmic_export_sender_build(nxmic_export_sender_t *sender,
+                                   uint8_t *out, uint16_t max_length) {
+  sender->built = 0;
+  if (!nxmic_export_sender_pending(sender)) return 0;
+  if (sender->next < sender->end) {
+    if (max_length <= NXMIC_EXPORT_CHUNK_HEADER_SIZE) return 0;
+    uint32_t left = sender->end - sender->next;
+    uint16_t room = max_length - NXMIC_EXPORT_CHUNK_HEADER_SIZE;
+    uint16_t length =
+        sender->read(sender->context, sender->next,
+                     out + NXMIC_EXPORT_CHUNK_HEADER_SIZE,
+                     left < room ? (uint16_t)left : room);
+    if (length > 0) {
+      out[0] = NXMIC_EXPORT_OP_CHUNK;
+      out[1] = sender->tag;
+      write_32(out, 2, sender->next);
+      write_16(out, 6, nxmic_crc16(out + NXMIC_EXPORT_CHUNK_HEADER_SIZE,
+                                   length));
+      sender->built = length;
+      return NXMIC_EXPORT_CHUNK_HEADER_SIZE + length;
+    }
+    // the recording is shorter than it claimed, close the range here
+    sender->end = sender->next;
+  }
+  if (max_length < NXMIC_EXPORT_END_SIZE) return 0;
+  out[0] = NXMIC_EXPORT_OP_END;
+  out[1] = sender->tag;
+  write_32(out, 2, sender->start);
+  write_32(out, 6, sender->end);
+  write_32(out, 10, range_crc(sender));
+  return NXMIC_EXPORT_END_SIZE;
+}
+
+void nxmic_export_sender_sent(nxmic_export_sender_t *sender) {
+  if (!sender->active) return;
+  if (sender->built == 0) {
+    // END is out; a lost END shows up as a stall and a new START
+    sender->active = false;
+    return;
+  }
+  sender->next += sender->built;
+  sender->credits--;
+  sender->chunks_sent++;
+  sender->bytes_sent += sender->built;
+  sender->built = 0;
+}
+
+void nxmic_export_sender_stop(nxmic_export_sender_t *sender) {
+  sender->active = false;
+  sender->built = 0;
+}
+
+void nxmic_export_receiver_init(nxmic_export_receiver_t *receiver,
+                                nxmic_export_write_t write, void *context) {
+  memset(receiver, 0, sizeof(*receiver));
+  receiver->write = write;
+  receiver->context = context;
+}
+
+void nxmic_export_receiver_begin(nxmic_export_receiver_t *receiver,
+                                 uint32_t offset, uint32_t length) {
+  receiver->state = NXMIC_EXPORT_RUNNING;
+  receiver->start = offset;
+  receiver->end = length == NXMIC_EXPORT_TO_END || length > ~offset
+                      ? NXMIC_EXPORT_TO_END
+                      : offset + length;
+  receiver->acked = offset;
+  receiver->crc = 0;
+  receiver->outstanding = 0;
+  receiver->start_due = true;
+}
+
+void nxmic_export_receiver_resume(nxmic_export_receiver_t *receiver) {
+  if (receiver->state != NXMIC_EXPORT_RUNNING) return;
+  receiver->start_due = true;
+  receiver->restarts++;
+}
+
+// Go back to the last acknowledged offset
+static void restart(nxmic_export_receiver_t *receiver) {
+  if (receiver->start_due) return;
+  receiver->start_due = true;
+  receiver->restarts++;
+}
+
+static void on_chunk(nxmic_export_receiver_t *receiver, const uint8_t *value,
+                     uint16_t length, uint32_t now_us) {
+  uint32_t offset = read_32(value, 2);
+  const uint8_t *data = value + NXMIC_EXPORT_CHUNK_HEADER_SIZE;
+  uint16_t data_length = length - NXMIC_EXPORT_CHUNK_HEADER_SIZE;
+  if (value[1] != receiver->tag) {
+    receiver->out_of_order++;  // sent before the last START
+    return;
+  }
+  if (receiver->outstanding) receiver->outstanding--;
+  if (offset != receiver->acked) {
+    receiver->out_of_order++;
+    restart(receiver);
+    return;
+  }
+  if (nxmic_crc16(data, data_length) != read_16(value, 6)) {
+    receiver->crc_errors++;
+    restart(receiver);
+    return;
+  }
+  if (receiver->write)
+    receiver->write(receiver->context, offset, data, data_length);
+  receiver->crc = nxmic_crc32_update(receiver->crc, data, data_length);
+  receiver->acked += data_length;
+  receiver->chunks++;
+  receiver->bytes += data_length;
+  receiver->progress_us = now_us;
+}
+
+static void on_end(nxmic_export_receiver_t *receiver, const uint8_t *value,
+                   uint32_t now_us) {
+  if (value[1] != receiver->tag) return;
+  uint32_t start = read_32(value, 2);
+  uint32_t end = read_32(value, 6);
+  // chunks before it went missing
+  if (start != receiver->start || end != receiver->acked) {
+    receiver->out_of_order++;
+    restart(receiver);
+    return;
+  }
+  receiver->end = end;
+  receiver->progress_us = now_us;
+  receiver->state = read_32(value, 10) == receiver->crc ? NXMIC_EXPORT_DONE
+                                                        : NXMIC_EXPORT_FAILED;
+}
+
+bool nxmic_export_receiver_on_notification(nxmic_export_receiver_t *receiver,
+                                           const uint8_t *value,
+                                           uint16_t length, uint32_t now_us) {
+  if (length < 1) return false;
+  if (value[0] == NXMIC_EXPORT_OP_CHUNK) {
+    if (length <= NXMIC_EXPORT_CHUNK_HEADER_SIZE) return false;
+    if (receiver->state == NXMIC_EXPORT_RUNNING)
+      on_chunk(receiver, value, length, now_us);
+    return true;
+  }
+  if (value[0] == NXMIC_EXPORT_OP_END) {
+    if (length < NXMIC_EXPORT_END_SIZE) return false;
+    if (receiver->state == NXMIC_EXPORT_RUNNING)
+      on_end(receiver, value, now_us);
+    return true;
+  }
+  return false;
+}
+
+uint16_t nxmic_export_receiver_build_request(
+    nxmic_export_receiver_t *receiver, uint32_t now_us, uint8_t *out) {
+  if (receiver->state != NXMIC_EXPORT_RUNNING) return 0;
+  // nothing arrived for a while: START, its first chunk or END got lost
+  if (!receiver->start_due &&
+      now_us - receiver->progress_us >= NXMIC_EXPORT_RETRY_US) {
+    receiver->start_due = true;
+    receiver->restarts++;
+  }
+  if (receiver->start_due) {
+    receiver->tag++;
+    out[0] = NXMIC_EXPORT_OP_START;
+    out[1] = receiver->tag;
+    write_32(out, 2, receiver->start);
+    write_32(out, 6, receiver->acked);
+    write_32(out, 10, receiver->end);
+    write_16(out, 14, NXMIC_EXPORT_WINDOW_CHUNKS);
+    out[16] = receiver->transport;
+    receiver->outstanding = NXMIC_EXPORT_WINDOW_CHUNKS;
+    receiver->start_due = false;
+    receiver->progress_us = now_us;
+    return NXMIC_EXPORT_START_SIZE;
+  }
+  // top the window up once half of it is used
+  if (receiver->outstanding > NXMIC_EXPORT_WINDOW_CHUNKS / 2) return 0;
+  out[0] = NXMIC_EXPORT_OP_CREDIT;
+  write_32(out, 1, receiver->acked);
+  write_16(out, 5, NXMIC_EXPORT_WINDOW_CHUNKS - receiver->outstanding);
+  receiver->outstanding = NXMIC_EXPORT_WINDOW_CHUNKS;
+  return NXMIC_EXPORT_CREDIT_SIZE;
+}
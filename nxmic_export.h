@@ -0,0 +1,163 @@
+#ifndef NXMIC_EXPORT_H_
+#define NXMIC_EXPORT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Bulk export of a recorded session over CHAR_DATA_EXPORT. The reader asks
+// for a byte range and hands out credits; the sensor notifies one chunk per
+// credit, as large as the MTU allows, and closes the transfer with the
+// CRC-32 of the whole range. The reader acknowledges its contiguous prefix
+// with every credit grant, so after a lost chunk or a disconnect it simply
+// starts again from that offset. Every START carries a new tag that the
+// sensor echoes, so chunks still in flight from before are told apart.
+//
+// Requests, written without response to CHAR_DATA_EXPORT (next to the NACKs
+// of nxmic_retransmit.h):
+//
+//   START   op u8, tag u8, start u32, resume u32, end u32, credits u16,
+//           transport u8
+//           transfer [resume, end) of the range [start, end); end may be
+//           NXMIC_EXPORT_TO_END, the sensor clamps it to the recording
+//   CREDIT  op u8, acked u32, credits u16
+//           credits are added to the sensor's allowance
+//   ABORT   op u8
+//
+// Notifications on CHAR_DATA_EXPORT:
+//
+//   CHUNK   op u8, tag u8, offset u32, crc16 u16, data
+//           CRC-16/CCITT-FALSE of data
+//   END     op u8, tag u8, start u32, end u32, crc32 u32
+//           CRC-32 (IEEE 802.3) of [start, end)
+//
+// All fields little-endian.
+//
+// With NXMIC_EXPORT_TRANSPORT_L2CAP the sensor sends CHUNK and END as SDUs
+// on the L2CAP LE credit-based channel the reader opened on
+// NXMIC_EXPORT_PSM instead of notifications: chunks of up to
+// NXMIC_EXPORT_SDU_SIZE, segmented by L2CAP, no ATT header per packet and
+// no CAN_SEND_NOW round trip per notification. Requests stay on GATT. A
+// sensor without the channel falls back to notifications.
+
+#define NXMIC_EXPORT_OP_START 0x02
+#define NXMIC_EXPORT_OP_CREDIT 0x03
+#define NXMIC_EXPORT_OP_ABORT 0x04
+#define NXMIC_EXPORT_OP_CHUNK 0x81
+#define NXMIC_EXPORT_OP_END 0x82
+
+#define NXMIC_EXPORT_TRANSPORT_GATT 0
+#define NXMIC_EXPORT_TRANSPORT_L2CAP 1
+
+// LE credit-based channel, PSM from the dynamic range. An SDU fills four
+// K-frames of 247 bytes (SDU length field included), each one LL PDU with
+// the 251-byte data length.
+#define NXMIC_EXPORT_PSM 0x0081
+#define NXMIC_EXPORT_SDU_SIZE (4 * 247 - 2)
+
+#define NXMIC_EXPORT_TO_END 0xffffffffu
+#define NXMIC_EXPORT_START_SIZE 17
+#define NXMIC_EXPORT_CREDIT_SIZE 7
+#define NXMIC_EXPORT_REQUEST_MAX_SIZE NXMIC_EXPORT_START_SIZE
+#define NXMIC_EXPORT_CHUNK_HEADER_SIZE 8
+#define NXMIC_EXPORT_END_SIZE 14
+
+// Reader side
+#define NXMIC_EXPORT_WINDOW_CHUNKS 32  // Credits outstanding at most
+#define NXMIC_EXPORT_RETRY_US 1000000  // Restart after this long without data
+
+// zlib convention: start from 0, feed the result back in
+uint32_t nxmic_crc32_update(uint32_t crc, const uint8_t *data, size_t length);
+uint16_t nxmic_crc16(const uint8_t *data, size_t length);
+
+// Reads up to length bytes of the recording at offset, returns how many
+typedef uint16_t (*nxmic_export_read_t)(void *context, uint32_t offset,
+                                        uint8_t *buffer, uint16_t length);
+
+// Sensor side
+typedef struct {
+  nxmic_export_read_t read;
+  void *context;
+  uint32_t size;  // Bytes recorded so far
+  bool active;
+  uint8_t tag;        // From START, echoed in every CHUNK and END
+  uint8_t transport;  // NXMIC_EXPORT_TRANSPORT_*, from START
+  uint32_t start;   // Range covered by the final CRC
+  uint32_t end;
+  uint32_t next;    // Next chunk offset
+  uint32_t acked;   // Last offset the reader acknowledged
+  uint16_t credits;
+  uint16_t built;   // Data bytes in the chunk handed out by build()
+  uint32_t chunks_sent;
+  uint32_t bytes_sent;
+  uint32_t starts;  // START requests, resumes and restarts included
+} nxmic_export_sender_t;
+
+void nxmic_export_sender_init(nxmic_export_sender_t *sender,
+                              nxmic_export_read_t read, void *context);
+// The recording grew (or was replaced); ranges are clamped to it
+void nxmic_export_sender_set_size(nxmic_export_sender_t *sender,
+                                  uint32_t size);
+// START, CREDIT or ABORT. false if the value is not an export request.
+bool nxmic_export_sender_handle_write(nxmic_export_sender_t *sender,
+                                      const uint8_t *value, uint16_t length);
+// A notification is ready to go out
+bool nxmic_export_sender_pending(const nxmic_export_sender_t *sender);
+// Build the next CHUNK or END into out, at most max_length bytes (MTU - 3,
+// or the SDU size on the L2CAP channel).
+// Returns its length, 0 if nothing is due. Call nxmic_export_sender_sent()
+// once the notification was accepted, build again otherwise.
+uint16_t nxmic_export_sender_build(nxmic_export_sender_t *sender,
+                                   uint8_t *out, uint16_t max_length);
+void nxmic_export_sender_sent(nxmic_export_sender_t *sender);
+// Connection lost: stop until the reader sends START again
+void nxmic_export_sender_stop(nxmic_export_sender_t *sender);
+
+// Reader side
+typedef void (*nxmic_export_write_t)(void *context, uint32_t offset,
+                                     const uint8_t *data, uint16_t length);
+
+typedef enum {
+  NXMIC_EXPORT_IDLE,
+  NXMIC_EXPORT_RUNNING,
+  NXMIC_EXPORT_DONE,    // END received, CRC-32 matched
+  NXMIC_EXPORT_FAILED,  // END received, CRC-32 did not match
+} nxmic_export_state_t;
+
+typedef struct {
+  nxmic_export_state_t state;
+  nxmic_export_write_t write;  // Optional, gets the data in order
+  void *context;
+  uint8_t transport;  // Asked for by the next START, may change on resume
+  uint32_t start;
+  uint32_t end;    // NXMIC_EXPORT_TO_END until the sensor reports it
+  uint32_t acked;  // Everything below is received and checked
+  uint32_t crc;    // CRC-32 of [start, acked)
+  uint16_t outstanding;  // Credits the sensor may still use
+  bool start_due;  // START from acked goes out with the next request
+  uint8_t tag;     // Of the last START
+  uint32_t progress_us;
+  uint32_t chunks;
+  uint32_t bytes;
+  uint32_t crc_errors;
+  uint32_t out_of_order;  // Chunks past a gap or from an earlier START
+  uint32_t restarts;      // STARTs after the first
+} nxmic_export_receiver_t;
+
+void nxmic_export_receiver_init(nxmic_export_receiver_t *receiver,
+                                nxmic_export_write_t write, void *context);
+// Ask for length bytes from offset, or NXMIC_EXPORT_TO_END
+void nxmic_export_receiver_begin(nxmic_export_receiver_t *receiver,
+                                 uint32_t offset, uint32_t length);
+// New connection: carry on from the last acknowledged offset
+void nxmic_export_receiver_resume(nxmic_export_receiver_t *receiver);
+// Handle a CHUNK or END, notification or SDU. false if it is neither.
+bool nxmic_export_receiver_on_notification(nxmic_export_receiver_t *receiver,
+                                           const uint8_t *value,
+                                           uint16_t length, uint32_t now_us);
+// START or CREDIT that is due, into out[NXMIC_EXPORT_REQUEST_MAX_SIZE].
+// Returns its length, 0 if there is nothing to send.
+uint16_t nxmic_export_receiver_build_request(
+    nxmic_export_receiver_t *receiver, uint32_t now_us, uint8_t *out);
+
+#endif
@@ -0,0 +1,61 @@
+#include "nxmic_frame.h"
+
+#include <string.h>
+
+static void set_sample_count(nxmic_frame_builder_t *builder,
+                             uint16_t sample_count) {
+  builder->buffer[2] = (uint8_t)sample_count;
+  builder->buffer[3] = (uint8_t)(sample_count >> 8);
+}
+
+void nxmic_frame_begin(nxmic_frame_builder_t *builder, uint8_t stream_id,
+                       nxmic_codec_t codec, uint16_t sequence,
+                       uint32_t base_timestamp_us, uint16_t capacity) {
+  if (capacity > NXMIC_FRAME_MAX_SIZE) capacity = NXMIC_FRAME_MAX_SIZE;
+  builder->capacity = capacity;
+  builder->length = NXMIC_FRAME_HEADER_SIZE;
+  builder->buffer[0] = stream_id;
+  builder->buffer[1] = (uint8_t)codec;
+  set_sample_count(builder, 0);
+  builder->buffer[4] = (uint8_t)sequence;
+  builder->buffer[5] = (uint8_t)(sequence >> 8);
+  builder->buffer[6] = (uint8_t)base_timestamp_us;
+  builder->buffer[7] = (uint8_t)(base_timestamp_us >> 8);
+  builder->buffer[8] = (uint8_t)(base_timestamp_us >> 16);
+  builder->buffer[9] = (uint8_t)(base_timestamp_us >> 24);
+}
+
+void nxmic_frame_commit(nxmic_frame_builder_t *builder, uint16_t length,
+                        uint16_t sample_count) {
+  builder->length += length;
+  set_sample_count(builder, nxmic_frame_sample_count(builder) + sample_count);
+}
+
+bool nxmic_frame_append(nxmic_frame_builder_t *builder, const void *sample,
+                        uint16_t sample_size) {
+  if (nxmic_frame_is_full(builder, sample_size)) return false;
+  memcpy(&builder->buffer[builder->length], sample, sample_size);
+  nxmic_frame_commit(builder, sample_size, 1);
+  return true;
+}
+
+bool nxmic_frame_append_int16(nxmic_frame_builder_t *builder, int16_t sample) {
+  uint8_t le[2] = {(uint8_t)sample, (uint8_t)((uint16_t)sample >> 8)};
+  return nxmic_frame_append(builder, le, sizeof(le));
+}
+
+bool nxmic_frame_parse(const uint8_t *data, uint16_t length,
+                       nxmic_frame_header_t *header, const uint8_t **samples,
+                       uint16_t *samples_length) {
+  if (length < NXMIC_FRAME_HEADER_SIZE) return false;
+  header->stream_id = data[0];
+  header->codec = data[1];
+  header->sample_count = (uint16_t)(data[2] | (data[3] << 8));
+  header->sequence = (uint16_t)(data[4] | (data[5] << 8));
+  header->base_timestamp_us = (uint32_t)data[6] | ((uint32_t)data[7] << 8) |
+                              ((uint32_t)data[8] << 16) |
+                              ((uint32_t)data[9] << 24);
+  *samples = data + NXMIC_FRAME_HEADER_SIZE;
+  *samples_length = length - NXMIC_FRAME_HEADER_SIZE;
+  return true;
+}
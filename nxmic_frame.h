@@ -0,0 +1,88 @@
+#ifndef NXMIC_FRAME_H_
+#define NXMIC_FRAME_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Framed stream format carried in every NxMic streaming notification:
+//
+//   stream_id      u8   gatt_characteristic_id_t of the stream
+//   codec          u8   nxmic_codec_t of the payload
+//   sample_count   u16  samples carried by the payload
+//   sequence       u16  per-stream frame counter, wraps
+//   base_timestamp u32  device time of the first sample in us
+//   payload ...         up to ATT MTU - 3 bytes total
+//
+// All multi-byte fields are little-endian.
+
+#define NXMIC_FRAME_HEADER_SIZE 10
+
+// Largest ATT value BTstack can send with HCI_ACL_PAYLOAD_SIZE 255 + 4
+#define NXMIC_FRAME_MAX_SIZE 252
+
+// How the samples in a frame payload are encoded
+typedef enum {
+  NXMIC_CODEC_PCM16 = 0,  // packed little-endian int16
+  NXMIC_CODEC_ADPCM = 1,  // one adpcm.h block
+  NXMIC_CODEC_RICE = 2,   // one ecg_codec.h block
+} nxmic_codec_t;
+
+typedef struct {
+  uint8_t stream_id;
+  uint8_t codec;
+  uint16_t sample_count;
+  uint16_t sequence;
+  uint32_t base_timestamp_us;
+} nxmic_frame_header_t;
+
+// Accumulates samples for one stream until the frame is full
+typedef struct {
+  uint8_t buffer[NXMIC_FRAME_MAX_SIZE];
+  uint16_t length;    // Bytes used, header included
+  uint16_t capacity;  // Frame size limit, ATT MTU - 3
+} nxmic_frame_builder_t;
+
+// Start a new frame. capacity is clamped to NXMIC_FRAME_MAX_SIZE.
+void nxmic_frame_begin(nxmic_frame_builder_t *builder, uint8_t stream_id,
+                       nxmic_codec_t codec, uint16_t sequence,
+                       uint32_t base_timestamp_us, uint16_t capacity);
+
+// Append one sample of sample_size bytes, false if it does not fit
+bool nxmic_frame_append(nxmic_frame_builder_t *builder, const void *sample,
+                        uint16_t sample_size);
+bool nxmic_frame_append_int16(nxmic_frame_builder_t *builder, int16_t sample);
+
+static inline uint16_t nxmic_frame_sample_count(
+    const nxmic_frame_builder_t *builder) {
+  return (uint16_t)(builder->buffer[2] | (builder->buffer[3] << 8));
+}
+
+// For codecs that write their block in place: free payload space, and
+// account for bytes/samples written there
+static inline uint8_t *nxmic_frame_payload(nxmic_frame_builder_t *builder) {
+  return &builder->buffer[builder->length];
+}
+static inline uint16_t nxmic_frame_remaining(
+    const nxmic_frame_builder_t *builder) {
+  return builder->capacity - builder->length;
+}
+void nxmic_frame_commit(nxmic_frame_builder_t *builder, uint16_t length,
+                        uint16_t sample_count);
+
+static inline bool nxmic_frame_is_empty(const nxmic_frame_builder_t *builder) {
+  return builder->length == 0 || nxmic_frame_sample_count(builder) == 0;
+}
+
+// True if another sample of sample_size bytes would not fit
+static inline bool nxmic_frame_is_full(const nxmic_frame_builder_t *builder,
+                                       uint16_t sample_size) {
+  return builder->length + sample_size > builder->capacity ||
+         nxmic_frame_sample_count(builder) == UINT16_MAX;
+}
+
+// Split a received notification into header and packed samples
+bool nxmic_frame_parse(const uint8_t *data, uint16_t length,
+                       nxmic_frame_header_t *header, const uint8_t **samples,
+                       uint16_t *samples_length);
+
+#endif
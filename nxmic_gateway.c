@@ -0,0 +1,177 @@
+#include "nxmic_gateway.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static uint16_t read_16(const uint8_t *buffer, int offset) {
+  return (uint16_t)(buffer[offset] | (buffer[offset + 1] << 8));
+}
+
+static uint32_t read_32(const uint8_t *buffer, int offset) {
+  return (uint32_t)buffer[offset] | ((uint32_t)buffer[offset + 1] << 8) |
+         ((uint32_t)buffer[offset + 2] << 16) |
+         ((uint32_t)buffer[offset + 3] << 24);
+}
+
+static void write_16(uint8_t *buffer, int offset, uint16_t value) {
+  buffer[offset] = (uint8_t)value;
+  buffer[offset + 1] = (uint8_t)(value >> 8);
+}
+
+static void write_32(uint8_t *buffer, int offset, uint32_t value) {
+  write_16(buffer, offset, (uint16_t)value);
+  write_16(buffer, offset + 2, (uint16_t)(value >> 16));
+}
+
+static void start_period(nxmic_gateway_t *gateway, uint32_t now_us) {
+  memset(&gateway->period, 0, sizeof(gateway->period));
+  gateway->period_start_us = now_us;
+  nxmic_histogram_reset(&gateway->forward);
+  nxmic_histogram_reset(&gateway->rtt);
+  nxmic_histogram_reset(&gateway->end_to_end);
+}
+
+void nxmic_gateway_init(nxmic_gateway_t *gateway, uint32_t flush_us,
+                        nxmic_gateway_send_t send, void *context) {
+  memset(gateway, 0, sizeof(*gateway));
+  gateway->flush_us = flush_us;
+  gateway->send = send;
+  gateway->context = context;
+  gateway->length = NXMIC_GATEWAY_HEADER_SIZE;
+}
+
+static void add_datagram(nxmic_gateway_stats_t *stats, uint8_t entries,
+                         uint16_t length, bool sent) {
+  if (!sent) {
+    stats->send_errors++;
+    return;
+  }
+  stats->datagrams++;
+  stats->entries += entries;
+  stats->bytes += length;
+}
+
+// Send the batch, the caller releases its slots whatever happened to it
+static uint32_t flush(nxmic_gateway_t *gateway, uint32_t now_us) {
+  uint8_t entries = (uint8_t)gateway->batched;
+  uint8_t header[NXMIC_GATEWAY_HEADER_SIZE];
+  write_16(header, 0, NXMIC_GATEWAY_MAGIC);
+  header[2] = NXMIC_GATEWAY_VERSION;
+  header[3] = entries;
+  write_32(header, 4, gateway->sequence);
+  write_32(header, 8, now_us);
+  bool sent = gateway->send(gateway->context, header, gateway->entries,
+                            entries, gateway->length);
+  add_datagram(&gateway->stats, entries, gateway->length, sent);
+  add_datagram(&gateway->period, entries, gateway->length, sent);
+  if (sent) {
+    for (uint8_t i = 0; i < entries; i++) {
+      nxmic_gateway_entry_t entry;
+      memcpy(&entry, gateway->entries[i].data, sizeof(entry));
+      nxmic_histogram_add(&gateway->forward, now_us - entry.arrival_us);
+    }
+    nxmic_gateway_flight_t *flight =
+        &gateway->in_flight[gateway->sequence % NXMIC_GATEWAY_IN_FLIGHT];
+    flight->sequence = gateway->sequence;
+    flight->sent_us = now_us;
+    flight->oldest_us = now_us - gateway->first_arrival_us;
+  }
+  gateway->sequence++;
+  uint32_t released = gateway->batched;
+  gateway->batched = 0;
+  gateway->length = NXMIC_GATEWAY_HEADER_SIZE;
+  return released;
+}
+
+uint32_t nxmic_gateway_service(nxmic_gateway_t *gateway, spsc_ring_t *ring,
+                               uint32_t available, uint32_t now_us) {
+  uint32_t released = 0;
+  while (gateway->batched < available) {
+    uint16_t length;
+    const uint8_t *slot = spsc_ring_peek(ring, gateway->batched, &length);
+    if (gateway->batched &&
+        (gateway->length + length > NXMIC_GATEWAY_MAX_DATAGRAM ||
+         gateway->batched == NXMIC_GATEWAY_MAX_ENTRIES)) {
+      uint32_t sent = flush(gateway, now_us);
+      spsc_ring_release(ring, sent);
+      released += sent;
+      available -= sent;
+      continue;
+    }
+    if (gateway->batched == 0) {
+      nxmic_gateway_entry_t entry;
+      memcpy(&entry, slot, sizeof(entry));
+      gateway->first_arrival_us = entry.arrival_us;
+    }
+    gateway->entries[gateway->batched].data = slot;
+    gateway->entries[gateway->batched].length = length;
+    gateway->batched++;
+    gateway->length += length;
+  }
+  if (gateway->batched &&
+      (gateway->batched == NXMIC_GATEWAY_MAX_ENTRIES ||
+       now_us - gateway->first_arrival_us >= gateway->flush_us)) {
+    uint32_t sent = flush(gateway, now_us);
+    spsc_ring_release(ring, sent);
+    released += sent;
+  }
+  return released;
+}
+
+void nxmic_gateway_on_ack(nxmic_gateway_t *gateway, const uint8_t *ack,
+                          uint16_t length, uint32_t now_us) {
+  uint32_t sequence, sent_us;
+  if (nxmic_gateway_parse_header(ack, length, &sequence, &sent_us) != 0)
+    return;
+  nxmic_gateway_flight_t *flight =
+      &gateway->in_flight[sequence % NXMIC_GATEWAY_IN_FLIGHT];
+  if (flight->sequence != sequence || flight->sent_us != sent_us) return;
+  flight->sent_us = ~sent_us;  // an ack counts once
+  uint32_t rtt = now_us - sent_us;
+  gateway->stats.acks++;
+  gateway->period.acks++;
+  nxmic_histogram_add(&gateway->rtt, rtt);
+  nxmic_histogram_add(&gateway->end_to_end, flight->oldest_us + rtt / 2);
+}
+
+void nxmic_gateway_report(nxmic_gateway_t *gateway, const char *label,
+                          uint32_t now_us) {
+  const nxmic_gateway_stats_t *period = &gateway->period;
+  uint32_t period_us = now_us - gateway->period_start_us;
+  if (period->datagrams == 0 || period_us == 0) {
+    printf("%s gateway: nothing forwarded, %lu send errors\n", label,
+           (unsigned long)period->send_errors);
+    start_period(gateway, now_us);
+    return;
+  }
+  printf("%s gateway: %lu datagrams/s, %lu.%lu entries/datagram, %lu B/s "
+         "UDP payload, %lu send errors, %lu acks\n",
+         label,
+         (unsigned long)((uint64_t)period->datagrams * 1000000 / period_us),
+         (unsigned long)(period->entries / period->datagrams),
+         (unsigned long)(period->entries * 10 / period->datagrams % 10),
+         (unsigned long)((uint64_t)period->bytes * 1000000 / period_us),
+         (unsigned long)period->send_errors, (unsigned long)period->acks);
+  const nxmic_histogram_t *histograms[] = {&gateway->forward, &gateway->rtt,
+                                           &gateway->end_to_end};
+  const char *names[] = {"forward", "udp rtt", "end-to-end"};
+  for (int i = 0; i < 3; i++) {
+    printf("%s gateway: %s p50 %lu us, p99 %lu us, max %lu us\n", label,
+           names[i],
+           (unsigned long)nxmic_histogram_quantile(histograms[i], 5000),
+           (unsigned long)nxmic_histogram_quantile(histograms[i], 9900),
+           (unsigned long)histograms[i]->max);
+  }
+  start_period(gateway, now_us);
+}
+
+int nxmic_gateway_parse_header(const uint8_t *datagram, uint16_t length,
+                               uint32_t *sequence, uint32_t *sent_us) {
+  if (length < NXMIC_GATEWAY_HEADER_SIZE ||
+      read_16(datagram, 0) != NXMIC_GATEWAY_MAGIC ||
+      datagram[2] != NXMIC_GATEWAY_VERSION)
+    return -1;
+  *sequence = read_32(datagram, 4);
+  *sent_us = read_32(datagram, 8);
+  return datagram[3];
+}
@@ -0,0 +1,116 @@
+#ifndef NXMIC_GATEWAY_H_
+#define NXMIC_GATEWAY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "nxmic_bench.h"
+#include "spsc_ring.h"
+
+// BLE-to-UDP gateway: the reader forwards the notifications it receives,
+// batched into UDP datagrams. Slots of the reader's notification ring
+// already hold an entry header followed by the ATT value, so a datagram is
+// a header plus ring slots referenced where they are (PBUF_REF pbufs on
+// the Pico, an iovec on the host); slots go back to the ring once their
+// datagram is sent.
+//
+// Datagram, little-endian:
+//
+//   magic u16 NXMIC_GATEWAY_MAGIC, version u8, count u8,
+//   sequence u32, sent_us u32 (gateway clock)
+//   count x { nxmic_gateway_entry_t, value[length] }
+//
+// A datagram goes out when the next entry would not fit, when it holds
+// NXMIC_GATEWAY_MAX_ENTRIES or when its oldest entry arrived flush_us ago.
+// The sink answers each one with an ack, the datagram header with count 0
+// and everything else echoed, which times the network leg.
+
+#define NXMIC_GATEWAY_MAGIC 0x474e  // "NG"
+#define NXMIC_GATEWAY_VERSION 2
+#define NXMIC_GATEWAY_HEADER_SIZE 12
+#define NXMIC_GATEWAY_ACK_SIZE NXMIC_GATEWAY_HEADER_SIZE
+// UDP payload of one Ethernet frame, so nothing is fragmented
+#define NXMIC_GATEWAY_MAX_DATAGRAM 1472
+#define NXMIC_GATEWAY_MAX_ENTRIES 16
+// Datagrams remembered for their acks
+#define NXMIC_GATEWAY_IN_FLIGHT 16
+
+// Entry header, also the record the reader keeps in front of each value in
+// its ring. Both ends are little-endian; slots are only 2-byte aligned, so
+// it is copied in and out with memcpy.
+typedef struct {
+  uint8_t link;         // Peripheral the notification came from
+  uint8_t char_id;      // gatt_characteristic_id_t
+  uint16_t length;      // Of the ATT value that follows
+  uint32_t arrival_us;  // When the gateway received it
+  uint32_t connection;  // Of the link, a new one after every disconnect
+} nxmic_gateway_entry_t;
+
+typedef struct {
+  const uint8_t *data;
+  uint16_t length;
+} nxmic_gateway_chunk_t;
+
+// Send header then the entries as one datagram of length bytes. The
+// entries point into the ring and are only valid during the call.
+typedef bool (*nxmic_gateway_send_t)(void *context, const uint8_t *header,
+                                     const nxmic_gateway_chunk_t *entries,
+                                     uint8_t count, uint16_t length);
+
+typedef struct {
+  uint32_t sequence;
+  uint32_t sent_us;
+  uint32_t oldest_us;  // Age of its oldest entry when sent
+} nxmic_gateway_flight_t;
+
+typedef struct {
+  uint32_t datagrams;
+  uint32_t entries;
+  uint32_t bytes;        // UDP payload
+  uint32_t send_errors;  // Datagrams dropped by the network stack
+  uint32_t acks;
+} nxmic_gateway_stats_t;
+
+typedef struct {
+  uint32_t flush_us;
+  nxmic_gateway_send_t send;
+  void *context;
+  uint32_t batched;  // Ring slots in the datagram being built
+  uint16_t length;   // Its size so far, header included
+  uint32_t first_arrival_us;
+  nxmic_gateway_chunk_t entries[NXMIC_GATEWAY_MAX_ENTRIES];
+  uint32_t sequence;
+  nxmic_gateway_flight_t in_flight[NXMIC_GATEWAY_IN_FLIGHT];  // By sequence
+  nxmic_gateway_stats_t stats;
+  // Since the last report
+  nxmic_gateway_stats_t period;
+  uint32_t period_start_us;
+  nxmic_histogram_t forward;     // Arrival to send, per entry
+  nxmic_histogram_t rtt;         // Datagram to its ack
+  nxmic_histogram_t end_to_end;  // Oldest entry's arrival to the sink,
+                                 // taking half the rtt for the way out
+} nxmic_gateway_t;
+
+void nxmic_gateway_init(nxmic_gateway_t *gateway, uint32_t flush_us,
+                        nxmic_gateway_send_t send, void *context);
+
+// Batch the first available slots of ring that are not batched yet and
+// send what is due. Returns how many slots were sent (or dropped) and
+// released, the caller's peek indices move down by that much. Call often:
+// the flush deadline is only checked here.
+uint32_t nxmic_gateway_service(nxmic_gateway_t *gateway, spsc_ring_t *ring,
+                               uint32_t available, uint32_t now_us);
+
+// An ack from the sink
+void nxmic_gateway_on_ack(nxmic_gateway_t *gateway, const uint8_t *ack,
+                          uint16_t length, uint32_t now_us);
+
+// Print throughput and latency since the previous report
+void nxmic_gateway_report(nxmic_gateway_t *gateway, const char *label,
+                          uint32_t now_us);
+
+// Sink side: check a datagram header, returns its entry count or -1
+int nxmic_gateway_parse_header(const uint8_t *datagram, uint16_t length,
+                               uint32_t *sequence, uint32_t *sent_us);
+
+#endif
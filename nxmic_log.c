@@ -0,0 +1,125 @@
+#include "nxmic_log.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "nxmic_probe.h"
+#if defined(__arm__) || defined(__riscv)
+#include "pico/time.h"
+#else
+#include <time.h>
+#endif
+
+#define LOG_RING_MASK (NXMIC_LOG_RING_SLOTS - 1)
+
+typedef struct {
+  // Minus the slot's index, so zeroed storage is an empty ring: position
+  // when free for the write at position, position + 1 once written
+  atomic_uint sequence;
+  uint32_t timestamp_us;
+  const char *format;
+  uint8_t level;
+  uint8_t count;
+  uint32_t args[NXMIC_LOG_MAX_ARGS];
+} log_slot_t;
+
+// By NXMIC_LOG_LEVEL_*
+static const char level_letters[] = "?EWID";
+
+static log_slot_t slots[NXMIC_LOG_RING_SLOTS];
+static atomic_uint head;  // Next position to claim, writers
+static uint32_t tail;     // Next position to drain, the drain
+static atomic_uint written;
+static atomic_uint dropped;
+static uint32_t drained;
+static uint32_t dropped_reported;
+
+static uint32_t log_time_us(void) {
+#if defined(__arm__) || defined(__riscv)
+  return time_us_32();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+#endif
+}
+
+static uint32_t load_sequence(uint32_t position) {
+  uint32_t index = position & LOG_RING_MASK;
+  return atomic_load_explicit(&slots[index].sequence, memory_order_acquire) +
+         index;
+}
+
+static void store_sequence(uint32_t position, uint32_t sequence) {
+  uint32_t index = position & LOG_RING_MASK;
+  atomic_store_explicit(&slots[index].sequence, sequence - index,
+                        memory_order_release);
+}
+
+void nxmic_log_write(uint8_t level, const char *format, const uint32_t *args,
+                     uint32_t count) {
+  uint32_t position = atomic_load_explicit(&head, memory_order_relaxed);
+  while (true) {
+    int32_t lap = (int32_t)(load_sequence(position) - position);
+    if (lap == 0) {
+      // on failure position is reloaded with the current head
+      if (atomic_compare_exchange_weak_explicit(&head, &position,
+                                                position + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+        break;
+    } else if (lap < 0) {
+      atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+      return;
+    } else {
+      position = atomic_load_explicit(&head, memory_order_relaxed);
+    }
+  }
+  if (count > NXMIC_LOG_MAX_ARGS) count = NXMIC_LOG_MAX_ARGS;
+  log_slot_t *slot = &slots[position & LOG_RING_MASK];
+  slot->timestamp_us = log_time_us();
+  slot->format = format;
+  slot->level = level;
+  slot->count = (uint8_t)count;
+  memcpy(slot->args, args, count * sizeof(uint32_t));
+  store_sequence(position, position + 1);
+  atomic_fetch_add_explicit(&written, 1, memory_order_relaxed);
+}
+
+uint32_t nxmic_log_drain(uint32_t max) {
+  NXMIC_PROBE_SCOPE(NXMIC_PROBE_LOG_DRAIN);
+  uint32_t printed = 0;
+  while (printed < max && load_sequence(tail) == tail + 1) {
+    // copied out so the slot goes back before the slow part
+    const log_slot_t *slot = &slots[tail & LOG_RING_MASK];
+    uint32_t timestamp_us = slot->timestamp_us;
+    const char *format = slot->format;
+    uint8_t level = slot->level;
+    uint32_t args[NXMIC_LOG_MAX_ARGS] = {0};
+    memcpy(args, slot->args, slot->count * sizeof(uint32_t));
+    store_sequence(tail, tail + NXMIC_LOG_RING_SLOTS);
+    tail++;
+    printf("%5lu.%06lu %c ", (unsigned long)(timestamp_us / 1000000),
+           (unsigned long)(timestamp_us % 1000000),
+           level_letters[level <= NXMIC_LOG_LEVEL_DEBUG ? level : 0]);
+    printf(format, args[0], args[1], args[2], args[3], args[4], args[5],
+           args[6], args[7]);
+    printed++;
+  }
+  drained += printed;
+  uint32_t total_dropped =
+      atomic_load_explicit(&dropped, memory_order_relaxed);
+  if (total_dropped != dropped_reported) {
+    printf("log: %lu records dropped, ring full\n",
+           (unsigned long)(total_dropped - dropped_reported));
+    dropped_reported = total_dropped;
+  }
+  return printed;
+}
+
+void nxmic_log_get_stats(nxmic_log_stats_t *stats) {
+  stats->written = atomic_load_explicit(&written, memory_order_relaxed);
+  stats->dropped = atomic_load_explicit(&dropped, memory_order_relaxed);
+  stats->drained = drained;
+}
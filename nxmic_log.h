@@ -0,0 +1,89 @@
+#ifndef NXMIC_LOG_H_
+#define NXMIC_LOG_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Deferred logging for the streaming paths. A call site only stores the
+// address of its format string, a timestamp and the raw arguments in a
+// lock-free RAM ring; nxmic_log_drain(), from the main loop or whatever
+// runs at the lowest priority, does the printf later. A full ring drops
+// the record and counts it, the call never blocks.
+//
+// Arguments are stored as 32-bit integers, so a format may only use
+// integer conversions of at most 32 bits (%d %u %x %c, and %ld %lu on the
+// Pico where long is 32 bits): no %s, no floats. Print fixed point instead.
+//
+// Levels are decided at compile time: below NXMIC_LOG_LEVEL a call is
+// empty and its arguments are not evaluated.
+//
+// Any context may log, on either core: writers claim slots with a
+// compare-and-swap and publish them through a per-slot sequence number. The
+// drain must only run in one place.
+
+#define NXMIC_LOG_LEVEL_OFF 0
+#define NXMIC_LOG_LEVEL_ERROR 1
+#define NXMIC_LOG_LEVEL_WARN 2
+#define NXMIC_LOG_LEVEL_INFO 3
+#define NXMIC_LOG_LEVEL_DEBUG 4
+
+#ifndef NXMIC_LOG_LEVEL
+#define NXMIC_LOG_LEVEL NXMIC_LOG_LEVEL_INFO
+#endif
+
+#define NXMIC_LOG_MAX_ARGS 8
+#define NXMIC_LOG_RING_SLOTS 64  // Power of two
+
+typedef struct {
+  uint32_t written;
+  uint32_t dropped;  // Ring full
+  uint32_t drained;
+} nxmic_log_stats_t;
+
+// Use the macros below. Arguments past NXMIC_LOG_MAX_ARGS are left out.
+void nxmic_log_write(uint8_t level, const char *format, const uint32_t *args,
+                     uint32_t count);
+
+// Print up to max records, oldest first, and a line for records dropped
+// since the last call. Returns how many were printed.
+uint32_t nxmic_log_drain(uint32_t max);
+
+void nxmic_log_get_stats(nxmic_log_stats_t *stats);
+
+#define NXMIC_LOG_ARGS_(...) ((const uint32_t[]){0, ##__VA_ARGS__})
+#define NXMIC_LOG_AT_(level, format, ...)                     \
+  nxmic_log_write((level), (format),                          \
+                  NXMIC_LOG_ARGS_(__VA_ARGS__) + 1,           \
+                  sizeof(NXMIC_LOG_ARGS_(__VA_ARGS__)) /      \
+                          sizeof(uint32_t) -                  \
+                      1)
+
+#if NXMIC_LOG_LEVEL >= NXMIC_LOG_LEVEL_ERROR
+#define NXMIC_LOG_ERROR(format, ...) \
+  NXMIC_LOG_AT_(NXMIC_LOG_LEVEL_ERROR, format, ##__VA_ARGS__)
+#else
+#define NXMIC_LOG_ERROR(format, ...) ((void)0)
+#endif
+
+#if NXMIC_LOG_LEVEL >= NXMIC_LOG_LEVEL_WARN
+#define NXMIC_LOG_WARN(format, ...) \
+  NXMIC_LOG_AT_(NXMIC_LOG_LEVEL_WARN, format, ##__VA_ARGS__)
+#else
+#define NXMIC_LOG_WARN(format, ...) ((void)0)
+#endif
+
+#if NXMIC_LOG_LEVEL >= NXMIC_LOG_LEVEL_INFO
+#define NXMIC_LOG_INFO(format, ...) \
+  NXMIC_LOG_AT_(NXMIC_LOG_LEVEL_INFO, format, ##__VA_ARGS__)
+#else
+#define NXMIC_LOG_INFO(format, ...) ((void)0)
+#endif
+
+#if NXMIC_LOG_LEVEL >= NXMIC_LOG_LEVEL_DEBUG
+#define NXMIC_LOG_DEBUG(format, ...) \
+  NXMIC_LOG_AT_(NXMIC_LOG_LEVEL_DEBUG, format, ##__VA_ARGS__)
+#else
+#define NXMIC_LOG_DEBUG(format, ...) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,122 @@
+#include "nxmic_notify.h"
+
+#include <string.h>
+
+void nxmic_notify_init(nxmic_notifier_t *notifier, nxmic_notify_send_t send,
+                       nxmic_notify_can_send_t can_send, uint32_t burst_limit,
+                       void *context) {
+  memset(notifier, 0, sizeof(*notifier));
+  nxmic_txq_init(&notifier->queue);
+  notifier->send = send;
+  notifier->can_send = can_send;
+  notifier->burst_limit = burst_limit;
+  notifier->context = context;
+}
+
+void nxmic_notify_set_fill(nxmic_notifier_t *notifier,
+                           nxmic_notify_fill_t fill,
+                           nxmic_notify_fill_pending_t fill_pending) {
+  notifier->fill = fill;
+  notifier->fill_pending = fill_pending;
+}
+
+void nxmic_notify_set_sent(nxmic_notifier_t *notifier,
+                           nxmic_notify_sent_t sent) {
+  notifier->sent = sent;
+}
+
+static nxmic_notify_stream_t *stream_for_handle(nxmic_notifier_t *notifier,
+                                                uint16_t handle) {
+  for (int i = 0; i < NXMIC_NOTIFY_MAX_STREAMS; i++) {
+    if (handle && notifier->streams[i].handle == handle)
+      return &notifier->streams[i];
+  }
+  return NULL;
+}
+
+nxmic_retx_window_t *nxmic_notify_add_stream(nxmic_notifier_t *notifier,
+                                             uint16_t handle,
+                                             uint8_t stream_id) {
+  if (handle == 0) return NULL;
+  nxmic_notify_stream_t *stream = stream_for_handle(notifier, handle);
+  for (int i = 0; i < NXMIC_NOTIFY_MAX_STREAMS && !stream; i++) {
+    if (notifier->streams[i].handle == 0) stream = &notifier->streams[i];
+  }
+  if (!stream) return NULL;
+  stream->handle = handle;
+  nxmic_retx_init(&stream->retx, stream_id);
+  return &stream->retx;
+}
+
+bool nxmic_notify_handle_nack(nxmic_notifier_t *notifier,
+                              const uint8_t *nack, uint16_t length) {
+  for (int i = 0; i < NXMIC_NOTIFY_MAX_STREAMS; i++) {
+    nxmic_notify_stream_t *stream = &notifier->streams[i];
+    if (stream->handle &&
+        nxmic_retx_handle_nack(&stream->retx, nack, length))
+      return true;
+  }
+  return false;
+}
+
+void nxmic_notify_reset(nxmic_notifier_t *notifier, uint16_t handle) {
+  nxmic_txq_remove(&notifier->queue, handle);
+  nxmic_notify_stream_t *stream = stream_for_handle(notifier, handle);
+  if (stream) nxmic_retx_reset(&stream->retx);
+}
+
+void nxmic_notify_clear(nxmic_notifier_t *notifier) {
+  nxmic_txq_clear(&notifier->queue);
+  for (int i = 0; i < NXMIC_NOTIFY_MAX_STREAMS; i++)
+    nxmic_retx_reset(&notifier->streams[i].retx);
+}
+
+bool nxmic_notify_pending(const nxmic_notifier_t *notifier) {
+  if (notifier->queue.count) return true;
+  for (int i = 0; i < NXMIC_NOTIFY_MAX_STREAMS; i++) {
+    if (notifier->streams[i].retx.queue_count) return true;
+  }
+  return notifier->fill_pending && notifier->fill_pending(notifier->context);
+}
+
+// One notification: queued values before retransmissions, retransmissions
+// before the fill. false if there was nothing to send or no room for it.
+static bool send_next(nxmic_notifier_t *notifier, uint32_t now_us) {
+  const nxmic_txq_entry_t *entry = nxmic_txq_peek(&notifier->queue, now_us);
+  if (entry) {
+    if (!notifier->send(notifier->context, entry->handle, entry->value,
+                        entry->length))
+      return false;
+    nxmic_notify_stream_t *stream = stream_for_handle(notifier, entry->handle);
+    if (stream) nxmic_retx_store(&stream->retx, entry->value, entry->length);
+    if (notifier->sent)
+      notifier->sent(notifier->context, entry->handle, entry->value,
+                     entry->length);
+    nxmic_txq_pop(&notifier->queue, entry);
+    return true;
+  }
+  for (int i = 0; i < NXMIC_NOTIFY_MAX_STREAMS; i++) {
+    nxmic_notify_stream_t *stream = &notifier->streams[i];
+    uint16_t length;
+    const uint8_t *frame = nxmic_retx_next(&stream->retx, &length);
+    if (!frame) continue;
+    if (!notifier->send(notifier->context, stream->handle, frame, length))
+      return false;
+    nxmic_retx_sent(&stream->retx);
+    return true;
+  }
+  return notifier->fill && notifier->fill(notifier->context);
+}
+
+bool nxmic_notify_run(nxmic_notifier_t *notifier, uint32_t now_us) {
+  uint32_t burst = 0;
+  while ((notifier->burst_limit == 0 || burst < notifier->burst_limit) &&
+         notifier->can_send(notifier->context)) {
+    if (!send_next(notifier, now_us)) break;
+    burst++;
+  }
+  notifier->events++;
+  notifier->notifications += burst;
+  if (burst > notifier->max_burst) notifier->max_burst = burst;
+  return nxmic_notify_pending(notifier);
+}
@@ -0,0 +1,96 @@
+#ifndef NXMIC_NOTIFY_H_
+#define NXMIC_NOTIFY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "nxmic_retransmit.h"
+#include "nxmic_txq.h"
+
+// The sensor's notifications of one connection, from what is queued to the
+// link, shared by the firmware (server_common.c, on BTstack's ATT server)
+// and the host simulator (host_sim.c, on virtual_link.h).
+//
+// Each send event takes, in turn: values from the queue (nxmic_txq.h);
+// then frames the reader asked for again, from the retransmission window
+// of their stream (nxmic_retransmit.h); then whatever the fill callback
+// has, an export chunk or benchmark filler. It sends back to back while
+// the link has room, up to the burst limit if there is one, and says
+// whether anything is left for the next event.
+//
+// Frames of a stream with a window are kept in it as they go out, so only
+// frames the link took can be asked for again.
+
+#define NXMIC_NOTIFY_MAX_STREAMS 4
+
+// Hand a notification to the link, false if it did not take it
+typedef bool (*nxmic_notify_send_t)(void *context, uint16_t handle,
+                                    const uint8_t *value, uint16_t length);
+// True while the link can take a notification
+typedef bool (*nxmic_notify_can_send_t)(void *context);
+// Send one notification of its own through the link, false if it has none
+// or the link did not take it
+typedef bool (*nxmic_notify_fill_t)(void *context);
+// True if the fill callback has something to send
+typedef bool (*nxmic_notify_fill_pending_t)(void *context);
+// A queued value went out on handle
+typedef void (*nxmic_notify_sent_t)(void *context, uint16_t handle,
+                                    const uint8_t *value, uint16_t length);
+
+typedef struct {
+  uint16_t handle;  // Value handle, 0 if the slot is free
+  nxmic_retx_window_t retx;
+} nxmic_notify_stream_t;
+
+typedef struct {
+  nxmic_txq_t queue;
+  nxmic_notify_stream_t streams[NXMIC_NOTIFY_MAX_STREAMS];
+  uint32_t burst_limit;  // Notifications per event, 0 for no limit
+  nxmic_notify_send_t send;
+  nxmic_notify_can_send_t can_send;
+  nxmic_notify_fill_t fill;  // NULL if none
+  nxmic_notify_fill_pending_t fill_pending;
+  nxmic_notify_sent_t sent;  // NULL if none
+  void *context;
+  uint32_t events;         // nxmic_notify_run() calls
+  uint32_t notifications;  // Sent from them
+  uint32_t max_burst;
+} nxmic_notifier_t;
+
+void nxmic_notify_init(nxmic_notifier_t *notifier, nxmic_notify_send_t send,
+                       nxmic_notify_can_send_t can_send, uint32_t burst_limit,
+                       void *context);
+
+void nxmic_notify_set_fill(nxmic_notifier_t *notifier,
+                           nxmic_notify_fill_t fill,
+                           nxmic_notify_fill_pending_t fill_pending);
+
+void nxmic_notify_set_sent(nxmic_notifier_t *notifier,
+                           nxmic_notify_sent_t sent);
+
+// Keep the frames sent on handle for retransmission as stream_id. NULL if
+// there is no room for another stream.
+nxmic_retx_window_t *nxmic_notify_add_stream(nxmic_notifier_t *notifier,
+                                             uint16_t handle,
+                                             uint8_t stream_id);
+
+// Queue the frames a NACK asks for. false if it is not a NACK for one of
+// the streams.
+bool nxmic_notify_handle_nack(nxmic_notifier_t *notifier,
+                              const uint8_t *nack, uint16_t length);
+
+// Drop what is queued and asked for on handle, e.g. when its notifications
+// are turned off
+void nxmic_notify_reset(nxmic_notifier_t *notifier, uint16_t handle);
+
+// Drop everything, e.g. on disconnect; the counters stay
+void nxmic_notify_clear(nxmic_notifier_t *notifier);
+
+// True if a send event has something to send
+bool nxmic_notify_pending(const nxmic_notifier_t *notifier);
+
+// One send event. Returns true if something is left, the sender then asks
+// the link for another event.
+bool nxmic_notify_run(nxmic_notifier_t *notifier, uint32_t now_us);
+
+#endif
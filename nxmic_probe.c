@@ -0,0 +1,81 @@
+#include "nxmic_probe.h"
+
+#if NXMIC_PROBES
+
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__arm__) || defined(__riscv)
+#include "pico/stdio.h"
+#endif
+
+static const char *const probe_names[NXMIC_PROBE_COUNT] = {
+    [NXMIC_PROBE_PACKET_HANDLER] = "packet_handler",
+    [NXMIC_PROBE_ATT_READ] = "att_read_callback",
+    [NXMIC_PROBE_ATT_WRITE] = "att_write_callback",
+    [NXMIC_PROBE_TEMP_SAMPLE] = "temp sample",
+    [NXMIC_PROBE_ADC_BLOCK] = "adc block",
+    [NXMIC_PROBE_PREVIEW_FILTER] = "preview filter",
+    [NXMIC_PROBE_HCI_EVENT] = "hci_event_handler",
+    [NXMIC_PROBE_GATT_CLIENT_EVENT] = "gatt client event",
+    [NXMIC_PROBE_NOTIFICATION] = "notification",
+    [NXMIC_PROBE_DECODE_BATCH] = "decode batch",
+    [NXMIC_PROBE_LOG_DRAIN] = "log drain",
+};
+
+static nxmic_probe_stats_t probes[NXMIC_PROBE_COUNT];
+
+void nxmic_probe_init(void) {
+#if defined(__ARM_ARCH_8M_MAIN__)
+  m33_hw->demcr |= M33_DEMCR_TRCENA_BITS;
+  m33_hw->dwt_ctrl |= M33_DWT_CTRL_CYCCNTENA_BITS;
+#endif
+}
+
+void nxmic_probe_add(nxmic_probe_id_t id, uint32_t elapsed) {
+  nxmic_probe_stats_t *probe = &probes[id];
+  probe->count++;
+  probe->total += elapsed;
+  if (elapsed > probe->max) probe->max = elapsed;
+  probe->histogram[elapsed ? 32 - __builtin_clz(elapsed) : 0]++;
+}
+
+const nxmic_probe_stats_t *nxmic_probe_get(nxmic_probe_id_t id) {
+  return &probes[id];
+}
+
+// Bound of the bucket holding the given quantile, the times in it are below
+static uint64_t quantile(const nxmic_probe_stats_t *probe,
+                         uint32_t per_10000) {
+  uint64_t rank = ((uint64_t)probe->count * per_10000 + 9999) / 10000;
+  uint64_t seen = 0;
+  for (int b = 0; b < NXMIC_PROBE_BUCKETS; b++) {
+    seen += probe->histogram[b];
+    if (seen >= rank) return 1ull << b;
+  }
+  return 1ull << NXMIC_PROBE_BUCKETS;
+}
+
+void nxmic_probe_report(void) {
+  for (int i = 0; i < NXMIC_PROBE_COUNT; i++) {
+    const nxmic_probe_stats_t *probe = &probes[i];
+    if (probe->count == 0) continue;
+    printf("probe %-18s %lu calls, mean %lu, p50 <%llu, p99 <%llu, max %lu "
+           "%s\n",
+           probe_names[i], (unsigned long)probe->count,
+           (unsigned long)(probe->total / probe->count),
+           (unsigned long long)quantile(probe, 5000),
+           (unsigned long long)quantile(probe, 9900),
+           (unsigned long)probe->max, NXMIC_PROBE_UNIT);
+  }
+}
+
+void nxmic_probe_reset(void) { memset(probes, 0, sizeof(probes)); }
+
+void nxmic_probe_poll(void) {
+#if defined(__arm__) || defined(__riscv)
+  if (getchar_timeout_us(0) == NXMIC_PROBE_DUMP_KEY) nxmic_probe_report();
+#endif
+}
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef NXMIC_PROBE_H_
+#define NXMIC_PROBE_H_
+
+#include <stdint.h>
+
+// Cycle probes for the hot paths. NXMIC_PROBE_SCOPE(id) at the top of a
+// block times it until the block is left, however it is left, and adds the
+// time to the probe's count, total, max and log2 histogram, all in static
+// storage. Built with NXMIC_PROBES 0 (the default) every macro here is
+// empty, so the probes can stay in the code of production builds.
+//
+// Time is the DWT cycle counter on the RP2350's Cortex-M33, microseconds
+// on cores without one, and CLOCK_MONOTONIC nanoseconds on the host, see
+// NXMIC_PROBE_UNIT. Each probe must only be hit from one context; reports
+// read the counters without locking and may catch a probe mid-update.
+//
+// The stats report prints and resets them every period; NXMIC_PROBE_POLL()
+// in a main loop prints them on demand in between, when
+// NXMIC_PROBE_DUMP_KEY comes in on the console.
+
+#ifndef NXMIC_PROBES
+#define NXMIC_PROBES 0
+#endif
+
+#define NXMIC_PROBE_DUMP_KEY 'p'
+
+typedef enum {
+  // Sensor
+  NXMIC_PROBE_PACKET_HANDLER,
+  NXMIC_PROBE_ATT_READ,
+  NXMIC_PROBE_ATT_WRITE,
+  NXMIC_PROBE_TEMP_SAMPLE,     // A temperature sample handed to core0
+  NXMIC_PROBE_ADC_BLOCK,       // Averaging a DMA block, acquisition core
+  NXMIC_PROBE_PREVIEW_FILTER,  // Decimating it for the preview, same core
+  // Reader
+  NXMIC_PROBE_HCI_EVENT,
+  NXMIC_PROBE_GATT_CLIENT_EVENT,
+  NXMIC_PROBE_NOTIFICATION,   // Queueing one from the BTstack callback
+  NXMIC_PROBE_DECODE_BATCH,   // Decoding what was queued, main loop
+  // Both
+  NXMIC_PROBE_LOG_DRAIN,  // Formatting deferred log records, nxmic_log.h
+  NXMIC_PROBE_COUNT
+} nxmic_probe_id_t;
+
+// Bucket b holds times in [2^(b-1), 2^b), bucket 0 a time of 0
+#define NXMIC_PROBE_BUCKETS 33
+
+typedef struct {
+  uint32_t count;
+  uint64_t total;
+  uint32_t max;
+  uint32_t histogram[NXMIC_PROBE_BUCKETS];
+} nxmic_probe_stats_t;
+
+#if defined(__ARM_ARCH_8M_MAIN__)
+#include "hardware/structs/m33.h"
+#define NXMIC_PROBE_UNIT "cycles"
+static inline uint32_t nxmic_probe_now(void) { return m33_hw->dwt_cyccnt; }
+#elif defined(__arm__) || defined(__riscv)
+#include "pico/time.h"
+#define NXMIC_PROBE_UNIT "us"
+static inline uint32_t nxmic_probe_now(void) { return time_us_32(); }
+#else
+#include <time.h>
+#define NXMIC_PROBE_UNIT "ns"
+static inline uint32_t nxmic_probe_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+#endif
+
+#if NXMIC_PROBES
+
+typedef struct {
+  nxmic_probe_id_t id;
+  uint32_t start;
+} nxmic_probe_scope_t;
+
+void nxmic_probe_add(nxmic_probe_id_t id, uint32_t elapsed);
+
+static inline void nxmic_probe_scope_end(const nxmic_probe_scope_t *scope) {
+  nxmic_probe_add(scope->id, nxmic_probe_now() - scope->start);
+}
+
+#define NXMIC_PROBE_SCOPE(id)                                     \
+  nxmic_probe_scope_t nxmic_probe_scope_                          \
+      __attribute__((cleanup(nxmic_probe_scope_end))) = {(id),    \
+                                                         nxmic_probe_now()}
+
+// Start the cycle counter of the calling core, once per core
+void nxmic_probe_init(void);
+const nxmic_probe_stats_t *nxmic_probe_get(nxmic_probe_id_t id);
+// Print every probe hit since the last reset: count, mean, p50, p99 (upper
+// bounds of their buckets) and max
+void nxmic_probe_report(void);
+void nxmic_probe_reset(void);
+// Report, without the reset, if NXMIC_PROBE_DUMP_KEY is waiting on stdin.
+// Does not wait; nothing is read on the host.
+void nxmic_probe_poll(void);
+
+#define NXMIC_PROBE_INIT() nxmic_probe_init()
+#define NXMIC_PROBE_REPORT() nxmic_probe_report()
+#define NXMIC_PROBE_RESET() nxmic_probe_reset()
+#define NXMIC_PROBE_POLL() nxmic_probe_poll()
+
+#else
+
+#define NXMIC_PROBE_SCOPE(id) \
+  do {                        \
+  } while (0)
+#define NXMIC_PROBE_INIT() ((void)0)
+#define NXMIC_PROBE_REPORT() ((void)0)
+#define NXMIC_PROBE_RESET() ((void)0)
+#define NXMIC_PROBE_POLL() ((void)0)
+
+#endif
+
+#endif
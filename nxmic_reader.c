@@ -0,0 +1,327 @@
+#include "nxmic_reader.h"
+
+#include <string.h>
+
+// Steps of a clock sync round
+#define TIMESYNC_IDLE 0
+#define TIMESYNC_WRITING 1
+#define TIMESYNC_READING 2
+
+void nxmic_reader_init(nxmic_reader_t *reader,
+                       const nxmic_reader_ops_t *ops, void *context) {
+  memset(reader, 0, sizeof(*reader));
+  reader->ops = ops;
+  reader->context = context;
+  nxmic_stream_init(&reader->streams, context);
+  nxmic_timesync_init(&reader->timesync);
+}
+
+static void fail(nxmic_reader_t *reader) {
+  reader->state = NXMIC_READER_IDLE;
+  reader->ops->failed(reader->context);
+}
+
+void nxmic_reader_connect(nxmic_reader_t *reader) {
+  memset(&reader->handles, 0, sizeof(reader->handles));
+  reader->database_hash_valid = false;
+  reader->cached = false;
+  reader->timesync_step = TIMESYNC_IDLE;
+  nxmic_stream_init(&reader->streams, reader->context);
+  reader->state = NXMIC_READER_W4_DATABASE_HASH;
+  if (!reader->ops->read_database_hash(reader->context)) fail(reader);
+}
+
+void nxmic_reader_on_service(nxmic_reader_t *reader, uint16_t start_handle,
+                             uint16_t end_handle) {
+  if (reader->state != NXMIC_READER_W4_SERVICE) return;
+  // we expect only one
+  reader->handles.service_start_handle = start_handle;
+  reader->handles.service_end_handle = end_handle;
+}
+
+void nxmic_reader_on_characteristic(
+    nxmic_reader_t *reader, const uint8_t *uuid128,
+    const nxmic_reader_characteristic_t *characteristic) {
+  if (reader->state != NXMIC_READER_W4_CHARACTERISTICS) return;
+  gatt_characteristic_id_t id = nxmic_stream_lookup_uuid128(uuid128);
+  if (id == CHAR_COUNT) return;
+  reader->handles.characteristics[id] = *characteristic;
+  nxmic_stream_bind(&reader->streams, id, characteristic->value_handle);
+}
+
+// The characteristic whose range holds a descriptor
+static gatt_characteristic_id_t characteristic_for_descriptor(
+    const nxmic_reader_t *reader, uint16_t handle) {
+  for (int i = 0; i < CHAR_COUNT; i++) {
+    const nxmic_reader_characteristic_t *c =
+        &reader->handles.characteristics[i];
+    if (c->value_handle == 0) continue;
+    if (handle > c->value_handle && handle <= c->end_handle)
+      return (gatt_characteristic_id_t)i;
+  }
+  return CHAR_COUNT;
+}
+
+void nxmic_reader_on_value(nxmic_reader_t *reader, uint16_t handle,
+                           const uint8_t *value, uint16_t length) {
+  switch (reader->state) {
+    case NXMIC_READER_W4_DATABASE_HASH:
+      if (length != sizeof(reader->handles.database_hash)) return;
+      memcpy(reader->handles.database_hash, value, length);
+      reader->database_hash_valid = true;
+      break;
+    case NXMIC_READER_W4_CCCDS: {
+      // read-by-type over the service range yields every CCCD in one sweep
+      gatt_characteristic_id_t id =
+          characteristic_for_descriptor(reader, handle);
+      if (id != CHAR_COUNT)
+        reader->handles.characteristics[id].cccd_handle = handle;
+      break;
+    }
+    case NXMIC_READER_READY: {
+      uint32_t client_us, device_us;
+      if (reader->timesync_step == TIMESYNC_READING &&
+          nxmic_timesync_parse_value(value, length, &client_us, &device_us) &&
+          client_us == reader->timesync_sent_us) {
+        nxmic_timesync_add_round(&reader->timesync, reader->timesync_sent_us,
+                                 reader->timesync_acked_us, device_us);
+      }
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+// Handles from the cache if the peer's Database Hash still matches
+static bool restore_handles(nxmic_reader_t *reader) {
+  nxmic_reader_handles_t cached;
+  if (!reader->database_hash_valid) return false;
+  if (!reader->ops->cache_load(reader->context, &cached)) return false;
+  if (memcmp(cached.database_hash, reader->handles.database_hash,
+             sizeof(cached.database_hash)) != 0)
+    return false;
+  reader->handles = cached;
+  for (int i = 0; i < CHAR_COUNT; i++) {
+    uint16_t value_handle = cached.characteristics[i].value_handle;
+    if (value_handle != 0)
+      nxmic_stream_bind(&reader->streams, (gatt_characteristic_id_t)i,
+                        value_handle);
+  }
+  return true;
+}
+
+static void start_discovery(nxmic_reader_t *reader) {
+  uint8_t service_uuid128[16];
+  for (int i = 0; i < 16; i++)
+    service_uuid128[i] = nxmic_gatt_service.uuid128[15 - i];
+  reader->state = NXMIC_READER_W4_SERVICE;
+  if (!reader->ops->discover_service(reader->context, service_uuid128))
+    fail(reader);
+}
+
+// The streams, and the export if the sensor can send it
+static bool wants_notifications(const nxmic_reader_t *reader,
+                                gatt_characteristic_id_t id) {
+  const nxmic_reader_characteristic_t *c = &reader->handles.characteristics[id];
+  if (c->value_handle == 0) return false;
+  if (id == CHAR_DATA_EXPORT)
+    return c->properties & NXMIC_READER_PROPERTY_NOTIFY;
+  return nxmic_stream_is_streaming(id);
+}
+
+// Issue the next CCCD write, false once every stream is on
+static bool enable_next_stream(nxmic_reader_t *reader) {
+  while (reader->next_cccd_write < CHAR_COUNT) {
+    gatt_characteristic_id_t id =
+        (gatt_characteristic_id_t)reader->next_cccd_write++;
+    if (wants_notifications(reader, id) &&
+        reader->ops->write_cccd(reader->context,
+                                &reader->handles.characteristics[id]))
+      return true;
+  }
+  return false;
+}
+
+static void schedule_timesync(nxmic_reader_t *reader) {
+  reader->ops->schedule_timesync(reader->context,
+                                 reader->timesync.count < NXMIC_TIMESYNC_ROUNDS
+                                     ? NXMIC_READER_TIMESYNC_FAST_PERIOD_MS
+                                     : NXMIC_READER_TIMESYNC_PERIOD_MS);
+}
+
+// Sensors without a writable CHAR_TIMESTAMP keep their frames in sensor
+// time
+static void become_ready(nxmic_reader_t *reader) {
+  reader->state = NXMIC_READER_READY;
+  reader->ops->ready(reader->context);
+  if (reader->state != NXMIC_READER_READY) return;
+  if (reader->handles.characteristics[CHAR_TIMESTAMP].properties &
+      NXMIC_READER_PROPERTY_WRITE)
+    schedule_timesync(reader);
+}
+
+// Handles are known, only the CCCD writes are left
+static void start_notifications(nxmic_reader_t *reader) {
+  reader->ops->bound(reader->context);
+  reader->state = NXMIC_READER_W4_NOTIFICATIONS;
+  reader->next_cccd_write = 0;
+}
+
+static void on_timesync_complete(nxmic_reader_t *reader, uint8_t att_status,
+                                 uint32_t now_us) {
+  if (reader->timesync_step == TIMESYNC_IDLE) return;
+  if (reader->timesync_step == TIMESYNC_WRITING && att_status == 0) {
+    reader->timesync_acked_us = now_us;
+    reader->timesync_step = TIMESYNC_READING;
+    uint16_t handle =
+        reader->handles.characteristics[CHAR_TIMESTAMP].value_handle;
+    if (reader->ops->read(reader->context, handle)) return;
+  }
+  reader->timesync_step = TIMESYNC_IDLE;
+  schedule_timesync(reader);
+}
+
+void nxmic_reader_on_complete(nxmic_reader_t *reader, uint8_t att_status,
+                              uint32_t now_us) {
+  nxmic_reader_handles_t *handles = &reader->handles;
+  switch (reader->state) {
+    case NXMIC_READER_W4_DATABASE_HASH:
+      if (!restore_handles(reader)) {
+        start_discovery(reader);
+        break;
+      }
+      reader->cached = true;
+      start_notifications(reader);
+      if (!enable_next_stream(reader)) become_ready(reader);
+      break;
+    case NXMIC_READER_W4_SERVICE:
+      if (att_status != 0 || handles->service_end_handle == 0) {
+        fail(reader);
+        break;
+      }
+      // look for every characteristic of the service
+      reader->state = NXMIC_READER_W4_CHARACTERISTICS;
+      if (!reader->ops->discover_characteristics(
+              reader->context, handles->service_start_handle,
+              handles->service_end_handle))
+        fail(reader);
+      break;
+    case NXMIC_READER_W4_CHARACTERISTICS:
+      if (att_status != 0) {
+        fail(reader);
+        break;
+      }
+      // find all CCCDs at once instead of one lookup per characteristic
+      reader->state = NXMIC_READER_W4_CCCDS;
+      if (!reader->ops->read_cccds(reader->context,
+                                   handles->service_start_handle,
+                                   handles->service_end_handle))
+        fail(reader);
+      break;
+    case NXMIC_READER_W4_CCCDS:
+      // on error the adapter looks each CCCD up as it is written
+      if (att_status != 0) {
+        for (int i = 0; i < CHAR_COUNT; i++)
+          handles->characteristics[i].cccd_handle = 0;
+      }
+      if (reader->database_hash_valid)
+        reader->ops->cache_store(reader->context, handles);
+      start_notifications(reader);
+      if (!enable_next_stream(reader)) fail(reader);
+      break;
+    case NXMIC_READER_W4_NOTIFICATIONS:
+      if (!enable_next_stream(reader)) become_ready(reader);
+      break;
+    case NXMIC_READER_READY:
+      on_timesync_complete(reader, att_status, now_us);
+      break;
+    default:
+      break;
+  }
+}
+
+void nxmic_reader_on_notification(nxmic_reader_t *reader,
+                                  uint16_t value_handle, const uint8_t *value,
+                                  uint16_t length, uint32_t now_us) {
+  uint16_t export_handle =
+      reader->handles.characteristics[CHAR_DATA_EXPORT].value_handle;
+  if (reader->export && export_handle && value_handle == export_handle) {
+    // export chunks are only checked, never queued for decoding
+    nxmic_export_receiver_on_notification(reader->export, value, length,
+                                          now_us);
+    return;
+  }
+  nxmic_stream_dispatch(&reader->streams, value_handle, value, length);
+}
+
+void nxmic_reader_sync_clock(nxmic_reader_t *reader, uint32_t now_us) {
+  if (reader->state != NXMIC_READER_READY ||
+      reader->timesync_step != TIMESYNC_IDLE)
+    return;
+  reader->timesync_sent_us = now_us;
+  nxmic_timesync_encode_request(now_us, reader->timesync_request);
+  reader->timesync_step = TIMESYNC_WRITING;
+  // the GATT client runs one procedure at a time, try again if it is busy
+  if (reader->ops->write(
+          reader->context,
+          reader->handles.characteristics[CHAR_TIMESTAMP].value_handle,
+          reader->timesync_request, sizeof(reader->timesync_request)))
+    return;
+  reader->timesync_step = TIMESYNC_IDLE;
+  schedule_timesync(reader);
+}
+
+// NACKs and export requests share CHAR_DATA_EXPORT, written without
+// response
+static bool write_export(nxmic_reader_t *reader, const uint8_t *value,
+                         uint16_t length) {
+  uint16_t handle =
+      reader->handles.characteristics[CHAR_DATA_EXPORT].value_handle;
+  if (!length || reader->state != NXMIC_READER_READY || !handle) return false;
+  return reader->ops->write_without_response(reader->context, handle, value,
+                                             length);
+}
+
+bool nxmic_reader_request_frames(nxmic_reader_t *reader,
+                                 gatt_characteristic_id_t char_id,
+                                 nxmic_gap_tracker_t *tracker,
+                                 uint32_t now_us) {
+  if (tracker->missing_count == 0) return false;
+  uint8_t nack[NXMIC_NACK_MAX_SIZE];
+  // not sent: retried once NXMIC_GAP_RETRY_US has passed
+  uint16_t length =
+      nxmic_gap_build_nack(tracker, (uint8_t)char_id, now_us, nack);
+  return write_export(reader, nack, length);
+}
+
+bool nxmic_reader_request_export(nxmic_reader_t *reader, uint32_t now_us) {
+  if (!reader->export) return false;
+  uint8_t request[NXMIC_EXPORT_REQUEST_MAX_SIZE];
+  uint16_t length =
+      nxmic_export_receiver_build_request(reader->export, now_us, request);
+  return write_export(reader, request, length);
+}
+
+bool nxmic_reader_queue(spsc_ring_t *ring, nxmic_reader_record_t *record,
+                        const uint8_t *value, uint16_t length) {
+  if (length > spsc_ring_max_payload(ring) - sizeof(*record)) return false;
+  uint8_t *slot = spsc_ring_claim(ring);
+  if (!slot) return false;
+  record->length = length;
+  memcpy(slot, record, sizeof(*record));
+  memcpy(slot + sizeof(*record), value, length);
+  spsc_ring_publish(ring, sizeof(*record) + length);
+  return true;
+}
+
+bool nxmic_reader_peek(const spsc_ring_t *ring, uint32_t index,
+                       nxmic_reader_record_t *record,
+                       nxmic_frame_header_t *frame, const uint8_t **payload,
+                       uint16_t *payload_length) {
+  uint16_t length;
+  const uint8_t *slot = spsc_ring_peek(ring, index, &length);
+  memcpy(record, slot, sizeof(*record));
+  return nxmic_frame_parse(slot + sizeof(*record), length - sizeof(*record),
+                           frame, payload, payload_length);
+}
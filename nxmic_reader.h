@@ -0,0 +1,188 @@
+#ifndef NXMIC_READER_H_
+#define NXMIC_READER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "nxmic_export.h"
+#include "nxmic_frame.h"
+#include "nxmic_gateway.h"
+#include "nxmic_gatt.h"
+#include "nxmic_retransmit.h"
+#include "nxmic_stream.h"
+#include "nxmic_timesync.h"
+#include "spsc_ring.h"
+
+// The reader's side of one connection to a sensor, shared by the firmware
+// (client.c, on BTstack's GATT client) and the host simulator (host_sim.c,
+// on virtual_link.h).
+//
+// From the connection up: the Database Hash is read first, and if the
+// cache holds handles for it discovery is skipped. Otherwise the NxMic
+// service is found, then its characteristics, then every CCCD in one
+// read-by-type sweep, and the handles go to the cache. Notifications are
+// turned on one stream at a time, each CCCD write sent from the completion
+// of the one before, so a stream flows as soon as its own CCCD lands. Once
+// all are on the connection is ready: clock sync rounds run on
+// CHAR_TIMESTAMP, faster until the fit has all of its rounds, and NACKs
+// for missing frames and export requests go out on CHAR_DATA_EXPORT.
+//
+// Procedures are started through nxmic_reader_ops_t and their results fed
+// back with the nxmic_reader_on_*() calls, one procedure at a time as the
+// GATT client runs them. A result must not be fed back from inside the op
+// that started its procedure.
+
+// Clock sync periods
+#define NXMIC_READER_TIMESYNC_FAST_PERIOD_MS 1000
+#define NXMIC_READER_TIMESYNC_PERIOD_MS 5000
+
+// Characteristic properties as the declaration carries them (BTstack's
+// ATT_PROPERTY_*)
+#define NXMIC_READER_PROPERTY_WRITE 0x08
+#define NXMIC_READER_PROPERTY_NOTIFY 0x10
+
+typedef enum {
+  NXMIC_READER_IDLE,
+  NXMIC_READER_W4_DATABASE_HASH,
+  NXMIC_READER_W4_SERVICE,
+  NXMIC_READER_W4_CHARACTERISTICS,
+  NXMIC_READER_W4_CCCDS,
+  NXMIC_READER_W4_NOTIFICATIONS,  // CCCD writes, one stream at a time
+  NXMIC_READER_READY,
+} nxmic_reader_state_t;
+
+// Discovered handles of one NxMic characteristic
+typedef struct {
+  uint16_t start_handle;
+  uint16_t value_handle;  // 0 if the sensor does not have it
+  uint16_t end_handle;
+  uint16_t cccd_handle;   // 0 if not discovered
+  uint16_t properties;    // NXMIC_READER_PROPERTY_*
+} nxmic_reader_characteristic_t;
+
+// What the cache keeps of a sensor, valid while its Database Hash matches
+typedef struct {
+  uint8_t database_hash[16];
+  uint16_t service_start_handle;
+  uint16_t service_end_handle;
+  nxmic_reader_characteristic_t characteristics[CHAR_COUNT];
+} nxmic_reader_handles_t;
+
+// Slots of the reader's notification ring: this record, then the ATT
+// value. It is the gateway's entry header, so a slot forwards as it is.
+typedef nxmic_gateway_entry_t nxmic_reader_record_t;
+
+typedef struct {
+  // GATT client procedures, false if one could not be started. uuid128
+  // is in BTstack (big-endian) order.
+  bool (*read_database_hash)(void *context);
+  bool (*discover_service)(void *context, const uint8_t *uuid128);
+  bool (*discover_characteristics)(void *context, uint16_t start_handle,
+                                   uint16_t end_handle);
+  bool (*read_cccds)(void *context, uint16_t start_handle,
+                     uint16_t end_handle);
+  // Turn notifications on; without a cccd_handle the adapter looks the
+  // CCCD up in the characteristic's range. A stream whose write cannot be
+  // started stays off.
+  bool (*write_cccd)(void *context,
+                     const nxmic_reader_characteristic_t *characteristic);
+  bool (*write)(void *context, uint16_t value_handle, const uint8_t *value,
+                uint16_t length);
+  bool (*read)(void *context, uint16_t value_handle);
+  bool (*write_without_response)(void *context, uint16_t value_handle,
+                                 const uint8_t *value, uint16_t length);
+  // Handles stored for the peer, false if there are none
+  bool (*cache_load)(void *context, nxmic_reader_handles_t *handles);
+  void (*cache_store)(void *context, const nxmic_reader_handles_t *handles);
+  // Call nxmic_reader_sync_clock() in delay_ms
+  void (*schedule_timesync)(void *context, uint32_t delay_ms);
+  // Value handles are bound, notifications can be routed
+  void (*bound)(void *context);
+  // Every stream is on
+  void (*ready)(void *context);
+  // Discovery failed or found no stream, the connection is of no use
+  void (*failed)(void *context);
+} nxmic_reader_ops_t;
+
+typedef struct {
+  nxmic_reader_state_t state;
+  const nxmic_reader_ops_t *ops;
+  void *context;
+  nxmic_reader_handles_t handles;
+  bool database_hash_valid;  // Peer exposed a Database Hash
+  bool cached;               // Handles restored from the cache
+  uint8_t next_cccd_write;   // Next stream to turn notifications on
+  nxmic_stream_table_t streams;  // value handle -> stream routing
+  nxmic_export_receiver_t *export;  // Takes CHAR_DATA_EXPORT, NULL if none
+  nxmic_timesync_t timesync;        // Sensor clock fit
+  uint8_t timesync_request[NXMIC_TIMESYNC_REQUEST_SIZE];  // Being written
+  uint32_t timesync_sent_us;  // Round in flight
+  uint32_t timesync_acked_us;
+  uint8_t timesync_step;  // Of the round in flight, 0 if none
+} nxmic_reader_t;
+
+// Forget everything, the clock fit included; context is handed to the ops
+// and to the stream handlers
+void nxmic_reader_init(nxmic_reader_t *reader,
+                       const nxmic_reader_ops_t *ops, void *context);
+
+// A connection is up: start over from the Database Hash. The clock fit is
+// kept, it belongs to the sensor rather than the connection.
+void nxmic_reader_connect(nxmic_reader_t *reader);
+
+// Results of the procedure in flight
+void nxmic_reader_on_service(nxmic_reader_t *reader, uint16_t start_handle,
+                             uint16_t end_handle);
+void nxmic_reader_on_characteristic(
+    nxmic_reader_t *reader, const uint8_t *uuid128,
+    const nxmic_reader_characteristic_t *characteristic);
+// A value read: the Database Hash, a CCCD of the sweep, the sensor's time
+void nxmic_reader_on_value(nxmic_reader_t *reader, uint16_t handle,
+                           const uint8_t *value, uint16_t length);
+// The procedure in flight is over, att_status 0 on success
+void nxmic_reader_on_complete(nxmic_reader_t *reader, uint8_t att_status,
+                              uint32_t now_us);
+
+// Route a notification, to the export receiver or to its stream
+void nxmic_reader_on_notification(nxmic_reader_t *reader,
+                                  uint16_t value_handle, const uint8_t *value,
+                                  uint16_t length, uint32_t now_us);
+
+static inline bool nxmic_reader_ready(const nxmic_reader_t *reader) {
+  return reader->state == NXMIC_READER_READY;
+}
+
+static inline const nxmic_reader_characteristic_t *
+nxmic_reader_characteristic(const nxmic_reader_t *reader,
+                            gatt_characteristic_id_t char_id) {
+  return &reader->handles.characteristics[char_id];
+}
+
+// One clock sync round: the reader's time written to CHAR_TIMESTAMP, then
+// read back with the sensor's. The next round is scheduled when it is over.
+void nxmic_reader_sync_clock(nxmic_reader_t *reader, uint32_t now_us);
+
+// NACK the frames tracker misses on char_id that are due again, see
+// nxmic_gap_build_nack(). Returns false if none went out.
+bool nxmic_reader_request_frames(nxmic_reader_t *reader,
+                                 gatt_characteristic_id_t char_id,
+                                 nxmic_gap_tracker_t *tracker,
+                                 uint32_t now_us);
+
+// Send what the export receiver asks for, if anything
+bool nxmic_reader_request_export(nxmic_reader_t *reader, uint32_t now_us);
+
+// Copy a notification into the ring behind record, record->length set
+// from length. false if the ring is full (counted by the ring) or the
+// value does not fit a slot.
+bool nxmic_reader_queue(spsc_ring_t *ring, nxmic_reader_record_t *record,
+                        const uint8_t *value, uint16_t length);
+
+// The index-th ready slot of the ring: its record, and the frame its value
+// holds. Returns false if the value is not a frame.
+bool nxmic_reader_peek(const spsc_ring_t *ring, uint32_t index,
+                       nxmic_reader_record_t *record,
+                       nxmic_frame_header_t *frame, const uint8_t **payload,
+                       uint16_t *payload_length);
+
+#endif
@@ -0,0 +1,163 @@
+#include "nxmic_retransmit.h"
+
+#include <string.h>
+
+#define FRAME_SEQUENCE_OFFSET 4
+
+static uint16_t read_16(const uint8_t *buffer, int offset) {
+  return (uint16_t)(buffer[offset] | (buffer[offset + 1] << 8));
+}
+
+void nxmic_retx_init(nxmic_retx_window_t *window, uint8_t stream_id) {
+  memset(window, 0, sizeof(*window));
+  window->stream_id = stream_id;
+}
+
+void nxmic_retx_store(nxmic_retx_window_t *window, const uint8_t *frame,
+                      uint16_t length) {
+  if (length < NXMIC_FRAME_HEADER_SIZE || length > NXMIC_FRAME_MAX_SIZE)
+    return;
+  uint16_t sequence = read_16(frame, FRAME_SEQUENCE_OFFSET);
+  nxmic_retx_slot_t *slot =
+      &window->slots[sequence & (NXMIC_RETX_WINDOW_FRAMES - 1)];
+  slot->sequence = sequence;
+  slot->length = length;
+  memcpy(slot->frame, frame, length);
+}
+
+bool nxmic_retx_handle_nack(nxmic_retx_window_t *window, const uint8_t *nack,
+                            uint16_t length) {
+  if (length < 3 || nack[0] != NXMIC_EXPORT_OP_NACK) return false;
+  if (nack[1] != window->stream_id) return false;
+  uint8_t count = nack[2];
+  if (count == 0 || count > NXMIC_NACK_MAX_SEQUENCES ||
+      length < 3 + 2 * count)
+    return false;
+  for (int i = 0; i < count; i++) {
+    if (window->queue_count == NXMIC_RETX_QUEUE_SIZE) {
+      window->expired++;  // the reader asks again after its retry timeout
+      continue;
+    }
+    uint8_t tail =
+        (window->queue_head + window->queue_count) % NXMIC_RETX_QUEUE_SIZE;
+    window->queue[tail] = read_16(nack, 3 + 2 * i);
+    window->queue_count++;
+  }
+  return true;
+}
+
+const uint8_t *nxmic_retx_next(nxmic_retx_window_t *window,
+                               uint16_t *length) {
+  while (window->queue_count) {
+    uint16_t sequence = window->queue[window->queue_head];
+    const nxmic_retx_slot_t *slot =
+        &window->slots[sequence & (NXMIC_RETX_WINDOW_FRAMES - 1)];
+    if (slot->length && slot->sequence == sequence) {
+      *length = slot->length;
+      return slot->frame;
+    }
+    // overwritten by a newer frame
+    window->expired++;
+    window->queue_head = (window->queue_head + 1) % NXMIC_RETX_QUEUE_SIZE;
+    window->queue_count--;
+  }
+  return NULL;
+}
+
+void nxmic_retx_sent(nxmic_retx_window_t *window) {
+  if (!window->queue_count) return;
+  window->queue_head = (window->queue_head + 1) % NXMIC_RETX_QUEUE_SIZE;
+  window->queue_count--;
+  window->retransmitted++;
+}
+
+void nxmic_retx_reset(nxmic_retx_window_t *window) {
+  window->queue_head = 0;
+  window->queue_count = 0;
+}
+
+void nxmic_gap_init(nxmic_gap_tracker_t *tracker) {
+  memset(tracker, 0, sizeof(*tracker));
+}
+
+void nxmic_gap_reset(nxmic_gap_tracker_t *tracker) {
+  tracker->unrecoverable += tracker->missing_count;
+  tracker->missing_count = 0;
+  tracker->synced = false;
+}
+
+static void add_missing(nxmic_gap_tracker_t *tracker, uint16_t sequence) {
+  tracker->gaps++;
+  if (tracker->missing_count == NXMIC_GAP_MAX_MISSING) {
+    tracker->unrecoverable++;
+    return;
+  }
+  nxmic_missing_frame_t *missing = &tracker->missing[tracker->missing_count++];
+  missing->sequence = sequence;
+  missing->attempts = 0;
+  missing->requested_us = 0;
+}
+
+static void remove_missing(nxmic_gap_tracker_t *tracker, int index) {
+  tracker->missing[index] = tracker->missing[--tracker->missing_count];
+}
+
+bool nxmic_gap_on_frame(nxmic_gap_tracker_t *tracker, uint16_t sequence) {
+  if (!tracker->synced) {
+    tracker->synced = true;
+    tracker->next_sequence = sequence + 1;
+    return true;
+  }
+  uint16_t ahead = sequence - tracker->next_sequence;
+  if (ahead < 0x8000) {
+    // frames older than the sensor's window cannot be asked for
+    uint16_t first = sequence - ahead;
+    if (ahead > NXMIC_RETX_WINDOW_FRAMES) {
+      uint16_t lost = ahead - NXMIC_RETX_WINDOW_FRAMES;
+      tracker->gaps += lost;
+      tracker->unrecoverable += lost;
+      first += lost;
+    }
+    for (uint16_t s = first; s != sequence; s++) add_missing(tracker, s);
+    tracker->next_sequence = sequence + 1;
+    return true;
+  }
+  for (int i = 0; i < tracker->missing_count; i++) {
+    if (tracker->missing[i].sequence != sequence) continue;
+    remove_missing(tracker, i);
+    tracker->recovered++;
+    return true;
+  }
+  tracker->duplicates++;
+  return false;
+}
+
+uint16_t nxmic_gap_build_nack(nxmic_gap_tracker_t *tracker, uint8_t stream_id,
+                              uint32_t now_us, uint8_t *out) {
+  uint8_t count = 0;
+  for (int i = 0; i < tracker->missing_count;) {
+    nxmic_missing_frame_t *missing = &tracker->missing[i];
+    if (missing->attempts &&
+        now_us - missing->requested_us < NXMIC_GAP_RETRY_US) {
+      i++;
+      continue;
+    }
+    if (missing->attempts == NXMIC_GAP_MAX_ATTEMPTS) {
+      tracker->unrecoverable++;
+      remove_missing(tracker, i);
+      continue;
+    }
+    if (count == NXMIC_NACK_MAX_SEQUENCES) break;
+    missing->attempts++;
+    missing->requested_us = now_us;
+    out[3 + 2 * count] = (uint8_t)missing->sequence;
+    out[4 + 2 * count] = (uint8_t)(missing->sequence >> 8);
+    count++;
+    i++;
+  }
+  if (count == 0) return 0;
+  out[0] = NXMIC_EXPORT_OP_NACK;
+  out[1] = stream_id;
+  out[2] = count;
+  return 3 + 2 * count;
+}
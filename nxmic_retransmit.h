@@ -0,0 +1,97 @@
+#ifndef NXMIC_RETRANSMIT_H_
+#define NXMIC_RETRANSMIT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "nxmic_frame.h"
+
+// Selective retransmission of stream frames. The sensor keeps its last
+// NXMIC_RETX_WINDOW_FRAMES frames per stream; the reader spots sequence
+// gaps and writes NACKs to CHAR_DATA_EXPORT; the sensor re-sends the
+// missing frames on the streaming characteristic whenever the live stream
+// leaves room.
+//
+// NACK, written without response to CHAR_DATA_EXPORT:
+//
+//   opcode     u8   NXMIC_EXPORT_OP_NACK
+//   stream_id  u8   gatt_characteristic_id_t of the stream
+//   count      u8   1..NXMIC_NACK_MAX_SEQUENCES
+//   sequence   u16  x count, little-endian
+
+#define NXMIC_EXPORT_OP_NACK 0x01
+#define NXMIC_NACK_MAX_SEQUENCES 8
+#define NXMIC_NACK_MAX_SIZE (3 + 2 * NXMIC_NACK_MAX_SEQUENCES)
+
+// Sensor side, frames kept for retransmission (power of two)
+#define NXMIC_RETX_WINDOW_FRAMES 16
+#define NXMIC_RETX_QUEUE_SIZE 16
+
+// Reader side
+#define NXMIC_GAP_MAX_MISSING 32
+#define NXMIC_GAP_RETRY_US 100000  // Re-request a frame after this long
+#define NXMIC_GAP_MAX_ATTEMPTS 3
+
+typedef struct {
+  uint16_t sequence;
+  uint16_t length;  // 0 if empty
+  uint8_t frame[NXMIC_FRAME_MAX_SIZE];
+} nxmic_retx_slot_t;
+
+typedef struct {
+  nxmic_retx_slot_t slots[NXMIC_RETX_WINDOW_FRAMES];  // by sequence
+  uint16_t queue[NXMIC_RETX_QUEUE_SIZE];  // requested sequences, in order
+  uint8_t queue_head;
+  uint8_t queue_count;
+  uint8_t stream_id;
+  uint32_t retransmitted;  // Frames sent again
+  uint32_t expired;        // Requested after they left the window
+} nxmic_retx_window_t;
+
+void nxmic_retx_init(nxmic_retx_window_t *window, uint8_t stream_id);
+// Keep a copy of a frame that was just sent
+void nxmic_retx_store(nxmic_retx_window_t *window, const uint8_t *frame,
+                      uint16_t length);
+// Queue the frames a NACK asks for. false if the NACK is malformed or for
+// another stream.
+bool nxmic_retx_handle_nack(nxmic_retx_window_t *window, const uint8_t *nack,
+                            uint16_t length);
+// Next requested frame still in the window, NULL if nothing is queued.
+// Call nxmic_retx_sent() once it went out.
+const uint8_t *nxmic_retx_next(nxmic_retx_window_t *window,
+                               uint16_t *length);
+void nxmic_retx_sent(nxmic_retx_window_t *window);
+// Forget everything queued, e.g. on disconnect
+void nxmic_retx_reset(nxmic_retx_window_t *window);
+
+typedef struct {
+  uint16_t sequence;
+  uint8_t attempts;
+  uint32_t requested_us;
+} nxmic_missing_frame_t;
+
+typedef struct {
+  bool synced;
+  uint16_t next_sequence;
+  nxmic_missing_frame_t missing[NXMIC_GAP_MAX_MISSING];
+  uint8_t missing_count;
+  uint32_t gaps;           // Frames found missing
+  uint32_t recovered;      // Missing frames that arrived later
+  uint32_t unrecoverable;  // Given up on
+  uint32_t duplicates;     // Frames received twice
+} nxmic_gap_tracker_t;
+
+void nxmic_gap_init(nxmic_gap_tracker_t *tracker);
+// Start over after a reconnect, keeping the counters. Frames still missing
+// are given up, the sensor's window does not survive the connection.
+void nxmic_gap_reset(nxmic_gap_tracker_t *tracker);
+// Account for a received frame. Returns false for a duplicate that should
+// not be decoded again.
+bool nxmic_gap_on_frame(nxmic_gap_tracker_t *tracker, uint16_t sequence);
+// Build a NACK for missing frames not requested within NXMIC_GAP_RETRY_US,
+// into out[NXMIC_NACK_MAX_SIZE]. Frames out of attempts are given up.
+// Returns the NACK length, 0 if there is nothing to ask for.
+uint16_t nxmic_gap_build_nack(nxmic_gap_tracker_t *tracker, uint8_t stream_id,
+                              uint32_t now_us, uint8_t *out);
+
+#endif
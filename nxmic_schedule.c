@@ -0,0 +1,194 @@
+#include "nxmic_schedule.h"
+
+#include <string.h>
+
+static uint32_t read_32(const uint8_t *buffer, int offset) {
+  return (uint32_t)buffer[offset] | ((uint32_t)buffer[offset + 1] << 8) |
+         ((uint32_t)buffer[offset + 2] << 16) |
+         ((uint32_t)buffer[offset + 3] << 24);
+}
+
+static void write_32(uint8_t *buffer, int offset, uint32_t value) {
+  buffer[offset] = (uint8_t)value;
+  buffer[offset + 1] = (uint8_t)(value >> 8);
+  buffer[offset + 2] = (uint8_t)(value >> 16);
+  buffer[offset + 3] = (uint8_t)(value >> 24);
+}
+
+static bool before(uint32_t a_us, uint32_t b_us) {
+  return (int32_t)(a_us - b_us) < 0;
+}
+
+static bool valid_interval(uint32_t interval_ms) {
+  return interval_ms == 0 || (interval_ms >= NXMIC_SCHEDULE_MIN_INTERVAL_MS &&
+                              interval_ms <= NXMIC_SCHEDULE_MAX_INTERVAL_MS);
+}
+
+static nxmic_schedule_entry_t *find(nxmic_schedule_t *schedule, uint8_t id) {
+  for (uint8_t i = 0; i < schedule->count; i++) {
+    if (schedule->entries[i].id == id) return &schedule->entries[i];
+  }
+  return NULL;
+}
+
+static uint32_t deadline_at(const nxmic_schedule_t *schedule, uint8_t slot) {
+  return schedule->entries[schedule->heap[slot]].deadline_us;
+}
+
+static void heap_place(nxmic_schedule_t *schedule, uint8_t slot,
+                       uint8_t entry) {
+  schedule->heap[slot] = entry;
+  schedule->entries[entry].heap_index = slot;
+}
+
+static void sift_up(nxmic_schedule_t *schedule, uint8_t slot) {
+  uint8_t entry = schedule->heap[slot];
+  uint32_t deadline_us = schedule->entries[entry].deadline_us;
+  while (slot > 0) {
+    uint8_t parent = (uint8_t)((slot - 1) / 2);
+    if (!before(deadline_us, deadline_at(schedule, parent))) break;
+    heap_place(schedule, slot, schedule->heap[parent]);
+    slot = parent;
+  }
+  heap_place(schedule, slot, entry);
+}
+
+static void sift_down(nxmic_schedule_t *schedule, uint8_t slot) {
+  uint8_t entry = schedule->heap[slot];
+  uint32_t deadline_us = schedule->entries[entry].deadline_us;
+  while (true) {
+    uint8_t child = (uint8_t)(2 * slot + 1);
+    if (child >= schedule->queued) break;
+    if (child + 1 < schedule->queued &&
+        before(deadline_at(schedule, child + 1), deadline_at(schedule, child)))
+      child++;
+    if (!before(deadline_at(schedule, child), deadline_us)) break;
+    heap_place(schedule, slot, schedule->heap[child]);
+    slot = child;
+  }
+  heap_place(schedule, slot, entry);
+}
+
+static void dequeue(nxmic_schedule_t *schedule,
+                    nxmic_schedule_entry_t *entry) {
+  uint8_t slot = entry->heap_index;
+  if (slot == NXMIC_SCHEDULE_NOT_QUEUED) return;
+  entry->heap_index = NXMIC_SCHEDULE_NOT_QUEUED;
+  uint8_t last = schedule->heap[--schedule->queued];
+  if (slot == schedule->queued) return;
+  heap_place(schedule, slot, last);
+  sift_up(schedule, slot);
+  sift_down(schedule, schedule->entries[last].heap_index);
+}
+
+// (Re)start an entry, first run interval_us from now
+static void start(nxmic_schedule_t *schedule, nxmic_schedule_entry_t *entry,
+                  uint32_t interval_ms, uint32_t now_us) {
+  dequeue(schedule, entry);
+  entry->interval_us = interval_ms * 1000;
+  if (interval_ms == 0) return;
+  entry->deadline_us = now_us + entry->interval_us;
+  uint8_t slot = schedule->queued++;
+  heap_place(schedule, slot, (uint8_t)(entry - schedule->entries));
+  sift_up(schedule, slot);
+}
+
+void nxmic_schedule_init(nxmic_schedule_t *schedule, uint32_t coalesce_us) {
+  memset(schedule, 0, sizeof(*schedule));
+  schedule->coalesce_us = coalesce_us;
+  nxmic_histogram_reset(&schedule->jitter);
+}
+
+bool nxmic_schedule_add(nxmic_schedule_t *schedule, uint8_t id,
+                        uint32_t interval_ms, bool settable, uint32_t now_us) {
+  if (schedule->count == NXMIC_SCHEDULE_MAX_ENTRIES || id >= 32 ||
+      find(schedule, id) || !valid_interval(interval_ms))
+    return false;
+  nxmic_schedule_entry_t *entry = &schedule->entries[schedule->count++];
+  memset(entry, 0, sizeof(*entry));
+  entry->id = id;
+  entry->settable = settable;
+  entry->heap_index = NXMIC_SCHEDULE_NOT_QUEUED;
+  start(schedule, entry, interval_ms, now_us);
+  return true;
+}
+
+bool nxmic_schedule_set_interval(nxmic_schedule_t *schedule, uint8_t id,
+                                 uint32_t interval_ms, uint32_t now_us) {
+  nxmic_schedule_entry_t *entry = find(schedule, id);
+  if (!entry || !valid_interval(interval_ms)) return false;
+  start(schedule, entry, interval_ms, now_us);
+  return true;
+}
+
+bool nxmic_schedule_next(const nxmic_schedule_t *schedule,
+                         uint32_t *deadline_us) {
+  if (schedule->queued == 0) return false;
+  *deadline_us = deadline_at(schedule, 0);
+  return true;
+}
+
+uint32_t nxmic_schedule_run(nxmic_schedule_t *schedule, uint32_t now_us) {
+  uint32_t due = 0;
+  int ran = 0;
+  uint32_t horizon_us = now_us + schedule->coalesce_us;
+  while (schedule->queued &&
+         !before(horizon_us, deadline_at(schedule, 0))) {
+    nxmic_schedule_entry_t *entry = &schedule->entries[schedule->heap[0]];
+    int32_t late = (int32_t)(now_us - entry->deadline_us);
+    nxmic_histogram_add(&schedule->jitter,
+                        (uint32_t)(late < 0 ? -late : late));
+    entry->runs++;
+    due |= 1u << entry->id;
+    ran++;
+    // from the deadline, not from now; periods slept through are dropped
+    entry->deadline_us += entry->interval_us;
+    if (!before(now_us, entry->deadline_us)) {
+      uint32_t missed =
+          (now_us - entry->deadline_us) / entry->interval_us + 1;
+      entry->skipped += missed;
+      schedule->skipped += missed;
+      entry->deadline_us += missed * entry->interval_us;
+    }
+    sift_down(schedule, 0);
+  }
+  if (ran) schedule->wakeups++;
+  if (ran > 1) schedule->bursts++;
+  return due;
+}
+
+bool nxmic_schedule_handle_write(nxmic_schedule_t *schedule,
+                                 const uint8_t *value, uint16_t length,
+                                 uint32_t now_us) {
+  bool valid = length > 0 && length % NXMIC_SCHEDULE_RECORD_SIZE == 0;
+  for (uint16_t offset = 0; valid && offset < length;
+       offset += NXMIC_SCHEDULE_RECORD_SIZE) {
+    const nxmic_schedule_entry_t *entry = find(schedule, value[offset]);
+    valid = entry && entry->settable &&
+            valid_interval(read_32(value, offset + 1));
+  }
+  if (!valid) {
+    schedule->rejected++;
+    return false;
+  }
+  for (uint16_t offset = 0; offset < length;
+       offset += NXMIC_SCHEDULE_RECORD_SIZE) {
+    nxmic_schedule_set_interval(schedule, value[offset],
+                                read_32(value, offset + 1), now_us);
+  }
+  return true;
+}
+
+uint16_t nxmic_schedule_encode(const nxmic_schedule_t *schedule,
+                               uint8_t *value, uint16_t size) {
+  uint16_t length = 0;
+  for (uint8_t i = 0; i < schedule->count; i++) {
+    const nxmic_schedule_entry_t *entry = &schedule->entries[i];
+    if (!entry->settable) continue;
+    if (size - length < NXMIC_SCHEDULE_RECORD_SIZE) break;
+    value[length] = entry->id;
+    write_32(value, length + 1, entry->interval_us / 1000);
+    length += NXMIC_SCHEDULE_RECORD_SIZE;
+  }
+  return length;
+}
@@ -0,0 +1,86 @@
+#ifndef NXMIC_SCHEDULE_H_
+#define NXMIC_SCHEDULE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "nxmic_bench.h"
+
+// Per-stream rate scheduler: every stream (and any periodic task of the
+// firmware) has its own interval, and a min-heap of deadlines gives the
+// next time anything is due, so the caller arms one timer for it instead
+// of polling on a fixed tick. Entries due within coalesce_us of each other
+// run in the same wakeup, which lets their notifications go out as one
+// burst; each is rescheduled from its own deadline, so running early or
+// late does not make it drift.
+//
+// Rates of the streams are written through CHAR_RECORDING_INTERVAL_SETTINGS
+// as a list of records, little-endian:
+//
+//   char_id u8, interval_ms u32 (0 stops the stream)
+//
+// A write applies every record or, if one names an unknown stream or an
+// interval out of range, none of them. A read returns the records of every
+// stream that can be set.
+//
+// Deadlines are wrapping 32-bit microseconds; intervals are bounded so that
+// they stay ordered.
+
+#define NXMIC_SCHEDULE_MAX_ENTRIES 8
+#define NXMIC_SCHEDULE_RECORD_SIZE 5
+#define NXMIC_SCHEDULE_MIN_INTERVAL_MS 10
+#define NXMIC_SCHEDULE_MAX_INTERVAL_MS (30 * 60 * 1000)
+#define NXMIC_SCHEDULE_NOT_QUEUED 0xff
+
+typedef struct {
+  uint8_t id;          // gatt_characteristic_id_t, or a task id up to 31
+  bool settable;       // Rate written through the characteristic
+  uint8_t heap_index;  // NXMIC_SCHEDULE_NOT_QUEUED while stopped
+  uint32_t interval_us;
+  uint32_t deadline_us;
+  uint32_t runs;
+  uint32_t skipped;  // Deadlines missed entirely, woken up too late
+} nxmic_schedule_entry_t;
+
+typedef struct {
+  nxmic_schedule_entry_t entries[NXMIC_SCHEDULE_MAX_ENTRIES];
+  uint8_t count;
+  uint8_t heap[NXMIC_SCHEDULE_MAX_ENTRIES];  // Entry indices by deadline
+  uint8_t queued;
+  uint32_t coalesce_us;
+  uint32_t wakeups;   // Calls to nxmic_schedule_run() with something due
+  uint32_t bursts;    // Of those, wakeups that ran more than one entry
+  uint32_t skipped;   // Deadlines missed, every entry
+  uint32_t rejected;  // Writes of the characteristic not applied
+  nxmic_histogram_t jitter;  // |run - deadline| of every run
+} nxmic_schedule_t;
+
+void nxmic_schedule_init(nxmic_schedule_t *schedule, uint32_t coalesce_us);
+
+// Add an entry running every interval_ms from now, 0 to leave it stopped.
+// false if the schedule is full, the id is taken or out of range.
+bool nxmic_schedule_add(nxmic_schedule_t *schedule, uint8_t id,
+                        uint32_t interval_ms, bool settable, uint32_t now_us);
+
+// Change the interval of an entry, its next run is interval_ms from now
+bool nxmic_schedule_set_interval(nxmic_schedule_t *schedule, uint8_t id,
+                                 uint32_t interval_ms, uint32_t now_us);
+
+// Deadline of the next entry due, false if every entry is stopped
+bool nxmic_schedule_next(const nxmic_schedule_t *schedule,
+                         uint32_t *deadline_us);
+
+// Take every entry due by now_us + coalesce_us and reschedule it. Returns
+// their ids as a mask (1u << id), 0 if the call was early.
+uint32_t nxmic_schedule_run(nxmic_schedule_t *schedule, uint32_t now_us);
+
+// A write of CHAR_RECORDING_INTERVAL_SETTINGS
+bool nxmic_schedule_handle_write(nxmic_schedule_t *schedule,
+                                 const uint8_t *value, uint16_t length,
+                                 uint32_t now_us);
+
+// Its value, as many records as fit in size bytes. Returns the length.
+uint16_t nxmic_schedule_encode(const nxmic_schedule_t *schedule,
+                               uint8_t *value, uint16_t size);
+
+#endif
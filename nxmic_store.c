@@ -0,0 +1,536 @@
+#include "nxmic_store.h"
+
+#include <string.h>
+
+#include "nxmic_export.h"  // CRCs
+
+#define STORE_MAGIC 0x534c584eu  // "NXLS"
+#define STORE_VERSION 1
+#define STORE_FLAG_FORMAT 0x01
+
+// Footer length of a page that was never programmed
+#define FOOTER_ERASED 0xffff
+
+typedef struct {
+  uint8_t flags;
+  uint16_t recording;
+  uint32_t sequence;
+  uint32_t offset;
+  uint32_t erase_count;
+} segment_header_t;
+
+static uint16_t read_16(const uint8_t *buffer, int offset) {
+  return (uint16_t)(buffer[offset] | (buffer[offset + 1] << 8));
+}
+
+static uint32_t read_32(const uint8_t *buffer, int offset) {
+  return (uint32_t)buffer[offset] | ((uint32_t)buffer[offset + 1] << 8) |
+         ((uint32_t)buffer[offset + 2] << 16) |
+         ((uint32_t)buffer[offset + 3] << 24);
+}
+
+static void write_16(uint8_t *buffer, int offset, uint16_t value) {
+  buffer[offset] = (uint8_t)value;
+  buffer[offset + 1] = (uint8_t)(value >> 8);
+}
+
+static void write_32(uint8_t *buffer, int offset, uint32_t value) {
+  write_16(buffer, offset, (uint16_t)value);
+  write_16(buffer, offset + 2, (uint16_t)(value >> 16));
+}
+
+static uint32_t page_data_size(const nxmic_store_t *store) {
+  return store->flash->page_size - NXMIC_STORE_FOOTER_SIZE;
+}
+
+// Where a page's data starts, the segment header comes first in page 0
+static uint32_t page_data_start(uint32_t page) {
+  return page == 0 ? NXMIC_STORE_HEADER_SIZE : 0;
+}
+
+static uint32_t page_capacity(const nxmic_store_t *store, uint32_t page) {
+  return page_data_size(store) - page_data_start(page);
+}
+
+// Page and byte within it for a position in a segment's data
+static void locate(const nxmic_store_t *store, uint32_t position,
+                   uint32_t *page, uint32_t *in_page) {
+  uint32_t first = page_capacity(store, 0);
+  if (position < first) {
+    *page = 0;
+    *in_page = NXMIC_STORE_HEADER_SIZE + position;
+    return;
+  }
+  position -= first;
+  *page = 1 + position / page_data_size(store);
+  *in_page = position % page_data_size(store);
+}
+
+static uint32_t sector_address(const nxmic_store_t *store, uint32_t sector) {
+  return sector * store->flash->sector_size;
+}
+
+static bool flash_read(nxmic_store_t *store, uint32_t address, void *buffer,
+                       uint32_t length) {
+  const nxmic_flash_t *flash = store->flash;
+  if (flash->read(flash->context, address, buffer, length)) return true;
+  store->stats.flash_errors++;
+  return false;
+}
+
+static bool flash_program(nxmic_store_t *store, uint32_t address,
+                          const void *data) {
+  const nxmic_flash_t *flash = store->flash;
+  if (flash->program(flash->context, address, data, flash->page_size)) {
+    store->stats.pages_programmed++;
+    return true;
+  }
+  store->stats.flash_errors++;
+  return false;
+}
+
+static void encode_header(const nxmic_store_t *store,
+                          const segment_header_t *header, uint8_t *out) {
+  write_32(out, 0, STORE_MAGIC);
+  out[4] = STORE_VERSION;
+  out[5] = header->flags;
+  write_16(out, 6, header->recording);
+  write_32(out, 8, header->sequence);
+  write_32(out, 12, header->offset);
+  write_32(out, 16, header->erase_count);
+  write_16(out, 20, store->flash->page_size);
+  write_16(out, 22, 0xffff);
+  write_32(out, 24, store->flash->sector_size);
+  write_32(out, 28, nxmic_crc32_update(0, out, 28));
+}
+
+// false for an erased, torn or foreign header
+static bool decode_header(const nxmic_store_t *store, const uint8_t *in,
+                          segment_header_t *header) {
+  if (read_32(in, 0) != STORE_MAGIC || in[4] != STORE_VERSION) return false;
+  if (read_32(in, 28) != nxmic_crc32_update(0, in, 28)) return false;
+  if (read_16(in, 20) != store->flash->page_size ||
+      read_32(in, 24) != store->flash->sector_size)
+    return false;
+  header->flags = in[5];
+  header->recording = read_16(in, 6);
+  header->sequence = read_32(in, 8);
+  header->offset = read_32(in, 12);
+  header->erase_count = read_32(in, 16);
+  return header->sequence != 0;
+}
+
+bool nxmic_store_init(nxmic_store_t *store, const nxmic_flash_t *flash,
+                      nxmic_store_segment_t *segments, uint32_t sector_count) {
+  memset(store, 0, sizeof(*store));
+  if (flash->page_size > NXMIC_STORE_MAX_PAGE_SIZE ||
+      flash->page_size <= NXMIC_STORE_HEADER_SIZE + NXMIC_STORE_FOOTER_SIZE ||
+      flash->sector_size % flash->page_size != 0 ||
+      flash->size % flash->sector_size != 0 ||
+      flash->size / flash->sector_size > sector_count ||
+      flash->size / flash->sector_size < 2)
+    return false;
+  store->flash = flash;
+  store->segments = segments;
+  store->sector_count = flash->size / flash->sector_size;
+  store->pages_per_sector = flash->sector_size / flash->page_size;
+  store->segment_capacity =
+      store->pages_per_sector * page_data_size(store) - NXMIC_STORE_HEADER_SIZE;
+  store->erased = -1;
+  store->head = store->sector_count - 1;
+  store->next_recording = 1;
+  return true;
+}
+
+// Data bytes in a segment that is not known to be full: page by page up to
+// the first erased, torn or partly filled one
+static uint32_t scan_segment(nxmic_store_t *store, uint32_t sector) {
+  uint8_t page_bytes[NXMIC_STORE_MAX_PAGE_SIZE];
+  uint16_t page_size = store->flash->page_size;
+  uint32_t length = 0;
+  for (uint32_t page = 0; page < store->pages_per_sector; page++) {
+    if (!flash_read(store, sector_address(store, sector) + page * page_size,
+                    page_bytes, page_size))
+      break;
+    store->stats.mount_reads++;
+    store->stats.mount_bytes += page_size;
+    uint16_t used = read_16(page_bytes, page_size - NXMIC_STORE_FOOTER_SIZE);
+    uint32_t start = page_data_start(page);
+    if (used == FOOTER_ERASED || used > page_capacity(store, page)) break;
+    if (read_16(page_bytes, page_size - 2) !=
+        nxmic_crc16(page_bytes + start, used))
+      break;
+    length += used;
+    if (used < page_capacity(store, page)) break;
+  }
+  return length;
+}
+
+bool nxmic_store_mount(nxmic_store_t *store) {
+  uint32_t count = store->sector_count;
+  uint32_t format_sequence = 0;
+  uint32_t erase_max = 0;
+  uint16_t last_recording = 0;
+  store->sequence = 0;
+  store->head = count - 1;
+  store->erased = -1;
+  store->lookup = 0;
+  store->active = NXMIC_STORE_NO_RECORDING;
+  store->active_length = 0;
+  store->page_first = 0;
+  store->page_count = 0;
+  store->filling = false;
+  store->stats.mount_reads = 0;
+  store->stats.mount_bytes = 0;
+
+  for (uint32_t sector = 0; sector < count; sector++) {
+    uint8_t raw[NXMIC_STORE_HEADER_SIZE];
+    nxmic_store_segment_t *segment = &store->segments[sector];
+    memset(segment, 0, sizeof(*segment));
+    if (!flash_read(store, sector_address(store, sector), raw, sizeof(raw)))
+      return false;
+    store->stats.mount_reads++;
+    store->stats.mount_bytes += sizeof(raw);
+    segment_header_t header;
+    if (!decode_header(store, raw, &header)) continue;
+    segment->sequence = header.sequence;
+    segment->offset = header.offset;
+    segment->erase_count = header.erase_count;
+    segment->recording = header.recording;
+    if (header.erase_count > erase_max) erase_max = header.erase_count;
+    if ((header.flags & STORE_FLAG_FORMAT) &&
+        header.sequence > format_sequence)
+      format_sequence = header.sequence;
+    if (header.sequence > store->sequence) {
+      store->sequence = header.sequence;
+      store->head = sector;
+      last_recording = header.recording;
+    }
+  }
+
+  for (uint32_t sector = 0; sector < count; sector++) {
+    nxmic_store_segment_t *segment = &store->segments[sector];
+    // a sector without a header lost its count, assume the worst
+    if (segment->sequence == 0) segment->erase_count = erase_max;
+    if (segment->sequence < format_sequence) segment->sequence = 0;
+  }
+
+  for (uint32_t sector = 0; sector < count; sector++) {
+    nxmic_store_segment_t *segment = &store->segments[sector];
+    if (segment->sequence == 0 ||
+        segment->recording == NXMIC_STORE_NO_RECORDING)
+      continue;
+    const nxmic_store_segment_t *next = &store->segments[(sector + 1) % count];
+    if (next->sequence == segment->sequence + 1 &&
+        next->recording == segment->recording &&
+        next->offset == segment->offset + store->segment_capacity) {
+      segment->length = store->segment_capacity;
+    } else {
+      segment->length = scan_segment(store, sector);
+    }
+  }
+
+  // ids only need to differ from the recordings still in flash
+  store->next_recording = (uint16_t)(last_recording + 1);
+  if (store->next_recording == NXMIC_STORE_NO_RECORDING)
+    store->next_recording++;
+  return true;
+}
+
+// Make sector ready for a new segment. The old header is overwritten with
+// zeros first, so an erase cut short cannot bring the segment back.
+static bool prepare_sector(nxmic_store_t *store, uint32_t sector) {
+  static const uint8_t zeros[NXMIC_STORE_MAX_PAGE_SIZE];
+  nxmic_store_segment_t *segment = &store->segments[sector];
+  uint32_t address = sector_address(store, sector);
+  if (segment->sequence != 0) {
+    if (segment->recording != NXMIC_STORE_NO_RECORDING)
+      store->stats.segments_recycled++;
+    segment->sequence = 0;
+    segment->length = 0;
+    if (!flash_program(store, address, zeros)) return false;
+  }
+  if (!store->flash->erase(store->flash->context, address)) {
+    store->stats.flash_errors++;
+    return false;
+  }
+  segment->erase_count++;
+  store->stats.sectors_erased++;
+  return true;
+}
+
+static bool prepare_next_sector(nxmic_store_t *store) {
+  uint32_t next = (store->head + 1) % store->sector_count;
+  if (store->erased == (int32_t)next) return true;
+  if (!prepare_sector(store, next)) return false;
+  store->erased = (int32_t)next;
+  return true;
+}
+
+// The next sector becomes the head, its header goes out with first_page
+static bool open_segment(nxmic_store_t *store, uint8_t flags,
+                         uint16_t recording, uint32_t offset,
+                         uint8_t *first_page) {
+  if (!prepare_next_sector(store)) return false;
+  uint32_t sector = (uint32_t)store->erased;
+  nxmic_store_segment_t *segment = &store->segments[sector];
+  segment_header_t header = {
+      .flags = flags,
+      .recording = recording,
+      .sequence = store->sequence + 1,
+      .offset = offset,
+      .erase_count = segment->erase_count,
+  };
+  encode_header(store, &header, first_page);
+  store->erased = -1;
+  if (!flash_program(store, sector_address(store, sector), first_page))
+    return false;
+  store->sequence = header.sequence;
+  store->head = sector;
+  segment->sequence = header.sequence;
+  segment->recording = recording;
+  segment->offset = offset;
+  segment->length = 0;
+  return true;
+}
+
+bool nxmic_store_format(nxmic_store_t *store) {
+  uint8_t page_bytes[NXMIC_STORE_MAX_PAGE_SIZE];
+  store->active = NXMIC_STORE_NO_RECORDING;
+  store->page_count = 0;
+  store->filling = false;
+  if (!prepare_next_sector(store)) return false;
+  for (uint32_t sector = 0; sector < store->sector_count; sector++) {
+    store->segments[sector].sequence = 0;
+    store->segments[sector].length = 0;
+  }
+  memset(page_bytes, 0xff, sizeof(page_bytes));
+  return open_segment(store, STORE_FLAG_FORMAT, NXMIC_STORE_NO_RECORDING, 0,
+                      page_bytes);
+}
+
+uint16_t nxmic_store_begin(nxmic_store_t *store) {
+  nxmic_store_end(store);
+  store->active = store->next_recording++;
+  if (store->next_recording == NXMIC_STORE_NO_RECORDING)
+    store->next_recording++;
+  store->active_length = 0;
+  return store->active;
+}
+
+static nxmic_store_page_t *page_at(nxmic_store_t *store, uint32_t index) {
+  return &store->pages[(store->page_first + index) % NXMIC_STORE_PAGE_BUFFERS];
+}
+
+bool nxmic_store_append(nxmic_store_t *store, const void *data,
+                        uint32_t length) {
+  if (store->active == NXMIC_STORE_NO_RECORDING) return false;
+  // page 0 of a segment holds the least, count every free buffer as one
+  uint32_t room = (NXMIC_STORE_PAGE_BUFFERS - store->page_count) *
+                  page_capacity(store, 0);
+  if (store->filling) {
+    const nxmic_store_page_t *page = page_at(store, store->page_count - 1);
+    room += page_capacity(store, page->page) - page->length;
+  }
+  if (room < length) {
+    store->stats.bytes_dropped += length;
+    return false;
+  }
+  const uint8_t *bytes = data;
+  while (length > 0) {
+    if (!store->filling) {
+      nxmic_store_page_t *page = page_at(store, store->page_count++);
+      uint32_t in_page;
+      memset(page->bytes, 0xff, sizeof(page->bytes));
+      page->recording = store->active;
+      page->offset = store->active_length;
+      page->length = 0;
+      uint32_t index;
+      locate(store, store->active_length % store->segment_capacity, &index,
+             &in_page);
+      page->page = (uint16_t)index;
+      store->filling = true;
+    }
+    nxmic_store_page_t *page = page_at(store, store->page_count - 1);
+    uint32_t free_bytes = page_capacity(store, page->page) - page->length;
+    uint32_t n = length < free_bytes ? length : free_bytes;
+    memcpy(page->bytes + page_data_start(page->page) + page->length, bytes,
+           n);
+    page->length += n;
+    store->active_length += n;
+    bytes += n;
+    length -= n;
+    if (n == free_bytes) store->filling = false;
+  }
+  return true;
+}
+
+void nxmic_store_end(nxmic_store_t *store) {
+  store->active = NXMIC_STORE_NO_RECORDING;
+  store->filling = false;
+}
+
+static bool program_page(nxmic_store_t *store, nxmic_store_page_t *page) {
+  uint16_t page_size = store->flash->page_size;
+  write_16(page->bytes, page_size - NXMIC_STORE_FOOTER_SIZE, page->length);
+  write_16(page->bytes, page_size - 2,
+           nxmic_crc16(page->bytes + page_data_start(page->page),
+                       page->length));
+  if (page->page == 0)
+    return open_segment(store, 0, page->recording, page->offset, page->bytes);
+  nxmic_store_segment_t *segment = &store->segments[store->head];
+  // the segment it belongs to was given up or formatted away
+  if (segment->sequence == 0 || segment->recording != page->recording ||
+      page->offset != segment->offset + segment->length)
+    return true;
+  return flash_program(store,
+                       sector_address(store, store->head) +
+                           page->page * page_size,
+                       page->bytes);
+}
+
+bool nxmic_store_service(nxmic_store_t *store, uint32_t max_pages) {
+  uint32_t ready = store->page_count - (store->filling ? 1 : 0);
+  bool programmed = ready > 0 && max_pages > 0;
+  for (; max_pages > 0 && ready > 0; max_pages--, ready--) {
+    nxmic_store_page_t *page = page_at(store, 0);
+    // a failed program loses the page rather than blocking the log
+    if (program_page(store, page)) {
+      nxmic_store_segment_t *segment = &store->segments[store->head];
+      if (segment->recording == page->recording &&
+          page->offset == segment->offset + segment->length)
+        segment->length += page->length;
+    }
+    store->page_first = (store->page_first + 1) % NXMIC_STORE_PAGE_BUFFERS;
+    store->page_count--;
+  }
+  if (ready > 0) return true;
+  // at most one erase per call: ahead only when no page went out
+  if (store->erased < 0 && !programmed) prepare_next_sector(store);
+  return false;
+}
+
+static bool in_segment(const nxmic_store_segment_t *segment,
+                       uint16_t recording, uint32_t offset) {
+  return segment->sequence != 0 && segment->recording == recording &&
+         offset >= segment->offset &&
+         offset - segment->offset < segment->length;
+}
+
+// Segment holding offset. Reads are mostly sequential, so try the last hit
+// and the one after it before scanning the index.
+static int32_t find_segment(nxmic_store_t *store, uint16_t recording,
+                            uint32_t offset) {
+  for (uint32_t i = 0; i < 2; i++) {
+    uint32_t sector = (store->lookup + i) % store->sector_count;
+    if (in_segment(&store->segments[sector], recording, offset)) {
+      store->lookup = sector;
+      return (int32_t)sector;
+    }
+  }
+  for (uint32_t sector = 0; sector < store->sector_count; sector++) {
+    if (in_segment(&store->segments[sector], recording, offset)) {
+      store->lookup = sector;
+      return (int32_t)sector;
+    }
+  }
+  return -1;
+}
+
+static uint32_t read_flash(nxmic_store_t *store, uint16_t recording,
+                           uint32_t offset, uint8_t *buffer,
+                           uint32_t length) {
+  int32_t sector = find_segment(store, recording, offset);
+  if (sector < 0) return 0;
+  const nxmic_store_segment_t *segment = &store->segments[sector];
+  uint32_t page, in_page;
+  locate(store, offset - segment->offset, &page, &in_page);
+  uint32_t left = segment->offset + segment->length - offset;
+  uint32_t in_this_page = page_data_size(store) - in_page;
+  if (length > left) length = left;
+  if (length > in_this_page) length = in_this_page;
+  uint32_t address = sector_address(store, (uint32_t)sector) +
+                     page * store->flash->page_size + in_page;
+  return flash_read(store, address, buffer, length) ? length : 0;
+}
+
+static uint32_t read_buffered(nxmic_store_t *store, uint16_t recording,
+                              uint32_t offset, uint8_t *buffer,
+                              uint32_t length) {
+  for (uint32_t i = 0; i < store->page_count; i++) {
+    const nxmic_store_page_t *page = page_at(store, i);
+    if (page->recording != recording || offset < page->offset ||
+        offset - page->offset >= page->length)
+      continue;
+    uint32_t skip = offset - page->offset;
+    if (length > page->length - skip) length = page->length - skip;
+    memcpy(buffer, page->bytes + page_data_start(page->page) + skip, length);
+    return length;
+  }
+  return 0;
+}
+
+uint32_t nxmic_store_read(nxmic_store_t *store, uint16_t recording,
+                          uint32_t offset, void *buffer, uint32_t length) {
+  uint8_t *out = buffer;
+  uint32_t copied = 0;
+  while (copied < length) {
+    uint32_t n = read_flash(store, recording, offset + copied, out + copied,
+                            length - copied);
+    if (n == 0)
+      n = read_buffered(store, recording, offset + copied, out + copied,
+                        length - copied);
+    if (n == 0) break;
+    copied += n;
+  }
+  return copied;
+}
+
+uint32_t nxmic_store_size(const nxmic_store_t *store, uint16_t recording) {
+  if (recording == NXMIC_STORE_NO_RECORDING) return 0;
+  if (recording == store->active) return store->active_length;
+  uint32_t size = 0;
+  for (uint32_t sector = 0; sector < store->sector_count; sector++) {
+    const nxmic_store_segment_t *segment = &store->segments[sector];
+    if (segment->sequence != 0 && segment->recording == recording &&
+        segment->offset + segment->length > size)
+      size = segment->offset + segment->length;
+  }
+  for (uint32_t i = 0; i < store->page_count; i++) {
+    const nxmic_store_page_t *page =
+        &store->pages[(store->page_first + i) % NXMIC_STORE_PAGE_BUFFERS];
+    if (page->recording == recording && page->offset + page->length > size)
+      size = page->offset + page->length;
+  }
+  return size;
+}
+
+void nxmic_store_get_info(const nxmic_store_t *store,
+                          nxmic_store_info_t *info) {
+  memset(info, 0, sizeof(*info));
+  info->capacity_bytes = (store->sector_count - 1) * store->segment_capacity;
+  info->erase_min = UINT32_MAX;
+  uint16_t previous = NXMIC_STORE_NO_RECORDING;
+  // oldest to newest: sectors are used round robin after the head
+  for (uint32_t i = 1; i <= store->sector_count; i++) {
+    const nxmic_store_segment_t *segment =
+        &store->segments[(store->head + i) % store->sector_count];
+    if (segment->erase_count < info->erase_min)
+      info->erase_min = segment->erase_count;
+    if (segment->erase_count > info->erase_max)
+      info->erase_max = segment->erase_count;
+    if (segment->sequence == 0 ||
+        segment->recording == NXMIC_STORE_NO_RECORDING)
+      continue;
+    info->used_bytes += segment->length;
+    if (segment->recording == previous) continue;
+    if (info->recordings++ == 0) info->first_recording = segment->recording;
+    info->last_recording = segment->recording;
+    previous = segment->recording;
+  }
+  if (store->active != NXMIC_STORE_NO_RECORDING &&
+      store->active != info->last_recording) {
+    if (info->recordings++ == 0) info->first_recording = store->active;
+    info->last_recording = store->active;
+  }
+}
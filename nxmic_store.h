@@ -0,0 +1,159 @@
+#ifndef NXMIC_STORE_H_
+#define NXMIC_STORE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Append-only recording store in NOR flash, laid out as a log of segments,
+// one per erase sector. Recordings are appended to RAM page buffers; full
+// pages are programmed later by nxmic_store_service(), from a context that
+// may stall for flash, so erase and program never sit on the sampling path.
+//
+// Every segment starts with a header in its first page:
+//
+//   magic u32 "NXLS", version u8, flags u8, recording u16, sequence u32,
+//   offset u32, erase_count u32, page_size u16, reserved u16,
+//   sector_size u32, crc32 u32
+//
+// and every page ends with a footer: data length u16, CRC-16 of that data.
+// The header goes out in the same page program as the first data, a torn
+// one fails its CRC and the sector counts as free. The sequence increases
+// with every segment opened, so mounting only reads the headers and the
+// footers of the last segment of each recording: a segment followed by the
+// next one of the same recording is full. Sectors are used round robin and
+// the oldest segment is given up for a new one, so every sector is erased
+// once per lap of the log; one sector is kept erased ahead. A FORMAT
+// segment drops everything older than itself without erasing it.
+//
+// Not thread safe: append, read and service must not run concurrently.
+
+// Flash the store lives in, addresses relative to its start
+typedef struct {
+  uint32_t size;         // Multiple of sector_size
+  uint32_t sector_size;  // Erase unit, one segment
+  uint16_t page_size;    // Program unit, at most NXMIC_STORE_MAX_PAGE_SIZE
+  void *context;
+  bool (*read)(void *context, uint32_t address, void *buffer,
+               uint32_t length);
+  // Whole pages; can only clear bits
+  bool (*program)(void *context, uint32_t address, const void *data,
+                  uint32_t length);
+  // One sector
+  bool (*erase)(void *context, uint32_t address);
+} nxmic_flash_t;
+
+#define NXMIC_STORE_MAX_PAGE_SIZE 256
+#define NXMIC_STORE_HEADER_SIZE 32
+#define NXMIC_STORE_FOOTER_SIZE 4
+// Pages buffered in RAM between append and flash
+#define NXMIC_STORE_PAGE_BUFFERS 8
+#define NXMIC_STORE_NO_RECORDING 0
+
+// RAM index entry, one per sector
+typedef struct {
+  uint32_t sequence;     // 0 if the sector holds no segment
+  uint32_t offset;       // Of its first data byte in the recording
+  uint32_t length;       // Data bytes in flash
+  uint32_t erase_count;
+  uint16_t recording;    // NXMIC_STORE_NO_RECORDING for a FORMAT segment
+} nxmic_store_segment_t;
+
+// A page on its way to flash, bytes laid out as they will be programmed
+typedef struct {
+  uint16_t recording;
+  uint16_t page;    // Within its segment
+  uint32_t offset;  // Of its first data byte in the recording
+  uint16_t length;  // Data bytes
+  uint8_t bytes[NXMIC_STORE_MAX_PAGE_SIZE];
+} nxmic_store_page_t;
+
+typedef struct {
+  uint32_t pages_programmed;
+  uint32_t sectors_erased;
+  uint32_t segments_recycled;  // Oldest data given up for new data
+  uint32_t bytes_dropped;      // Appends refused with every page buffer full
+  uint32_t flash_errors;
+  uint32_t mount_reads;        // Flash reads of the last mount
+  uint32_t mount_bytes;
+} nxmic_store_stats_t;
+
+typedef struct {
+  const nxmic_flash_t *flash;
+  nxmic_store_segment_t *segments;  // One per sector
+  uint32_t sector_count;
+  uint32_t pages_per_sector;
+  uint32_t segment_capacity;  // Data bytes per segment
+  uint32_t sequence;          // Of the newest segment
+  uint32_t head;              // Sector of the newest segment
+  int32_t erased;             // Sector erased ahead, -1 if none
+  uint32_t lookup;            // Sector the last read hit
+  uint16_t next_recording;
+  uint16_t active;            // Recording appended to, or NO_RECORDING
+  uint32_t active_length;
+  nxmic_store_page_t pages[NXMIC_STORE_PAGE_BUFFERS];  // Oldest first
+  uint32_t page_first;
+  uint32_t page_count;
+  bool filling;               // The newest page takes more data
+  nxmic_store_stats_t stats;
+} nxmic_store_t;
+
+typedef struct {
+  uint16_t recordings;
+  uint16_t first_recording;  // Oldest still (partly) in the store
+  uint16_t last_recording;   // Newest, active or not
+  uint32_t used_bytes;       // Recording data in flash
+  uint32_t capacity_bytes;
+  uint32_t erase_min;
+  uint32_t erase_max;
+} nxmic_store_info_t;
+
+// segments[] needs one entry per sector of the flash. false if the flash
+// geometry is not usable.
+bool nxmic_store_init(nxmic_store_t *store, const nxmic_flash_t *flash,
+                      nxmic_store_segment_t *segments, uint32_t sector_count);
+// Rebuild the index from flash. A blank flash mounts as an empty store;
+// a recording that was active at power loss is closed.
+bool nxmic_store_mount(nxmic_store_t *store);
+// Drop every recording: ends the active one, discards buffered pages and
+// writes a FORMAT segment (one erase and one page program)
+bool nxmic_store_format(nxmic_store_t *store);
+
+// End the active recording, if any, and start a new one. Returns its id.
+uint16_t nxmic_store_begin(nxmic_store_t *store);
+// Buffer data for the active recording, all or nothing. false without an
+// active recording or free page buffers.
+bool nxmic_store_append(nxmic_store_t *store, const void *data,
+                        uint32_t length);
+// Close the active recording, its last page goes out partly filled
+void nxmic_store_end(nxmic_store_t *store);
+
+// Program up to max_pages buffered pages, or erase the next sector ahead
+// when nothing is waiting, so a call stalls for at most one erase. Returns
+// true while there is more to do.
+bool nxmic_store_service(nxmic_store_t *store, uint32_t max_pages);
+
+// Copy up to length bytes of recording from offset, from flash or the page
+// buffers. Returns how many, 0 past the end or below what is left after
+// the oldest segments were given up.
+uint32_t nxmic_store_read(nxmic_store_t *store, uint16_t recording,
+                          uint32_t offset, void *buffer, uint32_t length);
+// End offset of recording, buffered data included
+uint32_t nxmic_store_size(const nxmic_store_t *store, uint16_t recording);
+void nxmic_store_get_info(const nxmic_store_t *store,
+                          nxmic_store_info_t *info);
+
+// GATT interface of the sensor, all fields little-endian:
+//
+// CHAR_ACTIVE_RECORDING reads as state u8 (1 while recording), recording
+// u16, length u32; writing 1 starts a new recording, 0 stops it.
+//
+// CHAR_FILESYSTEM_MANAGEMENT reads as nxmic_store_info_t: recordings u16,
+// first u16, last u16, used u32, capacity u32, erase_min u32, erase_max
+// u32. Writing FORMAT drops every recording; SELECT, recording u16, picks
+// what CHAR_DATA_EXPORT offloads (by default the newest recording).
+#define NXMIC_RECORDING_STATUS_SIZE 7
+#define NXMIC_STORE_INFO_SIZE 22
+#define NXMIC_STORE_OP_FORMAT 0x01
+#define NXMIC_STORE_OP_SELECT 0x02
+
+#endif
@@ -0,0 +1,97 @@
+#include "nxmic_stream.h"
+
+#include <stddef.h>
+#include <string.h>
+
+static nxmic_stream_handler_t stream_handler[CHAR_COUNT];
+
+void nxmic_stream_init(nxmic_stream_table_t *table, void *context) {
+  memset(table, 0, sizeof(*table));
+  table->context = context;
+}
+
+gatt_characteristic_id_t nxmic_stream_lookup_uuid128(const uint8_t *uuid128) {
+  for (int i = 0; i < nxmic_gatt_service.num_characteristics; i++) {
+    const uint8_t *le = nxmic_gatt_service.characteristics[i].uuid128;
+    int j = 0;
+    while (j < 16 && le[15 - j] == uuid128[j]) j++;
+    if (j == 16) return nxmic_gatt_service.characteristics[i].char_id;
+  }
+  return CHAR_COUNT;
+}
+
+bool nxmic_stream_is_streaming(gatt_characteristic_id_t char_id) {
+  switch (char_id) {
+    case CHAR_IMU_STREAMING:
+    case CHAR_TEMPERATURE_STREAMING:
+    case CHAR_STETHOSCOPE_STREAMING:
+    case CHAR_STETHOSCOPE_PREVIEW_STREAMING:
+    case CHAR_ECG_STREAMING:
+      return true;
+    default:
+      return false;
+  }
+}
+
+uint32_t nxmic_stream_total_bytes(const nxmic_stream_table_t *table) {
+  uint32_t bytes = 0;
+  for (int i = 0; i < CHAR_COUNT; i++) {
+    if (nxmic_stream_is_streaming((gatt_characteristic_id_t)i))
+      bytes += table->stats[i].bytes;
+  }
+  return bytes;
+}
+
+bool nxmic_stream_fits_low_power(uint32_t bytes, uint32_t period_ms,
+                                 bool low_power) {
+  uint64_t limit = (uint64_t)NXMIC_STREAM_LOW_POWER_BYTES_PER_S * period_ms;
+  if (!low_power) limit /= 2;
+  return (uint64_t)bytes * 1000 <= limit;
+}
+
+void nxmic_stream_set_handler(gatt_characteristic_id_t char_id,
+                              nxmic_stream_handler_t handler) {
+  if (char_id >= CHAR_COUNT) return;
+  stream_handler[char_id] = handler;
+}
+
+bool nxmic_stream_bind(nxmic_stream_table_t *table,
+                       gatt_characteristic_id_t char_id,
+                       uint16_t value_handle) {
+  if (char_id >= CHAR_COUNT) return false;
+  if (value_handle == 0 || value_handle >= NXMIC_STREAM_MAX_VALUE_HANDLE)
+    return false;
+  table->handle_to_stream[value_handle] = (uint8_t)(char_id + 1);
+  table->value_handle[char_id] = value_handle;
+  return true;
+}
+
+uint16_t nxmic_stream_value_handle(const nxmic_stream_table_t *table,
+                                   gatt_characteristic_id_t char_id) {
+  if (char_id >= CHAR_COUNT) return 0;
+  return table->value_handle[char_id];
+}
+
+bool nxmic_stream_dispatch(nxmic_stream_table_t *table, uint16_t value_handle,
+                           const uint8_t *value, uint16_t value_length) {
+  uint8_t slot = value_handle < NXMIC_STREAM_MAX_VALUE_HANDLE
+                     ? table->handle_to_stream[value_handle]
+                     : 0;
+  if (slot == 0) {
+    table->unrouted++;
+    return false;
+  }
+  uint8_t char_id = slot - 1;
+  table->stats[char_id].notifications++;
+  table->stats[char_id].bytes += value_length;
+  if (stream_handler[char_id])
+    stream_handler[char_id](table->context, (gatt_characteristic_id_t)char_id,
+                            value, value_length);
+  return true;
+}
+
+const nxmic_stream_stats_t *nxmic_stream_get_stats(
+    const nxmic_stream_table_t *table, gatt_characteristic_id_t char_id) {
+  if (char_id >= CHAR_COUNT) return NULL;
+  return &table->stats[char_id];
+}
@@ -0,0 +1,82 @@
+#ifndef NXMIC_STREAM_H_
+#define NXMIC_STREAM_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "nxmic_gatt.h"
+
+// Value handles above this are not routed. BTstack's compiled ATT DB is
+// bounded by MAX_ATT_DB_SIZE, so real handles stay well below it.
+#define NXMIC_STREAM_MAX_VALUE_HANDLE 256
+
+// Called for every notification routed to a stream. context is the one the
+// routing table was initialised with (e.g. the connection it belongs to).
+typedef void (*nxmic_stream_handler_t)(void *context,
+                                       gatt_characteristic_id_t char_id,
+                                       const uint8_t *value,
+                                       uint16_t value_length);
+
+typedef struct {
+  uint32_t notifications;  // Notifications routed to the stream
+  uint32_t bytes;          // Payload bytes routed to the stream
+} nxmic_stream_stats_t;
+
+// Per-connection routing table, value handles differ between peers
+typedef struct {
+  // value handle -> characteristic id + 1, 0 if unbound
+  uint8_t handle_to_stream[NXMIC_STREAM_MAX_VALUE_HANDLE];
+  uint16_t value_handle[CHAR_COUNT];
+  nxmic_stream_stats_t stats[CHAR_COUNT];
+  uint32_t unrouted;
+  void *context;
+} nxmic_stream_table_t;
+
+// Forget all handle bindings and counters (e.g. on disconnect)
+void nxmic_stream_init(nxmic_stream_table_t *table, void *context);
+
+// Map a 128-bit UUID in BTstack (big-endian) order to a characteristic id.
+// Returns CHAR_COUNT if the UUID is not part of the NxMic service.
+gatt_characteristic_id_t nxmic_stream_lookup_uuid128(const uint8_t *uuid128);
+
+// True if the characteristic is one of the CHAR_*_STREAMING entries
+bool nxmic_stream_is_streaming(gatt_characteristic_id_t char_id);
+
+// Stream payload a link carries on the reader's low-power link profile
+// (link_profile.h), in bytes a second: about a 244-byte frame per 200 ms
+// connection event, the longest interval of the profile. The temperature,
+// a sample every 512 ms, and the decimated preview, a few hundred bytes a
+// second, fit; the stethoscope does not.
+#define NXMIC_STREAM_LOW_POWER_BYTES_PER_S 1000
+
+// Payload routed to every stream of the table so far
+uint32_t nxmic_stream_total_bytes(const nxmic_stream_table_t *table);
+
+// True if bytes of stream payload received over period_ms fit the low-power
+// profile. What counts is what the sensor sends, not what its table lists:
+// a stream it has no source for stays silent. A link already on low power
+// stays up to the limit, one on high throughput moves down below half of
+// it, so a rate near the limit does not switch the link every period.
+bool nxmic_stream_fits_low_power(uint32_t bytes, uint32_t period_ms,
+                                 bool low_power);
+
+// Decoder for a stream, shared by all tables
+void nxmic_stream_set_handler(gatt_characteristic_id_t char_id,
+                              nxmic_stream_handler_t handler);
+
+// Route notifications for value_handle to char_id
+bool nxmic_stream_bind(nxmic_stream_table_t *table,
+                       gatt_characteristic_id_t char_id,
+                       uint16_t value_handle);
+uint16_t nxmic_stream_value_handle(const nxmic_stream_table_t *table,
+                                   gatt_characteristic_id_t char_id);
+
+// O(1) lookup of the value handle and call of the stream's handler.
+// Returns false if the handle is not bound to any stream.
+bool nxmic_stream_dispatch(nxmic_stream_table_t *table, uint16_t value_handle,
+                           const uint8_t *value, uint16_t value_length);
+
+const nxmic_stream_stats_t *nxmic_stream_get_stats(
+    const nxmic_stream_table_t *table, gatt_characteristic_id_t char_id);
+
+#endif
@@ -0,0 +1,134 @@
+#include "nxmic_timesync.h"
+
+#include <string.h>
+
+#define PPB 1000000000ll
+
+static uint32_t read_32(const uint8_t *buffer, int offset) {
+  return (uint32_t)buffer[offset] | ((uint32_t)buffer[offset + 1] << 8) |
+         ((uint32_t)buffer[offset + 2] << 16) |
+         ((uint32_t)buffer[offset + 3] << 24);
+}
+
+static void write_32(uint8_t *buffer, int offset, uint32_t value) {
+  buffer[offset] = (uint8_t)value;
+  buffer[offset + 1] = (uint8_t)(value >> 8);
+  buffer[offset + 2] = (uint8_t)(value >> 16);
+  buffer[offset + 3] = (uint8_t)(value >> 24);
+}
+
+void nxmic_timesync_init(nxmic_timesync_t *ts) {
+  memset(ts, 0, sizeof(*ts));
+}
+
+// Least squares over the usable rounds, relative to the newest one: x is
+// client time since it, y how much device - client moved since it
+static void fit(nxmic_timesync_t *ts) {
+  const nxmic_timesync_round_t *newest =
+      &ts->rounds[(ts->next + NXMIC_TIMESYNC_ROUNDS - 1) %
+                  NXMIC_TIMESYNC_ROUNDS];
+  uint32_t best_rtt = UINT32_MAX;
+  for (int i = 0; i < ts->count; i++) {
+    if (ts->rounds[i].rtt_us < best_rtt) best_rtt = ts->rounds[i].rtt_us;
+  }
+  uint32_t max_rtt = best_rtt < UINT32_MAX / 2 ? 2 * best_rtt : UINT32_MAX;
+  uint32_t base = newest->device_us - newest->client_us;
+
+  int64_t x[NXMIC_TIMESYNC_ROUNDS], y[NXMIC_TIMESYNC_ROUNDS];
+  uint32_t rtt[NXMIC_TIMESYNC_ROUNDS];
+  int n = 0;
+  int64_t sum_x = 0, sum_y = 0, min_x = 0, max_x = 0;
+  for (int i = 0; i < ts->count; i++) {
+    const nxmic_timesync_round_t *round = &ts->rounds[i];
+    if (round->rtt_us > max_rtt) continue;
+    x[n] = (int32_t)(round->client_us - newest->client_us);
+    y[n] = (int32_t)(round->device_us - round->client_us - base);
+    rtt[n] = round->rtt_us;
+    sum_x += x[n];
+    sum_y += y[n];
+    if (x[n] < min_x) min_x = x[n];
+    if (x[n] > max_x) max_x = x[n];
+    n++;
+  }
+  int64_t mean_x = sum_x / n, mean_y = sum_y / n;
+
+  if (max_x - min_x >= NXMIC_TIMESYNC_MIN_BASELINE_US) {
+    int64_t sxx = 0, sxy = 0;
+    for (int i = 0; i < n; i++) {
+      sxx += (x[i] - mean_x) * (x[i] - mean_x);
+      sxy += (x[i] - mean_x) * (y[i] - mean_y);
+    }
+    // slope in ppb, scaled so neither side overflows over ~35 minutes
+    int64_t drift = sxy * 1000 / (sxx / 1000000);
+    if (drift > NXMIC_TIMESYNC_MAX_DRIFT_PPB) {
+      drift = NXMIC_TIMESYNC_MAX_DRIFT_PPB;
+    } else if (drift < -NXMIC_TIMESYNC_MAX_DRIFT_PPB) {
+      drift = -NXMIC_TIMESYNC_MAX_DRIFT_PPB;
+    }
+    ts->drift_ppb = (int32_t)drift;
+  }
+  int64_t intercept = mean_y - ts->drift_ppb * mean_x / PPB;
+
+  uint32_t error = 0;
+  for (int i = 0; i < n; i++) {
+    int64_t residual = y[i] - intercept - ts->drift_ppb * x[i] / PPB;
+    if (residual < 0) residual = -residual;
+    if (residual + rtt[i] / 2 > error) error = (uint32_t)(residual + rtt[i] / 2);
+  }
+
+  ts->reference_us = newest->client_us;
+  ts->offset_us = base + (uint32_t)(int32_t)intercept;
+  ts->error_us = error;
+  ts->used = (uint8_t)n;
+  ts->valid = true;
+}
+
+void nxmic_timesync_add_round(nxmic_timesync_t *ts, uint32_t sent_us,
+                              uint32_t acked_us, uint32_t device_us) {
+  nxmic_timesync_round_t *round = &ts->rounds[ts->next];
+  round->rtt_us = acked_us - sent_us;
+  round->client_us = sent_us + round->rtt_us / 2;
+  round->device_us = device_us;
+  ts->next = (uint8_t)((ts->next + 1) % NXMIC_TIMESYNC_ROUNDS);
+  if (ts->count < NXMIC_TIMESYNC_ROUNDS) ts->count++;
+  ts->total_rounds++;
+  fit(ts);
+}
+
+uint32_t nxmic_timesync_to_client(const nxmic_timesync_t *ts,
+                                  uint32_t device_us) {
+  if (!ts->valid) return device_us;
+  // device - reference - offset = (client - reference) * (1 + drift)
+  int64_t since = (int32_t)(device_us - ts->reference_us - ts->offset_us);
+  return ts->reference_us +
+         (uint32_t)(int32_t)(since * PPB / (PPB + ts->drift_ppb));
+}
+
+uint32_t nxmic_timesync_sample_time(const nxmic_timesync_t *ts,
+                                    uint32_t base_device_us, uint32_t index,
+                                    uint32_t period_ns) {
+  uint32_t offset_us = (uint32_t)((uint64_t)index * period_ns / 1000);
+  return nxmic_timesync_to_client(ts, base_device_us + offset_us);
+}
+
+void nxmic_timesync_encode_request(
+    uint32_t client_us, uint8_t request[NXMIC_TIMESYNC_REQUEST_SIZE]) {
+  write_32(request, 0, client_us);
+}
+
+bool nxmic_timesync_encode_value(const uint8_t *request, uint16_t length,
+                                 uint32_t device_us,
+                                 uint8_t value[NXMIC_TIMESYNC_VALUE_SIZE]) {
+  if (length != NXMIC_TIMESYNC_REQUEST_SIZE) return false;
+  write_32(value, 0, read_32(request, 0));
+  write_32(value, 4, device_us);
+  return true;
+}
+
+bool nxmic_timesync_parse_value(const uint8_t *value, uint16_t length,
+                                uint32_t *client_us, uint32_t *device_us) {
+  if (length != NXMIC_TIMESYNC_VALUE_SIZE) return false;
+  *client_us = read_32(value, 0);
+  *device_us = read_32(value, 4);
+  return true;
+}
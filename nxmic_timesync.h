@@ -0,0 +1,83 @@
+#ifndef NXMIC_TIMESYNC_H_
+#define NXMIC_TIMESYNC_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Clock sync over CHAR_TIMESTAMP, so the reader can put its own time on
+// every sample without the sensor stamping more than each frame base.
+//
+// One round: the reader notes its time t1 and writes it (Write Request)
+// as client_us u32; the sensor keeps it with its own time_us_32() of when
+// the write arrived. The reader notes t4 at the Write Response, then reads
+// the characteristic back:
+//
+//   client_us u32, device_us u32, little-endian
+//
+// The device time is taken somewhere in [t1, t4], so it is paired with the
+// midpoint and is off by at most half the round trip. The reader keeps the
+// last NXMIC_TIMESYNC_ROUNDS rounds and fits device - client against
+// client time with least squares: the intercept is the offset, the slope
+// the drift of the sensor's crystal. Rounds that took more than twice the
+// fastest one are left out of the fit.
+//
+// Everything is in wrapping 32-bit microseconds and fixed point, the fit
+// holds while the rounds span less than about 35 minutes.
+
+#define NXMIC_TIMESYNC_REQUEST_SIZE 4
+#define NXMIC_TIMESYNC_VALUE_SIZE 8
+#define NXMIC_TIMESYNC_ROUNDS 8
+// Below this span the rounds say little about the drift: only the offset
+// is fitted and the previous drift kept
+#define NXMIC_TIMESYNC_MIN_BASELINE_US 1000000
+// Anything beyond is a bad round, not a crystal
+#define NXMIC_TIMESYNC_MAX_DRIFT_PPB 500000
+
+typedef struct {
+  uint32_t client_us;  // Midpoint of the write round trip
+  uint32_t device_us;  // When the sensor got the write
+  uint32_t rtt_us;
+} nxmic_timesync_round_t;
+
+// device = client + offset_us + drift_ppb * (client - reference_us) / 10^9
+typedef struct {
+  nxmic_timesync_round_t rounds[NXMIC_TIMESYNC_ROUNDS];
+  uint8_t count;
+  uint8_t next;
+  bool valid;             // At least one round fitted
+  uint32_t reference_us;  // Client time of the newest round
+  uint32_t offset_us;     // device - client at reference_us, mod 2^32
+  int32_t drift_ppb;      // Sensor clock rate over the reader's, minus one
+  // Largest error of the fitted clock at the rounds it was fitted to: the
+  // residual plus half the round trip, the most the midpoint can be off
+  uint32_t error_us;
+  uint8_t used;           // Rounds in the last fit
+  uint32_t total_rounds;
+} nxmic_timesync_t;
+
+void nxmic_timesync_init(nxmic_timesync_t *ts);
+// A completed round: sent_us when the write went out, acked_us when its
+// response came back, device_us what the sensor read back for it. Refits.
+void nxmic_timesync_add_round(nxmic_timesync_t *ts, uint32_t sent_us,
+                              uint32_t acked_us, uint32_t device_us);
+
+// Reader time of a sensor timestamp; device_us unchanged until valid
+uint32_t nxmic_timesync_to_client(const nxmic_timesync_t *ts,
+                                  uint32_t device_us);
+// Reader time of sample index of a frame stamped base_device_us, for a
+// stream sampled every period_ns of sensor time
+uint32_t nxmic_timesync_sample_time(const nxmic_timesync_t *ts,
+                                    uint32_t base_device_us, uint32_t index,
+                                    uint32_t period_ns);
+
+void nxmic_timesync_encode_request(uint32_t client_us,
+                                   uint8_t request[NXMIC_TIMESYNC_REQUEST_SIZE]);
+// Sensor side: the value a read returns after a request arrived at
+// device_us. false if the request is malformed.
+bool nxmic_timesync_encode_value(const uint8_t *request, uint16_t length,
+                                 uint32_t device_us,
+                                 uint8_t value[NXMIC_TIMESYNC_VALUE_SIZE]);
+bool nxmic_timesync_parse_value(const uint8_t *value, uint16_t length,
+                                uint32_t *client_us, uint32_t *device_us);
+
+#endif
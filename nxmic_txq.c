@@ -0,0 +1,95 @@
+#include "nxmic_txq.h"
+
+#include <string.h>
+
+// a queued before b
+static bool older(uint32_t a_us, uint32_t b_us) {
+  return (int32_t)(a_us - b_us) < 0;
+}
+
+static void release(nxmic_txq_t *queue, nxmic_txq_entry_t *entry) {
+  entry->length = 0;
+  queue->count--;
+}
+
+void nxmic_txq_init(nxmic_txq_t *queue) { memset(queue, 0, sizeof(*queue)); }
+
+void nxmic_txq_clear(nxmic_txq_t *queue) {
+  for (int i = 0; i < NXMIC_TXQ_SLOTS; i++) queue->entries[i].length = 0;
+  queue->count = 0;
+}
+
+void nxmic_txq_remove(nxmic_txq_t *queue, uint16_t handle) {
+  for (int i = 0; i < NXMIC_TXQ_SLOTS; i++) {
+    nxmic_txq_entry_t *entry = &queue->entries[i];
+    if (entry->length && entry->handle == handle) release(queue, entry);
+  }
+}
+
+bool nxmic_txq_push(nxmic_txq_t *queue, uint16_t handle,
+                    nxmic_txq_priority_t priority, bool replace,
+                    uint32_t max_age_us, const uint8_t *value,
+                    uint16_t length, uint32_t now_us) {
+  if (length == 0 || length > NXMIC_FRAME_MAX_SIZE) return false;
+  nxmic_txq_entry_t *slot = NULL;
+  nxmic_txq_entry_t *victim = NULL;
+  for (int i = 0; i < NXMIC_TXQ_SLOTS; i++) {
+    nxmic_txq_entry_t *entry = &queue->entries[i];
+    if (entry->length == 0) {
+      if (!slot) slot = entry;
+      continue;
+    }
+    if (replace && entry->handle == handle) {
+      queue->replaced++;
+      release(queue, entry);
+      slot = entry;
+      break;
+    }
+    if (!victim || entry->priority < victim->priority ||
+        (entry->priority == victim->priority &&
+         older(entry->queued_us, victim->queued_us)))
+      victim = entry;
+  }
+  if (!slot) {
+    if (victim->priority > priority) {
+      queue->rejected++;
+      return false;
+    }
+    queue->evicted++;
+    release(queue, victim);
+    slot = victim;
+  }
+  slot->handle = handle;
+  slot->length = length;
+  slot->priority = (uint8_t)priority;
+  slot->queued_us = now_us;
+  slot->max_age_us = max_age_us;
+  memcpy(slot->value, value, length);
+  queue->count++;
+  queue->queued++;
+  if (queue->count > queue->high_water) queue->high_water = queue->count;
+  return true;
+}
+
+const nxmic_txq_entry_t *nxmic_txq_peek(nxmic_txq_t *queue, uint32_t now_us) {
+  nxmic_txq_entry_t *next = NULL;
+  for (int i = 0; i < NXMIC_TXQ_SLOTS && queue->count; i++) {
+    nxmic_txq_entry_t *entry = &queue->entries[i];
+    if (entry->length == 0) continue;
+    if (entry->max_age_us && now_us - entry->queued_us > entry->max_age_us) {
+      queue->aged++;
+      release(queue, entry);
+      continue;
+    }
+    if (!next || entry->priority > next->priority ||
+        (entry->priority == next->priority &&
+         older(entry->queued_us, next->queued_us)))
+      next = entry;
+  }
+  return next;
+}
+
+void nxmic_txq_pop(nxmic_txq_t *queue, const nxmic_txq_entry_t *entry) {
+  release(queue, &queue->entries[entry - queue->entries]);
+  queue->sent++;
+}
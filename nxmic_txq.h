@@ -0,0 +1,75 @@
+#ifndef NXMIC_TXQ_H_
+#define NXMIC_TXQ_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "nxmic_frame.h"
+
+// Outgoing notifications of one connection. Values are copied in when they
+// are produced and leave, highest priority first and oldest first within a
+// priority, as long as the controller has an ACL buffer free: the sender
+// drains what it can on each ATT_EVENT_CAN_SEND_NOW instead of sending one
+// and asking for the next event.
+//
+// Stale samples go first: an entry older than the max age it was queued
+// with is dropped instead of sent, and a full queue makes room by dropping
+// the oldest entry of the lowest priority, if that is not above the new
+// one. A value queued with replace takes the place of a queued one for the
+// same handle, for readings where only the latest counts.
+//
+// Times are wrapping 32-bit microseconds.
+
+#define NXMIC_TXQ_SLOTS 8
+
+typedef enum {
+  NXMIC_TXQ_PRIORITY_LOW,
+  NXMIC_TXQ_PRIORITY_NORMAL,
+  NXMIC_TXQ_PRIORITY_HIGH,
+} nxmic_txq_priority_t;
+
+typedef struct {
+  uint16_t handle;   // Characteristic value handle
+  uint16_t length;   // 0 if the slot is free
+  uint8_t priority;  // nxmic_txq_priority_t
+  uint32_t queued_us;
+  uint32_t max_age_us;  // 0 if it never goes stale
+  uint8_t value[NXMIC_FRAME_MAX_SIZE];
+} nxmic_txq_entry_t;
+
+typedef struct {
+  nxmic_txq_entry_t entries[NXMIC_TXQ_SLOTS];  // Unordered
+  uint8_t count;
+  uint8_t high_water;
+  uint32_t queued;
+  uint32_t sent;
+  uint32_t replaced;  // By a newer value for the same handle
+  uint32_t evicted;   // To make room for a value of the same or higher
+                      // priority
+  uint32_t rejected;  // Full of higher priority values
+  uint32_t aged;      // Past their max age
+} nxmic_txq_t;
+
+void nxmic_txq_init(nxmic_txq_t *queue);
+
+// Drop everything queued, e.g. on disconnect; the counters stay
+void nxmic_txq_clear(nxmic_txq_t *queue);
+
+// Drop what is queued for handle, e.g. when its notifications are turned
+// off
+void nxmic_txq_remove(nxmic_txq_t *queue, uint16_t handle);
+
+// Copy a value in. false if it was rejected or is longer than a slot.
+bool nxmic_txq_push(nxmic_txq_t *queue, uint16_t handle,
+                    nxmic_txq_priority_t priority, bool replace,
+                    uint32_t max_age_us, const uint8_t *value,
+                    uint16_t length, uint32_t now_us);
+
+// Next value to send, dropping the ones that went stale; NULL if none.
+// Stays queued until nxmic_txq_pop().
+const nxmic_txq_entry_t *nxmic_txq_peek(nxmic_txq_t *queue, uint32_t now_us);
+
+// Release the entry returned by nxmic_txq_peek() once it was sent
+void nxmic_txq_pop(nxmic_txq_t *queue, const nxmic_txq_entry_t *entry);
+
+#endif
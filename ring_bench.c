@@ -0,0 +1,217 @@
+// Host check and benchmark of the notification ring (spsc_ring.h): empty
+// and full rings, payload limits, slots reused across many wraparounds and
+// across the wrap of the 32-bit head and tail, then one producer and one
+// consumer thread passing numbered messages of varying length, checked for
+// order and content, with the rate they get through.
+//
+//   nxmic_ring_bench [-n messages] [-s slots] [-m max_payload]
+//
+// The consumer takes every published slot in one batch and releases them
+// together, as the reader's main loop does, then one slot at a time to
+// compare against. Rates are this host's; the producer yields while the
+// ring is full and the consumer while it is empty, so on a single core
+// they show the cost of a batch per time slice. Exits non-zero if a check
+// fails.
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench_util.h"
+#include "spsc_ring.h"
+
+#define BENCH_MAX_SLOTS 1024
+#define BENCH_MAX_PAYLOAD 256
+#define BENCH_HEADER_SIZE 4  // Message number, little-endian
+
+typedef struct {
+  spsc_ring_t ring;
+  uint32_t messages;
+  uint32_t batch;  // Most slots released at once, 0 for all available
+  uint32_t errors;
+  uint64_t batches;
+} bench_run_t;
+
+static uint8_t storage[SPSC_RING_STORAGE_SIZE(BENCH_MAX_SLOTS,
+                                              BENCH_MAX_PAYLOAD)];
+static uint16_t max_payload = 64;
+
+// Message n: its number, then bytes derived from it, up to a length that
+// varies with n
+static uint16_t message_length(uint32_t n) {
+  return (uint16_t)(BENCH_HEADER_SIZE +
+                    n % (max_payload - BENCH_HEADER_SIZE + 1));
+}
+
+static void fill_message(uint32_t n, uint8_t *payload, uint16_t length) {
+  payload[0] = (uint8_t)n;
+  payload[1] = (uint8_t)(n >> 8);
+  payload[2] = (uint8_t)(n >> 16);
+  payload[3] = (uint8_t)(n >> 24);
+  for (uint16_t i = BENCH_HEADER_SIZE; i < length; i++)
+    payload[i] = (uint8_t)(n * 31 + i);
+}
+
+static int is_message(uint32_t n, const uint8_t *payload, uint16_t length) {
+  if (length != message_length(n)) return 0;
+  uint32_t number = payload[0] | payload[1] << 8 | payload[2] << 16 |
+                    (uint32_t)payload[3] << 24;
+  if (number != n) return 0;
+  for (uint16_t i = BENCH_HEADER_SIZE; i < length; i++) {
+    if (payload[i] != (uint8_t)(n * 31 + i)) return 0;
+  }
+  return 1;
+}
+
+static void check_single_thread(uint32_t slots) {
+  spsc_ring_t ring;
+  uint8_t payload[BENCH_MAX_PAYLOAD + 1];
+  uint16_t length;
+  bench_check(!spsc_ring_init(&ring, storage, 3, max_payload),
+              "slot count not a power of two accepted");
+  bench_check(spsc_ring_init(&ring, storage, slots, max_payload), "init");
+
+  // empty, then full
+  bench_check(spsc_ring_available(&ring) == 0, "new ring not empty");
+  memset(payload, 0, sizeof(payload));
+  bench_check(!spsc_ring_push(&ring, payload, (uint16_t)(max_payload + 1)),
+              "payload over the maximum accepted");
+  bench_check(atomic_load(&ring.overflows) == 0,
+              "oversized payload counted as an overflow");
+  for (uint32_t n = 0; n < slots; n++) {
+    fill_message(n, payload, message_length(n));
+    bench_check(spsc_ring_push(&ring, payload, message_length(n)),
+                "push refused before the ring was full");
+  }
+  bench_check(spsc_ring_available(&ring) == slots, "full ring count");
+  bench_check(spsc_ring_claim(&ring) == NULL, "claim on a full ring");
+  bench_check(atomic_load(&ring.overflows) == 1, "overflow not counted");
+  bench_check(ring.high_water == slots, "high water of a full ring");
+  for (uint32_t n = 0; n < slots; n++) {
+    const uint8_t *slot = spsc_ring_peek(&ring, n, &length);
+    bench_check(is_message(n, slot, length), "full ring read back");
+  }
+  spsc_ring_release(&ring, slots);
+  bench_check(spsc_ring_available(&ring) == 0, "released ring not empty");
+
+  // a third of the ring in flight, around it many times; then the same
+  // across the wrap of the 32-bit positions
+  for (int pass = 0; pass < 2; pass++) {
+    if (pass == 1) {
+      atomic_store(&ring.head, UINT32_MAX - 5 * slots);
+      atomic_store(&ring.tail, UINT32_MAX - 5 * slots);
+    }
+    uint32_t in_flight = slots / 3 + 1, next = 0, expected = 0;
+    for (uint32_t step = 0; step < 10 * slots; step++) {
+      while (spsc_ring_available(&ring) < in_flight) {
+        fill_message(next, payload, message_length(next));
+        bench_check(spsc_ring_push(&ring, payload, message_length(next)),
+                    "push refused with room left");
+        next++;
+      }
+      const uint8_t *slot = spsc_ring_peek(&ring, 0, &length);
+      bench_check(is_message(expected, slot, length),
+                  pass ? "order across the 32-bit wrap" : "order across wraps");
+      spsc_ring_release(&ring, 1);
+      expected++;
+    }
+  }
+  bench_check(atomic_load(&ring.overflows) == 1,
+              "overflow counted with room left");
+}
+
+static void *produce(void *context) {
+  bench_run_t *run = context;
+  for (uint32_t n = 0; n < run->messages; n++) {
+    uint16_t length = message_length(n);
+    uint8_t *payload;
+    while (!(payload = spsc_ring_claim(&run->ring))) sched_yield();
+    fill_message(n, payload, length);
+    spsc_ring_publish(&run->ring, length);
+  }
+  return NULL;
+}
+
+static void consume(bench_run_t *run) {
+  uint32_t expected = 0;
+  while (expected < run->messages) {
+    uint32_t count = spsc_ring_available(&run->ring);
+    if (count == 0) {
+      sched_yield();
+      continue;
+    }
+    if (run->batch && count > run->batch) count = run->batch;
+    for (uint32_t i = 0; i < count; i++) {
+      uint16_t length;
+      const uint8_t *slot = spsc_ring_peek(&run->ring, i, &length);
+      if (!is_message(expected + i, slot, length)) run->errors++;
+    }
+    spsc_ring_release(&run->ring, count);
+    expected += count;
+    run->batches++;
+  }
+}
+
+static void run_threads(const char *name, uint32_t slots, uint32_t messages,
+                        uint32_t batch) {
+  static bench_run_t run;
+  memset(&run, 0, sizeof(run));
+  spsc_ring_init(&run.ring, storage, slots, max_payload);
+  run.messages = messages;
+  run.batch = batch;
+  pthread_t producer;
+  uint64_t start = bench_now_ns();
+  if (pthread_create(&producer, NULL, produce, &run) != 0) {
+    bench_check(0, "producer thread");
+    return;
+  }
+  consume(&run);
+  pthread_join(producer, NULL);
+  uint64_t elapsed = bench_now_ns() - start;
+  printf("%-8s %10.0f msgs/s  %6.1f ns/msg  %6.1f msgs/batch  "
+         "full %lu  errors %lu\n",
+         name, messages * 1e9 / elapsed, (double)elapsed / messages,
+         (double)messages / run.batches,
+         (unsigned long)atomic_load(&run.ring.overflows),
+         (unsigned long)run.errors);
+  bench_check(run.errors == 0, "message lost, reordered or corrupted");
+}
+
+int main(int argc, char **argv) {
+  uint32_t messages = 2000000;
+  uint32_t slots = 64;  // The reader's NOTIFICATION_RING_SLOTS
+  int opt;
+  while ((opt = getopt(argc, argv, "n:s:m:")) != -1) {
+    switch (opt) {
+      case 'n':
+        messages = (uint32_t)atoi(optarg);
+        break;
+      case 's':
+        slots = (uint32_t)atoi(optarg);
+        break;
+      case 'm':
+        max_payload = (uint16_t)atoi(optarg);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-n messages] [-s slots] [-m max_payload]\n",
+                argv[0]);
+        return 2;
+    }
+  }
+  if (messages == 0 || slots < 2 || slots > BENCH_MAX_SLOTS ||
+      (slots & (slots - 1)) != 0 || max_payload < BENCH_HEADER_SIZE ||
+      max_payload > BENCH_MAX_PAYLOAD) {
+    fprintf(stderr, "invalid message count, slot count or payload size\n");
+    return 2;
+  }
+
+  check_single_thread(slots);
+  printf("%u messages of %d-%u bytes through %u slots\n", messages,
+         BENCH_HEADER_SIZE, max_payload, slots);
+  run_threads("batched", slots, messages, 0);
+  run_threads("single", slots, messages, 1);
+  return bench_failures != 0;
+}
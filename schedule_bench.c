@@ -0,0 +1,208 @@
+// Host benchmark of the rate scheduler (nxmic_schedule.h) in virtual time:
+// wakeups per second against the fixed tick it replaces, jitter of every
+// run, streams coalesced into one burst, and the runs of each stream
+// against its rate, across a rate change written to
+// CHAR_RECORDING_INTERVAL_SETTINGS halfway and a wrap of the 32-bit clock.
+//
+//   nxmic_schedule_bench [-t seconds] [-c coalesce_us] [-l latency_us]
+//
+// Every wakeup comes up to latency_us after the deadline it was armed for,
+// as a timer interrupt would. Exits non-zero if a stream drifts, misses a
+// deadline or runs further from it than latency and coalescing allow.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nxmic_gatt.h"
+#include "nxmic_schedule.h"
+
+// Periodic task of the firmware next to the streams, the LED
+#define BENCH_TASK_LED CHAR_COUNT
+
+typedef struct {
+  uint8_t id;
+  const char *name;
+  uint32_t interval_ms;  // From the start
+  uint32_t changed_ms;   // Written halfway, 0 stops it
+} bench_stream_t;
+
+static const bench_stream_t bench_streams[] = {
+    {CHAR_TEMPERATURE_STREAMING, "temp", 1000, 1000},
+    {CHAR_IMU_STREAMING, "imu", 20, 50},
+    {CHAR_ECG_STREAMING, "ecg", 40, 0},
+    {CHAR_BATTERY_LEVEL, "battery", 60000, 30000},
+    {BENCH_TASK_LED, "led", 1000, 1000},
+};
+#define BENCH_STREAM_COUNT \
+  (int)(sizeof(bench_streams) / sizeof(bench_streams[0]))
+
+static nxmic_schedule_t schedule;
+static uint32_t random_state = 12345;
+
+static uint32_t next_random(void) {
+  random_state = random_state * 1103515245u + 12345u;
+  return random_state >> 8;
+}
+
+static uint32_t gcd(uint32_t a, uint32_t b) {
+  while (b) {
+    uint32_t t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+static const nxmic_schedule_entry_t *entry_of(uint8_t id) {
+  for (uint8_t i = 0; i < schedule.count; i++) {
+    if (schedule.entries[i].id == id) return &schedule.entries[i];
+  }
+  return NULL;
+}
+
+// Runs of an interval over elapsed_us; coalescing may take one early
+static bool runs_match(uint32_t runs, uint32_t interval_ms,
+                       uint64_t elapsed_us) {
+  if (interval_ms == 0) return runs == 0;
+  uint64_t expected = elapsed_us / ((uint64_t)interval_ms * 1000);
+  return runs + 1 >= expected && runs <= expected + 1;
+}
+
+// Run the schedule from start_us for duration_us of virtual time
+static uint32_t run_for(uint32_t start_us, uint64_t duration_us,
+                        uint32_t latency_us, uint32_t *bursts) {
+  uint32_t now_us = start_us;
+  uint64_t elapsed_us = 0;
+  uint32_t wakeups = 0;
+  uint32_t deadline_us;
+  while (nxmic_schedule_next(&schedule, &deadline_us)) {
+    uint32_t wait_us = deadline_us - now_us;
+    if ((int32_t)wait_us < 0) wait_us = 0;
+    wait_us += next_random() % (latency_us + 1);
+    if (elapsed_us + wait_us >= duration_us) break;
+    elapsed_us += wait_us;
+    now_us += wait_us;
+    uint32_t streams =
+        nxmic_schedule_run(&schedule, now_us) & ~(1u << BENCH_TASK_LED);
+    wakeups++;
+    // streams due together go out in one burst of notifications
+    if (streams & (streams - 1)) (*bursts)++;
+  }
+  return wakeups;
+}
+
+static bool check_half(const char *label, const uint32_t *runs_before,
+                       bool changed, uint64_t duration_us) {
+  bool ok = true;
+  for (int i = 0; i < BENCH_STREAM_COUNT; i++) {
+    const bench_stream_t *stream = &bench_streams[i];
+    const nxmic_schedule_entry_t *entry = entry_of(stream->id);
+    uint32_t interval_ms = changed ? stream->changed_ms : stream->interval_ms;
+    uint32_t runs = entry->runs - runs_before[i];
+    bool match = runs_match(runs, interval_ms, duration_us);
+    printf("%s %-8s every %5u ms: %7u runs, expected %7u%s\n", label,
+           stream->name, interval_ms, runs,
+           interval_ms ? (uint32_t)(duration_us / (interval_ms * 1000ull))
+                       : 0,
+           match ? "" : "  DRIFT");
+    ok = ok && match;
+  }
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  uint32_t seconds = 600;
+  uint32_t coalesce_us = 2000;
+  uint32_t latency_us = 100;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "t:c:l:")) != -1) {
+    switch (opt) {
+      case 't':
+        seconds = (uint32_t)atoi(optarg);
+        break;
+      case 'c':
+        coalesce_us = (uint32_t)atoi(optarg);
+        break;
+      case 'l':
+        latency_us = (uint32_t)atoi(optarg);
+        break;
+      default:
+        fprintf(stderr,
+                "usage: %s [-t seconds] [-c coalesce_us] [-l latency_us]\n",
+                argv[0]);
+        return 2;
+    }
+  }
+  if (seconds < 2 || seconds > 2000) {
+    fprintf(stderr, "invalid duration\n");
+    return 2;
+  }
+
+  // a minute before the 32-bit clock wraps, so the run crosses it
+  uint32_t start_us = UINT32_MAX - 60 * 1000000u;
+  nxmic_schedule_init(&schedule, coalesce_us);
+  uint32_t tick_ms = 0;
+  for (int i = 0; i < BENCH_STREAM_COUNT; i++) {
+    const bench_stream_t *stream = &bench_streams[i];
+    if (!nxmic_schedule_add(&schedule, stream->id, stream->interval_ms,
+                            stream->id != BENCH_TASK_LED, start_us)) {
+      fprintf(stderr, "cannot add %s\n", stream->name);
+      return 1;
+    }
+    tick_ms = gcd(tick_ms, stream->interval_ms);
+  }
+
+  uint64_t half_us = (uint64_t)seconds * 1000000 / 2;
+  uint32_t runs_before[BENCH_STREAM_COUNT] = {0};
+  uint32_t bursts = 0;
+  uint32_t wakeups = run_for(start_us, half_us, latency_us, &bursts);
+  bool ok = check_half("before", runs_before, false, half_us);
+
+  // the new rates, written the way a reader would
+  uint32_t change_us = (uint32_t)(start_us + half_us);
+  uint8_t value[BENCH_STREAM_COUNT * NXMIC_SCHEDULE_RECORD_SIZE];
+  uint16_t length = 0;
+  for (int i = 0; i < BENCH_STREAM_COUNT; i++) {
+    const bench_stream_t *stream = &bench_streams[i];
+    runs_before[i] = entry_of(stream->id)->runs;
+    if (stream->id == BENCH_TASK_LED) continue;
+    value[length] = stream->id;
+    for (int b = 0; b < 4; b++)
+      value[length + 1 + b] = (uint8_t)(stream->changed_ms >> (8 * b));
+    length += NXMIC_SCHEDULE_RECORD_SIZE;
+  }
+  // a task cannot be set, and a bad record leaves the others alone
+  uint8_t rejected[NXMIC_SCHEDULE_RECORD_SIZE] = {BENCH_TASK_LED, 10};
+  if (nxmic_schedule_handle_write(&schedule, rejected, sizeof(rejected),
+                                  change_us) ||
+      !nxmic_schedule_handle_write(&schedule, value, length, change_us)) {
+    printf("interval settings: write not handled as expected\n");
+    ok = false;
+  }
+  uint8_t readback[sizeof(value)];
+  if (nxmic_schedule_encode(&schedule, readback, sizeof(readback)) !=
+          length ||
+      memcmp(readback, value, length) != 0) {
+    printf("interval settings: read back differs from the write\n");
+    ok = false;
+  }
+  wakeups += run_for(change_us, half_us, latency_us, &bursts);
+  ok = check_half("after ", runs_before, true, half_us) && ok;
+
+  uint32_t skipped = schedule.skipped;
+  uint32_t jitter_max = schedule.jitter.max;
+  bool jitter_ok = jitter_max <= latency_us + coalesce_us;
+  printf("schedule: %.1f wakeups/s (fixed %u ms tick: %.1f/s), %u bursts "
+         "of several streams, %u deadlines missed\n",
+         wakeups / (double)seconds, tick_ms, 1000.0 / tick_ms, bursts,
+         skipped);
+  printf("jitter: p50 %u us, p99 %u us, max %u us (latency %u us + "
+         "coalescing %u us)%s\n",
+         nxmic_histogram_quantile(&schedule.jitter, 5000),
+         nxmic_histogram_quantile(&schedule.jitter, 9900), jitter_max,
+         latency_us, coalesce_us, jitter_ok ? "" : "  TOO LATE");
+  return ok && jitter_ok && skipped == 0 ? 0 : 1;
+}
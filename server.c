@@ -7,41 +7,24 @@
 #include <stdio.h>
 
 #include "btstack.h"
-#include "hardware/adc.h"
 #include "pico/btstack_cyw43.h"
 #include "pico/cyw43_arch.h"
 #include "pico/stdlib.h"
+#include "link_profile.h"
+#include "nxmic_log.h"
+#include "nxmic_probe.h"
 #include "server_common.h"
 
-#define HEARTBEAT_PERIOD_MS 1000
+// Main loop pass: takes buffered recording pages to flash and prints the
+// deferred log
+#define RECORDING_SERVICE_PERIOD_MS 50
+#define LOG_DRAIN_BATCH 32
 
-static btstack_timer_source_t heartbeat;
 static btstack_packet_callback_registration_t hci_event_callback_registration;
 
-static void heartbeat_handler(struct btstack_timer_source *ts) {
-  static uint32_t counter = 0;
-  counter++;
-
-  // Update the temp every 10s
-  if (counter % 10 == 0) {
-    poll_temp();
-    if (le_notification_enabled) {
-      att_server_request_can_send_now_event(con_handle);
-    }
-  }
-
-  // Invert the led
-  static int led_on = true;
-  led_on = !led_on;
-  cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, led_on);
-
-  // Restart timer
-  btstack_run_loop_set_timer(ts, HEARTBEAT_PERIOD_MS);
-  btstack_run_loop_add_timer(ts);
-}
-
 int main() {
   stdio_init_all();
+  NXMIC_PROBE_INIT();
 
   for (int i = 0; i < 10; i++) {
     printf("SENSOR STARTING...\n");
@@ -55,15 +38,24 @@ int main() {
     return -1;
   }
 
-  // Initialise adc for the temp sensor
-  adc_init();
-  adc_select_input(ADC_CHANNEL_TEMPSENSOR);
-  adc_set_temp_sensor_enabled(true);
+  // Mount the flash recording store before the first sample arrives
+  recording_init();
+
+  // Free-running DMA acquisition of the temp sensor, with averaging and
+  // framing, on core1 unless NXMIC_DUAL_CORE is off
+  if (!temp_acquisition_start()) {
+    printf("failed to start acquisition\n");
+    return -1;
+  }
+  event_probe_start();
 
   l2cap_init();
   sm_init();
+  link_profile_init(LINK_PROFILE_HIGH_THROUGHPUT);
 
   att_server_init(profile_data, att_read_callback, att_write_callback);
+  att_handlers_init();
+  export_channel_init();
 
   // inform about BTstack state
   hci_event_callback_registration.callback = &packet_handler;
@@ -72,10 +64,8 @@ int main() {
   // register for ATT event
   att_server_register_packet_handler(packet_handler);
 
-  // set one-shot btstack timer
-  heartbeat.process = &heartbeat_handler;
-  btstack_run_loop_set_timer(&heartbeat, HEARTBEAT_PERIOD_MS);
-  btstack_run_loop_add_timer(&heartbeat);
+  // temperature publishing, the led and the stats, each at its own rate
+  schedule_start();
 
   // turn on bluetooth!
   hci_power_control(HCI_POWER_ON);
@@ -93,9 +83,14 @@ int main() {
   // (in which case you should use btstacK_run_loop_ methods to add work to the
   // run loop.
 
-  // this is a forever loop in place of where user code would go.
+  // this is a forever loop in place of where user code would go. Flash
+  // program and erase stall the CPU, so they are done here rather than in
+  // the BTstack context.
   while (true) {
-    sleep_ms(1000);
+    recording_service();
+    nxmic_log_drain(LOG_DRAIN_BATCH);
+    NXMIC_PROBE_POLL();
+    sleep_ms(RECORDING_SERVICE_PERIOD_MS);
   }
 #endif
   return 0;
@@ -5,27 +5,461 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include "btstack.h"
-#include "hardware/adc.h"
+#include "pico/cyw43_arch.h"
+#include "pico/stdlib.h"
 
 #include "temp_sensor.h"
+#include "nxmic_gatt.h"
+#include "nxmic_adv.h"
+#include "nxmic_att.h"
+#include "nxmic_bench.h"
+#include "nxmic_export.h"
+#include "nxmic_frame.h"
+#include "nxmic_log.h"
+#include "nxmic_notify.h"
+#include "nxmic_probe.h"
+#include "nxmic_retransmit.h"
+#include "nxmic_schedule.h"
+#include "nxmic_store.h"
+#include "nxmic_timesync.h"
+#include "nxmic_txq.h"
+#include "flash_pico.h"
+#include "link_profile.h"
+#include "adc_pipeline.h"
+#include "acquisition.h"
 #include "server_common.h"
 
+// Notified values in the generated temp_sensor.gatt, see gatt_gen.c; reads
+// and writes find their handlers by handle, see att_handlers_init()
+#define TEMP_STREAM_VALUE_HANDLE ATT_CHARACTERISTIC_FEDCBA98_7654_3210_FEDC_BA9876545555_01_VALUE_HANDLE
+#define DATA_EXPORT_VALUE_HANDLE ATT_CHARACTERISTIC_5D74B928_4F80_29A8_2B49_1DC8F1930919_01_VALUE_HANDLE
+#define PREVIEW_VALUE_HANDLE ATT_CHARACTERISTIC_FEDCBA98_7654_3210_FEDC_BA9876547777_01_VALUE_HANDLE
+
+// Stream frames waiting longer than this are dropped instead of sent
+#define TEMP_FRAME_MAX_AGE_US 2000000
+
+// Period of the async context latency probe
+#define EVENT_PROBE_PERIOD_US 10000
+
+// Periodic work. The temperature is the only stream this sensor has a
+// source for, its rate can be written; the LED and the stats are tasks.
+#define TEMP_PUBLISH_INTERVAL_MS 10000
+#define LED_INTERVAL_MS 1000
+#define STATS_INTERVAL_MS 10000
+#define SCHEDULE_TASK_LED CHAR_COUNT
+#define SCHEDULE_TASK_STATS (CHAR_COUNT + 1)
+#define SCHEDULE_TASK_BROADCAST (CHAR_COUNT + 2)
+// How often the advertised readings are brought up to date, see nxmic_adv.h
+#define BROADCAST_INTERVAL_MS 500
+// Work due this close together shares a wakeup and a notification burst
+#define SCHEDULE_COALESCE_US 2000
+
+// Longest CHAR_LABEL_DATA kept, it reads back as written
+#define LABEL_MAX_SIZE 64
+
+// Buffered pages programmed per pass of the main loop
+#define RECORDING_SERVICE_PAGES 1
+
+// ATT notification header + L2CAP header, for payload efficiency
+#define NOTIFICATION_OVERHEAD (3 + 4)
+
 #define APP_AD_FLAGS 0x06
+// The NxMic service and the latest readings go in the advertisement so
+// readers can scan passively, see nxmic_adv.h; the name moves to the scan
+// response to make room
+#define ADV_SERVICE_UUID128_OFFSET 5
+#define ADV_BROADCAST_OFFSET 21
 static uint8_t adv_data[] = {
     // Flags general discoverable
     0x02, BLUETOOTH_DATA_TYPE_FLAGS, APP_AD_FLAGS,
+    // NxMic service, filled in from nxmic_gatt_service
+    0x11, BLUETOOTH_DATA_TYPE_COMPLETE_LIST_OF_128_BIT_SERVICE_CLASS_UUIDS, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    // Telemetry broadcast, encoded once there is a reading; a zero length
+    // ends the data until then
+    0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+static const uint8_t adv_data_len = sizeof(adv_data);
+static uint8_t scan_response_data[] = {
     // Name
     0x17, BLUETOOTH_DATA_TYPE_COMPLETE_LOCAL_NAME, 'P', 'i', 'c', 'o', ' ', '0', '0', ':', '0', '0', ':', '0', '0', ':', '0', '0', ':', '0', '0', ':', '0', '0',
-    0x03, BLUETOOTH_DATA_TYPE_COMPLETE_LIST_OF_16_BIT_SERVICE_CLASS_UUIDS, 0x1a, 0x18,
 };
-static const uint8_t adv_data_len = sizeof(adv_data);
+static const uint8_t scan_response_data_len = sizeof(scan_response_data);
+
+// Advertising follows the broadcast: its interval, and non-connectable while
+// a central is connected so observers still hear the readings
+#define ADV_TYPE_CONNECTABLE 0     // ADV_IND
+#define ADV_TYPE_NONCONNECTABLE 3  // ADV_NONCONN_IND
+static nxmic_adv_broadcast_t broadcast;
+static bool temp_sampled;
+static bool adv_connected;
+static uint16_t adv_interval;
+static uint8_t adv_type = 0xff;
+// No battery gauge on this board, the level reads and advertises as unknown
+static uint8_t battery_level = NXMIC_ADV_BATTERY_UNKNOWN;
+// CHAR_DEVICE_SERIAL, the public address once BTstack is up
+static uint8_t device_serial[6];
 
 int le_notification_enabled;
-hci_con_handle_t con_handle;
+int temp_stream_enabled;
+hci_con_handle_t con_handle = HCI_CON_HANDLE_INVALID;
 uint16_t current_temp;
+stream_stats_t temp_stream_stats;
+// CHAR_STETHOSCOPE_PREVIEW_STREAMING, decimated by the acquisition core
+static int preview_enabled;
+static stream_stats_t preview_stream_stats;
+
+// ATT dispatch, filled in by att_handlers_init()
+static nxmic_att_table_t att_table;
+
+// Notifications of the connection, see nxmic_notify.h, set up by
+// att_handlers_init(). Every value its queue drops is a stream frame, the
+// 2-byte reading only replaces itself.
+static nxmic_notifier_t notifier;
+static nxmic_retx_window_t *temp_retx;  // The notifier's, for the stats
+static uint32_t tx_report_us;      // Counters at the previous stats
+static uint32_t tx_report_events;
+static uint32_t tx_report_notifications;
+
+// Temperature samples go to a recording in flash, started at boot. It is
+// only appended to, so offsets stay valid when an export resumes after a
+// disconnect, and it survives a reset of the sensor.
+static nxmic_flash_t recording_flash;
+static nxmic_store_segment_t recording_segments[FLASH_PICO_SECTORS];
+static nxmic_store_t recording_store;
+static bool recording_ready;           // store mounted
+static bool recording_format_pending;  // FORMAT written, done by the main loop
+static uint16_t export_recording;      // what CHAR_DATA_EXPORT offloads
+static uint8_t timesync_value[NXMIC_TIMESYNC_VALUE_SIZE];  // last sync round
+static int export_enabled;
+
+static uint16_t export_recording_read(void *context, uint32_t offset, uint8_t *buffer, uint16_t length) {
+    UNUSED(context);
+    if (!recording_ready) return 0;
+    return (uint16_t)nxmic_store_read(&recording_store, export_recording, offset, buffer, length);
+}
+
+static nxmic_export_sender_t export_sender = { .read = export_recording_read };
+
+// L2CAP channel for the export, opened by the reader on NXMIC_EXPORT_PSM.
+// The sensor never receives on it, the buffer only satisfies the minimum MTU.
+static uint16_t export_cid;
+static uint16_t export_channel_mtu;
+static uint8_t export_channel_rx[23];
+
+static bool export_uses_channel(void) {
+    return export_cid && export_sender.transport == NXMIC_EXPORT_TRANSPORT_L2CAP;
+}
+
+static void request_can_send_now(void) {
+    if (con_handle == HCI_CON_HANDLE_INVALID) return;
+    att_server_request_can_send_now_event(con_handle);
+}
+
+// The async context runs BTstack, the ADC blocks without NXMIC_DUAL_CORE
+// and the flash store bookkeeping; how late a periodic worker runs is how
+// long its events wait
+static async_at_time_worker_t event_probe_worker;
+static absolute_time_t event_probe_due;
+static nxmic_histogram_t event_latency;
+
+static void event_probe_handler(async_context_t *context, async_at_time_worker_t *worker) {
+    nxmic_histogram_add(&event_latency, (uint32_t)absolute_time_diff_us(event_probe_due, get_absolute_time()));
+    event_probe_due = make_timeout_time_us(EVENT_PROBE_PERIOD_US);
+    async_context_add_at_time_worker_at(context, worker, event_probe_due);
+}
+
+void event_probe_start(void) {
+    event_probe_worker.do_work = event_probe_handler;
+    event_probe_due = make_timeout_time_us(EVENT_PROBE_PERIOD_US);
+    async_context_add_at_time_worker_at(cyw43_arch_async_context(), &event_probe_worker, event_probe_due);
+}
+
+// Put the latest readings on air, and set the interval and type to go with
+// them. BTstack restarts advertising with new parameters by itself.
+static void advertise(void) {
+    uint32_t now_ms = to_ms_since_boot(get_absolute_time());
+    if (temp_sampled && nxmic_adv_broadcast_update(&broadcast, (int16_t)current_temp, battery_level, now_ms)) {
+        nxmic_adv_broadcast_encode(&broadcast, &adv_data[ADV_BROADCAST_OFFSET]);
+        gap_advertisements_set_data(adv_data_len, (uint8_t*) adv_data);
+    }
+    uint16_t interval = nxmic_adv_broadcast_interval(&broadcast, now_ms);
+    uint8_t type = adv_connected ? ADV_TYPE_NONCONNECTABLE : ADV_TYPE_CONNECTABLE;
+    if (interval == adv_interval && type == adv_type) return;
+    adv_interval = interval;
+    adv_type = type;
+    bd_addr_t null_addr;
+    memset(null_addr, 0, 6);
+    gap_advertisements_set_params(interval, interval, type, 0, null_addr, 0x07, 0x00);
+}
+
+static nxmic_schedule_t schedule;
+static async_at_time_worker_t schedule_worker;
+// CHAR_RECORDING_INTERVAL_SETTINGS as read, encoded again when written
+static uint8_t intervals_value[NXMIC_SCHEDULE_MAX_ENTRIES * NXMIC_SCHEDULE_RECORD_SIZE];
+static uint16_t intervals_length;
+
+// One timer, for whatever is due next
+static void schedule_arm(async_context_t *context) {
+    uint32_t deadline_us;
+    async_context_remove_at_time_worker(context, &schedule_worker);
+    if (!nxmic_schedule_next(&schedule, &deadline_us)) return;
+    int32_t wait_us = (int32_t)(deadline_us - time_us_32());
+    async_context_add_at_time_worker_at(context, &schedule_worker, make_timeout_time_us(wait_us > 0 ? wait_us : 0));
+}
+
+static void schedule_handler(async_context_t *context, async_at_time_worker_t *worker) {
+    UNUSED(worker);
+    uint32_t due = nxmic_schedule_run(&schedule, time_us_32());
+    if (due & (1u << CHAR_TEMPERATURE_STREAMING)) publish_temp();
+    if (due & (1u << SCHEDULE_TASK_LED)) {
+        static int led_on = true;
+        led_on = !led_on;
+        cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, led_on);
+    }
+    if (due & (1u << SCHEDULE_TASK_STATS)) print_stream_stats();
+    if (due & (1u << SCHEDULE_TASK_BROADCAST)) advertise();
+    // the notifications of everything due go out in one burst
+    if (notifier.queue.count) request_can_send_now();
+    schedule_arm(context);
+}
+
+void schedule_start(void) {
+    uint32_t now_us = time_us_32();
+    nxmic_schedule_init(&schedule, SCHEDULE_COALESCE_US);
+    nxmic_schedule_add(&schedule, CHAR_TEMPERATURE_STREAMING, TEMP_PUBLISH_INTERVAL_MS, true, now_us);
+    nxmic_schedule_add(&schedule, SCHEDULE_TASK_LED, LED_INTERVAL_MS, false, now_us);
+    nxmic_schedule_add(&schedule, SCHEDULE_TASK_STATS, STATS_INTERVAL_MS, false, now_us);
+    nxmic_schedule_add(&schedule, SCHEDULE_TASK_BROADCAST, BROADCAST_INTERVAL_MS, false, now_us);
+    intervals_length = nxmic_schedule_encode(&schedule, intervals_value, sizeof(intervals_value));
+    schedule_worker.do_work = schedule_handler;
+    schedule_arm(cyw43_arch_async_context());
+}
+
+// A frame from the acquisition core is queued for the ATT layer. Frames
+// that wait longer than TEMP_FRAME_MAX_AGE_US are dropped, fresh data wins;
+// the preview gives way to the temperature stream.
+static void stream_frame_handler(const uint8_t *frame, uint16_t length) {
+    if (frame[0] == CHAR_STETHOSCOPE_PREVIEW_STREAMING) {
+        nxmic_txq_push(&notifier.queue, PREVIEW_VALUE_HANDLE, NXMIC_TXQ_PRIORITY_LOW, false, TEMP_FRAME_MAX_AGE_US, frame, length, time_us_32());
+    } else {
+        nxmic_txq_push(&notifier.queue, TEMP_STREAM_VALUE_HANDLE, NXMIC_TXQ_PRIORITY_NORMAL, false, TEMP_FRAME_MAX_AGE_US, frame, length, time_us_32());
+    }
+    request_can_send_now();
+}
+
+// The 2-byte reading, only the latest one is worth sending
+static void queue_legacy_temp(void) {
+    nxmic_txq_push(&notifier.queue, ATT_CHARACTERISTIC_ORG_BLUETOOTH_CHARACTERISTIC_TEMPERATURE_01_VALUE_HANDLE, NXMIC_TXQ_PRIORITY_HIGH, true, 0,
+                   (const uint8_t *)&current_temp, sizeof(current_temp), time_us_32());
+}
+
+#if NXMIC_BENCHMARK
+// Benchmark mode: keep the link saturated with full frames of filler on the
+// temperature stream, stamped with their sequence number and send time
+static uint16_t bench_sequence;
+
+static bool bench_send_frame(void) {
+    nxmic_frame_builder_t frame;
+    uint16_t mtu = att_server_get_mtu(con_handle);
+    nxmic_frame_begin(&frame, CHAR_TEMPERATURE_STREAMING, NXMIC_CODEC_PCM16, bench_sequence, time_us_32(), mtu - 3);
+    while (!nxmic_frame_is_full(&frame, sizeof(int16_t))) {
+        nxmic_frame_append_int16(&frame, (int16_t)bench_sequence);
+    }
+    if (att_server_notify(con_handle, TEMP_STREAM_VALUE_HANDLE, frame.buffer, frame.length) != ERROR_CODE_SUCCESS) return false;
+    bench_sequence++;
+    temp_stream_stats.frames_sent++;
+    temp_stream_stats.samples_sent += nxmic_frame_sample_count(&frame);
+    temp_stream_stats.bytes_sent += frame.length;
+    return true;
+}
+#endif
+
+static void export_select(uint16_t recording) {
+    if (recording != export_recording) nxmic_export_sender_stop(&export_sender);
+    export_recording = recording;
+    nxmic_export_sender_set_size(&export_sender, nxmic_store_size(&recording_store, recording));
+}
+
+// Only RAM is touched here, the main loop takes the pages to flash
+static void temp_recording_add_sample(int16_t sample) {
+    if (!nxmic_store_append(&recording_store, &sample, sizeof(sample))) return;
+    if (recording_store.active == export_recording) {
+        nxmic_export_sender_set_size(&export_sender, recording_store.active_length);
+    }
+}
+
+static uint16_t recording_status(uint8_t *out) {
+    uint16_t recording = recording_store.active;
+    if (recording == NXMIC_STORE_NO_RECORDING) recording = export_recording;
+    out[0] = recording_store.active != NXMIC_STORE_NO_RECORDING;
+    little_endian_store_16(out, 1, recording);
+    little_endian_store_32(out, 3, nxmic_store_size(&recording_store, recording));
+    return NXMIC_RECORDING_STATUS_SIZE;
+}
+
+static uint16_t store_info(uint8_t *out) {
+    nxmic_store_info_t info;
+    nxmic_store_get_info(&recording_store, &info);
+    little_endian_store_16(out, 0, info.recordings);
+    little_endian_store_16(out, 2, info.first_recording);
+    little_endian_store_16(out, 4, info.last_recording);
+    little_endian_store_32(out, 6, info.used_bytes);
+    little_endian_store_32(out, 10, info.capacity_bytes);
+    little_endian_store_32(out, 14, info.erase_min);
+    little_endian_store_32(out, 18, info.erase_max);
+    return NXMIC_STORE_INFO_SIZE;
+}
+
+static void recording_start(void) {
+    export_select(nxmic_store_begin(&recording_store));
+    printf("recording %u started\n", recording_store.active);
+}
+
+void recording_init(void) {
+    flash_pico_init(&recording_flash);
+    if (!nxmic_store_init(&recording_store, &recording_flash, recording_segments, FLASH_PICO_SECTORS) ||
+        !nxmic_store_mount(&recording_store)) {
+        printf("recording store unavailable, nothing is recorded\n");
+        return;
+    }
+    recording_ready = true;
+    nxmic_store_info_t info;
+    nxmic_store_get_info(&recording_store, &info);
+    printf("recording store: %u recordings, %lu/%lu kB used, mounted with %lu reads\n",
+           info.recordings, (unsigned long)(info.used_bytes / 1024), (unsigned long)(info.capacity_bytes / 1024),
+           (unsigned long)recording_store.stats.mount_reads);
+    recording_start();
+}
+
+// Flash stalls (a page program, or one erase) happen here on the main loop,
+// never in the ADC or BTstack callbacks that feed and read the store
+void recording_service(void) {
+    if (!recording_ready) return;
+    async_context_t *context = cyw43_arch_async_context();
+    async_context_acquire_lock_blocking(context);
+    if (recording_format_pending) {
+        recording_format_pending = false;
+        nxmic_export_sender_stop(&export_sender);
+        if (nxmic_store_format(&recording_store)) printf("recording store formatted\n");
+        recording_start();
+    }
+    nxmic_store_service(&recording_store, RECORDING_SERVICE_PAGES);
+    async_context_release_lock(context);
+}
+
+// Bulk export only gets what the streams leave of the link
+static bool export_send_chunk(void) {
+    static uint8_t chunk[NXMIC_FRAME_MAX_SIZE];
+    uint16_t mtu = att_server_get_mtu(con_handle);
+    uint16_t length = nxmic_export_sender_build(&export_sender, chunk, mtu - 3 < sizeof(chunk) ? mtu - 3 : sizeof(chunk));
+    if (!length || att_server_notify(con_handle, DATA_EXPORT_VALUE_HANDLE, chunk, length) != ERROR_CODE_SUCCESS) return false;
+    nxmic_export_sender_sent(&export_sender);
+    return true;
+}
+
+// On the channel L2CAP segments the SDU and paces it with its own credits;
+// the buffer has to stay untouched until the next L2CAP_EVENT_CAN_SEND_NOW
+static void export_send_sdu(void) {
+    static uint8_t sdu[NXMIC_EXPORT_SDU_SIZE];
+    uint16_t length = nxmic_export_sender_build(&export_sender, sdu, export_channel_mtu < sizeof(sdu) ? export_channel_mtu : sizeof(sdu));
+    if (length && l2cap_send(export_cid, sdu, length) == ERROR_CODE_SUCCESS) {
+        nxmic_export_sender_sent(&export_sender);
+    }
+    if (nxmic_export_sender_pending(&export_sender)) l2cap_request_can_send_now_event(export_cid);
+}
+
+static void export_channel_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size) {
+    UNUSED(channel);
+    UNUSED(size);
+    if (packet_type != HCI_EVENT_PACKET) return;
+    switch (hci_event_packet_get_type(packet)) {
+        case L2CAP_EVENT_CBM_INCOMING_CONNECTION: {
+            uint16_t cid = l2cap_event_cbm_incoming_connection_get_local_cid(packet);
+            if (export_cid) {
+                l2cap_cbm_decline_connection(cid, L2CAP_CBM_CONNECTION_RESULT_NO_RESOURCES_AVAILABLE);
+                break;
+            }
+            l2cap_cbm_accept_connection(cid, export_channel_rx, sizeof(export_channel_rx), L2CAP_LE_AUTOMATIC_CREDITS);
+            break;
+        }
+        case L2CAP_EVENT_CBM_CHANNEL_OPENED:
+            if (l2cap_event_cbm_channel_opened_get_status(packet) != ERROR_CODE_SUCCESS) break;
+            export_cid = l2cap_event_cbm_channel_opened_get_local_cid(packet);
+            export_channel_mtu = l2cap_event_cbm_channel_opened_get_remote_mtu(packet);
+            printf("export channel open, SDUs up to %u bytes\n", export_channel_mtu);
+            break;
+        case L2CAP_EVENT_CAN_SEND_NOW:
+            if (export_uses_channel()) export_send_sdu();
+            break;
+        case L2CAP_EVENT_CHANNEL_CLOSED:
+            if (l2cap_event_channel_closed_get_local_cid(packet) != export_cid) break;
+            export_cid = 0;
+            if (export_sender.transport == NXMIC_EXPORT_TRANSPORT_L2CAP) nxmic_export_sender_stop(&export_sender);
+            break;
+        default:
+            break;
+    }
+}
+
+void export_channel_init(void) {
+    l2cap_cbm_register_service(&export_channel_handler, NXMIC_EXPORT_PSM, LEVEL_0);
+}
+
+static void temp_stream_reset(void) {
+    acquisition_set_stream(false, 0);
+    nxmic_notify_reset(&notifier, TEMP_STREAM_VALUE_HANDLE);
+}
+
+static void preview_reset(void) {
+    acquisition_set_preview(false, 0);
+    nxmic_notify_reset(&notifier, PREVIEW_VALUE_HANDLE);
+}
+
+static bool notify_send(void *context, uint16_t handle, const uint8_t *value, uint16_t length) {
+    UNUSED(context);
+    return att_server_notify(con_handle, handle, value, length) == ERROR_CODE_SUCCESS;
+}
+
+// Send back to back while the controller has ACL buffers free, up to
+// NXMIC_TX_BURST per event if set
+static bool notify_can_send(void *context) {
+    UNUSED(context);
+    return att_server_can_send_packet_now(con_handle);
+}
+
+// What goes out once the queue and the retransmissions are through
+static bool notify_fill(void *context) {
+    UNUSED(context);
+#if NXMIC_BENCHMARK
+    if (temp_stream_enabled) return bench_send_frame();
+#endif
+    return export_enabled && !export_uses_channel() && export_send_chunk();
+}
+
+static bool notify_fill_pending(void *context) {
+    UNUSED(context);
+    return (NXMIC_BENCHMARK && temp_stream_enabled) ||
+           (export_enabled && !export_uses_channel() && nxmic_export_sender_pending(&export_sender));
+}
+
+static void notify_sent(void *context, uint16_t handle, const uint8_t *value, uint16_t length) {
+    UNUSED(context);
+    stream_stats_t *stats = NULL;
+    if (handle == TEMP_STREAM_VALUE_HANDLE) {
+        stats = &temp_stream_stats;
+    } else if (handle == PREVIEW_VALUE_HANDLE) {
+        stats = &preview_stream_stats;
+    }
+    if (!stats) return;
+    stats->frames_sent++;
+    stats->samples_sent += little_endian_read_16(value, 2);
+    stats->bytes_sent += length;
+}
 
 void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size) {
+    NXMIC_PROBE_SCOPE(NXMIC_PROBE_PACKET_HANDLER);
     UNUSED(size);
     UNUSED(channel);
     bd_addr_t local_addr;
@@ -37,70 +471,371 @@ void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint
             if (btstack_event_state_get_state(packet) != HCI_STATE_WORKING) return;
             gap_local_bd_addr(local_addr);
             printf("BTstack up and running on %s.\n", bd_addr_to_str(local_addr));
+            memcpy(device_serial, local_addr, sizeof(device_serial));
 
-            // setup advertisements
-            uint16_t adv_int_min = 800;
-            uint16_t adv_int_max = 800;
-            uint8_t adv_type = 0;
-            bd_addr_t null_addr;
-            memset(null_addr, 0, 6);
-            gap_advertisements_set_params(adv_int_min, adv_int_max, adv_type, 0, null_addr, 0x07, 0x00);
+            // setup advertisements, and keep them going alongside a
+            // connection; only the one connection is ever accepted, as
+            // the advertisements turn non-connectable with it and BTstack
+            // has room for no more (MAX_NR_HCI_CONNECTIONS)
+            memcpy(&adv_data[ADV_SERVICE_UUID128_OFFSET], nxmic_gatt_service.uuid128, 16);
             assert(adv_data_len <= 31); // ble limitation
+            assert(scan_response_data_len <= 31);
             gap_advertisements_set_data(adv_data_len, (uint8_t*) adv_data);
+            gap_scan_response_set_data(scan_response_data_len, (uint8_t*) scan_response_data);
+            gap_set_max_number_peripheral_connections(1);
+            advertise();
             gap_advertisements_enable(1);
-
-            poll_temp();
-
+            break;
+        case HCI_EVENT_LE_META:
+            if (hci_event_le_meta_get_subevent_code(packet) != HCI_SUBEVENT_LE_CONNECTION_COMPLETE) break;
+            if (hci_subevent_le_connection_complete_get_status(packet) != ERROR_CODE_SUCCESS) break;
+            con_handle = hci_subevent_le_connection_complete_get_connection_handle(packet);
+            adv_connected = true;
+            advertise();
             break;
         case HCI_EVENT_DISCONNECTION_COMPLETE:
+            // only the link the streams are on takes them down
+            if (hci_event_disconnection_complete_get_connection_handle(packet) != con_handle) break;
+            adv_connected = false;
+            advertise();
             le_notification_enabled = 0;
+            temp_stream_enabled = 0;
+            preview_enabled = 0;
+            export_enabled = 0;
+            con_handle = HCI_CON_HANDLE_INVALID;
+            temp_stream_reset();
+            preview_reset();
+            nxmic_notify_clear(&notifier);
+            nxmic_export_sender_stop(&export_sender);
+            nxmic_att_cancel(&att_table);
             break;
         case ATT_EVENT_CAN_SEND_NOW:
-            att_server_notify(con_handle, ATT_CHARACTERISTIC_ORG_BLUETOOTH_CHARACTERISTIC_TEMPERATURE_01_VALUE_HANDLE, (uint8_t*)&current_temp, sizeof(current_temp));
+            // ask for another event only if something is left
+            if (nxmic_notify_run(&notifier, time_us_32())) request_can_send_now();
             break;
         default:
             break;
     }
 }
 
-uint16_t att_read_callback(hci_con_handle_t connection_handle, uint16_t att_handle, uint16_t offset, uint8_t * buffer, uint16_t buffer_size) {
+// Per characteristic ATT handlers, see nxmic_att.h. Values kept in a
+// variable are read from it in place; the recording status and the store
+// info only exist encoded and are built on each read.
+static const char firmware_version[] = NXMIC_FIRMWARE_VERSION;
+static uint8_t label_value[LABEL_MAX_SIZE];
+static uint16_t label_length;
+
+static int timestamp_write(uint16_t connection_handle, const uint8_t *value, uint16_t length) {
     UNUSED(connection_handle);
+    // stamped first thing, the reader pairs it with its round trip; the
+    // same clock stamps the frames
+    uint32_t device_us = time_us_32();
+    // a malformed request leaves the last round's value to be read
+    if (!nxmic_timesync_encode_value(value, length, device_us, timesync_value)) return ATT_ERROR_INVALID_ATTRIBUTE_VALUE_LENGTH;
+    return 0;
+}
 
-    if (att_handle == ATT_CHARACTERISTIC_ORG_BLUETOOTH_CHARACTERISTIC_TEMPERATURE_01_VALUE_HANDLE){
-        return att_read_callback_handle_blob((const uint8_t *)&current_temp, sizeof(current_temp), offset, buffer, buffer_size);
+static int interval_write(uint16_t connection_handle, const uint8_t *value, uint16_t length) {
+    UNUSED(connection_handle);
+    // all records or none, the next wakeup moves with them
+    if (!nxmic_schedule_handle_write(&schedule, value, length, time_us_32())) return ATT_ERROR_VALUE_NOT_ALLOWED;
+    intervals_length = nxmic_schedule_encode(&schedule, intervals_value, sizeof(intervals_value));
+    schedule_arm(cyw43_arch_async_context());
+    return 0;
+}
+
+static int export_write(uint16_t connection_handle, const uint8_t *value, uint16_t length) {
+    if (nxmic_export_sender_handle_write(&export_sender, value, length)) {
+        // without the channel the export falls back to notifications
+        con_handle = connection_handle;
+        if (export_uses_channel()) {
+            l2cap_request_can_send_now_event(export_cid);
+        } else if (export_enabled) {
+            request_can_send_now();
+        }
+    } else if (temp_stream_enabled && nxmic_notify_handle_nack(&notifier, value, length)) {
+        request_can_send_now();
     }
     return 0;
 }
 
-int att_write_callback(hci_con_handle_t connection_handle, uint16_t att_handle, uint16_t transaction_mode, uint16_t offset, uint8_t *buffer, uint16_t buffer_size) {
-    UNUSED(transaction_mode);
-    UNUSED(offset);
-    UNUSED(buffer_size);
-    
-    if (att_handle != ATT_CHARACTERISTIC_ORG_BLUETOOTH_CHARACTERISTIC_TEMPERATURE_01_CLIENT_CONFIGURATION_HANDLE) return 0;
-    le_notification_enabled = little_endian_read_16(buffer, 0) == GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_NOTIFICATION;
+static uint16_t recording_status_build(uint8_t out[NXMIC_ATT_BUILD_MAX]) {
+    return recording_ready ? recording_status(out) : 0;
+}
+
+static int recording_write(uint16_t connection_handle, const uint8_t *value, uint16_t length) {
+    UNUSED(connection_handle);
+    if (!recording_ready || length < 1) return 0;
+    if (value[0]) {
+        recording_start();
+    } else {
+        nxmic_store_end(&recording_store);
+    }
+    return 0;
+}
+
+static uint16_t store_info_build(uint8_t out[NXMIC_ATT_BUILD_MAX]) {
+    return recording_ready ? store_info(out) : 0;
+}
+
+static int filesystem_write(uint16_t connection_handle, const uint8_t *value, uint16_t length) {
+    UNUSED(connection_handle);
+    if (!recording_ready || length < 1) return 0;
+    if (value[0] == NXMIC_STORE_OP_FORMAT) {
+        // an erase does not belong in a BTstack callback
+        recording_format_pending = true;
+    } else if (value[0] == NXMIC_STORE_OP_SELECT && length >= 3) {
+        export_select(little_endian_read_16(value, 1));
+    }
+    return 0;
+}
+
+static int label_write(uint16_t connection_handle, const uint8_t *value, uint16_t length) {
+    UNUSED(connection_handle);
+    if (length > sizeof(label_value)) return ATT_ERROR_INVALID_ATTRIBUTE_VALUE_LENGTH;
+    memcpy(label_value, value, length);
+    label_length = length;
+    return 0;
+}
+
+static bool notifications_on(const uint8_t *value, uint16_t length) {
+    return length >= 2 && little_endian_read_16(value, 0) == GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_NOTIFICATION;
+}
+
+static int legacy_temp_configuration_write(uint16_t connection_handle, const uint8_t *value, uint16_t length) {
+    le_notification_enabled = notifications_on(value, length);
     con_handle = connection_handle;
     if (le_notification_enabled) {
+        queue_legacy_temp();
         att_server_request_can_send_now_event(con_handle);
+    } else {
+        nxmic_notify_reset(&notifier, ATT_CHARACTERISTIC_ORG_BLUETOOTH_CHARACTERISTIC_TEMPERATURE_01_VALUE_HANDLE);
     }
     return 0;
 }
 
-void poll_temp(void) {
-    adc_select_input(ADC_CHANNEL_TEMPSENSOR);
-    uint32_t raw32 = adc_read();
-    const uint32_t bits = 12;
-
-    // Scale raw reading to 16 bit value using a Taylor expansion (for 8 <= bits <= 16)
-    uint16_t raw16 = raw32 << (16 - bits) | raw32 >> (2 * bits - 16);
-
-    // ref https://github.com/raspberrypi/pico-micropython-examples/blob/master/adc/temperature.py
-    const float conversion_factor = 3.3 / (65535);
-    float reading = raw16 * conversion_factor;
-    
-    // The temperature sensor measures the Vbe voltage of a biased bipolar diode, connected to the fifth ADC channel
-    // Typically, Vbe = 0.706V at 27 degrees C, with a slope of -1.721mV (0.001721) per degree. 
-    float deg_c = 27 - (reading - 0.706) / 0.001721;
-    current_temp = deg_c * 100;
-    printf("Write temp %.2f degc\n", deg_c);
- }
\ No newline at end of file
+static int temp_stream_configuration_write(uint16_t connection_handle, const uint8_t *value, uint16_t length) {
+    temp_stream_enabled = notifications_on(value, length);
+    con_handle = connection_handle;
+    if (!temp_stream_enabled) temp_stream_reset();
+    // the acquisition core frames the samples, the benchmark sends filler from here
+    if (temp_stream_enabled && !NXMIC_BENCHMARK) acquisition_set_stream(true, att_server_get_mtu(con_handle) - 3);
+    if (temp_stream_enabled && NXMIC_BENCHMARK) request_can_send_now();
+    return 0;
+}
+
+static int preview_configuration_write(uint16_t connection_handle, const uint8_t *value, uint16_t length) {
+    preview_enabled = notifications_on(value, length);
+    con_handle = connection_handle;
+    if (preview_enabled) {
+        acquisition_set_preview(true, att_server_get_mtu(con_handle) - 3);
+    } else {
+        preview_reset();
+    }
+    return 0;
+}
+
+static int export_configuration_write(uint16_t connection_handle, const uint8_t *value, uint16_t length) {
+    export_enabled = notifications_on(value, length);
+    con_handle = connection_handle;
+    if (!export_enabled) nxmic_export_sender_stop(&export_sender);
+    return 0;
+}
+
+static const nxmic_att_handler_t legacy_temp_configuration_handler = { .write = legacy_temp_configuration_write };
+
+static const nxmic_att_handler_t char_handlers[CHAR_COUNT] = {
+    [CHAR_DEVICE_SERIAL] = { .value = device_serial, .size = sizeof(device_serial) },
+    [CHAR_TIMESTAMP] = { .value = timesync_value, .size = sizeof(timesync_value), .write = timestamp_write },
+    [CHAR_FIRMWARE_VERSION] = { .value = firmware_version, .size = sizeof(firmware_version) - 1 },
+    [CHAR_TEMPERATURE_STREAMING] = { .value = &current_temp, .size = sizeof(current_temp) },
+    [CHAR_BATTERY_LEVEL] = { .value = &battery_level, .size = sizeof(battery_level) },
+    [CHAR_ACTIVE_RECORDING] = { .build = recording_status_build, .write = recording_write },
+    [CHAR_DATA_EXPORT] = { .write = export_write },
+    [CHAR_LABEL_DATA] = { .value = label_value, .size = sizeof(label_value), .length = &label_length, .write = label_write },
+    [CHAR_RECORDING_INTERVAL_SETTINGS] = { .value = intervals_value, .size = sizeof(intervals_value), .length = &intervals_length, .write = interval_write },
+    [CHAR_FILESYSTEM_MANAGEMENT] = { .build = store_info_build, .write = filesystem_write },
+};
+
+static const nxmic_att_handler_t configuration_handlers[CHAR_COUNT] = {
+    [CHAR_TEMPERATURE_STREAMING] = { .write = temp_stream_configuration_write },
+    [CHAR_STETHOSCOPE_PREVIEW_STREAMING] = { .write = preview_configuration_write },
+    [CHAR_DATA_EXPORT] = { .write = export_configuration_write },
+};
+
+// The NxMic handles are wherever compile_gatt.py put them; they are looked
+// up once and kept in nxmic_gatt_service. Characteristics the sensor has
+// no source for keep no handler.
+void att_handlers_init(void) {
+    nxmic_notify_init(&notifier, notify_send, notify_can_send, NXMIC_TX_BURST, NULL);
+    nxmic_notify_set_fill(&notifier, notify_fill, notify_fill_pending);
+    nxmic_notify_set_sent(&notifier, notify_sent);
+    // frames the reader missed on the temperature stream are sent again
+    temp_retx = nxmic_notify_add_stream(&notifier, TEMP_STREAM_VALUE_HANDLE, CHAR_TEMPERATURE_STREAMING);
+    nxmic_att_init(&att_table);
+    // the temperature reads the same on the ESS characteristic and the stream
+    nxmic_att_register(&att_table, ATT_CHARACTERISTIC_ORG_BLUETOOTH_CHARACTERISTIC_TEMPERATURE_01_VALUE_HANDLE,
+                       &char_handlers[CHAR_TEMPERATURE_STREAMING]);
+    nxmic_att_register(&att_table, ATT_CHARACTERISTIC_ORG_BLUETOOTH_CHARACTERISTIC_TEMPERATURE_01_CLIENT_CONFIGURATION_HANDLE,
+                       &legacy_temp_configuration_handler);
+    for (int i = 0; i < nxmic_gatt_service.num_characteristics; i++) {
+        gatt_characteristic_t *c = &nxmic_gatt_service.characteristics[i];
+        uint8_t uuid128[16];
+        reverse_128(c->uuid128, uuid128);
+        c->value_handle = gatt_server_get_value_handle_for_characteristic_with_uuid128(0x0001, 0xffff, uuid128);
+        c->handle = c->value_handle ? c->value_handle - 1 : 0;
+        if (c->char_id >= CHAR_COUNT || !c->value_handle) continue;
+        const nxmic_att_handler_t *handler = &char_handlers[c->char_id];
+        if ((handler->value || handler->build || handler->write) && !nxmic_att_register(&att_table, c->value_handle, handler)) {
+            printf("no room for the handler of handle %u\n", c->value_handle);
+        }
+        handler = &configuration_handlers[c->char_id];
+        if (!handler->write) continue;
+        uint16_t configuration_handle = gatt_server_get_client_configuration_handle_for_characteristic_with_uuid128(0x0001, 0xffff, uuid128);
+        if (!nxmic_att_register(&att_table, configuration_handle, handler)) {
+            printf("no room for the handler of handle %u\n", configuration_handle);
+        }
+    }
+}
+
+uint16_t att_read_callback(hci_con_handle_t connection_handle, uint16_t att_handle, uint16_t offset, uint8_t * buffer, uint16_t buffer_size) {
+    NXMIC_PROBE_SCOPE(NXMIC_PROBE_ATT_READ);
+    UNUSED(connection_handle);
+    uint8_t scratch[NXMIC_ATT_BUILD_MAX];
+    uint16_t length;
+    const uint8_t *value = nxmic_att_value(&att_table, att_handle, scratch, &length);
+    if (!value) return 0;
+    return att_read_callback_handle_blob(value, length, offset, buffer, buffer_size);
+}
+
+// A Write Long arrives as chunks staged at their offset, then an execute
+// (after BTstack's validate) or a cancel, with handle 0
+int att_write_callback(hci_con_handle_t connection_handle, uint16_t att_handle, uint16_t transaction_mode, uint16_t offset, uint8_t *buffer, uint16_t buffer_size) {
+    NXMIC_PROBE_SCOPE(NXMIC_PROBE_ATT_WRITE);
+    switch (transaction_mode) {
+        case ATT_TRANSACTION_MODE_ACTIVE:
+            return nxmic_att_prepare(&att_table, att_handle, offset, buffer, buffer_size);
+        case ATT_TRANSACTION_MODE_VALIDATE:
+            return 0;
+        case ATT_TRANSACTION_MODE_EXECUTE:
+            return nxmic_att_execute(&att_table, connection_handle);
+        case ATT_TRANSACTION_MODE_CANCEL:
+            nxmic_att_cancel(&att_table);
+            return 0;
+        default:
+            return nxmic_att_write(&att_table, att_handle, connection_handle, buffer, buffer_size);
+    }
+}
+
+static void temp_sample_handler(int16_t sample) {
+    NXMIC_PROBE_SCOPE(NXMIC_PROBE_TEMP_SAMPLE);
+    current_temp = (uint16_t)sample;
+    temp_sampled = true;
+    temp_recording_add_sample(sample);
+}
+
+static const acquisition_output_t temp_output = {
+    .sample = temp_sample_handler,
+    .frame = stream_frame_handler,
+};
+
+bool temp_acquisition_start(void) {
+    return acquisition_start(TEMP_ADC_SAMPLE_RATE_HZ, &temp_output);
+}
+
+void publish_temp(void) {
+    int16_t centi = (int16_t)current_temp;
+    NXMIC_LOG_INFO("Write temp %c%d.%02d degc\n", centi < 0 ? '-' : '+', abs(centi) / 100, abs(centi) % 100);
+    if (le_notification_enabled) queue_legacy_temp();
+}
+
+// Notifications per CAN_SEND_NOW event and per connection event since the
+// previous stats, the connection events counted from the interval
+static void print_tx_stats(void) {
+    uint32_t now_us = time_us_32();
+    uint32_t period_us = now_us - tx_report_us;
+    uint32_t events = notifier.events - tx_report_events;
+    uint32_t notifications = notifier.notifications - tx_report_notifications;
+    tx_report_us = now_us;
+    tx_report_events = notifier.events;
+    tx_report_notifications = notifier.notifications;
+    const link_params_t *params = con_handle != HCI_CON_HANDLE_INVALID ? link_profile_get_params(con_handle) : NULL;
+    uint32_t conn_events = params && params->conn_interval ? period_us / (params->conn_interval * 1250u) : 0;
+    printf("tx: %lu notifications in %lu events, %lu.%02lu per event (max %lu, burst limit %d), %lu.%02lu per connection event\n",
+           (unsigned long)notifications, (unsigned long)events,
+           (unsigned long)(events ? notifications / events : 0), (unsigned long)(events ? notifications * 100 / events % 100 : 0),
+           (unsigned long)notifier.max_burst, NXMIC_TX_BURST,
+           (unsigned long)(conn_events ? notifications / conn_events : 0),
+           (unsigned long)(conn_events ? notifications * 100 / conn_events % 100 : 0));
+    const nxmic_txq_t *queue = &notifier.queue;
+    printf("tx queue: high water %u/%d, %lu replaced, %lu evicted, %lu rejected, %lu stale\n",
+           queue->high_water, NXMIC_TXQ_SLOTS, (unsigned long)queue->replaced, (unsigned long)queue->evicted,
+           (unsigned long)queue->rejected, (unsigned long)queue->aged);
+    notifier.max_burst = 0;
+}
+
+void print_stream_stats(void) {
+    const stream_stats_t *stats = &temp_stream_stats;
+    const adc_pipeline_stats_t *adc_stats = adc_pipeline_get_stats();
+    uint32_t cpu_permille = adc_pipeline_cpu_load_permille();
+    acquisition_stats_t acquisition;
+    acquisition_get_stats(&acquisition);
+    printf("adc: %lu samples/s, %lu blocks, %lu overruns, core%d %lu.%lu%%\n",
+           (unsigned long)adc_pipeline_sample_rate_hz(), (unsigned long)adc_stats->blocks,
+           (unsigned long)adc_stats->overruns, NXMIC_DUAL_CORE, (unsigned long)(cpu_permille / 10),
+           (unsigned long)(cpu_permille % 10));
+    printf("acquisition: %lu samples, %lu frames, results queued high water %lu, %lu dropped, %lu stale frames\n",
+           (unsigned long)acquisition.samples, (unsigned long)acquisition.frames,
+           (unsigned long)acquisition.ring_high_water, (unsigned long)acquisition.ring_overflows,
+           (unsigned long)acquisition.stale_frames);
+    if (acquisition.preview_samples) {
+        printf("preview: %lu samples at 1/%d of the ADC rate, %lu frames, %lu frames/%lu samples sent\n",
+               (unsigned long)acquisition.preview_samples, ACQUISITION_PREVIEW_FACTOR,
+               (unsigned long)acquisition.preview_frames, (unsigned long)preview_stream_stats.frames_sent,
+               (unsigned long)preview_stream_stats.samples_sent);
+    }
+    printf("async context latency: p50 %lu us, p99 %lu us, max %lu us\n",
+           (unsigned long)nxmic_histogram_quantile(&event_latency, 5000),
+           (unsigned long)nxmic_histogram_quantile(&event_latency, 9900), (unsigned long)event_latency.max);
+    nxmic_histogram_reset(&event_latency);
+    printf("schedule: %lu wakeups, %lu with several due, jitter p50 %lu us, p99 %lu us, max %lu us, %lu deadlines missed\n",
+           (unsigned long)schedule.wakeups, (unsigned long)schedule.bursts,
+           (unsigned long)nxmic_histogram_quantile(&schedule.jitter, 5000),
+           (unsigned long)nxmic_histogram_quantile(&schedule.jitter, 9900), (unsigned long)schedule.jitter.max,
+           (unsigned long)schedule.skipped);
+    nxmic_histogram_reset(&schedule.jitter);
+    nxmic_log_stats_t log_stats;
+    nxmic_log_get_stats(&log_stats);
+    printf("log: %lu records, %lu dropped\n", (unsigned long)log_stats.written, (unsigned long)log_stats.dropped);
+    printf("broadcast: sequence %u, every %lu ms, %s\n", broadcast.reading.sequence,
+           (unsigned long)adv_interval * 625 / 1000, adv_connected ? "non-connectable" : "connectable");
+    NXMIC_PROBE_REPORT();
+    NXMIC_PROBE_RESET();
+    if (con_handle != HCI_CON_HANDLE_INVALID) link_profile_print(con_handle);
+    if (recording_ready) {
+        const nxmic_store_stats_t *store_stats = &recording_store.stats;
+        printf("recording %u: %lu bytes, %lu pages programmed, %lu sectors erased, %lu segments recycled, %lu bytes dropped, %lu flash errors\n",
+               recording_store.active, (unsigned long)recording_store.active_length,
+               (unsigned long)store_stats->pages_programmed, (unsigned long)store_stats->sectors_erased,
+               (unsigned long)store_stats->segments_recycled, (unsigned long)store_stats->bytes_dropped,
+               (unsigned long)store_stats->flash_errors);
+    }
+    printf("export: recording %u, %lu bytes, %lu chunks/%lu bytes sent, %lu starts, %s\n",
+           export_recording, (unsigned long)export_sender.size, (unsigned long)export_sender.chunks_sent,
+           (unsigned long)export_sender.bytes_sent, (unsigned long)export_sender.starts,
+           export_uses_channel() ? "L2CAP channel" : "notifications");
+    print_tx_stats();
+    if (stats->frames_sent == 0) return;
+    // sample bytes vs. everything the notifications put on the link
+    uint32_t sample_bytes = stats->samples_sent * sizeof(int16_t);
+    uint32_t link_bytes = stats->bytes_sent + stats->frames_sent * NOTIFICATION_OVERHEAD;
+    uint32_t legacy_permille = 1000 * sizeof(int16_t) / (sizeof(int16_t) + NOTIFICATION_OVERHEAD);
+    printf("temp stream: %lu frames, %lu samples (%lu/frame), %lu dropped, payload efficiency %lu.%lu%% (2-byte notifications %lu.%lu%%)\n",
+           (unsigned long)stats->frames_sent, (unsigned long)stats->samples_sent,
+           (unsigned long)(stats->samples_sent / stats->frames_sent),
+           (unsigned long)(notifier.queue.evicted + notifier.queue.rejected + notifier.queue.aged),
+           (unsigned long)(1000 * sample_bytes / link_bytes / 10), (unsigned long)(1000 * sample_bytes / link_bytes % 10),
+           (unsigned long)(legacy_permille / 10), (unsigned long)(legacy_permille % 10));
+    printf("temp stream: %lu frames retransmitted, %lu requested after leaving the window\n",
+           (unsigned long)temp_retx->retransmitted, (unsigned long)temp_retx->expired);
+}
\ No newline at end of file
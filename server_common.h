@@ -8,15 +8,54 @@
 #define SERVER_COMMON_H_
 
 #define ADC_CHANNEL_TEMPSENSOR 4
+// Saturate the temperature stream with timestamped frames, see
+// nxmic_bench.h on the reader
+#ifndef NXMIC_BENCHMARK
+#define NXMIC_BENCHMARK 0
+#endif
+
+// Per-input ADC rate; each DMA block is averaged into one temperature sample
+#ifndef TEMP_ADC_SAMPLE_RATE_HZ
+#define TEMP_ADC_SAMPLE_RATE_HZ 1000
+#endif
+
+// Most notifications sent per ATT_EVENT_CAN_SEND_NOW, 0 for as many as the
+// controller has buffers for; 1 is how the sensor used to send
+#ifndef NXMIC_TX_BURST
+#define NXMIC_TX_BURST 0
+#endif
+
+// CHAR_FIRMWARE_VERSION
+#ifndef NXMIC_FIRMWARE_VERSION
+#define NXMIC_FIRMWARE_VERSION "0.1"
+#endif
+
+// Counters for a framed NxMic stream
+typedef struct {
+    uint32_t frames_sent;
+    uint32_t samples_sent;
+    uint32_t bytes_sent;      // ATT values, frame headers included
+} stream_stats_t;
 
 extern int le_notification_enabled;
+extern int temp_stream_enabled;
 extern hci_con_handle_t con_handle;
 extern uint16_t current_temp;
+extern stream_stats_t temp_stream_stats;
 extern uint8_t const profile_data[];
 
+// Handlers of the reads and writes, once att_server_init() set the profile
+void att_handlers_init(void);
 void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size);
 uint16_t att_read_callback(hci_con_handle_t connection_handle, uint16_t att_handle, uint16_t offset, uint8_t * buffer, uint16_t buffer_size);
 int att_write_callback(hci_con_handle_t connection_handle, uint16_t att_handle, uint16_t transaction_mode, uint16_t offset, uint8_t *buffer, uint16_t buffer_size);
-void poll_temp(void);
+bool temp_acquisition_start(void);
+void event_probe_start(void);
+void schedule_start(void);
+void publish_temp(void);
+void export_channel_init(void);
+void recording_init(void);
+void recording_service(void);
+void print_stream_stats(void);
 
 #endif
@@ -8,42 +8,23 @@
 #include "btstack.h"
 #include "pico/cyw43_arch.h"
 #include "pico/stdlib.h"
-#include "hardware/adc.h"
 
 #include "lwip/netif.h"
 #include "lwip/ip4_addr.h"
 #include "lwip/apps/lwiperf.h"
 
+#include "link_profile.h"
+#include "nxmic_log.h"
+#include "nxmic_probe.h"
 #include "server_common.h"
 
-#define HEARTBEAT_PERIOD_MS 1000
+// Main loop pass: takes buffered recording pages to flash and prints the
+// deferred log
+#define RECORDING_SERVICE_PERIOD_MS 50
+#define LOG_DRAIN_BATCH 32
 
-static void heartbeat_handler(async_context_t *context, async_at_time_worker_t *worker);
-
-static async_at_time_worker_t heartbeat_worker = { .do_work = heartbeat_handler };
 static btstack_packet_callback_registration_t hci_event_callback_registration;
 
-static void heartbeat_handler(async_context_t *context, async_at_time_worker_t *worker) {
-    static uint32_t counter = 0;
-    counter++;
-
-    // Update the temp every 10s
-    if (counter % 10 == 0) {
-        poll_temp();
-        if (le_notification_enabled) {
-            att_server_request_can_send_now_event(con_handle);
-        }
-    }
-
-    // Invert the led
-    static int led_on = true;
-    led_on = !led_on;
-    cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, led_on);
-
-    // Restart timer
-    async_context_add_at_time_worker_in_ms(context, &heartbeat_worker, HEARTBEAT_PERIOD_MS);
-}
-
 // Report IP results and exit
 static void iperf_report(void *arg, enum lwiperf_report_type report_type,
                          const ip_addr_t *local_addr, u16_t local_port, const ip_addr_t *remote_addr, u16_t remote_port,
@@ -60,6 +41,7 @@ static void iperf_report(void *arg, enum lwiperf_report_type report_type,
 
 int main() {
     stdio_init_all();
+    NXMIC_PROBE_INIT();
 
     // initialize CYW43 architecture
     //   - will enable BT if CYW43_ENABLE_BLUETOOTH == 1
@@ -69,14 +51,23 @@ int main() {
         return -1;
     }
 
-    // Initialise adc for the temp sensor
-    adc_init();
-    adc_select_input(ADC_CHANNEL_TEMPSENSOR);
-    adc_set_temp_sensor_enabled(true);
+    // Mount the flash recording store before the first sample arrives
+    recording_init();
+
+    // Free-running DMA acquisition of the temp sensor, with averaging and
+    // framing, on core1 unless NXMIC_DUAL_CORE is off
+    if (!temp_acquisition_start()) {
+        printf("failed to start acquisition\n");
+        return -1;
+    }
+    event_probe_start();
 
     l2cap_init();
     sm_init();
+    link_profile_init(LINK_PROFILE_HIGH_THROUGHPUT);
     att_server_init(profile_data, att_read_callback, att_write_callback);    
+    att_handlers_init();
+    export_channel_init();
 
     // inform about BTstack state
     hci_event_callback_registration.callback = &packet_handler;
@@ -85,8 +76,8 @@ int main() {
     // register for ATT event
     att_server_register_packet_handler(packet_handler);
 
-    // use an async worker for for the led
-    async_context_add_at_time_worker_in_ms(cyw43_arch_async_context(), &heartbeat_worker, HEARTBEAT_PERIOD_MS);
+    // temperature publishing, the led and the stats, each at its own rate
+    schedule_start();
 
     // Connect to Wi-Fi
     cyw43_arch_enable_sta_mode();
@@ -107,9 +98,13 @@ int main() {
     // turn on bluetooth!
     hci_power_control(HCI_POWER_ON);
 
-    // For threadsafe background we can just enter a loop
+    // For threadsafe background we can just enter a loop, it takes the
+    // recording to flash
     while(true) {
-        sleep_ms(1000);
+        recording_service();
+        nxmic_log_drain(LOG_DRAIN_BATCH);
+        NXMIC_PROBE_POLL();
+        sleep_ms(RECORDING_SERVICE_PERIOD_MS);
     }
 
     cyw43_arch_deinit();
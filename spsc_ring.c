@@ -0,0 +1,68 @@
+#include "spsc_ring.h"
+
+#include <string.h>
+
+static inline uint8_t *slot_at(const spsc_ring_t *ring, uint32_t position) {
+  return ring->storage + (size_t)(position & ring->mask) * ring->slot_size;
+}
+
+bool spsc_ring_init(spsc_ring_t *ring, void *storage, uint32_t slot_count,
+                    uint16_t max_payload) {
+  if (slot_count == 0 || (slot_count & (slot_count - 1)) != 0) return false;
+  ring->storage = (uint8_t *)storage;
+  ring->mask = slot_count - 1;
+  ring->slot_size = SPSC_RING_SLOT_HEADER_SIZE + max_payload;
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  ring->high_water = 0;
+  atomic_init(&ring->overflows, 0);
+  return true;
+}
+
+uint8_t *spsc_ring_claim(spsc_ring_t *ring) {
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  uint32_t used = head - tail;
+  if (used > ring->mask) {
+    atomic_fetch_add_explicit(&ring->overflows, 1, memory_order_relaxed);
+    return NULL;
+  }
+  if (used + 1 > ring->high_water) ring->high_water = used + 1;
+  return slot_at(ring, head) + SPSC_RING_SLOT_HEADER_SIZE;
+}
+
+void spsc_ring_publish(spsc_ring_t *ring, uint16_t length) {
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  uint8_t *slot = slot_at(ring, head);
+  slot[0] = (uint8_t)length;
+  slot[1] = (uint8_t)(length >> 8);
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+bool spsc_ring_push(spsc_ring_t *ring, const void *data, uint16_t length) {
+  if (length > spsc_ring_max_payload(ring)) return false;
+  uint8_t *payload = spsc_ring_claim(ring);
+  if (!payload) return false;
+  memcpy(payload, data, length);
+  spsc_ring_publish(ring, length);
+  return true;
+}
+
+uint32_t spsc_ring_available(spsc_ring_t *ring) {
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  return head - tail;
+}
+
+const uint8_t *spsc_ring_peek(const spsc_ring_t *ring, uint32_t index,
+                              uint16_t *length) {
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  const uint8_t *slot = slot_at(ring, tail + index);
+  *length = (uint16_t)(slot[0] | (slot[1] << 8));
+  return slot + SPSC_RING_SLOT_HEADER_SIZE;
+}
+
+void spsc_ring_release(spsc_ring_t *ring, uint32_t count) {
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+}
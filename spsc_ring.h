@@ -0,0 +1,62 @@
+#ifndef SPSC_RING_H_
+#define SPSC_RING_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Lock-free single-producer/single-consumer ring of fixed-size slots.
+//
+// The producer (e.g. a BTstack callback in IRQ context) claims a slot, fills
+// it in place and publishes it; the consumer (main loop or core1) reads a
+// batch of published slots and releases them in one go. head is only
+// written by the producer and tail only by the consumer, so no locks are
+// needed as long as there is exactly one of each.
+
+// Each slot starts with its payload length
+#define SPSC_RING_SLOT_HEADER_SIZE 2
+
+// Storage for slot_count slots of up to max_payload bytes each
+#define SPSC_RING_STORAGE_SIZE(slot_count, max_payload) \
+  ((slot_count) * (SPSC_RING_SLOT_HEADER_SIZE + (max_payload)))
+
+typedef struct {
+  uint8_t *storage;
+  uint32_t mask;       // slot_count - 1
+  uint16_t slot_size;  // header + max payload
+  atomic_uint head;    // next slot to publish, producer owned
+  atomic_uint tail;    // next slot to consume, consumer owned
+  uint32_t high_water;          // most slots ever in use, producer owned
+  atomic_uint overflows;        // claims refused because the ring was full
+} spsc_ring_t;
+
+// slot_count must be a power of two, storage at least
+// SPSC_RING_STORAGE_SIZE(slot_count, max_payload) bytes
+bool spsc_ring_init(spsc_ring_t *ring, void *storage, uint32_t slot_count,
+                    uint16_t max_payload);
+
+// Producer: returns the payload area of the next free slot, or NULL (and
+// counts an overflow) if the ring is full
+uint8_t *spsc_ring_claim(spsc_ring_t *ring);
+
+// Producer: make the claimed slot visible to the consumer
+void spsc_ring_publish(spsc_ring_t *ring, uint16_t length);
+
+// Producer: claim, copy and publish in one call
+bool spsc_ring_push(spsc_ring_t *ring, const void *data, uint16_t length);
+
+// Consumer: number of published slots ready to read
+uint32_t spsc_ring_available(spsc_ring_t *ring);
+
+// Consumer: payload of the index-th ready slot, index < available
+const uint8_t *spsc_ring_peek(const spsc_ring_t *ring, uint32_t index,
+                              uint16_t *length);
+
+// Consumer: hand count slots back to the producer
+void spsc_ring_release(spsc_ring_t *ring, uint32_t count);
+
+static inline uint16_t spsc_ring_max_payload(const spsc_ring_t *ring) {
+  return ring->slot_size - SPSC_RING_SLOT_HEADER_SIZE;
+}
+
+#endif
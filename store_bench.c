@@ -0,0 +1,270 @@
+// Host benchmark of the flash recording store (nxmic_store.h) on the file
+// flash emulator: sustained write bandwidth, mount time with the store
+// full, and recovery after power cuts at random points of the log.
+//
+//   nxmic_store_bench [-f image] [-s size_kb] [-S sector_size]
+//                     [-b append_bytes] [-c power_cuts]
+//
+// Flash times are virtual, from the typical NOR timings in flash_file.h;
+// the CPU times are this host's.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench_util.h"
+#include "flash_file.h"
+#include "nxmic_store.h"
+
+#define BENCH_PAGE_SIZE 256
+#define BENCH_MOUNTS 100
+#define BENCH_MAX_APPEND 1024
+
+static flash_file_t file;
+static nxmic_store_segment_t *segments;
+static nxmic_store_t store;
+static uint32_t random_state = 12345;
+
+static uint32_t next_random(void) {
+  random_state = random_state * 1103515245u + 12345u;
+  return random_state >> 8;
+}
+
+static uint8_t pattern_byte(uint16_t recording, uint32_t offset) {
+  return (uint8_t)(offset * 31 + (offset >> 8) + recording * 7);
+}
+
+static bool mount_store(void) {
+  uint32_t sectors = file.flash.size / file.flash.sector_size;
+  return nxmic_store_init(&store, &file.flash, segments, sectors) &&
+         nxmic_store_mount(&store);
+}
+
+// Append length bytes of the pattern, servicing the store whenever its page
+// buffers are full. Stops early if the flash loses power.
+static uint32_t write_recording(uint16_t recording, uint32_t offset,
+                                uint32_t length, uint32_t block,
+                                uint64_t *longest_service_ns) {
+  uint8_t data[BENCH_MAX_APPEND];
+  uint32_t written = 0;
+  while (written < length && !file.powered_off) {
+    uint32_t n = length - written < block ? length - written : block;
+    for (uint32_t i = 0; i < n; i++)
+      data[i] = pattern_byte(recording, offset + written + i);
+    while (!nxmic_store_append(&store, data, n) && !file.powered_off) {
+      uint64_t busy = file.busy_ns;
+      nxmic_store_service(&store, NXMIC_STORE_PAGE_BUFFERS);
+      if (longest_service_ns && file.busy_ns - busy > *longest_service_ns)
+        *longest_service_ns = file.busy_ns - busy;
+    }
+    written += n;
+  }
+  return written;
+}
+
+// Program every buffered page, then idle once for the erase ahead
+static void drain(void) {
+  while (nxmic_store_service(&store, NXMIC_STORE_PAGE_BUFFERS) &&
+         !file.powered_off) {
+  }
+  nxmic_store_service(&store, 0);
+}
+
+// Compare everything the store still has of recording with the pattern.
+// Returns the number of bytes checked, or -1 on a mismatch.
+static int64_t verify_recording(uint16_t recording, uint32_t first,
+                                uint32_t size) {
+  uint8_t data[BENCH_MAX_APPEND];
+  for (uint32_t offset = first; offset < size;) {
+    uint32_t n = nxmic_store_read(&store, recording, offset, data,
+                                  sizeof(data));
+    if (n == 0) return -1;
+    for (uint32_t i = 0; i < n; i++) {
+      if (data[i] != pattern_byte(recording, offset + i)) return -1;
+    }
+    offset += n;
+  }
+  return size - first;
+}
+
+static void erase_spread(uint32_t *min, uint32_t *max) {
+  uint32_t sectors = file.flash.size / file.flash.sector_size;
+  *min = UINT32_MAX;
+  *max = 0;
+  for (uint32_t i = 0; i < sectors; i++) {
+    if (file.erase_counts[i] < *min) *min = file.erase_counts[i];
+    if (file.erase_counts[i] > *max) *max = file.erase_counts[i];
+  }
+}
+
+static bool bench_write(uint32_t block) {
+  nxmic_store_info_t info;
+  if (!flash_file_wipe(&file) || !mount_store()) return false;
+  nxmic_store_get_info(&store, &info);
+  // three laps of the log, so every sector is recycled
+  uint32_t length = 3 * info.capacity_bytes;
+  uint64_t busy = file.busy_ns;
+  uint32_t programs = file.programs, erases = file.erases;
+  uint64_t longest_ns = 0;
+  uint64_t start = bench_now_ns();
+  uint16_t recording = nxmic_store_begin(&store);
+  write_recording(recording, 0, length, block, &longest_ns);
+  nxmic_store_end(&store);
+  drain();
+  uint64_t cpu = bench_now_ns() - start;
+  double flash_s = (file.busy_ns - busy) / 1e9;
+  uint32_t erase_min, erase_max;
+  erase_spread(&erase_min, &erase_max);
+  printf("write: %u kB in %u-byte appends, %.2f s of flash time, %.1f kB/s "
+         "sustained (%u pages, %u erases), longest service %.1f ms, "
+         "cpu %.1f ns/byte\n",
+         length / 1024, block, flash_s, length / 1024.0 / flash_s,
+         file.programs - programs, file.erases - erases, longest_ns / 1e6,
+         (double)cpu / length);
+  printf("wear: erase counts %u..%u over %u sectors, %u segments recycled\n",
+         erase_min, erase_max, store.sector_count,
+         store.stats.segments_recycled);
+
+  nxmic_store_get_info(&store, &info);
+  uint32_t size = nxmic_store_size(&store, recording);
+  int64_t checked = verify_recording(recording, size - info.used_bytes, size);
+  printf("read back: %s, last %u kB of %u kB kept\n",
+         checked < 0 ? "MISMATCH" : "ok", info.used_bytes / 1024,
+         size / 1024);
+  return checked >= 0;
+}
+
+// Mount the full store left by bench_write()
+static bool bench_mount(void) {
+  uint64_t busy = file.busy_ns;
+  uint64_t start = bench_now_ns();
+  for (int i = 0; i < BENCH_MOUNTS; i++) {
+    if (!mount_store()) return false;
+  }
+  uint64_t cpu = (bench_now_ns() - start) / BENCH_MOUNTS;
+  double flash_ms = (file.busy_ns - busy) / 1e6 / BENCH_MOUNTS;
+  double scan_ms = (FLASH_FILE_READ_SETUP_NS +
+                    (double)file.flash.size * FLASH_FILE_READ_NS_PER_BYTE) /
+                   1e6;
+  nxmic_store_info_t info;
+  nxmic_store_get_info(&store, &info);
+  printf("mount (full, %u kB of %u kB used): %u reads, %u bytes, %.2f ms of "
+         "flash time (reading the whole flash: %.1f ms), cpu %.1f us\n",
+         info.used_bytes / 1024, info.capacity_bytes / 1024,
+         store.stats.mount_reads, store.stats.mount_bytes, flash_ms, scan_ms,
+         cpu / 1e3);
+  return info.used_bytes == info.capacity_bytes;
+}
+
+// Power is cut at a random flash operation while a recording is written;
+// after the reboot every page that was programmed must be back, intact
+static bool bench_power_cuts(int cuts, uint32_t block) {
+  int recovered = 0;
+  for (int i = 0; i < cuts; i++) {
+    if (!flash_file_wipe(&file) || !mount_store()) return false;
+    nxmic_store_info_t info;
+    nxmic_store_get_info(&store, &info);
+    // a few recordings in, then the cut somewhere in the next lap
+    for (int r = 0; r < 3; r++) {
+      uint16_t recording = nxmic_store_begin(&store);
+      write_recording(recording, 0, next_random() % info.capacity_bytes / 2,
+                      block, NULL);
+    }
+    drain();
+    uint16_t recording = nxmic_store_begin(&store);
+    file.cut_after = 1 + (int32_t)(next_random() % (2 * store.sector_count *
+                                                    store.pages_per_sector));
+    write_recording(recording, 0, 2 * info.capacity_bytes, block, NULL);
+    drain();
+    // pages in flash when the power went
+    uint32_t durable = 0, first = UINT32_MAX;
+    for (uint32_t s = 0; s < store.sector_count; s++) {
+      const nxmic_store_segment_t *segment = &store.segments[s];
+      if (segment->sequence == 0 || segment->recording != recording) continue;
+      if (segment->offset + segment->length > durable)
+        durable = segment->offset + segment->length;
+      if (segment->offset < first) first = segment->offset;
+    }
+    file.cut_after = -1;
+    file.powered_off = false;
+    if (!mount_store()) return false;
+    uint32_t size = nxmic_store_size(&store, recording);
+    if (durable == 0) {
+      recovered++;
+      continue;
+    }
+    int64_t checked = verify_recording(recording, first, size);
+    if (checked < 0 || size < durable) {
+      printf("power cut %d: recording %u back with %u of %u bytes%s\n", i,
+             recording, size, durable, checked < 0 ? ", data MISMATCH" : "");
+      continue;
+    }
+    recovered++;
+  }
+  printf("power cuts: %d/%d recordings recovered with every programmed "
+         "page intact\n",
+         recovered, cuts);
+  return recovered == cuts;
+}
+
+int main(int argc, char **argv) {
+  const char *path = "nxmic_store.img";
+  uint32_t size = 1024 * 1024;
+  uint32_t sector_size = 4096;
+  uint32_t block = 512;
+  int cuts = 50;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "f:s:S:b:c:")) != -1) {
+    switch (opt) {
+      case 'f':
+        path = optarg;
+        break;
+      case 's':
+        size = (uint32_t)atoi(optarg) * 1024;
+        break;
+      case 'S':
+        sector_size = (uint32_t)atoi(optarg);
+        break;
+      case 'b':
+        block = (uint32_t)atoi(optarg);
+        break;
+      case 'c':
+        cuts = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr,
+                "usage: %s [-f image] [-s size_kb] [-S sector_size] "
+                "[-b append_bytes] [-c power_cuts]\n",
+                argv[0]);
+        return 2;
+    }
+  }
+  if (block == 0 || block > BENCH_MAX_APPEND || cuts < 0 ||
+      sector_size < BENCH_PAGE_SIZE || size < 2 * sector_size ||
+      size % sector_size != 0) {
+    fprintf(stderr, "invalid store parameters\n");
+    return 2;
+  }
+
+  if (!flash_file_open(&file, path, size, sector_size, BENCH_PAGE_SIZE)) {
+    fprintf(stderr, "cannot open %s\n", path);
+    return 1;
+  }
+  segments = calloc(size / sector_size, sizeof(*segments));
+  if (!segments || !mount_store()) {
+    fprintf(stderr, "cannot set up the store\n");
+    return 1;
+  }
+  printf("flash: %u kB, %u-byte sectors, %u-byte pages, %u data bytes per "
+         "segment (%.1f%%)\n",
+         size / 1024, sector_size, BENCH_PAGE_SIZE, store.segment_capacity,
+         100.0 * store.segment_capacity / sector_size);
+
+  bool ok = bench_write(block) && bench_mount() &&
+            bench_power_cuts(cuts, block);
+  flash_file_close(&file);
+  free(segments);
+  return ok ? 0 : 1;
+}
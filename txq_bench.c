@@ -0,0 +1,308 @@
+// Host simulation of the sensor's notification queue (nxmic_txq.h) drained
+// the way server_common.c does on ATT_EVENT_CAN_SEND_NOW, back to back
+// while the controller has an ACL buffer free (NXMIC_TX_BURST 0), against
+// one notification per event (NXMIC_TX_BURST 1), in virtual time: events
+// and notifications per event, throughput, what the queue dropped and the
+// latency from a frame being queued to its connection event.
+//
+//   nxmic_txq_bench [-t seconds] [-i interval_us] [-p pdus_per_event]
+//                   [-b acl_buffers] [-d event_us]
+//
+// The temperature stream (normal priority) and the preview (low) are
+// offered at 25% to 150% of what the link carries, two frames to one, with
+// the 2-byte reading (high, replaced) once a second. The controller holds
+// acl_buffers notifications and sends up to pdus_per_event of them at each
+// connection event. A CAN_SEND_NOW comes event_us after it was asked for
+// and there is a buffer free, a pass of the run loop; set it from the async
+// context latency the sensor's stats print. The clock starts 5 s before
+// the 32-bit wrap. Exits non-zero if a stream goes out of order or a frame
+// is not accounted for.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nxmic_txq.h"
+
+#define BENCH_TEMP_HANDLE 0x0010
+#define BENCH_PREVIEW_HANDLE 0x0020
+#define BENCH_READING_HANDLE 0x0030
+#define BENCH_FRAME_SIZE 244      // Full frames on a 247-byte MTU
+#define BENCH_MAX_AGE_US 2000000  // TEMP_FRAME_MAX_AGE_US, server_common.c
+#define BENCH_READING_INTERVAL_US 1000000
+#define BENCH_START_US (UINT32_MAX - 5000000u)
+#define BENCH_MAX_BUFFERS 32
+#define BENCH_NEVER UINT64_MAX
+
+typedef struct {
+  uint16_t handle;
+  nxmic_txq_priority_t priority;
+  bool replace;
+  uint32_t max_age_us;
+  uint16_t length;
+  double period_us;
+  double next_us;
+  uint32_t sequence;       // Next one to queue
+  uint32_t last_sent;      // Sequence + 1 of the last one sent, 0 if none
+  uint32_t produced;
+  uint32_t rejected;
+  uint32_t delivered;
+  bool out_of_order;
+} bench_stream_t;
+
+typedef struct {
+  uint16_t handle;
+  uint32_t queued_us;
+} bench_buffer_t;
+
+typedef struct {
+  uint32_t events;
+  uint32_t notifications;
+  uint32_t max_burst;
+  uint64_t latency_us;
+  uint32_t max_latency_us;
+  uint32_t delivered;
+  bool failed;
+} bench_result_t;
+
+static bench_stream_t streams[3];
+static bench_buffer_t buffers[BENCH_MAX_BUFFERS];
+static int buffer_head, buffer_count;
+
+static uint32_t get_le32(const uint8_t *p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+  for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static bench_stream_t *stream_of(uint16_t handle) {
+  for (int s = 0; s < 3; s++) {
+    if (streams[s].handle == handle) return &streams[s];
+  }
+  return NULL;
+}
+
+static void init_streams(double frames_per_s) {
+  streams[0] = (bench_stream_t){.handle = BENCH_TEMP_HANDLE,
+                                .priority = NXMIC_TXQ_PRIORITY_NORMAL,
+                                .max_age_us = BENCH_MAX_AGE_US,
+                                .length = BENCH_FRAME_SIZE,
+                                .period_us = 1e6 / (frames_per_s * 2 / 3)};
+  streams[1] = (bench_stream_t){.handle = BENCH_PREVIEW_HANDLE,
+                                .priority = NXMIC_TXQ_PRIORITY_LOW,
+                                .max_age_us = BENCH_MAX_AGE_US,
+                                .length = BENCH_FRAME_SIZE,
+                                .period_us = 1e6 / (frames_per_s / 3)};
+  streams[2] = (bench_stream_t){.handle = BENCH_READING_HANDLE,
+                                .priority = NXMIC_TXQ_PRIORITY_HIGH,
+                                .replace = true,
+                                .length = 4,  // Room for the sequence
+                                .period_us = BENCH_READING_INTERVAL_US};
+  for (int s = 0; s < 3; s++) streams[s].next_us = streams[s].period_us / 2;
+}
+
+// A value stamped with its stream's sequence number
+static bool produce(nxmic_txq_t *queue, bench_stream_t *stream,
+                    uint32_t now_us) {
+  uint8_t value[BENCH_FRAME_SIZE] = {0};
+  put_le32(value, stream->sequence);
+  stream->sequence++;
+  stream->produced++;
+  if (!nxmic_txq_push(queue, stream->handle, stream->priority,
+                      stream->replace, stream->max_age_us, value,
+                      stream->length, BENCH_START_US + now_us)) {
+    stream->rejected++;
+    return false;
+  }
+  return true;
+}
+
+// server_common.c's send_notifications() with att_server_notify() handing
+// the value to the controller; returns true if more is left
+static bool send_notifications(nxmic_txq_t *queue, uint32_t burst_limit,
+                               int acl_buffers, uint32_t now_us,
+                               bench_result_t *result) {
+  uint32_t burst = 0;
+  while ((burst_limit == 0 || burst < burst_limit) &&
+         buffer_count < acl_buffers) {
+    const nxmic_txq_entry_t *entry =
+        nxmic_txq_peek(queue, BENCH_START_US + now_us);
+    if (!entry) break;
+    bench_stream_t *stream = stream_of(entry->handle);
+    uint32_t sequence = get_le32(entry->value);
+    if (sequence < stream->last_sent) stream->out_of_order = true;
+    stream->last_sent = sequence + 1;
+    bench_buffer_t *buffer =
+        &buffers[(buffer_head + buffer_count++) % BENCH_MAX_BUFFERS];
+    buffer->handle = entry->handle;
+    buffer->queued_us = entry->queued_us;
+    nxmic_txq_pop(queue, entry);
+    burst++;
+  }
+  result->events++;
+  result->notifications += burst;
+  if (burst > result->max_burst) result->max_burst = burst;
+  return queue->count != 0;
+}
+
+// One connection event: the controller sends what it holds, oldest first
+static void connection_event(int pdus_per_event, uint32_t now_us,
+                             bench_result_t *result) {
+  for (int p = 0; p < pdus_per_event && buffer_count; p++) {
+    bench_buffer_t *buffer = &buffers[buffer_head];
+    buffer_head = (buffer_head + 1) % BENCH_MAX_BUFFERS;
+    buffer_count--;
+    uint32_t latency_us = BENCH_START_US + now_us - buffer->queued_us;
+    result->latency_us += latency_us;
+    if (latency_us > result->max_latency_us) result->max_latency_us = latency_us;
+    result->delivered++;
+    stream_of(buffer->handle)->delivered++;
+  }
+}
+
+static bench_result_t simulate(double frames_per_s, uint32_t burst_limit,
+                               uint64_t duration_us, uint32_t interval_us,
+                               int pdus_per_event, int acl_buffers,
+                               uint32_t event_us) {
+  static nxmic_txq_t queue;
+  bench_result_t result = {0};
+  nxmic_txq_init(&queue);
+  init_streams(frames_per_s);
+  buffer_head = buffer_count = 0;
+  uint64_t next_connection_us = interval_us;
+  uint64_t host_free_us = 0;  // End of the last CAN_SEND_NOW handled
+  bool requested = false;
+  uint64_t now_us = 0;
+  while (now_us < duration_us) {
+    uint64_t next_us = next_connection_us;
+    for (int s = 0; s < 3; s++) {
+      uint64_t due_us = (uint64_t)ceil(streams[s].next_us);
+      if (due_us < next_us) next_us = due_us;
+    }
+    uint64_t can_send_us = BENCH_NEVER;
+    if (requested && buffer_count < acl_buffers)
+      can_send_us = host_free_us > now_us ? host_free_us : now_us;
+    if (can_send_us < next_us) next_us = can_send_us;
+    now_us = next_us;
+
+    for (int s = 0; s < 3; s++) {
+      while (streams[s].next_us <= now_us) {
+        produce(&queue, &streams[s], (uint32_t)now_us);
+        streams[s].next_us += streams[s].period_us;
+        requested = true;
+      }
+    }
+    if (now_us >= next_connection_us) {
+      connection_event(pdus_per_event, (uint32_t)now_us, &result);
+      next_connection_us += interval_us;
+    }
+    if (now_us == can_send_us) {
+      requested = send_notifications(&queue, burst_limit, acl_buffers,
+                                     (uint32_t)now_us, &result);
+      // The next event is at least a pass of the run loop away
+      host_free_us = now_us + event_us;
+    } else if (requested && buffer_count < acl_buffers &&
+               host_free_us <= now_us) {
+      // Asked for with a buffer free: BTstack answers on its next pass
+      host_free_us = now_us + event_us;
+    }
+  }
+
+  // Every value queued was sent, aged out, evicted, replaced or is still
+  // queued, and every one sent was delivered or is still in a buffer
+  uint32_t produced = 0, rejected = 0;
+  for (int s = 0; s < 3; s++) {
+    produced += streams[s].produced;
+    rejected += streams[s].rejected;
+    if (streams[s].out_of_order) {
+      printf("FAILED: handle 0x%04x sent out of order\n", streams[s].handle);
+      result.failed = true;
+    }
+  }
+  if (queue.queued != produced - rejected ||
+      queue.queued != queue.sent + queue.aged + queue.evicted +
+                          queue.replaced + queue.count ||
+      queue.sent != result.delivered + (uint32_t)buffer_count ||
+      queue.sent != result.notifications) {
+    printf("FAILED: %u produced, %u rejected, %u queued, %u sent, %u aged, "
+           "%u evicted, %u replaced, %u left; %u delivered, %d in buffers\n",
+           produced, rejected, queue.queued, queue.sent, queue.aged,
+           queue.evicted, queue.replaced, queue.count, result.delivered,
+           buffer_count);
+    result.failed = true;
+  }
+  double seconds = duration_us / 1e6;
+  printf("  burst %-9s %8.0f events/s %5.2f notif/event (max %2u) "
+         "%7.1f notif/s  latency %6.1f ms (max %6.1f)  aged %u evicted %u "
+         "rejected %u\n",
+         burst_limit ? "1" : "unlimited", result.events / seconds,
+         result.events ? (double)result.notifications / result.events : 0,
+         result.max_burst, result.delivered / seconds,
+         result.delivered ? result.latency_us / 1e3 / result.delivered : 0,
+         result.max_latency_us / 1e3, queue.aged, queue.evicted,
+         queue.rejected);
+  return result;
+}
+
+int main(int argc, char **argv) {
+  uint32_t seconds = 60;
+  uint32_t interval_us = 7500;
+  int pdus_per_event = 6;
+  int acl_buffers = 8;
+  uint32_t event_us = 200;
+  int opt;
+  while ((opt = getopt(argc, argv, "t:i:p:b:d:")) != -1) {
+    switch (opt) {
+      case 't':
+        seconds = (uint32_t)atoi(optarg);
+        break;
+      case 'i':
+        interval_us = (uint32_t)atoi(optarg);
+        break;
+      case 'p':
+        pdus_per_event = atoi(optarg);
+        break;
+      case 'b':
+        acl_buffers = atoi(optarg);
+        break;
+      case 'd':
+        event_us = (uint32_t)atoi(optarg);
+        break;
+      default:
+        fprintf(stderr,
+                "usage: %s [-t seconds] [-i interval_us] [-p pdus_per_event] "
+                "[-b acl_buffers] [-d event_us]\n",
+                argv[0]);
+        return 2;
+    }
+  }
+  if (seconds == 0 || interval_us == 0 || pdus_per_event <= 0 ||
+      acl_buffers <= 0 || acl_buffers > BENCH_MAX_BUFFERS) {
+    fprintf(stderr, "invalid duration, interval, PDU or buffer count\n");
+    return 2;
+  }
+
+  static const int loads[] = {25, 50, 90, 150};
+  double capacity = 1e6 * pdus_per_event / interval_us;
+  printf("%u us interval, %d notifications per event (%.0f/s), %d ACL "
+         "buffers, CAN_SEND_NOW %u us after the request\n",
+         interval_us, pdus_per_event, capacity, acl_buffers, event_us);
+  int failed = 0;
+  for (size_t l = 0; l < sizeof(loads) / sizeof(loads[0]); l++) {
+    printf("%d%% offered (%.0f frames/s):\n", loads[l],
+           capacity * loads[l] / 100);
+    uint64_t duration_us = (uint64_t)seconds * 1000000;
+    bench_result_t one =
+        simulate(capacity * loads[l] / 100, 1, duration_us, interval_us,
+                 pdus_per_event, acl_buffers, event_us);
+    bench_result_t unlimited =
+        simulate(capacity * loads[l] / 100, 0, duration_us, interval_us,
+                 pdus_per_event, acl_buffers, event_us);
+    failed |= one.failed || unlimited.failed;
+  }
+  return failed;
+}
@@ -0,0 +1,254 @@
+// Host end of the BLE-to-UDP gateway (nxmic_gateway.h): receives the
+// gateway's datagrams, acks each one so the gateway can time the network
+// leg, and checks the stream that comes out: datagram sequence, entry
+// framing, NxMic frames and codecs, frame loss per stream.
+//
+//   nxmic_udp_sink [-p port] [-s report_period_s] [-t seconds]
+//
+// Runs until interrupted, or for seconds if given. Works with
+// picow_ble_gateway on the board and with nxmic_host_sim -g on this host.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nxmic_codec.h"
+#include "nxmic_frame.h"
+#include "nxmic_gateway.h"
+#include "nxmic_gatt.h"
+#include "nxmic_retransmit.h"
+
+#define SINK_DEFAULT_PORT 5401
+#define SINK_MAX_LINKS 8
+// A sequence this far behind the expected one is a restarted gateway
+#define SINK_RESTART_DISTANCE 1024
+
+typedef struct {
+  uint64_t frames;
+  uint64_t samples;
+  uint64_t payload_bytes;
+  uint64_t corrupt;  // Frame or codec did not parse
+  nxmic_gap_tracker_t gaps;
+  uint32_t connection;  // Of the link, the sequence restarts with a new one
+} sink_stream_t;
+
+typedef struct {
+  uint64_t datagrams;
+  uint64_t entries;
+  uint64_t bytes;  // UDP payload
+  uint64_t lost;       // Datagrams skipped in the sequence
+  uint64_t reordered;  // Arrived after a later one
+  uint64_t malformed;
+  uint64_t restarts;
+} sink_stats_t;
+
+static const char *const stream_names[CHAR_COUNT] = {
+    [CHAR_IMU_STREAMING] = "imu",
+    [CHAR_TEMPERATURE_STREAMING] = "temp",
+    [CHAR_STETHOSCOPE_STREAMING] = "steth",
+    [CHAR_STETHOSCOPE_PREVIEW_STREAMING] = "steth-preview",
+    [CHAR_ECG_STREAMING] = "ecg",
+    [CHAR_DATA_EXPORT] = "export",
+};
+
+static sink_stream_t streams[SINK_MAX_LINKS][CHAR_COUNT];
+static sink_stats_t stats;
+static sink_stats_t reported;  // stats at the previous report
+static bool synced;
+static uint32_t next_sequence;
+
+static uint64_t monotonic_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void check_sequence(uint32_t sequence) {
+  int32_t ahead = (int32_t)(sequence - next_sequence);
+  if (synced && ahead < -SINK_RESTART_DISTANCE) {
+    stats.restarts++;
+    synced = false;
+  }
+  if (!synced || ahead >= 0) {
+    if (synced) stats.lost += (uint32_t)ahead;
+    synced = true;
+    next_sequence = sequence + 1;
+    return;
+  }
+  // counted as lost when the later one came in
+  stats.reordered++;
+  if (stats.lost) stats.lost--;
+}
+
+static void sink_entry(const nxmic_gateway_entry_t *entry,
+                       const uint8_t *value) {
+  static int16_t decoded[NXMIC_CODEC_MAX_SAMPLES];
+  if (entry->link >= SINK_MAX_LINKS || entry->char_id >= CHAR_COUNT) {
+    stats.malformed++;
+    return;
+  }
+  sink_stream_t *stream = &streams[entry->link][entry->char_id];
+  if (stream->connection != entry->connection) {
+    nxmic_gap_reset(&stream->gaps);
+    stream->connection = entry->connection;
+  }
+  nxmic_frame_header_t frame;
+  const uint8_t *payload;
+  uint16_t payload_length;
+  if (!nxmic_frame_parse(value, entry->length, &frame, &payload,
+                         &payload_length)) {
+    stream->corrupt++;
+    return;
+  }
+  if (!nxmic_gap_on_frame(&stream->gaps, frame.sequence)) return;
+  int count = nxmic_codec_decode(&frame, payload, payload_length, decoded,
+                                 NXMIC_CODEC_MAX_SAMPLES);
+  if (count < 0) {
+    stream->corrupt++;
+    return;
+  }
+  stream->frames++;
+  stream->samples += (uint64_t)count;
+  stream->payload_bytes += payload_length;
+}
+
+// The entries of a datagram must add up to it exactly
+static bool entries_fit(const uint8_t *datagram, uint16_t length, int count) {
+  uint16_t offset = NXMIC_GATEWAY_HEADER_SIZE;
+  for (int i = 0; i < count; i++) {
+    nxmic_gateway_entry_t entry;
+    if (length - offset < (int)sizeof(entry)) return false;
+    memcpy(&entry, datagram + offset, sizeof(entry));
+    offset += sizeof(entry);
+    if (length - offset < entry.length) return false;
+    offset += entry.length;
+  }
+  return offset == length;
+}
+
+static bool sink_datagram(const uint8_t *datagram, uint16_t length) {
+  uint32_t sequence, sent_us;
+  int count = nxmic_gateway_parse_header(datagram, length, &sequence,
+                                         &sent_us);
+  if (count <= 0 || !entries_fit(datagram, length, count)) return false;
+  uint16_t offset = NXMIC_GATEWAY_HEADER_SIZE;
+  for (int i = 0; i < count; i++) {
+    nxmic_gateway_entry_t entry;
+    memcpy(&entry, datagram + offset, sizeof(entry));
+    offset += sizeof(entry);
+    sink_entry(&entry, datagram + offset);
+    offset += entry.length;
+  }
+  check_sequence(sequence);
+  stats.datagrams++;
+  stats.entries += (uint64_t)count;
+  stats.bytes += length;
+  return true;
+}
+
+static void print_report(uint64_t period_us) {
+  double seconds = period_us / 1e6;
+  printf("sink: %.0f datagrams/s, %.0f entries/s, %.0f B/s UDP payload, "
+         "%lu lost, %lu reordered, %lu malformed, %lu gateway restarts\n",
+         (stats.datagrams - reported.datagrams) / seconds,
+         (stats.entries - reported.entries) / seconds,
+         (stats.bytes - reported.bytes) / seconds, (unsigned long)stats.lost,
+         (unsigned long)stats.reordered, (unsigned long)stats.malformed,
+         (unsigned long)stats.restarts);
+  reported = stats;
+  for (int l = 0; l < SINK_MAX_LINKS; l++) {
+    for (int c = 0; c < CHAR_COUNT; c++) {
+      const sink_stream_t *stream = &streams[l][c];
+      if (stream->frames == 0 && stream->corrupt == 0) continue;
+      printf("[%d] %-13s %lu frames/%lu samples, %lu payload bytes, "
+             "%lu lost frames (%lu recovered), %lu duplicates, %lu corrupt\n",
+             l, stream_names[c] ? stream_names[c] : "?",
+             (unsigned long)stream->frames, (unsigned long)stream->samples,
+             (unsigned long)stream->payload_bytes,
+             (unsigned long)stream->gaps.gaps,
+             (unsigned long)stream->gaps.recovered,
+             (unsigned long)stream->gaps.duplicates,
+             (unsigned long)stream->corrupt);
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  uint16_t port = SINK_DEFAULT_PORT;
+  uint32_t report_period_s = 10;
+  uint32_t seconds = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "p:s:t:")) != -1) {
+    switch (opt) {
+      case 'p':
+        port = (uint16_t)atoi(optarg);
+        break;
+      case 's':
+        report_period_s = (uint32_t)atoi(optarg);
+        break;
+      case 't':
+        seconds = (uint32_t)atoi(optarg);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-p port] [-s report_period_s] "
+                        "[-t seconds]\n",
+                argv[0]);
+        return 2;
+    }
+  }
+  if (port == 0 || report_period_s == 0) {
+    fprintf(stderr, "invalid options\n");
+    return 2;
+  }
+
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  struct sockaddr_in address = {
+      .sin_family = AF_INET,
+      .sin_port = htons(port),
+      .sin_addr.s_addr = htonl(INADDR_ANY),
+  };
+  if (fd < 0 ||
+      bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+    perror("bind");
+    return 1;
+  }
+  // wake up for the reports even when nothing comes in
+  struct timeval timeout = {.tv_sec = 0, .tv_usec = 100000};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  for (int l = 0; l < SINK_MAX_LINKS; l++) {
+    for (int c = 0; c < CHAR_COUNT; c++) nxmic_gap_init(&streams[l][c].gaps);
+  }
+  printf("sink: listening on UDP port %u\n", port);
+
+  uint64_t start_us = monotonic_us();
+  uint64_t report_us = start_us;
+  static uint8_t datagram[NXMIC_GATEWAY_MAX_DATAGRAM];
+  while (!seconds || monotonic_us() - start_us < (uint64_t)seconds * 1000000) {
+    struct sockaddr_in from;
+    socklen_t from_length = sizeof(from);
+    ssize_t length = recvfrom(fd, datagram, sizeof(datagram), 0,
+                              (struct sockaddr *)&from, &from_length);
+    if (length > 0) {
+      if (sink_datagram(datagram, (uint16_t)length)) {
+        datagram[3] = 0;  // the ack is the header with no entries
+        sendto(fd, datagram, NXMIC_GATEWAY_ACK_SIZE, 0,
+               (struct sockaddr *)&from, from_length);
+      } else {
+        stats.malformed++;
+      }
+    }
+    uint64_t now_us = monotonic_us();
+    if (now_us - report_us >= (uint64_t)report_period_s * 1000000) {
+      print_report(now_us - report_us);
+      report_us = now_us;
+    }
+  }
+  print_report(monotonic_us() - report_us);
+  close(fd);
+  return 0;
+}
@@ -0,0 +1,467 @@
+#include "virtual_link.h"
+
+#include <string.h>
+
+// Handles below the NxMic service belong to the GAP and GATT services
+#define FIRST_SERVICE_HANDLE 0x0010
+
+// Read By Type response entries: handle + properties + value handle + UUID
+#define CHARACTERISTIC_ENTRY_SIZE (2 + 1 + 2 + 16)
+// Read By Type response entries for CCCDs: handle + 16-bit value
+#define CCCD_ENTRY_SIZE (2 + 2)
+
+#define L2CAP_HEADER_SIZE 4
+#define SDU_LENGTH_SIZE 2
+#define ATT_NOTIFICATION_HEADER_SIZE 3
+// Access address, LL header and CRC around every PDU payload
+#define LL_PDU_OVERHEAD (4 + 2 + 3)
+#define T_IFS_US 150
+
+static void reverse_128_bytes(const uint8_t *src, uint8_t *dst) {
+  for (int i = 0; i < 16; i++) dst[i] = src[15 - i];
+}
+
+// nxmic_gatt.h's GATT_CHAR_* flags as the characteristic declaration
+// carries them
+static uint8_t declaration_properties(uint8_t flags) {
+  static const uint8_t bits[][2] = {
+      {GATT_CHAR_READ, 0x02},
+      {GATT_CHAR_WRITE_WITHOUT_RESPONSE, 0x04},
+      {GATT_CHAR_WRITE, 0x08},
+      {GATT_CHAR_NOTIFY, 0x10},
+      {GATT_CHAR_INDICATE, 0x20},
+  };
+  uint8_t properties = 0;
+  for (size_t i = 0; i < sizeof(bits) / sizeof(bits[0]); i++) {
+    if (flags & bits[i][0]) properties |= bits[i][1];
+  }
+  return properties;
+}
+
+// Stand-in for the AES-CMAC Database Hash: anything that changes with the
+// layout of the database will do for the client's cache check
+static void compute_database_hash(virtual_link_t *link) {
+  uint64_t hash = 0xcbf29ce484222325ull;  // FNV-1a
+  for (int i = 0; i < CHAR_COUNT; i++) {
+    const virtual_link_characteristic_t *c = &link->characteristics[i];
+    const uint8_t fields[] = {(uint8_t)c->start_handle,
+                              (uint8_t)(c->start_handle >> 8), c->properties};
+    for (size_t j = 0; j < sizeof(fields); j++) {
+      hash = (hash ^ fields[j]) * 0x100000001b3ull;
+    }
+    for (int j = 0; j < 16; j++) {
+      hash = (hash ^ c->uuid128[j]) * 0x100000001b3ull;
+    }
+  }
+  for (int i = 0; i < 16; i++) {
+    hash = (hash ^ (uint64_t)i) * 0x100000001b3ull;
+    link->database_hash[i] = (uint8_t)(hash >> 56);
+  }
+}
+
+void virtual_link_init(virtual_link_t *link,
+                       const virtual_link_config_t *config) {
+  memset(link, 0, sizeof(*link));
+  link->config = *config;
+  link->random_state = 0x2545f491;
+  if (link->config.mtu > NXMIC_FRAME_MAX_SIZE + ATT_NOTIFICATION_HEADER_SIZE)
+    link->config.mtu = NXMIC_FRAME_MAX_SIZE + ATT_NOTIFICATION_HEADER_SIZE;
+
+  uint16_t handle = FIRST_SERVICE_HANDLE;
+  link->service_start = handle++;
+  for (int i = 0; i < nxmic_gatt_service.num_characteristics; i++) {
+    const gatt_characteristic_t *src = &nxmic_gatt_service.characteristics[i];
+    if (src->char_id >= CHAR_COUNT) continue;
+    virtual_link_characteristic_t *c = &link->characteristics[src->char_id];
+    reverse_128_bytes(src->uuid128, c->uuid128);
+    c->properties = declaration_properties(src->properties);
+    c->start_handle = handle++;
+    c->value_handle = handle++;
+    if (src->properties & (GATT_CHAR_NOTIFY | GATT_CHAR_INDICATE))
+      c->cccd_handle = handle++;
+    c->end_handle = handle - 1;
+  }
+  link->service_end = handle - 1;
+  compute_database_hash(link);
+}
+
+void virtual_link_set_handler(virtual_link_t *link,
+                              virtual_link_notification_handler_t handler,
+                              void *context) {
+  link->handler = handler;
+  link->handler_context = context;
+}
+
+void virtual_link_set_write_handler(virtual_link_t *link,
+                                    virtual_link_write_handler_t handler,
+                                    void *context) {
+  link->write_handler = handler;
+  link->write_handler_context = context;
+}
+
+void virtual_link_set_read_handler(virtual_link_t *link,
+                                   virtual_link_read_handler_t handler,
+                                   void *context) {
+  link->read_handler = handler;
+  link->read_handler_context = context;
+}
+
+// xorshift32, so lossy runs are repeatable
+static bool drop_notification(virtual_link_t *link) {
+  if (link->config.loss_per_mille == 0) return false;
+  uint32_t x = link->random_state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  link->random_state = x;
+  return x % 1000 < link->config.loss_per_mille;
+}
+
+void virtual_link_connect(virtual_link_t *link) {
+  link->connected = true;
+  link->next_event_us = link->now_us + link->config.conn_interval_us;
+}
+
+void virtual_link_disconnect(virtual_link_t *link) {
+  link->connected = false;
+  link->stats.lost += link->queue_count;
+  link->queue_head = 0;
+  link->queue_count = 0;
+  memset(link->notifications_enabled, 0, sizeof(link->notifications_enabled));
+  link->coc_open = false;
+  link->coc_tx_length = 0;
+  link->coc_sdu_expected = 0;
+  link->carry_events = 0;
+}
+
+// Air time of one L2CAP PDU split into LL PDUs, each acknowledged by an
+// empty PDU from the client
+static uint32_t air_time_us(const virtual_link_t *link, uint16_t l2cap_length,
+                            uint32_t *pdus) {
+  uint32_t preamble = link->config.phy_mbps == 2 ? 2 : 1;
+  uint32_t remaining = L2CAP_HEADER_SIZE + l2cap_length;
+  uint32_t air_time = 0;
+  *pdus = 0;
+  while (remaining) {
+    uint32_t fragment = remaining < link->config.max_tx_octets
+                            ? remaining
+                            : link->config.max_tx_octets;
+    remaining -= fragment;
+    uint32_t data_bits = (preamble + LL_PDU_OVERHEAD + fragment) * 8;
+    uint32_t ack_bits = (preamble + LL_PDU_OVERHEAD) * 8;
+    air_time += (data_bits + ack_bits) / link->config.phy_mbps + 2 * T_IFS_US;
+    (*pdus)++;
+  }
+  return air_time;
+}
+
+// Client side of a K-frame: reassemble, hand out complete SDUs and return
+// the credit
+static void receive_k_frame(virtual_link_t *link,
+                            const virtual_link_packet_t *packet) {
+  const uint8_t *payload = packet->value;
+  uint16_t length = packet->length;
+  link->stats.k_frames++;
+  link->coc_credits++;
+  if (link->coc_sdu_expected == 0) {
+    link->coc_sdu_expected = (uint16_t)(payload[0] | (payload[1] << 8));
+    link->coc_sdu_length = 0;
+    payload += SDU_LENGTH_SIZE;
+    length -= SDU_LENGTH_SIZE;
+  }
+  memcpy(link->coc_sdu + link->coc_sdu_length, payload, length);
+  link->coc_sdu_length += length;
+  if (link->coc_sdu_length < link->coc_sdu_expected) return;
+  link->coc_sdu_expected = 0;
+  link->stats.sdus++;
+  if (link->sdu_handler) {
+    link->sdu_handler(link->sdu_handler_context, link->coc_sdu,
+                      link->coc_sdu_length);
+  }
+}
+
+// Server side: move as much of the SDU into the controller queue as the
+// credits allow
+static void queue_k_frames(virtual_link_t *link) {
+  while (link->coc_tx_length && link->coc_credits &&
+         link->queue_count < VIRTUAL_LINK_QUEUE_SIZE) {
+    uint32_t tail =
+        (link->queue_head + link->queue_count) % VIRTUAL_LINK_QUEUE_SIZE;
+    virtual_link_packet_t *packet = &link->queue[tail];
+    uint16_t left = link->coc_tx_length - link->coc_tx_offset;
+    packet->value_handle = 0;
+    packet->length = left < link->coc_mps ? left : link->coc_mps;
+    memcpy(packet->value, link->coc_tx + link->coc_tx_offset, packet->length);
+    link->coc_tx_offset += packet->length;
+    if (link->coc_tx_offset == link->coc_tx_length) link->coc_tx_length = 0;
+    link->queue_count++;
+    link->coc_credits--;
+  }
+}
+
+static void run_connection_event(virtual_link_t *link) {
+  link->stats.events++;
+  if (link->carry_events) {
+    link->carry_events--;
+    return;
+  }
+  uint32_t budget_us = link->config.conn_interval_us;
+  uint32_t pdus_left = link->config.max_packets_per_event;
+  while (link->queue_count) {
+    virtual_link_packet_t *packet = &link->queue[link->queue_head];
+    bool notification = packet->value_handle != 0;
+    uint32_t pdus;
+    uint32_t air_time = air_time_us(
+        link,
+        packet->length + (notification ? ATT_NOTIFICATION_HEADER_SIZE : 0),
+        &pdus);
+    if (air_time > budget_us || pdus > pdus_left) {
+      if (pdus_left < link->config.max_packets_per_event) break;
+      // too big for any one event: its fragments take the next ones too
+      uint32_t by_pdus = (pdus + pdus_left - 1) / pdus_left;
+      uint32_t by_time = (air_time + budget_us - 1) / budget_us;
+      link->carry_events = (by_pdus > by_time ? by_pdus : by_time) - 1;
+      link->stats.pdus += pdus - pdus_left;
+      air_time = budget_us;
+      pdus = pdus_left;
+    }
+    budget_us -= air_time;
+    pdus_left -= pdus;
+    link->queue_head = (link->queue_head + 1) % VIRTUAL_LINK_QUEUE_SIZE;
+    link->queue_count--;
+    link->stats.pdus += pdus;
+    if (!notification) {
+      receive_k_frame(link, packet);
+      continue;
+    }
+    link->stats.notifications++;
+    link->stats.bytes += packet->length;
+    if (drop_notification(link)) {
+      link->stats.dropped++;
+    } else if (link->handler) {
+      link->handler(link->handler_context, packet->value_handle,
+                    packet->value, packet->length);
+    }
+  }
+  // credits returned in this event let the rest of the SDU follow
+  queue_k_frames(link);
+}
+
+void virtual_link_run_until(virtual_link_t *link, uint64_t t_us) {
+  while (link->connected && link->next_event_us <= t_us) {
+    link->now_us = link->next_event_us;
+    link->next_event_us += link->config.conn_interval_us;
+    run_connection_event(link);
+  }
+  if (t_us > link->now_us) link->now_us = t_us;
+}
+
+// Request in the next connection event, response in the one after
+static bool att_round_trips(virtual_link_t *link, uint32_t count) {
+  for (uint32_t i = 0; i < count && link->connected; i++) {
+    link->stats.att_requests++;
+    virtual_link_run_until(link, link->next_event_us);
+    virtual_link_run_until(link, link->next_event_us);
+  }
+  return link->connected;
+}
+
+// Responses needed for entries of entry_size bytes, plus the request that
+// ends the procedure with Attribute Not Found
+static uint32_t read_by_type_round_trips(const virtual_link_t *link,
+                                         uint32_t entries,
+                                         uint32_t entry_size) {
+  uint32_t per_response = (link->config.mtu - 2) / entry_size;
+  if (per_response == 0) per_response = 1;
+  return (entries + per_response - 1) / per_response + 1;
+}
+
+bool virtual_link_read_database_hash(virtual_link_t *link, uint8_t hash[16]) {
+  if (!att_round_trips(link, 1)) return false;
+  memcpy(hash, link->database_hash, 16);
+  return true;
+}
+
+bool virtual_link_discover_service(virtual_link_t *link,
+                                   const uint8_t *uuid128, uint16_t *start,
+                                   uint16_t *end) {
+  // Find By Type Value, then the continuation that finds nothing more
+  if (!att_round_trips(link, 2)) return false;
+  uint8_t service_uuid[16];
+  reverse_128_bytes(nxmic_gatt_service.uuid128, service_uuid);
+  if (memcmp(uuid128, service_uuid, 16) != 0) return false;
+  *start = link->service_start;
+  *end = link->service_end;
+  return true;
+}
+
+int virtual_link_discover_characteristics(
+    virtual_link_t *link, virtual_link_characteristic_t *characteristics,
+    int max_characteristics) {
+  int count = 0;
+  for (int i = 0; i < CHAR_COUNT && count < max_characteristics; i++) {
+    if (link->characteristics[i].start_handle == 0) continue;
+    characteristics[count++] = link->characteristics[i];
+  }
+  if (!att_round_trips(link, read_by_type_round_trips(
+                                 link, count, CHARACTERISTIC_ENTRY_SIZE)))
+    return 0;
+  return count;
+}
+
+int virtual_link_read_cccds(virtual_link_t *link, uint16_t *handles,
+                            int max_handles) {
+  int count = 0;
+  for (int i = 0; i < CHAR_COUNT && count < max_handles; i++) {
+    if (link->characteristics[i].cccd_handle == 0) continue;
+    handles[count++] = link->characteristics[i].cccd_handle;
+  }
+  if (!att_round_trips(link,
+                       read_by_type_round_trips(link, count, CCCD_ENTRY_SIZE)))
+    return 0;
+  return count;
+}
+
+bool virtual_link_write_cccd(virtual_link_t *link, uint16_t cccd_handle,
+                             bool enable) {
+  if (!att_round_trips(link, 1)) return false;
+  for (int i = 0; i < CHAR_COUNT; i++) {
+    if (link->characteristics[i].cccd_handle != cccd_handle) continue;
+    link->notifications_enabled[i] = enable;
+    return true;
+  }
+  return false;
+}
+
+static int characteristic_for_value_handle(const virtual_link_t *link,
+                                          uint16_t value_handle) {
+  for (int i = 0; i < CHAR_COUNT; i++) {
+    if (link->characteristics[i].value_handle == value_handle) return i;
+  }
+  return -1;
+}
+
+bool virtual_link_write(virtual_link_t *link, uint16_t value_handle,
+                        const uint8_t *value, uint16_t value_length) {
+  int i = characteristic_for_value_handle(link, value_handle);
+  if (!link->connected || i < 0 ||
+      value_length > link->config.mtu - ATT_NOTIFICATION_HEADER_SIZE)
+    return false;
+  link->stats.att_requests++;
+  virtual_link_run_until(link, link->next_event_us);
+  if (!link->connected) return false;
+  if (link->write_handler) {
+    link->write_handler(link->write_handler_context, value_handle, value,
+                        value_length);
+  }
+  virtual_link_run_until(link, link->next_event_us);
+  return link->connected;
+}
+
+uint16_t virtual_link_read(virtual_link_t *link, uint16_t value_handle,
+                           uint8_t *buffer, uint16_t buffer_size) {
+  int i = characteristic_for_value_handle(link, value_handle);
+  if (!link->connected || i < 0 || !link->read_handler) return 0;
+  if (buffer_size > link->config.mtu - 1) buffer_size = link->config.mtu - 1;
+  link->stats.att_requests++;
+  virtual_link_run_until(link, link->next_event_us);
+  if (!link->connected) return 0;
+  uint16_t length = link->read_handler(link->read_handler_context,
+                                       value_handle, buffer, buffer_size);
+  virtual_link_run_until(link, link->next_event_us);
+  return link->connected ? length : 0;
+}
+
+bool virtual_link_write_without_response(virtual_link_t *link,
+                                         uint16_t value_handle,
+                                         const uint8_t *value,
+                                         uint16_t value_length) {
+  if (!link->connected) return false;
+  if (value_length > link->config.mtu - ATT_NOTIFICATION_HEADER_SIZE)
+    return false;
+  for (int i = 0; i < CHAR_COUNT; i++) {
+    if (link->characteristics[i].value_handle != value_handle) continue;
+    link->stats.writes++;
+    if (link->write_handler) {
+      link->write_handler(link->write_handler_context, value_handle, value,
+                          value_length);
+    }
+    return true;
+  }
+  return false;
+}
+
+bool virtual_link_read_long(virtual_link_t *link, uint32_t length) {
+  return att_round_trips(link, length / (link->config.mtu - 1) + 1);
+}
+
+bool virtual_link_coc_open(virtual_link_t *link, uint16_t psm, uint16_t mtu,
+                           virtual_link_sdu_handler_t handler, void *context) {
+  (void)psm;  // one service, always accepted
+  if (!att_round_trips(link, 1)) return false;
+  link->coc_open = true;
+  link->coc_mtu =
+      mtu < VIRTUAL_LINK_COC_MAX_SDU ? mtu : VIRTUAL_LINK_COC_MAX_SDU;
+  link->coc_mps = link->config.max_tx_octets - L2CAP_HEADER_SIZE;
+  if (link->coc_mps > NXMIC_FRAME_MAX_SIZE)
+    link->coc_mps = NXMIC_FRAME_MAX_SIZE;
+  link->coc_credits = VIRTUAL_LINK_COC_CREDITS;
+  link->coc_tx_length = 0;
+  link->coc_sdu_expected = 0;
+  link->sdu_handler = handler;
+  link->sdu_handler_context = context;
+  return true;
+}
+
+bool virtual_link_coc_send(virtual_link_t *link, const uint8_t *sdu,
+                           uint16_t length) {
+  if (!link->connected || !link->coc_open || length > link->coc_mtu)
+    return false;
+  if (link->coc_tx_length) {
+    link->stats.queue_full++;
+    return false;
+  }
+  link->coc_tx[0] = (uint8_t)length;
+  link->coc_tx[1] = (uint8_t)(length >> 8);
+  memcpy(link->coc_tx + SDU_LENGTH_SIZE, sdu, length);
+  link->coc_tx_length = SDU_LENGTH_SIZE + length;
+  link->coc_tx_offset = 0;
+  queue_k_frames(link);
+  return true;
+}
+
+bool virtual_link_notifications_enabled(const virtual_link_t *link,
+                                        gatt_characteristic_id_t char_id) {
+  return link->connected && link->notifications_enabled[char_id];
+}
+
+uint16_t virtual_link_value_handle(const virtual_link_t *link,
+                                   gatt_characteristic_id_t char_id) {
+  return link->characteristics[char_id].value_handle;
+}
+
+bool virtual_link_can_notify(const virtual_link_t *link) {
+  return link->connected && link->queue_count < VIRTUAL_LINK_QUEUE_SIZE;
+}
+
+bool virtual_link_notify(virtual_link_t *link, uint16_t value_handle,
+                         const uint8_t *value, uint16_t value_length) {
+  int i = characteristic_for_value_handle(link, value_handle);
+  if (i < 0 ||
+      !virtual_link_notifications_enabled(link, (gatt_characteristic_id_t)i))
+    return false;
+  if (value_length > link->config.mtu - ATT_NOTIFICATION_HEADER_SIZE)
+    return false;
+  if (link->queue_count == VIRTUAL_LINK_QUEUE_SIZE) {
+    link->stats.queue_full++;
+    return false;
+  }
+  uint32_t tail =
+      (link->queue_head + link->queue_count) % VIRTUAL_LINK_QUEUE_SIZE;
+  virtual_link_packet_t *packet = &link->queue[tail];
+  packet->value_handle = value_handle;
+  packet->length = value_length;
+  memcpy(packet->value, value, value_length);
+  link->queue_count++;
+  return true;
+}
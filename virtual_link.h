@@ -0,0 +1,211 @@
+#ifndef VIRTUAL_LINK_H_
+#define VIRTUAL_LINK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "nxmic_frame.h"
+#include "nxmic_gatt.h"
+
+// In-process stand-in for one BLE connection between a simulated NxMic
+// sensor (ATT server) and reader (GATT client), used by the host build.
+//
+// It models what matters for throughput and latency at the ATT level: a
+// GATT database laid out from nxmic_gatt_service, one connection interval
+// per ATT request/response, and notifications leaving a bounded controller
+// queue at connection events, limited by the PHY rate, the LL data length
+// and the packets the controller puts in one event. Time is virtual, in us.
+
+// Packets buffered in the simulated controller
+#define VIRTUAL_LINK_QUEUE_SIZE 16
+
+// L2CAP LE credit-based channel: largest SDU, and the credits the client
+// grants up front (it returns one per K-frame received, like BTstack's
+// automatic credits)
+#define VIRTUAL_LINK_COC_MAX_SDU 2048
+#define VIRTUAL_LINK_COC_CREDITS 10
+
+typedef struct {
+  uint16_t mtu;                   // ATT MTU agreed on the link
+  uint32_t conn_interval_us;      // Connection interval
+  uint16_t max_tx_octets;         // LL payload per PDU, 27 without DLE
+  uint8_t phy_mbps;               // 1 or 2
+  uint8_t max_packets_per_event;  // Controller limit per connection event
+  uint16_t loss_per_mille;        // Notifications dropped before delivery,
+                                  // like an overrun in the reader's stack
+} virtual_link_config_t;
+
+// One characteristic in the simulated database
+typedef struct {
+  uint8_t uuid128[16];     // BTstack (big-endian) order
+  uint8_t properties;      // As the declaration carries them, the Core
+                           // spec's bits (BTstack's ATT_PROPERTY_*)
+  uint16_t start_handle;   // Declaration
+  uint16_t value_handle;
+  uint16_t end_handle;
+  uint16_t cccd_handle;    // 0 if the characteristic cannot notify
+} virtual_link_characteristic_t;
+
+typedef void (*virtual_link_notification_handler_t)(void *context,
+                                                    uint16_t value_handle,
+                                                    const uint8_t *value,
+                                                    uint16_t value_length);
+
+// Client side callback for a reassembled SDU on the credit-based channel
+typedef void (*virtual_link_sdu_handler_t)(void *context, const uint8_t *sdu,
+                                           uint16_t length);
+
+// Server side callback for Write Requests and Write Without Response to a
+// characteristic value, by handle like BTstack's att_write_callback
+typedef void (*virtual_link_write_handler_t)(void *context,
+                                             uint16_t value_handle,
+                                             const uint8_t *value,
+                                             uint16_t value_length);
+
+// Server side callback for a Read Request, returns the value length
+typedef uint16_t (*virtual_link_read_handler_t)(void *context,
+                                                uint16_t value_handle,
+                                                uint8_t *buffer,
+                                                uint16_t buffer_size);
+
+typedef struct {
+  uint32_t att_requests;     // Request/response round trips
+  uint32_t events;           // Connection events while connected
+  uint32_t notifications;    // Sent to the client
+  uint32_t bytes;            // ATT values delivered
+  uint32_t pdus;             // LL data PDUs, fragments included
+  uint32_t queue_full;       // Notify calls rejected by a full queue
+  uint32_t lost;             // Queued notifications lost on disconnect
+  uint32_t dropped;          // Dropped by loss_per_mille
+  uint32_t writes;           // Write Without Response from the client
+  uint32_t sdus;             // Delivered on the credit-based channel
+  uint32_t k_frames;         // L2CAP PDUs carrying them
+} virtual_link_stats_t;
+
+typedef struct {
+  uint16_t value_handle;  // 0 for a K-frame of the credit-based channel
+  uint16_t length;        // ATT value, or K-frame information payload
+  uint8_t value[NXMIC_FRAME_MAX_SIZE];
+} virtual_link_packet_t;
+
+typedef struct {
+  virtual_link_config_t config;
+  uint16_t service_start;
+  uint16_t service_end;
+  virtual_link_characteristic_t characteristics[CHAR_COUNT];
+  uint8_t database_hash[16];
+  bool notifications_enabled[CHAR_COUNT];
+  bool connected;
+  uint64_t now_us;
+  uint64_t next_event_us;
+  uint32_t carry_events;  // Still taken by fragments of an oversized packet
+  virtual_link_packet_t queue[VIRTUAL_LINK_QUEUE_SIZE];
+  uint32_t queue_head;
+  uint32_t queue_count;
+  virtual_link_notification_handler_t handler;
+  void *handler_context;
+  virtual_link_write_handler_t write_handler;
+  void *write_handler_context;
+  virtual_link_read_handler_t read_handler;
+  void *read_handler_context;
+  bool coc_open;
+  uint16_t coc_mtu;      // Largest SDU
+  uint16_t coc_mps;      // K-frame payload, one LL PDU with the header
+  uint16_t coc_credits;  // K-frames the server may still send
+  uint8_t coc_tx[2 + VIRTUAL_LINK_COC_MAX_SDU];  // SDU length + SDU
+  uint16_t coc_tx_length;  // 0 if no SDU is being sent
+  uint16_t coc_tx_offset;  // Already in K-frames
+  uint8_t coc_sdu[VIRTUAL_LINK_COC_MAX_SDU];  // Client side reassembly
+  uint16_t coc_sdu_length;
+  uint16_t coc_sdu_expected;  // 0 before the first K-frame of an SDU
+  virtual_link_sdu_handler_t sdu_handler;
+  void *sdu_handler_context;
+  uint32_t random_state;
+  virtual_link_stats_t stats;
+} virtual_link_t;
+
+// Lay out the database from nxmic_gatt_service, disconnected at t = 0
+void virtual_link_init(virtual_link_t *link,
+                       const virtual_link_config_t *config);
+
+// Client side notification callback, any state
+void virtual_link_set_handler(virtual_link_t *link,
+                              virtual_link_notification_handler_t handler,
+                              void *context);
+
+// Server side handler for writes from the client
+void virtual_link_set_write_handler(virtual_link_t *link,
+                                    virtual_link_write_handler_t handler,
+                                    void *context);
+void virtual_link_set_read_handler(virtual_link_t *link,
+                                   virtual_link_read_handler_t handler,
+                                   void *context);
+
+void virtual_link_connect(virtual_link_t *link);
+// Drops queued packets, every CCCD and the channel, like a real disconnect
+void virtual_link_disconnect(virtual_link_t *link);
+
+// Advance virtual time, running every connection event up to t_us
+void virtual_link_run_until(virtual_link_t *link, uint64_t t_us);
+
+// Client ATT procedures. Each costs one or more connection intervals of
+// virtual time and returns false when not connected.
+bool virtual_link_read_database_hash(virtual_link_t *link, uint8_t hash[16]);
+bool virtual_link_discover_service(virtual_link_t *link,
+                                   const uint8_t *uuid128, uint16_t *start,
+                                   uint16_t *end);
+// Fills characteristics[], returns how many were found
+int virtual_link_discover_characteristics(
+    virtual_link_t *link, virtual_link_characteristic_t *characteristics,
+    int max_characteristics);
+// One read-by-type sweep for every CCCD in the service range
+int virtual_link_read_cccds(virtual_link_t *link, uint16_t *handles,
+                            int max_handles);
+bool virtual_link_write_cccd(virtual_link_t *link, uint16_t cccd_handle,
+                             bool enable);
+// Write Request: the server gets the value in the connection event that
+// carries it, the response is back one event later
+bool virtual_link_write(virtual_link_t *link, uint16_t value_handle,
+                        const uint8_t *value, uint16_t value_length);
+// Read Request of up to MTU - 1 bytes, returns the value length (0 on
+// failure)
+uint16_t virtual_link_read(virtual_link_t *link, uint16_t value_handle,
+                           uint8_t *buffer, uint16_t buffer_size);
+// Write Without Response, handed to the server at once (it shares the next
+// connection event with the notifications, so it costs no round trip)
+bool virtual_link_write_without_response(virtual_link_t *link,
+                                         uint16_t value_handle,
+                                         const uint8_t *value,
+                                         uint16_t value_length);
+// Read Long of a length-byte value: a Read, then Read Blobs until a short
+// response, each returning up to MTU - 1 bytes for one round trip. This is
+// the offload path without an export protocol (optimistic: a real attribute
+// ends at 512 bytes, so every 512 bytes would also need a request to move
+// the window).
+bool virtual_link_read_long(virtual_link_t *link, uint32_t length);
+
+// Client opens the credit-based channel, one round trip for the LE Credit
+// Based Connection Request. The MTU is capped at VIRTUAL_LINK_COC_MAX_SDU.
+bool virtual_link_coc_open(virtual_link_t *link, uint16_t psm, uint16_t mtu,
+                           virtual_link_sdu_handler_t handler, void *context);
+// Server side: send an SDU, segmented into K-frames as credits and queue
+// space allow. false if the channel is closed, the SDU exceeds the MTU or
+// the previous SDU is still going out (retry after the next event). Not
+// subject to loss_per_mille: credits keep the client from overrunning.
+bool virtual_link_coc_send(virtual_link_t *link, const uint8_t *sdu,
+                           uint16_t length);
+
+// Server side: true if the client enabled notifications on char_id
+bool virtual_link_notifications_enabled(const virtual_link_t *link,
+                                        gatt_characteristic_id_t char_id);
+uint16_t virtual_link_value_handle(const virtual_link_t *link,
+                                   gatt_characteristic_id_t char_id);
+// True while the controller queue has room for a notification
+bool virtual_link_can_notify(const virtual_link_t *link);
+// Queue a notification on a value handle, false if notifications are off,
+// the value exceeds MTU - 3 or the controller queue is full (retry after
+// the next event)
+bool virtual_link_notify(virtual_link_t *link, uint16_t value_handle,
+                         const uint8_t *value, uint16_t value_length);
+
+#endif